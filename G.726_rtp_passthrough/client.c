@@ -6,7 +6,7 @@ void createElements(){
 	pipeline = gst_pipeline_new ("audio-echo-receive");
 	createUdpSource();
 	payDepay = gst_element_factory_make ("rtpg726depay",  "rtp-depay");
-	codec	 = gst_element_factory_make ("ffdec_g726",    "G.726-decoder");
+	codec	 = gst_element_factory_make ("g726dec",       "G.726-decoder");
 	sink     = gst_element_factory_make ("autoaudiosink", "audio-output");
 }
 
@@ -1,6 +1,10 @@
 #include <stdio.h>
 #include <gst/gst.h>
 
+#include "latencyTracer.h"
+#include "g726Enc.h"
+#include "g726Dec.h"
+
 void createElementsOrExit();
 void createElements();		 	// a pseudo-abstract method
 void exitOnInvalidElement();
@@ -25,6 +29,8 @@ GstElement *pipeline, *source, *codec, *payDepay, *sink;
 
 int main(int argc, char *argv[]) {
     gst_init(NULL, NULL);
+	gst_g726_enc_register();
+	gst_g726_dec_register();
 	
 	loop = g_main_loop_new (NULL, FALSE);
 
@@ -35,6 +41,7 @@ int main(int argc, char *argv[]) {
 
 	g_print ("Linking elements.\n");
 	linkElements();
+	latencyTracer_attach(pipeline);
 
 	runLoop();
 	cleanUp(); // Under normal conditions this method will never be called
@@ -105,6 +112,7 @@ void runLoop(){
 void cleanUp(){
 	g_print ("Returned, stopping playback\n");
 	gst_element_set_state (pipeline, GST_STATE_NULL);
+	latencyTracer_dump();
 
 	g_print ("Deleting pipeline\n");
 	gst_object_unref (GST_OBJECT (pipeline));
@@ -30,7 +30,7 @@ void createSource(){
 void createEncoder(){
 	g_print ("Creating encoder.\n");
 
-	codec = gst_element_factory_make ("ffenc_g726", "G.726-coder");
+	codec = gst_element_factory_make ("g726enc", "G.726-coder");
 	g_object_set (G_OBJECT (codec), "bitrate", 32000, NULL);
 }
 
@@ -0,0 +1,172 @@
+#ifndef CODEC_H
+#define CODEC_H
+
+#include <stdio.h>
+#include <gst/gst.h>
+
+#include "rtpDtx.h"
+
+/*
+ * The codecs a leg may use, told apart by their RTP payload type, so every
+ * stream picks its own and a receiver finds out from the packets.
+ *
+ * G.726 at 32 kbit/s is coded by the built-in g726enc and g726dec (see
+ * g726.h). Opus comes from gst-plugins-bad (opusenc, opusdec, rtpopuspay,
+ * rtpopusdepay) and is sent at 16 kbit/s: half the bandwidth of G.726, for
+ * better speech quality. A codec whose elements are not installed is left
+ * out: its payload type is not mapped and nobody sends it.
+ *
+ * The programs work on 8 kHz mono audio. Opus encodes that as it is, but
+ * its RTP clock runs at 48 kHz and its decoder may answer at any rate, so
+ * its decoded audio goes through a converter back to 8 kHz mono.
+ */
+
+typedef struct {
+	const gchar* name;
+	guint payload;
+	const gchar* encodingName;
+	gint clockRate;
+	const gchar* encoder;
+	const gchar* payloader;
+	const gchar* depayloader;
+	const gchar* decoder;
+	gint bitrate;
+	gboolean convert;
+} Codec;
+
+#define CODEC_COUNT 2
+
+static const Codec codecs[CODEC_COUNT] = {
+	{ "g726", 96, "G726", 8000,
+		"g726enc", "rtpg726pay", "rtpg726depay", "g726dec", 32000, FALSE },
+	{ "opus", 97, "X-GST-OPUS-DRAFT-SPITTKA-00", 48000,
+		"opusenc", "rtpopuspay", "rtpopusdepay", "opusdec", 16000, TRUE },
+};
+
+#define CODEC_DEFAULT (&codecs[0])
+
+#define CODEC_CONVERTER \
+	"audioconvert ! audioresample ! " \
+	"audio/x-raw-int, rate = (int) 8000, channels = (int) 1, width = (int) 16, depth = (int) 16"
+
+guint codec_index(const Codec* codec){
+	return codec - codecs;
+}
+
+const Codec* codec_byName(const gchar* name){
+	guint i;
+	for (i = 0; i < CODEC_COUNT; i++){
+		if (g_str_equal (codecs[i].name, name)){
+			return &codecs[i];
+		}
+	}
+	return NULL;
+}
+
+const Codec* codec_byPayload(guint payload){
+	guint i;
+	for (i = 0; i < CODEC_COUNT; i++){
+		if (codecs[i].payload == payload){
+			return &codecs[i];
+		}
+	}
+	return NULL;
+}
+
+// rtpbin names its receive pads "recv_rtp_src_<session>_<ssrc>_<payload>".
+const Codec* codec_ofPad(GstPad* rtpBinPad){
+	guint session, ssrc, payload;
+	if (sscanf (GST_PAD_NAME (rtpBinPad), "recv_rtp_src_%u_%u_%u", &session, &ssrc, &payload) != 3){
+		return NULL;
+	}
+	return codec_byPayload(payload);
+}
+
+static gboolean codec_hasFactory(const gchar* name){
+	GstElementFactory* factory = gst_element_factory_find (name);
+	if (!factory){
+		return FALSE;
+	}
+	gst_object_unref (factory);
+	return TRUE;
+}
+
+// Looked up once; the built-in G.726 elements must be registered by then.
+gboolean codec_isAvailable(const Codec* codec){
+	static gint available[CODEC_COUNT];
+	guint i = codec_index(codec);
+
+	if (!available[i]){
+		available[i] = codec_hasFactory(codec->encoder)
+			&& codec_hasFactory(codec->payloader)
+			&& codec_hasFactory(codec->depayloader)
+			&& codec_hasFactory(codec->decoder) ? 1 : -1;
+	}
+	return available[i] > 0;
+}
+
+GstCaps* codec_rtpCaps(const Codec* codec){
+	return gst_caps_new_simple ("application/x-rtp",
+		"media",           G_TYPE_STRING, "audio",
+		"clock-rate",      G_TYPE_INT,    codec->clockRate,
+		"encoding-name",   G_TYPE_STRING, codec->encodingName,
+		"encoding-params", G_TYPE_STRING, "1",
+		"channels",        G_TYPE_INT,    1,
+		"payload",         G_TYPE_INT,    codec->payload,
+		NULL);
+}
+
+static GstCaps* codec_requestPtMap(GstElement* rtpbin, guint session, guint pt, gpointer data){
+	const Codec* codec = codec_byPayload(pt);
+	if (codec && codec_isAvailable(codec)){
+		return codec_rtpCaps(codec);
+	}
+	return rtpDtx_comfortNoiseCaps(pt);
+}
+
+/*
+ * Gives rtpbin the caps of every available codec and of comfort noise (see
+ * rtpDtx.h). The signal has no accumulator, so this must be its only
+ * handler.
+ */
+void codec_mapPayloads(GstElement* rtpbin){
+	g_signal_connect (rtpbin, "request-pt-map", G_CALLBACK (codec_requestPtMap), NULL);
+}
+
+GstElement* codec_makeEncoder(const Codec* codec, const gchar* name){
+	GstElement* elem = gst_element_factory_make (codec->encoder, name);
+	if (elem){
+		g_object_set (G_OBJECT (elem), "bitrate", codec->bitrate, NULL);
+	}
+	return elem;
+}
+
+// Payloaders default to the first dynamic payload type, 96.
+GstElement* codec_makePayloader(const Codec* codec, const gchar* name){
+	GstElement* elem = gst_element_factory_make (codec->payloader, name);
+	if (elem){
+		g_object_set (G_OBJECT (elem), "pt", codec->payload, NULL);
+	}
+	return elem;
+}
+
+GstElement* codec_makeDepayloader(const Codec* codec, const gchar* name){
+	return gst_element_factory_make (codec->depayloader, name);
+}
+
+GstElement* codec_makeDecoder(const Codec* codec, const gchar* name){
+	return gst_element_factory_make (codec->decoder, name);
+}
+
+/*
+ * A bin to put behind the codec's decoder which brings its output to 8 kHz
+ * mono, or NULL when the decoder produces that already.
+ */
+GstElement* codec_makeConverter(const Codec* codec){
+	if (!codec->convert){
+		return NULL;
+	}
+	return gst_parse_bin_from_description (CODEC_CONVERTER, TRUE, NULL);
+}
+
+#endif
@@ -0,0 +1,243 @@
+#ifndef DTX_GATE_H
+#define DTX_GATE_H
+
+#include <gst/gst.h>
+
+#include "voiceActivity.h"
+
+/*
+ * "dtxgate" - discontinuous transmission for 8 kHz mono S16 audio, put in
+ * front of an encoder.
+ *
+ * Speech (see voiceActivity.h) passes untouched. Between talkspurts audio is
+ * dropped, so nothing downstream spends CPU or bandwidth on it; instead a
+ * "comfort-noise" custom downstream event is sent when the silence starts,
+ * every "sid-interval" after that and whenever the background noise level
+ * changes noticeably. The event carries the running "timestamp" at which it
+ * applies and the noise "level" in -dBov; rtpdtx (see rtpDtx.h) turns it
+ * into an RFC 3389 comfort noise packet after the payloader. The first
+ * buffer of a talkspurt is flagged DISCONT.
+ *
+ * Buffers may have any length; the decision is made per buffer.
+ */
+
+#define DTX_GATE_DEFAULT_SID_INTERVAL_MS 200
+#define DTX_GATE_LEVEL_CHANGE            3
+
+#define GST_TYPE_DTX_GATE (gst_dtx_gate_get_type())
+#define GST_DTX_GATE(obj) (G_TYPE_CHECK_INSTANCE_CAST((obj), GST_TYPE_DTX_GATE, GstDtxGate))
+
+typedef struct _GstDtxGate      GstDtxGate;
+typedef struct _GstDtxGateClass GstDtxGateClass;
+
+struct _GstDtxGate {
+	GstElement element;
+
+	GstPad* sinkpad;
+	GstPad* srcpad;
+
+	guint hangoverMs;
+	guint sidIntervalMs;
+
+	// Only touched with the stream lock held.
+	VoiceActivity vad;
+	gboolean suppressing;
+	GstClockTime lastSidTime;
+	guint lastSidLevel;
+
+	volatile gint buffersSuppressed;
+};
+
+struct _GstDtxGateClass {
+	GstElementClass parent_class;
+};
+
+enum {
+	DTX_GATE_PROP_0,
+	DTX_GATE_PROP_HANGOVER,
+	DTX_GATE_PROP_SID_INTERVAL,
+	DTX_GATE_PROP_BUFFERS_SUPPRESSED
+};
+
+#define DTX_GATE_CAPS \
+	"audio/x-raw-int, "              \
+	"endianness = (int) BYTE_ORDER, " \
+	"signed = (boolean) true, "       \
+	"width = (int) 16, "              \
+	"depth = (int) 16, "              \
+	"rate = (int) 8000, "             \
+	"channels = (int) 1"
+
+static GstStaticPadTemplate gst_dtx_gate_sink_template = GST_STATIC_PAD_TEMPLATE ("sink",
+	GST_PAD_SINK, GST_PAD_ALWAYS, GST_STATIC_CAPS (DTX_GATE_CAPS));
+
+static GstStaticPadTemplate gst_dtx_gate_src_template = GST_STATIC_PAD_TEMPLATE ("src",
+	GST_PAD_SRC, GST_PAD_ALWAYS, GST_STATIC_CAPS (DTX_GATE_CAPS));
+
+// Defined with G_DEFINE_TYPE rather than GST_BOILERPLATE, whose file-wide
+// parent_class would clash with the other elements built into a program.
+G_DEFINE_TYPE (GstDtxGate, gst_dtx_gate, GST_TYPE_ELEMENT);
+
+static void gst_dtx_gate_set_property (GObject* object, guint id, const GValue* value, GParamSpec* pspec);
+static void gst_dtx_gate_get_property (GObject* object, guint id, GValue* value, GParamSpec* pspec);
+static GstFlowReturn gst_dtx_gate_chain (GstPad* pad, GstBuffer* buffer);
+static GstStateChangeReturn gst_dtx_gate_change_state (GstElement* element, GstStateChange transition);
+
+static void gst_dtx_gate_class_init (GstDtxGateClass* klass){
+	GObjectClass*    gobject_class = G_OBJECT_CLASS (klass);
+	GstElementClass* element_class = GST_ELEMENT_CLASS (klass);
+
+	gst_element_class_add_pad_template (element_class, gst_static_pad_template_get (&gst_dtx_gate_sink_template));
+	gst_element_class_add_pad_template (element_class, gst_static_pad_template_get (&gst_dtx_gate_src_template));
+
+	gst_element_class_set_details_simple (element_class,
+		"DTX gate", "Filter/Audio",
+		"Drops audio between talkspurts and marks where comfort noise is due",
+		"GStreamer Audio Echo");
+
+	gobject_class->set_property = gst_dtx_gate_set_property;
+	gobject_class->get_property = gst_dtx_gate_get_property;
+
+	g_object_class_install_property (gobject_class, DTX_GATE_PROP_HANGOVER,
+		g_param_spec_uint ("hangover", "Hangover",
+			"How long audio keeps flowing after the last speech (ms)", 0, 5000,
+			VOICE_ACTIVITY_DEFAULT_HANGOVER_MS, G_PARAM_READWRITE));
+
+	g_object_class_install_property (gobject_class, DTX_GATE_PROP_SID_INTERVAL,
+		g_param_spec_uint ("sid-interval", "SID interval",
+			"How often comfort noise is refreshed during silence (ms)", 20, 60000,
+			DTX_GATE_DEFAULT_SID_INTERVAL_MS, G_PARAM_READWRITE));
+
+	g_object_class_install_property (gobject_class, DTX_GATE_PROP_BUFFERS_SUPPRESSED,
+		g_param_spec_int ("buffers-suppressed", "Buffers suppressed",
+			"Buffers dropped as silence", 0, G_MAXINT, 0, G_PARAM_READABLE));
+
+	element_class->change_state = GST_DEBUG_FUNCPTR (gst_dtx_gate_change_state);
+}
+
+// A stream starts as speech for one hangover, so the far end learns about
+// it before the first silence, even when it starts silent.
+static void gst_dtx_gate_reset (GstDtxGate* gate){
+	voiceActivity_init(&gate->vad, gate->hangoverMs);
+	gate->vad.hangoverLeft = gate->vad.hangoverSamples;
+	gate->suppressing  = FALSE;
+	gate->lastSidTime  = GST_CLOCK_TIME_NONE;
+	gate->lastSidLevel = VOICE_ACTIVITY_MAX_LEVEL;
+}
+
+static void gst_dtx_gate_init (GstDtxGate* gate){
+	gate->sinkpad = gst_pad_new_from_static_template (&gst_dtx_gate_sink_template, "sink");
+	gst_pad_set_chain_function (gate->sinkpad, GST_DEBUG_FUNCPTR (gst_dtx_gate_chain));
+	gst_element_add_pad (GST_ELEMENT (gate), gate->sinkpad);
+
+	gate->srcpad = gst_pad_new_from_static_template (&gst_dtx_gate_src_template, "src");
+	gst_element_add_pad (GST_ELEMENT (gate), gate->srcpad);
+
+	gate->hangoverMs    = VOICE_ACTIVITY_DEFAULT_HANGOVER_MS;
+	gate->sidIntervalMs = DTX_GATE_DEFAULT_SID_INTERVAL_MS;
+	gate->buffersSuppressed = 0;
+	gst_dtx_gate_reset (gate);
+}
+
+static void gst_dtx_gate_set_property (GObject* object, guint id, const GValue* value, GParamSpec* pspec){
+	GstDtxGate* gate = GST_DTX_GATE (object);
+
+	switch (id) {
+		case DTX_GATE_PROP_HANGOVER:
+			gate->hangoverMs = g_value_get_uint (value);
+			break;
+		case DTX_GATE_PROP_SID_INTERVAL:
+			gate->sidIntervalMs = g_value_get_uint (value);
+			break;
+		default:
+			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, id, pspec);
+			break;
+	}
+}
+
+static void gst_dtx_gate_get_property (GObject* object, guint id, GValue* value, GParamSpec* pspec){
+	GstDtxGate* gate = GST_DTX_GATE (object);
+
+	switch (id) {
+		case DTX_GATE_PROP_HANGOVER:
+			g_value_set_uint (value, gate->hangoverMs);
+			break;
+		case DTX_GATE_PROP_SID_INTERVAL:
+			g_value_set_uint (value, gate->sidIntervalMs);
+			break;
+		case DTX_GATE_PROP_BUFFERS_SUPPRESSED:
+			g_value_set_int (value, g_atomic_int_get (&gate->buffersSuppressed));
+			break;
+		default:
+			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, id, pspec);
+			break;
+	}
+}
+
+static gboolean gst_dtx_gate_sid_due (GstDtxGate* gate, GstClockTime timestamp, guint level){
+	if (!gate->suppressing){
+		return TRUE;
+	}
+	if (!GST_CLOCK_TIME_IS_VALID (timestamp) || !GST_CLOCK_TIME_IS_VALID (gate->lastSidTime)){
+		return FALSE;
+	}
+	if (ABS ((gint) level - (gint) gate->lastSidLevel) >= DTX_GATE_LEVEL_CHANGE){
+		return TRUE;
+	}
+	return timestamp >= gate->lastSidTime + gate->sidIntervalMs * GST_MSECOND;
+}
+
+static gboolean gst_dtx_gate_push_sid (GstDtxGate* gate, GstClockTime timestamp, guint level){
+	gate->lastSidTime  = timestamp;
+	gate->lastSidLevel = level;
+
+	GstStructure* structure = gst_structure_new ("comfort-noise",
+		"timestamp", G_TYPE_UINT64, timestamp,
+		"level",     G_TYPE_INT,    (gint) level,
+		NULL);
+	return gst_pad_push_event (gate->srcpad, gst_event_new_custom (GST_EVENT_CUSTOM_DOWNSTREAM, structure));
+}
+
+static GstFlowReturn gst_dtx_gate_chain (GstPad* pad, GstBuffer* buffer){
+	GstDtxGate* gate = GST_DTX_GATE (GST_PAD_PARENT (pad));
+
+	gboolean speech = voiceActivity_update(&gate->vad,
+		(const gint16*) GST_BUFFER_DATA (buffer), GST_BUFFER_SIZE (buffer) / 2);
+
+	if (speech){
+		if (gate->suppressing){
+			gate->suppressing = FALSE;
+			buffer = gst_buffer_make_metadata_writable (buffer);
+			GST_BUFFER_FLAG_SET (buffer, GST_BUFFER_FLAG_DISCONT);
+		}
+		return gst_pad_push (gate->srcpad, buffer);
+	}
+
+	// Without timestamps there is no refresh, one event per silence.
+	GstClockTime timestamp = GST_BUFFER_TIMESTAMP (buffer);
+	guint level = voiceActivity_noiseLevel(&gate->vad);
+
+	if (gst_dtx_gate_sid_due (gate, timestamp, level)){
+		gst_dtx_gate_push_sid (gate, timestamp, level);
+	}
+	gate->suppressing = TRUE;
+
+	g_atomic_int_inc (&gate->buffersSuppressed);
+	gst_buffer_unref (buffer);
+	return GST_FLOW_OK;
+}
+
+static GstStateChangeReturn gst_dtx_gate_change_state (GstElement* element, GstStateChange transition){
+	GstStateChangeReturn result = GST_ELEMENT_CLASS (gst_dtx_gate_parent_class)->change_state (element, transition);
+
+	if (transition == GST_STATE_CHANGE_PAUSED_TO_READY){
+		gst_dtx_gate_reset (GST_DTX_GATE (element));
+	}
+	return result;
+}
+
+void gst_dtx_gate_register (){
+	gst_element_register (NULL, "dtxgate", GST_RANK_NONE, GST_TYPE_DTX_GATE);
+}
+
+#endif
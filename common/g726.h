@@ -0,0 +1,815 @@
+#ifndef G726_H
+#define G726_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+/*
+ * ITU-T G.726 ADPCM at 16, 24, 32 and 40 kbit/s on 16-bit linear PCM.
+ *
+ * Every rate is described by a G726Rate: the quantizer's decision levels
+ * and, per code, the reconstruction level, the scale factor and the
+ * speed control weights. Encoder and decoder share the same
+ * predict / reconstruct / adapt step, so an encoder's state always tracks
+ * the state of the decoder at the other end. Codes are packed most
+ * significant bits first, the way rtpg726pay and rtpg726depay expect them
+ * (they convert to and from RFC 3551 order themselves).
+ *
+ * The state arithmetic follows the ITU fixed point description, including
+ * its 16-bit wrap-arounds, so any conforming decoder can follow.
+ *
+ * Many independent channels of the same rate can be coded in one call with
+ * G726Channels. Channels are grouped by G726_LANES and every group runs in
+ * lockstep in SIMD vectors, one channel per lane; channels left over are
+ * coded one by one. g726_init() enables the lane kernels when the CPU has
+ * AVX2.
+ */
+
+#define G726_SAMPLE_RATE 8000
+#define G726_LANES       8
+
+typedef struct {
+	gint bitrate;
+	guint bits;
+	guint quantizerSize;
+	gint16 quantizer[15];
+	gint32 dqln[32];
+	gint32 wi[32];
+	gint32 fi[32];
+} G726Rate;
+
+static const G726Rate g726_rates[] = {
+	{ 16000, 2, 1,
+		{ 261 },
+		{ 116, 365, 365, 116 },
+		{ -704, 14048, 14048, -704 },
+		{ 0, 0xE00, 0xE00, 0 } },
+	{ 24000, 3, 3,
+		{ 8, 218, 331 },
+		{ -2048, 135, 273, 373, 373, 273, 135, -2048 },
+		{ -128, 960, 4384, 18624, 18624, 4384, 960, -128 },
+		{ 0, 0x200, 0x400, 0xE00, 0xE00, 0x400, 0x200, 0 } },
+	{ 32000, 4, 7,
+		{ -124, 80, 178, 246, 300, 349, 400 },
+		{ -2048, 4, 135, 213, 273, 323, 373, 425, 425, 373, 323, 273, 213, 135, 4, -2048 },
+		{ -384, 576, 1312, 2048, 3584, 6336, 11360, 35904,
+		  35904, 11360, 6336, 3584, 2048, 1312, 576, -384 },
+		{ 0, 0, 0, 0x200, 0x200, 0x200, 0x600, 0xE00, 0xE00, 0x600, 0x200, 0x200, 0x200, 0, 0, 0 } },
+	{ 40000, 5, 15,
+		{ -122, -16, 68, 139, 198, 250, 298, 339, 378, 413, 445, 475, 502, 528, 553 },
+		{ -2048, -66, 28, 104, 169, 224, 274, 318, 358, 395, 429, 459, 488, 514, 539, 566,
+		  566, 539, 514, 488, 459, 429, 395, 358, 318, 274, 224, 169, 104, 28, -66, -2048 },
+		{ 448, 448, 768, 1248, 1280, 1312, 1856, 3200, 4512, 5728, 7008, 8960, 11456, 14080, 16928, 22272,
+		  22272, 16928, 14080, 11456, 8960, 7008, 5728, 4512, 3200, 1856, 1312, 1280, 1248, 768, 448, 448 },
+		{ 0, 0, 0, 0, 0, 0x200, 0x200, 0x200, 0x200, 0x200, 0x400, 0x600, 0x800, 0xA00, 0xC00, 0xC00,
+		  0xC00, 0xC00, 0xA00, 0x800, 0x600, 0x400, 0x200, 0x200, 0x200, 0x200, 0x200, 0, 0, 0, 0, 0 } }
+};
+
+// Returns 0 for a bitrate G.726 does not have.
+const G726Rate* g726_rateForBitrate(gint bitrate){
+	guint i;
+	for (i = 0; i < G_N_ELEMENTS (g726_rates); i++){
+		if (g726_rates[i].bitrate == bitrate){
+			return &g726_rates[i];
+		}
+	}
+	return 0;
+}
+
+gsize g726_encodedSize(const G726Rate* rate, guint samples){
+	return (samples * rate->bits + 7) / 8;
+}
+
+guint g726_decodedSamples(const G726Rate* rate, gsize bytes){
+	return bytes * 8 / rate->bits;
+}
+
+/*
+ * One channel's state. dq and sr hold the last quantized differences and
+ * reconstructed samples in the 11-bit floating point format of the
+ * predictor.
+ */
+typedef struct {
+	gint32 yl;
+	gint16 yu, dms, dml, ap, td;
+	gint16 a[2], b[6], pk[2];
+	gint16 dq[6], sr[2];
+} G726State;
+
+void g726_initState(G726State* state){
+	memset (state, 0, sizeof (G726State));
+	state->yl = 34816;
+	state->yu = 544;
+
+	int i;
+	for (i = 0; i < 2; i++){
+		state->sr[i] = 32;
+	}
+	for (i = 0; i < 6; i++){
+		state->dq[i] = 32;
+	}
+}
+
+// floor(log2(value)) + 1 for value in 1..0x7FFF, 0 below.
+static gint g726_log2(gint value){
+	return value > 0 ? MIN (g_bit_storage (value), 15) : 0;
+}
+
+// Number of levels value is not below.
+static gint g726_quan(gint value, const gint16* levels, guint size){
+	guint i;
+	for (i = 0; i < size && value >= levels[i]; i++){
+	}
+	return i;
+}
+
+// Multiplies a predictor coefficient by a value in floating point format.
+static gint g726_fmult(gint an, gint srn){
+	gint anmag  = an > 0 ? an : ((-an) & 0x1FFF);
+	gint anexp  = g726_log2(anmag) - 6;
+	gint anmant = anmag == 0 ? 32 : anexp >= 0 ? anmag >> anexp : anmag << -anexp;
+
+	gint wanexp  = anexp + ((srn >> 6) & 0xF) - 13;
+	gint wanmant = (anmant * (srn & 077) + 0x30) >> 4;
+	gint retval  = wanexp >= 0 ? ((wanmant << wanexp) & 0x7FFF) : (wanmant >> -wanexp);
+
+	return (an ^ srn) < 0 ? -retval : retval;
+}
+
+// Converts a 16-bit value to the predictor's floating point format.
+static gint16 g726_toFloat(gint value){
+	gint magnitude = value < 0 ? -value : value;
+	if (magnitude == 0){
+		return 0x20;
+	}
+	gint exp = g726_log2(magnitude);
+	gint16 converted = (exp << 6) + ((magnitude << 6) >> exp);
+	return value < 0 ? converted - 0x400 : converted;
+}
+
+typedef struct {
+	gint16 sez;
+	gint16 se;
+	gint y;
+} G726Prediction;
+
+static void g726_predict(const G726State* state, G726Prediction* prediction){
+	gint16 sezi = 0;
+	int i;
+	for (i = 0; i < 6; i++){
+		sezi += g726_fmult(state->b[i] >> 2, state->dq[i]);
+	}
+	gint16 sei = sezi + g726_fmult(state->a[1] >> 2, state->sr[1]) + g726_fmult(state->a[0] >> 2, state->sr[0]);
+
+	prediction->sez = sezi >> 1;
+	prediction->se  = sei >> 1;
+
+	if (state->ap >= 256){
+		prediction->y = state->yu;
+	} else {
+		gint y   = state->yl >> 6;
+		gint dif = state->yu - y;
+		gint al  = state->ap >> 2;
+		if (dif > 0){
+			y += (dif * al) >> 6;
+		} else if (dif < 0){
+			y += (dif * al + 0x3F) >> 6;
+		}
+		prediction->y = y;
+	}
+}
+
+static guint g726_quantize(const G726Rate* rate, gint16 d, gint y){
+	gint16 dqm  = ABS (d);
+	gint exp    = g726_log2(dqm >> 1);
+	gint16 dl   = (exp << 7) + (((dqm << 7) >> exp) & 0x7F);
+	gint16 dln  = dl - (y >> 2);
+	guint i     = g726_quan(dln, rate->quantizer, rate->quantizerSize);
+	guint mask  = (1 << rate->bits) - 1;
+
+	if (d < 0){
+		return mask - i;
+	}
+	// Only 16 kbit/s has no code for a zero difference.
+	if (i == 0 && rate->bits != 2){
+		return mask;
+	}
+	return i;
+}
+
+static gint g726_reconstruct(gboolean negative, gint dqln, gint y){
+	gint16 dql = dqln + (y >> 2);
+	if (dql < 0){
+		return negative ? -0x8000 : 0;
+	}
+	gint dex = (dql >> 7) & 15;
+	gint dqt = 128 + (dql & 127);
+	gint16 dq = (dqt << 7) >> (14 - dex);
+	return negative ? dq - 0x8000 : dq;
+}
+
+// Reconstructs the sample of code and adapts the state to it.
+static gint16 g726_adapt(const G726Rate* rate, G726State* state, const G726Prediction* prediction, guint code){
+	gint y   = prediction->y;
+	gint dq  = g726_reconstruct(code & (1 << (rate->bits - 1)), rate->dqln[code], y);
+	gint16 sr    = dq < 0 ? prediction->se - (dq & 0x7FFF) : prediction->se + dq;
+	gint16 dqsez = sr + prediction->sez - prediction->se;
+	gint wi = rate->wi[code];
+	gint fi = rate->fi[code];
+
+	gint16 pk0 = dqsez < 0;
+	gint16 mag = dq & 0x7FFF;
+
+	// Transition detector
+	gint16 ylint = state->yl >> 15;
+	gint16 ylfrac = (state->yl >> 10) & 0x1F;
+	gint16 thr2 = ylint > 9 ? 31 << 10 : (32 + ylfrac) << ylint;
+	gint16 dqthr = (thr2 + (thr2 >> 1)) >> 1;
+	gboolean tr = state->td && mag > dqthr;
+
+	// Quantizer scale factor
+	state->yu = CLAMP (y + ((wi - y) >> 5), 544, 5120);
+	state->yl += state->yu + ((-state->yl) >> 6);
+
+	gint16 a2p = 0;
+	int i;
+	if (tr){
+		memset (state->a, 0, sizeof (state->a));
+		memset (state->b, 0, sizeof (state->b));
+	} else {
+		// Pole predictor coefficients
+		gint16 pks1 = pk0 ^ state->pk[0];
+
+		a2p = state->a[1] - (state->a[1] >> 7);
+		if (dqsez != 0){
+			gint16 fa1 = pks1 ? state->a[0] : -state->a[0];
+			if (fa1 < -8191){
+				a2p -= 0x100;
+			} else if (fa1 > 8191){
+				a2p += 0xFF;
+			} else {
+				a2p += fa1 >> 5;
+			}
+
+			if (pk0 ^ state->pk[1]){
+				a2p = a2p <= -12160 ? -12288 : a2p >= 12416 ? 12288 : a2p - 0x80;
+			} else {
+				a2p = a2p <= -12416 ? -12288 : a2p >= 12160 ? 12288 : a2p + 0x80;
+			}
+		}
+		state->a[1] = a2p;
+
+		state->a[0] -= state->a[0] >> 8;
+		if (dqsez != 0){
+			state->a[0] += pks1 ? -192 : 192;
+		}
+		gint16 a1ul = 15360 - a2p;
+		state->a[0] = CLAMP (state->a[0], -a1ul, a1ul);
+
+		// Zero predictor coefficients
+		for (i = 0; i < 6; i++){
+			state->b[i] -= state->b[i] >> (rate->bits == 5 ? 9 : 8);
+			if (mag){
+				state->b[i] += (dq ^ state->dq[i]) >= 0 ? 128 : -128;
+			}
+		}
+	}
+
+	for (i = 5; i > 0; i--){
+		state->dq[i] = state->dq[i - 1];
+	}
+	state->dq[0] = mag == 0 ? (dq >= 0 ? 0x20 : (gint16) 0xFC20) : g726_toFloat(dq >= 0 ? mag : -mag);
+
+	state->sr[1] = state->sr[0];
+	state->sr[0] = sr == -32768 ? (gint16) 0xFC20 : g726_toFloat(sr);
+
+	state->pk[1] = state->pk[0];
+	state->pk[0] = pk0;
+
+	// Tone detector and speed control
+	state->td = !tr && a2p < -11776;
+
+	state->dms += (fi - state->dms) >> 5;
+	state->dml += ((fi << 2) - state->dml) >> 7;
+
+	if (tr){
+		state->ap = 256;
+	} else if (y < 1536 || state->td || ABS ((state->dms << 2) - state->dml) >= (state->dml >> 3)){
+		state->ap += (0x200 - state->ap) >> 4;
+	} else {
+		state->ap += (-state->ap) >> 4;
+	}
+
+	return sr;
+}
+
+guint g726_encodeSample(const G726Rate* rate, G726State* state, gint16 sample){
+	G726Prediction prediction;
+	g726_predict(state, &prediction);
+
+	gint16 d = (sample >> 2) - prediction.se;
+	guint code = g726_quantize(rate, d, prediction.y);
+	g726_adapt(rate, state, &prediction, code);
+	return code;
+}
+
+gint16 g726_decodeSample(const G726Rate* rate, G726State* state, guint code){
+	G726Prediction prediction;
+	g726_predict(state, &prediction);
+
+	gint sr = g726_adapt(rate, state, &prediction, code & ((1 << rate->bits) - 1));
+	return CLAMP (sr << 2, G_MININT16, G_MAXINT16);
+}
+
+/*
+ * Encodes samples values of pcm, stride values apart, into out. A last
+ * byte that is not filled up is padded with zero bits.
+ */
+void g726_encode(const G726Rate* rate, G726State* state, const gint16* pcm, guint stride, guint samples, guint8* out){
+	guint32 bits = 0;
+	guint count = 0;
+	guint i;
+	for (i = 0; i < samples; i++){
+		bits = (bits << rate->bits) | g726_encodeSample(rate, state, pcm[i * stride]);
+		count += rate->bits;
+		if (count >= 8){
+			count -= 8;
+			*out++ = bits >> count;
+		}
+	}
+	if (count){
+		*out = bits << (8 - count);
+	}
+}
+
+void g726_decode(const G726Rate* rate, G726State* state, const guint8* in, guint samples, gint16* pcm, guint stride){
+	guint32 bits = 0;
+	guint count = 0;
+	guint i;
+	for (i = 0; i < samples; i++){
+		if (count < rate->bits){
+			bits = (bits << 8) | *in++;
+			count += 8;
+		}
+		count -= rate->bits;
+		pcm[i * stride] = g726_decodeSample(rate, state, bits >> count);
+	}
+}
+
+/*
+ * The lane kernels: the same step as above for G726_LANES channels at a
+ * time, with every branch turned into a select. Comparisons yield -1 in
+ * lanes where they hold, so "mask & x" keeps x only there.
+ *
+ * They are only built for AVX2: without its variable shifts the vector
+ * code is slower than coding the channels one by one.
+ */
+
+typedef gint32 G726Vector __attribute__ ((vector_size (G726_LANES * sizeof (gint32))));
+
+typedef struct {
+	G726Vector yl, yu, dms, dml, ap, td;
+	G726Vector a[2], b[6], pk[2];
+	G726Vector dq[6], sr[2];
+} G726LaneState;
+
+typedef void (*G726EncodeLanesFunc) (const G726Rate* rate, G726LaneState* state, const gint16* const* pcm, guint stride, guint samples, guint8* const* out);
+typedef void (*G726DecodeLanesFunc) (const G726Rate* rate, G726LaneState* state, const guint8* const* in, guint samples, gint16* const* pcm, guint stride);
+
+typedef struct {
+	const gchar* name;
+	G726EncodeLanesFunc encodeLanes;
+	G726DecodeLanesFunc decodeLanes;
+} G726Kernels;
+
+static G726Kernels g726Kernels;
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define G726_X86 1
+
+#pragma GCC push_options
+#pragma GCC target ("avx2")
+
+#define G726_INLINE static inline __attribute__ ((always_inline))
+
+G726_INLINE G726Vector g726v_select(G726Vector mask, G726Vector x, G726Vector y){
+	return (mask & x) | (~mask & y);
+}
+
+// Sign extends the low 16 bits, like storing to a 16-bit variable.
+G726_INLINE G726Vector g726v_short(G726Vector x){
+	return (x << 16) >> 16;
+}
+
+G726_INLINE G726Vector g726v_abs(G726Vector x){
+	return g726v_select(x < 0, -x, x);
+}
+
+G726_INLINE G726Vector g726v_clamp(G726Vector x, G726Vector low, G726Vector high){
+	x = g726v_select(x < low, low, x);
+	return g726v_select(x > high, high, x);
+}
+
+// Shifts left by count, right by -count.
+G726_INLINE G726Vector g726v_shift(G726Vector x, G726Vector count){
+	G726Vector zero = { 0 };
+	G726Vector left  = g726v_select(count > 0, count, zero);
+	G726Vector right = g726v_select(count < 0, -count, zero);
+	right = g726v_select(right > 31, zero + 31, right);
+	return (x << left) >> right;
+}
+
+G726_INLINE G726Vector g726v_log2(G726Vector value){
+	G726Vector result = { 0 };
+	gint level;
+	for (level = 1; level <= 0x4000; level <<= 1){
+		result -= value >= level;
+	}
+	return result;
+}
+
+G726_INLINE G726Vector g726v_quan(G726Vector value, const gint16* levels, guint size){
+	G726Vector result = { 0 };
+	guint i;
+	for (i = 0; i < size; i++){
+		result -= value >= levels[i];
+	}
+	return result;
+}
+
+G726_INLINE G726Vector g726v_lookup(const gint32* table, G726Vector index){
+	G726Vector result;
+	int lane;
+	for (lane = 0; lane < G726_LANES; lane++){
+		result[lane] = table[index[lane]];
+	}
+	return result;
+}
+
+G726_INLINE G726Vector g726v_fmult(G726Vector an, G726Vector srn){
+	G726Vector zero = { 0 };
+	G726Vector anmag  = g726v_select(an > 0, an, (-an) & 0x1FFF);
+	G726Vector anexp  = g726v_log2(anmag) - 6;
+	G726Vector anmant = g726v_select(anmag == 0, zero + 32, g726v_shift(anmag, -anexp));
+
+	G726Vector wanexp  = anexp + ((srn >> 6) & 0xF) - 13;
+	G726Vector wanmant = (anmant * (srn & 077) + 0x30) >> 4;
+	G726Vector retval  = g726v_select(wanexp >= 0, g726v_shift(wanmant, wanexp) & 0x7FFF, g726v_shift(wanmant, wanexp));
+
+	return g726v_select((an ^ srn) < 0, -retval, retval);
+}
+
+G726_INLINE G726Vector g726v_toFloat(G726Vector value){
+	G726Vector magnitude = g726v_abs(value);
+	G726Vector exp = g726v_log2(magnitude);
+	G726Vector converted = (exp << 6) + g726v_shift(magnitude << 6, -exp);
+	converted = g726v_select(value < 0, converted - 0x400, converted);
+	G726Vector zero = { 0 };
+	return g726v_short(g726v_select(magnitude == 0, zero + 0x20, converted));
+}
+
+G726_INLINE void g726v_predict(const G726LaneState* state, G726Vector* sez, G726Vector* se, G726Vector* y){
+	G726Vector sezi = { 0 };
+	int i;
+	for (i = 0; i < 6; i++){
+		sezi += g726v_fmult(state->b[i] >> 2, state->dq[i]);
+	}
+	sezi = g726v_short(sezi);
+	G726Vector sei = g726v_short(sezi + g726v_fmult(state->a[1] >> 2, state->sr[1]) + g726v_fmult(state->a[0] >> 2, state->sr[0]));
+
+	*sez = sezi >> 1;
+	*se  = sei >> 1;
+
+	G726Vector yl  = state->yl >> 6;
+	G726Vector dif = state->yu - yl;
+	G726Vector al  = state->ap >> 2;
+	G726Vector adapted = yl + g726v_select(dif < 0, (dif * al + 0x3F) >> 6, (dif * al) >> 6);
+	*y = g726v_select(state->ap >= 256, state->yu, adapted);
+}
+
+G726_INLINE G726Vector g726v_quantize(const G726Rate* rate, G726Vector d, G726Vector y){
+	G726Vector dqm = g726v_short(g726v_abs(d));
+	G726Vector exp = g726v_log2(dqm >> 1);
+	G726Vector dl  = g726v_short((exp << 7) + (g726v_shift(dqm << 7, -exp) & 0x7F));
+	G726Vector dln = g726v_short(dl - (y >> 2));
+	G726Vector i   = g726v_quan(dln, rate->quantizer, rate->quantizerSize);
+	G726Vector zero = { 0 };
+	G726Vector mask = zero + ((1 << rate->bits) - 1);
+
+	G726Vector positive = i;
+	if (rate->bits != 2){
+		positive = g726v_select(i == 0, mask, i);
+	}
+	return g726v_select(d < 0, mask - i, positive);
+}
+
+G726_INLINE G726Vector g726v_reconstruct(G726Vector negative, G726Vector dqln, G726Vector y){
+	G726Vector zero = { 0 };
+	G726Vector dql = g726v_short(dqln + (y >> 2));
+	G726Vector dex = (dql >> 7) & 15;
+	G726Vector dqt = 128 + (dql & 127);
+	G726Vector dq  = g726v_short(g726v_shift(dqt << 7, dex - 14));
+	dq = g726v_select(dql < 0, zero, dq);
+	return g726v_select(negative, dq - 0x8000, dq);
+}
+
+G726_INLINE G726Vector g726v_adapt(const G726Rate* rate, G726LaneState* state, G726Vector sez, G726Vector se, G726Vector y, G726Vector code){
+	G726Vector zero = { 0 };
+	G726Vector dq = g726v_reconstruct((code & (1 << (rate->bits - 1))) != 0, g726v_lookup(rate->dqln, code), y);
+	G726Vector sr    = g726v_short(g726v_select(dq < 0, se - (dq & 0x7FFF), se + dq));
+	G726Vector dqsez = g726v_short(sr + sez - se);
+	G726Vector wi = g726v_lookup(rate->wi, code);
+	G726Vector fi = g726v_lookup(rate->fi, code);
+
+	G726Vector pk0 = -(dqsez < 0);
+	G726Vector mag = dq & 0x7FFF;
+
+	G726Vector ylint  = state->yl >> 15;
+	G726Vector ylfrac = (state->yl >> 10) & 0x1F;
+	G726Vector thr2   = g726v_select(ylint > 9, zero + (31 << 10), g726v_short(g726v_shift(32 + ylfrac, ylint)));
+	G726Vector dqthr  = g726v_short((thr2 + (thr2 >> 1)) >> 1);
+	G726Vector tr     = (state->td != 0) & (mag > dqthr);
+
+	state->yu = g726v_clamp(y + ((wi - y) >> 5), zero + 544, zero + 5120);
+	state->yl += state->yu + ((-state->yl) >> 6);
+
+	G726Vector pks1 = pk0 ^ state->pk[0];
+	G726Vector active = dqsez != 0;
+
+	G726Vector a2p = g726v_short(state->a[1] - (state->a[1] >> 7));
+	G726Vector fa1 = g726v_short(g726v_select(pks1 != 0, state->a[0], -state->a[0]));
+	G726Vector step = g726v_select(fa1 < -8191, zero - 0x100, g726v_select(fa1 > 8191, zero + 0xFF, fa1 >> 5));
+	G726Vector a2pUpdated = g726v_short(a2p + step);
+	G726Vector differ = (pk0 ^ state->pk[1]) != 0;
+	G726Vector a2pDiffer = g726v_select(a2pUpdated <= -12160, zero - 12288,
+		g726v_select(a2pUpdated >= 12416, zero + 12288, a2pUpdated - 0x80));
+	G726Vector a2pSame = g726v_select(a2pUpdated <= -12416, zero - 12288,
+		g726v_select(a2pUpdated >= 12160, zero + 12288, a2pUpdated + 0x80));
+	a2p = g726v_select(active, g726v_select(differ, a2pDiffer, a2pSame), a2p);
+
+	G726Vector a1 = g726v_short(state->a[0] - (state->a[0] >> 8));
+	a1 = g726v_short(a1 + (active & g726v_select(pks1 != 0, zero - 192, zero + 192)));
+	G726Vector a1ul = 15360 - a2p;
+	a1 = g726v_clamp(a1, -a1ul, a1ul);
+
+	state->a[1] = g726v_select(tr, zero, a2p);
+	state->a[0] = g726v_select(tr, zero, a1);
+
+	int i;
+	for (i = 0; i < 6; i++){
+		G726Vector b = g726v_short(state->b[i] - (state->b[i] >> (rate->bits == 5 ? 9 : 8)));
+		b = g726v_short(b + ((mag != 0) & g726v_select((dq ^ state->dq[i]) >= 0, zero + 128, zero - 128)));
+		state->b[i] = g726v_select(tr, zero, b);
+	}
+
+	for (i = 5; i > 0; i--){
+		state->dq[i] = state->dq[i - 1];
+	}
+	G726Vector dqZero = g726v_select(dq >= 0, zero + 0x20, zero - 992);
+	state->dq[0] = g726v_select(mag == 0, dqZero, g726v_toFloat(g726v_select(dq >= 0, mag, -mag)));
+
+	state->sr[1] = state->sr[0];
+	state->sr[0] = g726v_select(sr == -32768, zero - 992, g726v_toFloat(sr));
+
+	state->pk[1] = state->pk[0];
+	state->pk[0] = pk0;
+
+	state->td = -(~tr & (a2p < -11776));
+
+	state->dms = g726v_short(state->dms + ((fi - state->dms) >> 5));
+	state->dml = g726v_short(state->dml + (((fi << 2) - state->dml) >> 7));
+
+	G726Vector fast = (y < 1536) | (state->td != 0)
+		| (g726v_abs((state->dms << 2) - state->dml) >= (state->dml >> 3));
+	G726Vector ap = g726v_select(fast, state->ap + ((0x200 - state->ap) >> 4), state->ap + ((-state->ap) >> 4));
+	state->ap = g726v_select(tr, zero + 256, ap);
+
+	return sr;
+}
+
+G726_INLINE void g726_encodeLanesBody(const G726Rate* rate, G726LaneState* state, const gint16* const* pcm, guint stride, guint samples, guint8* const* out){
+	G726Vector bits = { 0 };
+	guint count = 0;
+	guint i, byte = 0;
+	int lane;
+	for (i = 0; i < samples; i++){
+		G726Vector sample;
+		for (lane = 0; lane < G726_LANES; lane++){
+			sample[lane] = pcm[lane][i * stride];
+		}
+
+		G726Vector sez, se, y;
+		g726v_predict(state, &sez, &se, &y);
+		G726Vector d = g726v_short((sample >> 2) - se);
+		G726Vector code = g726v_quantize(rate, d, y);
+		g726v_adapt(rate, state, sez, se, y, code);
+
+		bits = (bits << rate->bits) | code;
+		count += rate->bits;
+		if (count >= 8){
+			count -= 8;
+			for (lane = 0; lane < G726_LANES; lane++){
+				out[lane][byte] = bits[lane] >> count;
+			}
+			byte++;
+		}
+	}
+	if (count){
+		for (lane = 0; lane < G726_LANES; lane++){
+			out[lane][byte] = bits[lane] << (8 - count);
+		}
+	}
+}
+
+G726_INLINE void g726_decodeLanesBody(const G726Rate* rate, G726LaneState* state, const guint8* const* in, guint samples, gint16* const* pcm, guint stride){
+	G726Vector bits = { 0 };
+	guint count = 0;
+	guint i, byte = 0;
+	int lane;
+	for (i = 0; i < samples; i++){
+		if (count < rate->bits){
+			for (lane = 0; lane < G726_LANES; lane++){
+				bits[lane] = (bits[lane] << 8) | in[lane][byte];
+			}
+			byte++;
+			count += 8;
+		}
+		count -= rate->bits;
+		G726Vector code = (bits >> count) & ((1 << rate->bits) - 1);
+
+		G726Vector sez, se, y;
+		g726v_predict(state, &sez, &se, &y);
+		G726Vector sr = g726v_adapt(rate, state, sez, se, y, code);
+
+		G726Vector zero = { 0 };
+		G726Vector sample = g726v_clamp(sr << 2, zero + G_MININT16, zero + G_MAXINT16);
+		for (lane = 0; lane < G726_LANES; lane++){
+			pcm[lane][i * stride] = sample[lane];
+		}
+	}
+}
+
+static void g726_encodeLanesAvx2(const G726Rate* rate, G726LaneState* state, const gint16* const* pcm, guint stride, guint samples, guint8* const* out){
+	g726_encodeLanesBody(rate, state, pcm, stride, samples, out);
+}
+
+static void g726_decodeLanesAvx2(const G726Rate* rate, G726LaneState* state, const guint8* const* in, guint samples, gint16* const* pcm, guint stride){
+	g726_decodeLanesBody(rate, state, in, samples, pcm, stride);
+}
+
+#pragma GCC pop_options
+#endif
+
+void g726_init(){
+	if (g726Kernels.name){
+		return;
+	}
+
+	g726Kernels.name = "scalar";
+
+#ifdef G726_X86
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx2")){
+		g726Kernels.name        = "avx2";
+		g726Kernels.encodeLanes = g726_encodeLanesAvx2;
+		g726Kernels.decodeLanes = g726_decodeLanesAvx2;
+	}
+#endif
+}
+
+/*
+ * Independent channels of one rate, coded together. With lane kernels
+ * channel c is lane c % G726_LANES of group c / G726_LANES while its group
+ * is full; the channels after the last full group, or all of them without
+ * lane kernels, keep a scalar state.
+ */
+typedef struct {
+	const G726Rate* rate;
+	guint channels;
+	guint groups;
+	G726LaneState* lanes;
+	G726State* states;
+} G726Channels;
+
+// Copies a channel's state out, in the form g726_encode() keeps it.
+void g726Channels_getState(const G726Channels* channels, guint channel, G726State* out){
+	guint group = channel / G726_LANES;
+	if (group >= channels->groups){
+		*out = channels->states[channel - channels->groups * G726_LANES];
+		return;
+	}
+
+	const G726LaneState* state = &channels->lanes[group];
+	guint lane = channel % G726_LANES;
+	int i;
+	out->yl  = state->yl[lane];
+	out->yu  = state->yu[lane];
+	out->dms = state->dms[lane];
+	out->dml = state->dml[lane];
+	out->ap  = state->ap[lane];
+	out->td  = state->td[lane];
+	for (i = 0; i < 2; i++){
+		out->a[i]  = state->a[i][lane];
+		out->pk[i] = state->pk[i][lane];
+		out->sr[i] = state->sr[i][lane];
+	}
+	for (i = 0; i < 6; i++){
+		out->b[i]  = state->b[i][lane];
+		out->dq[i] = state->dq[i][lane];
+	}
+}
+
+// Has a channel carry on from state, e.g. another coder's channel.
+void g726Channels_setState(G726Channels* channels, guint channel, const G726State* in){
+	guint group = channel / G726_LANES;
+	if (group >= channels->groups){
+		channels->states[channel - channels->groups * G726_LANES] = *in;
+		return;
+	}
+
+	G726LaneState* state = &channels->lanes[group];
+	guint lane = channel % G726_LANES;
+	int i;
+	state->yl[lane]  = in->yl;
+	state->yu[lane]  = in->yu;
+	state->dms[lane] = in->dms;
+	state->dml[lane] = in->dml;
+	state->ap[lane]  = in->ap;
+	state->td[lane]  = in->td;
+	for (i = 0; i < 2; i++){
+		state->a[i][lane]  = in->a[i];
+		state->pk[i][lane] = in->pk[i];
+		state->sr[i][lane] = in->sr[i];
+	}
+	for (i = 0; i < 6; i++){
+		state->b[i][lane]  = in->b[i];
+		state->dq[i][lane] = in->dq[i];
+	}
+}
+
+void g726Channels_reset(G726Channels* channels, guint channel){
+	G726State initial;
+	g726_initState(&initial);
+	g726Channels_setState(channels, channel, &initial);
+}
+
+G726Channels* g726Channels_new(const G726Rate* rate, guint count){
+	g726_init();
+
+	G726Channels* channels = g_new0 (G726Channels, 1);
+	channels->rate     = rate;
+	channels->channels = count;
+	channels->groups   = g726Kernels.encodeLanes ? count / G726_LANES : 0;
+
+	// Vectors are loaded aligned, which malloc does not promise for AVX.
+	void* lanes = 0;
+	if (channels->groups && posix_memalign (&lanes, sizeof (G726Vector), channels->groups * sizeof (G726LaneState))){
+		lanes = 0;
+		channels->groups = 0;
+	}
+	channels->lanes  = (G726LaneState*) lanes;
+	channels->states = g_new0 (G726State, count - channels->groups * G726_LANES + 1);
+
+	guint c;
+	for (c = 0; c < count; c++){
+		g726Channels_reset(channels, c);
+	}
+	return channels;
+}
+
+void g726Channels_free(G726Channels* channels){
+	free (channels->lanes);
+	g_free (channels->states);
+	g_free (channels);
+}
+
+/*
+ * Encodes samples values of every channel: pcm[c] is channel c's first
+ * sample, the next ones are stride values apart; its codes are written to
+ * out[c], g726_encodedSize() bytes.
+ */
+void g726Channels_encode(G726Channels* channels, const gint16* const* pcm, guint stride, guint samples, guint8* const* out){
+	guint group, c;
+	for (group = 0; group < channels->groups; group++){
+		c = group * G726_LANES;
+		g726Kernels.encodeLanes(channels->rate, &channels->lanes[group], pcm + c, stride, samples, out + c);
+	}
+	for (c = channels->groups * G726_LANES; c < channels->channels; c++){
+		g726_encode(channels->rate, &channels->states[c - channels->groups * G726_LANES], pcm[c], stride, samples, out[c]);
+	}
+}
+
+void g726Channels_decode(G726Channels* channels, const guint8* const* in, guint samples, gint16* const* pcm, guint stride){
+	guint group, c;
+	for (group = 0; group < channels->groups; group++){
+		c = group * G726_LANES;
+		g726Kernels.decodeLanes(channels->rate, &channels->lanes[group], in + c, samples, pcm + c, stride);
+	}
+	for (c = channels->groups * G726_LANES; c < channels->channels; c++){
+		g726_decode(channels->rate, &channels->states[c - channels->groups * G726_LANES], in[c], samples, pcm[c], stride);
+	}
+}
+
+#endif
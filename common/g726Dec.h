@@ -0,0 +1,207 @@
+#ifndef G726_DEC_H
+#define G726_DEC_H
+
+#include <gst/gst.h>
+
+#include "g726.h"
+
+/*
+ * "g726dec" - G.726 decoder (see g726.h), a drop-in for ffdec_g726.
+ *
+ * Takes audio/x-adpcm, layout g726 as rtpg726depay produces it; the rate
+ * comes from the caps' bitrate. Produces 8 kHz S16.
+ *
+ * With more than one channel every input buffer holds the channels' codes
+ * one channel after the other, as g726enc writes them; all channels are
+ * decoded in one G726Channels call into interleaved output.
+ */
+
+#define GST_TYPE_G726_DEC (gst_g726_dec_get_type())
+#define GST_G726_DEC(obj) (G_TYPE_CHECK_INSTANCE_CAST((obj), GST_TYPE_G726_DEC, GstG726Dec))
+
+typedef struct _GstG726Dec      GstG726Dec;
+typedef struct _GstG726DecClass GstG726DecClass;
+
+struct _GstG726Dec {
+	GstElement element;
+
+	GstPad* sinkpad;
+	GstPad* srcpad;
+
+	// Only touched with the stream lock held.
+	gint channels;
+	G726Channels* coder;
+	const guint8** inputs;
+	gint16** planes;
+};
+
+struct _GstG726DecClass {
+	GstElementClass parent_class;
+};
+
+static GstStaticPadTemplate gst_g726_dec_sink_template = GST_STATIC_PAD_TEMPLATE ("sink",
+	GST_PAD_SINK, GST_PAD_ALWAYS, GST_STATIC_CAPS (
+		"audio/x-adpcm, "
+		"layout = (string) g726, "
+		"bitrate = (int) { 16000, 24000, 32000, 40000 }, "
+		"rate = (int) 8000, "
+		"channels = (int) [ 1, 64 ]"));
+
+static GstStaticPadTemplate gst_g726_dec_src_template = GST_STATIC_PAD_TEMPLATE ("src",
+	GST_PAD_SRC, GST_PAD_ALWAYS, GST_STATIC_CAPS (
+		"audio/x-raw-int, "
+		"endianness = (int) BYTE_ORDER, "
+		"signed = (boolean) true, "
+		"width = (int) 16, "
+		"depth = (int) 16, "
+		"rate = (int) 8000, "
+		"channels = (int) [ 1, 64 ]"));
+
+// Defined with G_DEFINE_TYPE rather than GST_BOILERPLATE, whose file-wide
+// parent_class would clash with the other elements built into a program.
+G_DEFINE_TYPE (GstG726Dec, gst_g726_dec, GST_TYPE_ELEMENT);
+
+static void gst_g726_dec_finalize (GObject* object);
+static gboolean gst_g726_dec_setcaps (GstPad* pad, GstCaps* caps);
+static GstFlowReturn gst_g726_dec_chain (GstPad* pad, GstBuffer* buffer);
+static GstStateChangeReturn gst_g726_dec_change_state (GstElement* element, GstStateChange transition);
+
+static void gst_g726_dec_class_init (GstG726DecClass* klass){
+	GObjectClass*    gobject_class = G_OBJECT_CLASS (klass);
+	GstElementClass* element_class = GST_ELEMENT_CLASS (klass);
+
+	gst_element_class_add_pad_template (element_class, gst_static_pad_template_get (&gst_g726_dec_sink_template));
+	gst_element_class_add_pad_template (element_class, gst_static_pad_template_get (&gst_g726_dec_src_template));
+
+	gst_element_class_set_details_simple (element_class,
+		"G.726 decoder", "Codec/Decoder/Audio",
+		"Table-driven G.726 ADPCM decoder at 16, 24, 32 and 40 kbit/s",
+		"GStreamer Audio Echo");
+
+	gobject_class->finalize = gst_g726_dec_finalize;
+
+	element_class->change_state = GST_DEBUG_FUNCPTR (gst_g726_dec_change_state);
+
+	g726_init();
+}
+
+static void gst_g726_dec_init (GstG726Dec* dec){
+	dec->sinkpad = gst_pad_new_from_static_template (&gst_g726_dec_sink_template, "sink");
+	gst_pad_set_setcaps_function (dec->sinkpad, GST_DEBUG_FUNCPTR (gst_g726_dec_setcaps));
+	gst_pad_set_chain_function (dec->sinkpad, GST_DEBUG_FUNCPTR (gst_g726_dec_chain));
+	gst_element_add_pad (GST_ELEMENT (dec), dec->sinkpad);
+
+	dec->srcpad = gst_pad_new_from_static_template (&gst_g726_dec_src_template, "src");
+	gst_pad_use_fixed_caps (dec->srcpad);
+	gst_element_add_pad (GST_ELEMENT (dec), dec->srcpad);
+
+	dec->channels = 0;
+	dec->coder    = 0;
+	dec->inputs   = 0;
+	dec->planes   = 0;
+}
+
+static void gst_g726_dec_free_coder (GstG726Dec* dec){
+	if (dec->coder){
+		g726Channels_free (dec->coder);
+	}
+	g_free (dec->inputs);
+	g_free (dec->planes);
+	dec->coder    = 0;
+	dec->inputs   = 0;
+	dec->planes   = 0;
+	dec->channels = 0;
+}
+
+static void gst_g726_dec_finalize (GObject* object){
+	gst_g726_dec_free_coder (GST_G726_DEC (object));
+	G_OBJECT_CLASS (gst_g726_dec_parent_class)->finalize (object);
+}
+
+static gboolean gst_g726_dec_setcaps (GstPad* pad, GstCaps* caps){
+	GstG726Dec* dec = GST_G726_DEC (gst_pad_get_parent (pad));
+	GstStructure* structure = gst_caps_get_structure (caps, 0);
+
+	gint channels = 0, bitrate = 0;
+	gst_structure_get_int (structure, "channels", &channels);
+	gst_structure_get_int (structure, "bitrate", &bitrate);
+	const G726Rate* rate = g726_rateForBitrate (bitrate);
+
+	GstCaps* srcCaps = gst_caps_new_simple ("audio/x-raw-int",
+		"endianness", G_TYPE_INT,     G_BYTE_ORDER,
+		"signed",     G_TYPE_BOOLEAN, TRUE,
+		"width",      G_TYPE_INT,     16,
+		"depth",      G_TYPE_INT,     16,
+		"rate",       G_TYPE_INT,     G726_SAMPLE_RATE,
+		"channels",   G_TYPE_INT,     channels,
+		NULL);
+	gboolean ok = rate && channels > 0 && gst_pad_set_caps (dec->srcpad, srcCaps);
+	gst_caps_unref (srcCaps);
+
+	if (ok){
+		gst_g726_dec_free_coder (dec);
+		dec->channels = channels;
+		dec->coder    = g726Channels_new (rate, channels);
+		dec->inputs   = g_new0 (const guint8*, channels);
+		dec->planes   = g_new0 (gint16*, channels);
+	}
+
+	gst_object_unref (dec);
+	return ok;
+}
+
+static GstFlowReturn gst_g726_dec_chain (GstPad* pad, GstBuffer* buffer){
+	GstG726Dec* dec = GST_G726_DEC (GST_PAD_PARENT (pad));
+
+	if (!dec->coder){
+		gst_buffer_unref (buffer);
+		return GST_FLOW_NOT_NEGOTIATED;
+	}
+
+	guint channels     = dec->channels;
+	gsize channelBytes = GST_BUFFER_SIZE (buffer) / channels;
+	guint samples      = g726_decodedSamples (dec->coder->rate, channelBytes);
+	if (!samples){
+		gst_buffer_unref (buffer);
+		return GST_FLOW_OK;
+	}
+
+	GstBuffer* out = gst_buffer_new_and_alloc (samples * channels * 2);
+	gint16* pcm = (gint16*) GST_BUFFER_DATA (out);
+
+	guint c;
+	for (c = 0; c < channels; c++){
+		dec->inputs[c] = GST_BUFFER_DATA (buffer) + c * channelBytes;
+		dec->planes[c] = pcm + c;
+	}
+	g726Channels_decode (dec->coder, dec->inputs, samples, dec->planes, channels);
+
+	gst_buffer_copy_metadata (out, buffer, GST_BUFFER_COPY_TIMESTAMPS | GST_BUFFER_COPY_FLAGS);
+	GST_BUFFER_DURATION (out) = gst_util_uint64_scale_int (samples, GST_SECOND, G726_SAMPLE_RATE);
+	GST_BUFFER_OFFSET (out)     = GST_BUFFER_OFFSET_NONE;
+	GST_BUFFER_OFFSET_END (out) = GST_BUFFER_OFFSET_NONE;
+	gst_buffer_set_caps (out, GST_PAD_CAPS (dec->srcpad));
+	gst_buffer_unref (buffer);
+
+	return gst_pad_push (dec->srcpad, out);
+}
+
+static GstStateChangeReturn gst_g726_dec_change_state (GstElement* element, GstStateChange transition){
+	GstStateChangeReturn result = GST_ELEMENT_CLASS (gst_g726_dec_parent_class)->change_state (element, transition);
+
+	// The pad keeps its caps, so the coder is kept too and only restarted.
+	GstG726Dec* dec = GST_G726_DEC (element);
+	if (transition == GST_STATE_CHANGE_PAUSED_TO_READY && dec->coder){
+		gint c;
+		for (c = 0; c < dec->channels; c++){
+			g726Channels_reset (dec->coder, c);
+		}
+	}
+	return result;
+}
+
+void gst_g726_dec_register (){
+	gst_element_register (NULL, "g726dec", GST_RANK_NONE, GST_TYPE_G726_DEC);
+}
+
+#endif
@@ -0,0 +1,371 @@
+#ifndef G726_ENC_H
+#define G726_ENC_H
+
+#include <gst/gst.h>
+
+#include "g726.h"
+
+/*
+ * "g726enc" - G.726 encoder (see g726.h), a drop-in for ffenc_g726.
+ *
+ * Takes 8 kHz S16 and produces audio/x-adpcm, layout g726 at the rate of
+ * the "bitrate" property, packed the way rtpg726pay expects. Codes are
+ * produced for whole groups of 8 samples, so every output buffer ends on a
+ * byte boundary at every rate; samples left over wait for the next buffer.
+ *
+ * Interleaved multi-channel input is coded as independent channels in one
+ * G726Channels call; each output buffer then holds every channel's codes
+ * one channel after the other.
+ *
+ * gst_g726_enc_copy_state() has an encoder carry on from another one's
+ * state, so a decoder fed the other's codes so far can take this one's
+ * next codes without a jump: G.726 is adaptive, and a decoder fed a second
+ * encoder's codes would otherwise predict from the wrong history.
+ */
+
+#define G726_ENC_DEFAULT_BITRATE 32000
+#define G726_ENC_GROUP_SAMPLES   8
+#define G726_ENC_MAX_CHANNELS    64
+
+#define GST_TYPE_G726_ENC (gst_g726_enc_get_type())
+#define GST_G726_ENC(obj) (G_TYPE_CHECK_INSTANCE_CAST((obj), GST_TYPE_G726_ENC, GstG726Enc))
+
+typedef struct _GstG726Enc      GstG726Enc;
+typedef struct _GstG726EncClass GstG726EncClass;
+
+struct _GstG726Enc {
+	GstElement element;
+
+	GstPad* sinkpad;
+	GstPad* srcpad;
+
+	gint bitrate;
+
+	// Only touched with the stream lock held.
+	gint channels;
+	G726Channels* coder;
+	gint16 pending[(G726_ENC_GROUP_SAMPLES - 1) * G726_ENC_MAX_CHANNELS];
+	guint pendingSamples;
+	const gint16** planes;
+	guint8** outputs;
+
+	// Left by gst_g726_enc_copy_state() for the next buffer, under the
+	// object lock.
+	G726State* copiedStates;
+	gint copiedChannels;
+};
+
+struct _GstG726EncClass {
+	GstElementClass parent_class;
+};
+
+enum {
+	G726_ENC_PROP_0,
+	G726_ENC_PROP_BITRATE
+};
+
+static GstStaticPadTemplate gst_g726_enc_sink_template = GST_STATIC_PAD_TEMPLATE ("sink",
+	GST_PAD_SINK, GST_PAD_ALWAYS, GST_STATIC_CAPS (
+		"audio/x-raw-int, "
+		"endianness = (int) BYTE_ORDER, "
+		"signed = (boolean) true, "
+		"width = (int) 16, "
+		"depth = (int) 16, "
+		"rate = (int) 8000, "
+		"channels = (int) [ 1, 64 ]"));
+
+static GstStaticPadTemplate gst_g726_enc_src_template = GST_STATIC_PAD_TEMPLATE ("src",
+	GST_PAD_SRC, GST_PAD_ALWAYS, GST_STATIC_CAPS (
+		"audio/x-adpcm, "
+		"layout = (string) g726, "
+		"bitrate = (int) { 16000, 24000, 32000, 40000 }, "
+		"rate = (int) 8000, "
+		"channels = (int) [ 1, 64 ]"));
+
+// Defined with G_DEFINE_TYPE rather than GST_BOILERPLATE, whose file-wide
+// parent_class would clash with the other elements built into a program.
+G_DEFINE_TYPE (GstG726Enc, gst_g726_enc, GST_TYPE_ELEMENT);
+
+static void gst_g726_enc_set_property (GObject* object, guint id, const GValue* value, GParamSpec* pspec);
+static void gst_g726_enc_get_property (GObject* object, guint id, GValue* value, GParamSpec* pspec);
+static void gst_g726_enc_finalize (GObject* object);
+static gboolean gst_g726_enc_setcaps (GstPad* pad, GstCaps* caps);
+static GstFlowReturn gst_g726_enc_chain (GstPad* pad, GstBuffer* buffer);
+static gboolean gst_g726_enc_sink_event (GstPad* pad, GstEvent* event);
+static GstStateChangeReturn gst_g726_enc_change_state (GstElement* element, GstStateChange transition);
+
+static void gst_g726_enc_class_init (GstG726EncClass* klass){
+	GObjectClass*    gobject_class = G_OBJECT_CLASS (klass);
+	GstElementClass* element_class = GST_ELEMENT_CLASS (klass);
+
+	gst_element_class_add_pad_template (element_class, gst_static_pad_template_get (&gst_g726_enc_sink_template));
+	gst_element_class_add_pad_template (element_class, gst_static_pad_template_get (&gst_g726_enc_src_template));
+
+	gst_element_class_set_details_simple (element_class,
+		"G.726 encoder", "Codec/Encoder/Audio",
+		"Table-driven G.726 ADPCM encoder at 16, 24, 32 and 40 kbit/s",
+		"GStreamer Audio Echo");
+
+	gobject_class->set_property = gst_g726_enc_set_property;
+	gobject_class->get_property = gst_g726_enc_get_property;
+	gobject_class->finalize     = gst_g726_enc_finalize;
+
+	g_object_class_install_property (gobject_class, G726_ENC_PROP_BITRATE,
+		g_param_spec_int ("bitrate", "Bitrate",
+			"16000, 24000, 32000 or 40000 bit/s, read when caps are set", 16000, 40000,
+			G726_ENC_DEFAULT_BITRATE, G_PARAM_READWRITE));
+
+	element_class->change_state = GST_DEBUG_FUNCPTR (gst_g726_enc_change_state);
+
+	g726_init();
+}
+
+static void gst_g726_enc_init (GstG726Enc* enc){
+	enc->sinkpad = gst_pad_new_from_static_template (&gst_g726_enc_sink_template, "sink");
+	gst_pad_set_setcaps_function (enc->sinkpad, GST_DEBUG_FUNCPTR (gst_g726_enc_setcaps));
+	gst_pad_set_chain_function (enc->sinkpad, GST_DEBUG_FUNCPTR (gst_g726_enc_chain));
+	gst_pad_set_event_function (enc->sinkpad, GST_DEBUG_FUNCPTR (gst_g726_enc_sink_event));
+	gst_element_add_pad (GST_ELEMENT (enc), enc->sinkpad);
+
+	enc->srcpad = gst_pad_new_from_static_template (&gst_g726_enc_src_template, "src");
+	gst_pad_use_fixed_caps (enc->srcpad);
+	gst_element_add_pad (GST_ELEMENT (enc), enc->srcpad);
+
+	enc->bitrate  = G726_ENC_DEFAULT_BITRATE;
+	enc->channels = 0;
+	enc->coder    = 0;
+	enc->pendingSamples = 0;
+	enc->planes  = 0;
+	enc->outputs = 0;
+	enc->copiedStates   = 0;
+	enc->copiedChannels = 0;
+}
+
+static void gst_g726_enc_free_coder (GstG726Enc* enc){
+	if (enc->coder){
+		g726Channels_free (enc->coder);
+	}
+	g_free (enc->planes);
+	g_free (enc->outputs);
+	enc->coder    = 0;
+	enc->planes   = 0;
+	enc->outputs  = 0;
+	enc->channels = 0;
+	enc->pendingSamples = 0;
+}
+
+static void gst_g726_enc_drop_copied_states (GstG726Enc* enc){
+	GST_OBJECT_LOCK (enc);
+	g_free (enc->copiedStates);
+	enc->copiedStates   = 0;
+	enc->copiedChannels = 0;
+	GST_OBJECT_UNLOCK (enc);
+}
+
+static void gst_g726_enc_finalize (GObject* object){
+	gst_g726_enc_free_coder (GST_G726_ENC (object));
+	gst_g726_enc_drop_copied_states (GST_G726_ENC (object));
+	G_OBJECT_CLASS (gst_g726_enc_parent_class)->finalize (object);
+}
+
+static void gst_g726_enc_set_property (GObject* object, guint id, const GValue* value, GParamSpec* pspec){
+	GstG726Enc* enc = GST_G726_ENC (object);
+
+	switch (id){
+		case G726_ENC_PROP_BITRATE:
+			if (!g726_rateForBitrate (g_value_get_int (value))){
+				g_warning ("g726enc: unsupported bitrate %d", g_value_get_int (value));
+				break;
+			}
+			enc->bitrate = g_value_get_int (value);
+			break;
+		default:
+			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, id, pspec);
+			break;
+	}
+}
+
+static void gst_g726_enc_get_property (GObject* object, guint id, GValue* value, GParamSpec* pspec){
+	GstG726Enc* enc = GST_G726_ENC (object);
+
+	switch (id){
+		case G726_ENC_PROP_BITRATE:
+			g_value_set_int (value, enc->bitrate);
+			break;
+		default:
+			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, id, pspec);
+			break;
+	}
+}
+
+static gboolean gst_g726_enc_setcaps (GstPad* pad, GstCaps* caps){
+	GstG726Enc* enc = GST_G726_ENC (gst_pad_get_parent (pad));
+
+	gint channels = 0;
+	gst_structure_get_int (gst_caps_get_structure (caps, 0), "channels", &channels);
+
+	GstCaps* srcCaps = gst_caps_new_simple ("audio/x-adpcm",
+		"layout",   G_TYPE_STRING, "g726",
+		"bitrate",  G_TYPE_INT,    enc->bitrate,
+		"rate",     G_TYPE_INT,    G726_SAMPLE_RATE,
+		"channels", G_TYPE_INT,    channels,
+		NULL);
+	gboolean ok = channels > 0 && gst_pad_set_caps (enc->srcpad, srcCaps);
+	gst_caps_unref (srcCaps);
+
+	if (ok){
+		gst_g726_enc_free_coder (enc);
+		enc->channels = channels;
+		enc->coder    = g726Channels_new (g726_rateForBitrate (enc->bitrate), channels);
+		enc->planes   = g_new0 (const gint16*, channels);
+		enc->outputs  = g_new0 (guint8*, channels);
+	}
+
+	gst_object_unref (enc);
+	return ok;
+}
+
+static GstFlowReturn gst_g726_enc_chain (GstPad* pad, GstBuffer* buffer){
+	GstG726Enc* enc = GST_G726_ENC (GST_PAD_PARENT (pad));
+
+	if (!enc->coder){
+		gst_buffer_unref (buffer);
+		return GST_FLOW_NOT_NEGOTIATED;
+	}
+
+	GST_OBJECT_LOCK (enc);
+	if (enc->copiedStates && enc->copiedChannels == enc->channels){
+		gint c;
+		for (c = 0; c < enc->channels; c++){
+			g726Channels_setState (enc->coder, c, &enc->copiedStates[c]);
+		}
+	}
+	g_free (enc->copiedStates);
+	enc->copiedStates = 0;
+	GST_OBJECT_UNLOCK (enc);
+
+	guint channels = enc->channels;
+	guint frames   = GST_BUFFER_SIZE (buffer) / (2 * channels);
+	const gint16* pcm = (const gint16*) GST_BUFFER_DATA (buffer);
+
+	// The common case, whole groups and nothing left over, codes the input
+	// buffer in place; otherwise the left-over samples are put in front.
+	guint pendingFrames = enc->pendingSamples / channels;
+	guint totalFrames   = pendingFrames + frames;
+	guint codedFrames   = totalFrames - totalFrames % G726_ENC_GROUP_SAMPLES;
+
+	gint16* joined = 0;
+	if (pendingFrames){
+		joined = g_new (gint16, totalFrames * channels);
+		memcpy (joined, enc->pending, enc->pendingSamples * 2);
+		memcpy (joined + enc->pendingSamples, pcm, frames * channels * 2);
+		pcm = joined;
+	}
+
+	GstFlowReturn result = GST_FLOW_OK;
+	if (codedFrames){
+		gsize channelBytes = g726_encodedSize (enc->coder->rate, codedFrames);
+		GstBuffer* out = gst_buffer_new_and_alloc (channelBytes * channels);
+
+		guint c;
+		for (c = 0; c < channels; c++){
+			enc->planes[c]  = pcm + c;
+			enc->outputs[c] = GST_BUFFER_DATA (out) + c * channelBytes;
+		}
+		g726Channels_encode (enc->coder, enc->planes, channels, codedFrames, enc->outputs);
+
+		GST_BUFFER_TIMESTAMP (out) = GST_BUFFER_TIMESTAMP_IS_VALID (buffer)
+			? GST_BUFFER_TIMESTAMP (buffer) - MIN (GST_BUFFER_TIMESTAMP (buffer),
+				gst_util_uint64_scale_int (pendingFrames, GST_SECOND, G726_SAMPLE_RATE))
+			: GST_CLOCK_TIME_NONE;
+		GST_BUFFER_DURATION (out) = gst_util_uint64_scale_int (codedFrames, GST_SECOND, G726_SAMPLE_RATE);
+		if (GST_BUFFER_FLAG_IS_SET (buffer, GST_BUFFER_FLAG_DISCONT)){
+			GST_BUFFER_FLAG_SET (out, GST_BUFFER_FLAG_DISCONT);
+		}
+		gst_buffer_set_caps (out, GST_PAD_CAPS (enc->srcpad));
+
+		result = gst_pad_push (enc->srcpad, out);
+	}
+
+	enc->pendingSamples = (totalFrames - codedFrames) * channels;
+	memcpy (enc->pending, pcm + codedFrames * channels, enc->pendingSamples * 2);
+
+	g_free (joined);
+	gst_buffer_unref (buffer);
+	return result;
+}
+
+static gboolean gst_g726_enc_sink_event (GstPad* pad, GstEvent* event){
+	GstG726Enc* enc = GST_G726_ENC (gst_pad_get_parent (pad));
+
+	if (GST_EVENT_TYPE (event) == GST_EVENT_FLUSH_STOP || GST_EVENT_TYPE (event) == GST_EVENT_NEWSEGMENT){
+		enc->pendingSamples = 0;
+	}
+	gboolean result = gst_pad_push_event (enc->srcpad, event);
+
+	gst_object_unref (enc);
+	return result;
+}
+
+static GstStateChangeReturn gst_g726_enc_change_state (GstElement* element, GstStateChange transition){
+	GstStateChangeReturn result = GST_ELEMENT_CLASS (gst_g726_enc_parent_class)->change_state (element, transition);
+
+	// The pad keeps its caps, so the coder is kept too and only restarted.
+	GstG726Enc* enc = GST_G726_ENC (element);
+	if (transition == GST_STATE_CHANGE_PAUSED_TO_READY && enc->coder){
+		gint c;
+		for (c = 0; c < enc->channels; c++){
+			g726Channels_reset (enc->coder, c);
+		}
+		enc->pendingSamples = 0;
+	}
+	if (transition == GST_STATE_CHANGE_PAUSED_TO_READY){
+		gst_g726_enc_drop_copied_states (enc);
+	}
+	return result;
+}
+
+/*
+ * Has "element" code its next buffer on from the state "from" has reached.
+ * Both must be g726enc at the same bitrate, else nothing is copied and
+ * FALSE returned, as it is while "from" has not coded yet. The state is
+ * read under from's stream lock, so the call is exact between two of
+ * from's buffers, e.g. from the thread that streams into it.
+ */
+gboolean gst_g726_enc_copy_state (GstElement* element, GstElement* from){
+	if (!G_TYPE_CHECK_INSTANCE_TYPE (element, GST_TYPE_G726_ENC) || !G_TYPE_CHECK_INSTANCE_TYPE (from, GST_TYPE_G726_ENC)){
+		return FALSE;
+	}
+	GstG726Enc* enc    = GST_G726_ENC (element);
+	GstG726Enc* source = GST_G726_ENC (from);
+	if (enc->bitrate != source->bitrate){
+		return FALSE;
+	}
+
+	GST_PAD_STREAM_LOCK (source->sinkpad);
+	gint channels = source->coder ? source->channels : 0;
+	G726State* states = g_new (G726State, MAX (channels, 1));
+	gint c;
+	for (c = 0; c < channels; c++){
+		g726Channels_getState (source->coder, c, &states[c]);
+	}
+	GST_PAD_STREAM_UNLOCK (source->sinkpad);
+
+	if (!channels){
+		g_free (states);
+		return FALSE;
+	}
+
+	GST_OBJECT_LOCK (enc);
+	g_free (enc->copiedStates);
+	enc->copiedStates   = states;
+	enc->copiedChannels = channels;
+	GST_OBJECT_UNLOCK (enc);
+	return TRUE;
+}
+
+void gst_g726_enc_register (){
+	gst_element_register (NULL, "g726enc", GST_RANK_NONE, GST_TYPE_G726_ENC);
+}
+
+#endif
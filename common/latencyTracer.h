@@ -0,0 +1,467 @@
+#ifndef LATENCY_TRACER_H
+#define LATENCY_TRACER_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <gst/gst.h>
+#include <glib-unix.h>
+
+/*
+ * Opt-in per-stage latency tracing, shared by all the examples.
+ *
+ * Run any program with LATENCY_TRACE=1 in its environment and
+ * latencyTracer_attach() puts buffer probes on the pads of every element of
+ * the pipeline, including elements and pads added later. Plain GstBins are
+ * looked into; any other bin (rtpbin, autoaudiosrc, ...) is one stage.
+ *
+ * Two numbers are kept per stage, each in a histogram:
+ *
+ * - residence: from a buffer entering the element to the buffer with the
+ *   nearest timestamp leaving it. This is how long the element holds data:
+ *   codec framing, packetization, the jitterbuffer;
+ * - age: how far the running time is past the buffer's timestamp as it
+ *   leaves the stage (or enters it, for sinks). Live sources stamp capture
+ *   time and udpsrc stamps arrival time, so this is the delay accumulated
+ *   since the audio was captured or the packet arrived.
+ *
+ * An element with several independent streams, like rtpbin, has one stage
+ * per stream, told apart by the pad name: send_rtp_sink_0 enters the stage
+ * that send_rtp_src_0 leaves.
+ *
+ * The histograms are printed by latencyTracer_dump(), which the programs
+ * call on the way out, and on SIGINT or SIGTERM (then the program exits) or
+ * SIGUSR1 (then it carries on).
+ */
+
+#define LATENCY_TRACER_ENV "LATENCY_TRACE"
+
+#define LATENCY_TRACER_BUCKET_US 100
+#define LATENCY_TRACER_BUCKETS   10000
+#define LATENCY_TRACER_RING      32
+
+typedef struct {
+	gint buckets[LATENCY_TRACER_BUCKETS + 1];
+	gint count;
+	gint maxUs;
+} LatencyHistogram;
+
+typedef struct {
+	gchar* name;
+	LatencyHistogram residence;
+	LatencyHistogram age;
+} LatencyStage;
+
+typedef struct _LatencyTracerElement LatencyTracerElement;
+
+typedef struct {
+	LatencyTracerElement* owner;
+	gchar* name;
+	LatencyStage* stage;
+
+	GMutex* lock;
+	gboolean fed;
+	GstClockTime timestamps[LATENCY_TRACER_RING];
+	GstClockTime arrivals[LATENCY_TRACER_RING];
+	guint next;
+} LatencyTracerLane;
+
+struct _LatencyTracerElement {
+	GstElement* element;
+	gchar* label;
+	gboolean sink;
+
+	GMutex* lock;
+	GHashTable* lanes;
+};
+
+static gboolean latencyTracer_enabled;
+static GMutex* latencyTracer_lock;
+static GPtrArray* latencyTracer_stages;
+static GHashTable* latencyTracer_stagesByName;
+
+static void latencyTracer_traceElement(GstElement* element);
+
+static void latencyTracer_record(LatencyHistogram* histogram, GstClockTimeDiff latency){
+	if (latency < 0){
+		return;
+	}
+
+	gint us = (gint) MIN (latency / GST_USECOND, G_MAXINT);
+	gint bucket = MIN (us / LATENCY_TRACER_BUCKET_US, LATENCY_TRACER_BUCKETS);
+
+	g_atomic_int_inc (&histogram->buckets[bucket]);
+	g_atomic_int_inc (&histogram->count);
+
+	gint max;
+	do {
+		max = g_atomic_int_get (&histogram->maxUs);
+	} while (us > max && !g_atomic_int_compare_and_exchange (&histogram->maxUs, max, us));
+}
+
+// The upper edge of the bucket holding the given fraction of the samples.
+static gdouble latencyTracer_percentileMs(LatencyHistogram* histogram, gdouble fraction){
+	gint wanted = (gint) (histogram->count * fraction);
+	gint seen = 0;
+	gint i;
+
+	for (i = 0; i < LATENCY_TRACER_BUCKETS; i++){
+		seen += g_atomic_int_get (&histogram->buckets[i]);
+		if (seen > wanted){
+			return (i + 1) * LATENCY_TRACER_BUCKET_US / 1000.0;
+		}
+	}
+	return g_atomic_int_get (&histogram->maxUs) / 1000.0;
+}
+
+static LatencyStage* latencyTracer_getStage(const gchar* name){
+	g_mutex_lock (latencyTracer_lock);
+
+	LatencyStage* stage = g_hash_table_lookup (latencyTracer_stagesByName, name);
+	if (!stage){
+		stage = g_new0 (LatencyStage, 1);
+		stage->name = g_strdup (name);
+		g_hash_table_insert (latencyTracer_stagesByName, stage->name, stage);
+		g_ptr_array_add (latencyTracer_stages, stage);
+	}
+
+	g_mutex_unlock (latencyTracer_lock);
+	return stage;
+}
+
+/*
+ * Element names with their numbering dropped, so that the hundreds of
+ * decoders of phone_server add up into one stage.
+ */
+static gchar* latencyTracer_stripNumbers(const gchar* name, const gchar* extra){
+	gchar* label = g_strdup (name);
+	gsize length = strlen (label);
+
+	while (length && (g_ascii_isdigit (label[length - 1]) || label[length - 1] == '_')){
+		label[--length] = 0;
+	}
+
+	const gchar* suffix = 0;
+	if (extra){
+		suffix = g_str_has_suffix (label, extra) ? extra : 0;
+	}
+	if (suffix){
+		length -= strlen (suffix);
+		label[length] = 0;
+		while (length && label[length - 1] == '_'){
+			label[--length] = 0;
+		}
+	}
+	return label;
+}
+
+// "send_rtp_sink_0" and "send_rtp_src_0" are both in lane "send_rtp".
+static gchar* latencyTracer_laneName(GstPad* pad){
+	gchar* name = gst_pad_get_name (pad);
+	gchar* lane = latencyTracer_stripNumbers(name,
+		GST_PAD_DIRECTION (pad) == GST_PAD_SRC ? "src" : "sink");
+	g_free (name);
+	return lane;
+}
+
+// Elements named by GStreamer ("ffdec_g7260") are labelled by their factory.
+static gchar* latencyTracer_elementLabel(GstElement* element){
+	gchar* name = gst_element_get_name (element);
+	GstElementFactory* factory = gst_element_get_factory (element);
+	gchar* label = 0;
+
+	if (factory){
+		const gchar* factoryName = GST_PLUGIN_FEATURE_NAME (factory);
+		const gchar* rest = name + strlen (factoryName);
+		if (g_str_has_prefix (name, factoryName) && *rest && strspn (rest, "0123456789") == strlen (rest)){
+			label = g_strdup (factoryName);
+		}
+	}
+
+	if (!label){
+		label = latencyTracer_stripNumbers(name, 0);
+	}
+	g_free (name);
+	return label;
+}
+
+static void latencyTracer_freeLane(gpointer data){
+	LatencyTracerLane* lane = (LatencyTracerLane*) data;
+	g_mutex_free (lane->lock);
+	g_free (lane->name);
+	g_free (lane);
+}
+
+static LatencyTracerLane* latencyTracer_getLane(LatencyTracerElement* traced, const gchar* name){
+	g_mutex_lock (traced->lock);
+
+	LatencyTracerLane* lane = g_hash_table_lookup (traced->lanes, name);
+	if (!lane){
+		lane = g_new0 (LatencyTracerLane, 1);
+		lane->owner = traced;
+		lane->name  = g_strdup (name);
+		lane->lock  = g_mutex_new ();
+
+		gchar* stageName = *name
+			? g_strdup_printf ("%s %s", traced->label, name)
+			: g_strdup (traced->label);
+		lane->stage = latencyTracer_getStage(stageName);
+		g_free (stageName);
+
+		g_hash_table_insert (traced->lanes, lane->name, lane);
+	}
+
+	g_mutex_unlock (traced->lock);
+	return lane;
+}
+
+static void latencyTracer_freeElement(gpointer data){
+	LatencyTracerElement* traced = (LatencyTracerElement*) data;
+	g_hash_table_destroy (traced->lanes);
+	g_mutex_free (traced->lock);
+	g_free (traced->label);
+	g_free (traced);
+}
+
+static GstClockTimeDiff latencyTracer_age(GstElement* element, GstBuffer* buffer){
+	GstClock* clock = GST_ELEMENT_CLOCK (element);
+	if (!clock || !GST_BUFFER_TIMESTAMP_IS_VALID (buffer)){
+		return -1;
+	}
+
+	GstClockTime now = gst_clock_get_time (clock);
+	return GST_CLOCK_DIFF (GST_ELEMENT_CAST (element)->base_time + GST_BUFFER_TIMESTAMP (buffer), now);
+}
+
+static gboolean latencyTracer_sinkProbe(GstPad* pad, GstBuffer* buffer, gpointer data){
+	LatencyTracerLane* lane = (LatencyTracerLane*) data;
+
+	if (!GST_BUFFER_TIMESTAMP_IS_VALID (buffer)){
+		return TRUE;
+	}
+
+	g_mutex_lock (lane->lock);
+	lane->timestamps[lane->next] = GST_BUFFER_TIMESTAMP (buffer);
+	lane->arrivals[lane->next]   = gst_util_get_timestamp ();
+	lane->next = (lane->next + 1) % LATENCY_TRACER_RING;
+	lane->fed  = TRUE;
+	g_mutex_unlock (lane->lock);
+
+	if (lane->owner->sink){
+		latencyTracer_record(&lane->stage->age, latencyTracer_age(lane->owner->element, buffer));
+	}
+	return TRUE;
+}
+
+/*
+ * The buffer leaving is matched with the buffer of the nearest timestamp
+ * that entered on the same lane, or on the element's plain sink pads when
+ * the lane has no input of its own (the mix-minus outputs of a mixer).
+ */
+static gboolean latencyTracer_srcProbe(GstPad* pad, GstBuffer* buffer, gpointer data){
+	LatencyTracerLane* lane = (LatencyTracerLane*) data;
+	LatencyTracerElement* traced = lane->owner;
+
+	if (!GST_BUFFER_TIMESTAMP_IS_VALID (buffer)){
+		return TRUE;
+	}
+
+	latencyTracer_record(&lane->stage->age, latencyTracer_age(traced->element, buffer));
+
+	LatencyTracerLane* input = lane;
+	if (!lane->fed){
+		g_mutex_lock (traced->lock);
+		input = g_hash_table_lookup (traced->lanes, "");
+		g_mutex_unlock (traced->lock);
+	}
+	if (!input || !input->fed){
+		return TRUE;
+	}
+
+	GstClockTime timestamp = GST_BUFFER_TIMESTAMP (buffer);
+	GstClockTime arrival   = GST_CLOCK_TIME_NONE;
+	GstClockTime distance  = GST_CLOCK_TIME_NONE;
+	guint i;
+
+	g_mutex_lock (input->lock);
+	for (i = 0; i < LATENCY_TRACER_RING; i++){
+		if (!input->arrivals[i]){
+			continue;
+		}
+		GstClockTime d = timestamp > input->timestamps[i]
+			? timestamp - input->timestamps[i]
+			: input->timestamps[i] - timestamp;
+		if (d < distance){
+			distance = d;
+			arrival  = input->arrivals[i];
+		}
+	}
+	g_mutex_unlock (input->lock);
+
+	if (GST_CLOCK_TIME_IS_VALID (arrival)){
+		latencyTracer_record(&lane->stage->residence, GST_CLOCK_DIFF (arrival, gst_util_get_timestamp ()));
+	}
+	return TRUE;
+}
+
+static void latencyTracer_tracePad(GstElement* element, GstPad* pad, gpointer data){
+	LatencyTracerElement* traced = (LatencyTracerElement*) data;
+
+	gchar* name = latencyTracer_laneName(pad);
+	LatencyTracerLane* lane = latencyTracer_getLane(traced, name);
+	g_free (name);
+
+	gst_pad_add_buffer_probe (pad, GST_PAD_DIRECTION (pad) == GST_PAD_SRC
+			? G_CALLBACK (latencyTracer_srcProbe)
+			: G_CALLBACK (latencyTracer_sinkProbe), lane);
+}
+
+static void latencyTracer_traceExistingPad(gpointer item, gpointer data){
+	GstPad* pad = GST_PAD (item);
+	latencyTracer_tracePad(GST_PAD_PARENT (pad), pad, data);
+	gst_object_unref (pad);
+}
+
+static gboolean latencyTracer_hasSrcTemplate(GstElement* element){
+	GList* templates = gst_element_class_get_pad_template_list (GST_ELEMENT_GET_CLASS (element));
+	for (; templates; templates = templates->next){
+		if (GST_PAD_TEMPLATE_DIRECTION (templates->data) == GST_PAD_SRC){
+			return TRUE;
+		}
+	}
+	return FALSE;
+}
+
+static void latencyTracer_elementAdded(GstBin* bin, GstElement* element, gpointer data){
+	latencyTracer_traceElement(element);
+}
+
+static void latencyTracer_traceChild(gpointer item, gpointer data){
+	latencyTracer_traceElement(GST_ELEMENT (item));
+	gst_object_unref (item);
+}
+
+/*
+ * A pooled bin is added to the pipeline again on every join, so it is only
+ * watched the first time; a second handler per rejoin would pile up.
+ */
+static void latencyTracer_traceBin(GstBin* bin){
+	if (g_object_get_data (G_OBJECT (bin), "latency-tracer")){
+		return;
+	}
+	g_object_set_data (G_OBJECT (bin), "latency-tracer", bin);
+
+	g_signal_connect (bin, "element-added", G_CALLBACK (latencyTracer_elementAdded), NULL);
+
+	GstIterator* children = gst_bin_iterate_elements (bin);
+	gst_iterator_foreach (children, latencyTracer_traceChild, NULL);
+	gst_iterator_free (children);
+}
+
+static void latencyTracer_traceElement(GstElement* element){
+	if (G_OBJECT_TYPE (element) == GST_TYPE_BIN){
+		latencyTracer_traceBin(GST_BIN (element));
+		return;
+	}
+
+	if (g_object_get_data (G_OBJECT (element), "latency-tracer")){
+		return;
+	}
+
+	LatencyTracerElement* traced = g_new0 (LatencyTracerElement, 1);
+
+	traced->element = element;
+	traced->label   = latencyTracer_elementLabel(element);
+	traced->sink    = !element->numsrcpads && !latencyTracer_hasSrcTemplate(element);
+	traced->lock    = g_mutex_new ();
+	traced->lanes   = g_hash_table_new_full (g_str_hash, g_str_equal, NULL, latencyTracer_freeLane);
+
+	g_object_set_data_full (G_OBJECT (element), "latency-tracer", traced, latencyTracer_freeElement);
+
+	// The default lane always exists, so stages print in pipeline order.
+	latencyTracer_getLane(traced, "");
+
+	g_signal_connect (element, "pad-added", G_CALLBACK (latencyTracer_tracePad), traced);
+
+	GstIterator* pads = gst_element_iterate_pads (element);
+	gst_iterator_foreach (pads, latencyTracer_traceExistingPad, traced);
+	gst_iterator_free (pads);
+}
+
+static void latencyTracer_printHistogram(LatencyHistogram* histogram){
+	if (!g_atomic_int_get (&histogram->count)){
+		g_print ("  %8s %8s %8s", "-", "-", "-");
+		return;
+	}
+	g_print ("  %8.2f %8.2f %8.2f",
+		latencyTracer_percentileMs(histogram, 0.5),
+		latencyTracer_percentileMs(histogram, 0.99),
+		g_atomic_int_get (&histogram->maxUs) / 1000.0);
+}
+
+void latencyTracer_dump(){
+	if (!latencyTracer_enabled){
+		return;
+	}
+
+	g_mutex_lock (latencyTracer_lock);
+
+	g_print ("Latency per stage, ms:\n");
+	g_print ("\t%-28s  %26s  %26s\n", "", "residence p50/p99/max", "age p50/p99/max");
+
+	guint i;
+	for (i = 0; i < latencyTracer_stages->len; i++){
+		LatencyStage* stage = g_ptr_array_index (latencyTracer_stages, i);
+		if (!stage->residence.count && !stage->age.count){
+			continue;
+		}
+		g_print ("\t%-28s", stage->name);
+		latencyTracer_printHistogram(&stage->residence);
+		latencyTracer_printHistogram(&stage->age);
+		g_print ("\n");
+	}
+
+	g_mutex_unlock (latencyTracer_lock);
+}
+
+static gboolean latencyTracer_onSignal(gpointer data){
+	int signal = GPOINTER_TO_INT (data);
+
+	latencyTracer_dump();
+
+	if (signal != SIGUSR1){
+		exit (128 + signal);
+	}
+	return TRUE;
+}
+
+/*
+ * Traces the pipeline when LATENCY_TRACE is set, does nothing otherwise.
+ * Must be called from the main thread, after gst_init(); signals are
+ * handled on the default main context.
+ */
+void latencyTracer_attach(GstElement* pipeline){
+	const gchar* setting = g_getenv (LATENCY_TRACER_ENV);
+	if (!setting || !*setting || !strcmp (setting, "0")){
+		return;
+	}
+
+	if (!latencyTracer_enabled){
+		latencyTracer_enabled      = TRUE;
+		latencyTracer_lock         = g_mutex_new ();
+		latencyTracer_stages       = g_ptr_array_new ();
+		latencyTracer_stagesByName = g_hash_table_new (g_str_hash, g_str_equal);
+
+		g_unix_signal_add (SIGINT,  latencyTracer_onSignal, GINT_TO_POINTER (SIGINT));
+		g_unix_signal_add (SIGTERM, latencyTracer_onSignal, GINT_TO_POINTER (SIGTERM));
+#if GLIB_CHECK_VERSION (2, 36, 0)
+		g_unix_signal_add (SIGUSR1, latencyTracer_onSignal, GINT_TO_POINTER (SIGUSR1));
+#endif
+
+		g_print ("Latency tracing is on.\n");
+	}
+
+	latencyTracer_traceBin(GST_BIN (pipeline));
+}
+
+#endif
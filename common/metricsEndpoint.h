@@ -0,0 +1,506 @@
+#ifndef METRICS_ENDPOINT_H
+#define METRICS_ENDPOINT_H
+
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <gst/gst.h>
+
+/*
+ * A Prometheus text format endpoint on loopback HTTP.
+ *
+ * metricsEndpoint_start() listens on 127.0.0.1 and serves every GET from
+ * the default main context: the program's collect function is called then,
+ * so nothing is polled between scrapes and streaming threads never wait on
+ * the endpoint. The collect function reads what the pipeline already keeps
+ * (rtpbin source stats, element properties) and the counters below, which
+ * streaming threads update with atomic adds only.
+ */
+
+#define METRICS_REQUEST_MAX 8192
+
+typedef struct {
+	GPtrArray* families;
+	GHashTable* byName;
+} MetricsSnapshot;
+
+typedef struct {
+	gchar* name;
+	GString* text;
+} MetricsFamily;
+
+typedef struct {
+	MetricsSnapshot* snapshot;
+	const gchar* labels;
+} MetricsSampleContext;
+
+typedef void (*MetricsCollectFunc) (MetricsSnapshot* snapshot, gpointer data);
+
+// Packets and bytes through a pad.
+typedef struct {
+	volatile guint64 packets;
+	volatile guint64 bytes;
+} MetricsTraffic;
+
+// Thread CPU time spent in one or more elements.
+typedef struct {
+	volatile guint64 ns;
+} MetricsCpu;
+
+typedef struct {
+	MetricsCpu* total;
+	guint64 start;
+} MetricsCpuProbe;
+
+// RTP timestamps at a jitterbuffer's input and output, and their clock rate.
+typedef struct {
+	volatile guint32 ssrc;
+	volatile guint32 in;
+	volatile guint32 out;
+	volatile gint clockRate;
+	volatile gint started;
+	gint payload;
+} MetricsJitterbuffer;
+
+typedef struct {
+	int fd;
+	GString* request;
+	GString* response;
+	gsize sent;
+} MetricsClient;
+
+static int metricsEndpoint_fd = -1;
+static MetricsCollectFunc metricsEndpoint_collect;
+static gpointer metricsEndpoint_data;
+
+/*
+ * Adds one sample. The family's HELP and TYPE lines are written the first
+ * time it is seen, so that samples of one family stay together whatever
+ * order they are collected in. Labels come preformatted: room="9559".
+ */
+void metrics_add(MetricsSnapshot* snapshot, const gchar* name, const gchar* type, const gchar* help, const gchar* labels, gdouble value){
+	MetricsFamily* family = g_hash_table_lookup (snapshot->byName, name);
+	if (!family){
+		family = g_new0 (MetricsFamily, 1);
+		family->name = g_strdup (name);
+		family->text = g_string_new (NULL);
+		g_string_append_printf (family->text, "# HELP %s %s\n# TYPE %s %s\n", name, help, name, type);
+		g_hash_table_insert (snapshot->byName, family->name, family);
+		g_ptr_array_add (snapshot->families, family);
+	}
+
+	gchar number[G_ASCII_DTOSTR_BUF_SIZE];
+	g_ascii_formatd (number, sizeof (number), "%.15g", value);
+
+	if (labels && *labels){
+		g_string_append_printf (family->text, "%s{%s} %s\n", name, labels, number);
+	} else {
+		g_string_append_printf (family->text, "%s %s\n", name, number);
+	}
+}
+
+static GString* metrics_render(){
+	MetricsSnapshot snapshot;
+	snapshot.families = g_ptr_array_new ();
+	snapshot.byName   = g_hash_table_new (g_str_hash, g_str_equal);
+
+	metricsEndpoint_collect(&snapshot, metricsEndpoint_data);
+
+	GString* text = g_string_new (NULL);
+	guint i;
+	for (i = 0; i < snapshot.families->len; i++){
+		MetricsFamily* family = g_ptr_array_index (snapshot.families, i);
+		g_string_append_len (text, family->text->str, family->text->len);
+		g_string_free (family->text, TRUE);
+		g_free (family->name);
+		g_free (family);
+	}
+
+	g_ptr_array_free (snapshot.families, TRUE);
+	g_hash_table_destroy (snapshot.byName);
+	return text;
+}
+
+static gboolean metrics_trafficProbe(GstPad* pad, GstBuffer* buffer, gpointer data){
+	MetricsTraffic* traffic = (MetricsTraffic*) data;
+	__sync_fetch_and_add (&traffic->packets, 1);
+	__sync_fetch_and_add (&traffic->bytes, GST_BUFFER_SIZE (buffer));
+	return TRUE;
+}
+
+// The counters must outlive the pad.
+void metrics_countTraffic(GstPad* pad, MetricsTraffic* traffic){
+	gst_pad_add_buffer_probe (pad, G_CALLBACK (metrics_trafficProbe), traffic);
+}
+
+static guint64 metrics_threadCpuNs(){
+	struct timespec now;
+	clock_gettime (CLOCK_THREAD_CPUTIME_ID, &now);
+	return (guint64) now.tv_sec * GST_SECOND + now.tv_nsec;
+}
+
+static gboolean metrics_cpuSinkProbe(GstPad* pad, GstBuffer* buffer, gpointer data){
+	((MetricsCpuProbe*) data)->start = metrics_threadCpuNs();
+	return TRUE;
+}
+
+static gboolean metrics_cpuSrcProbe(GstPad* pad, GstBuffer* buffer, gpointer data){
+	MetricsCpuProbe* probe = (MetricsCpuProbe*) data;
+	if (probe->start){
+		__sync_fetch_and_add (&probe->total->ns, metrics_threadCpuNs() - probe->start);
+		probe->start = 0;
+	}
+	return TRUE;
+}
+
+/*
+ * Adds the CPU time of a one-in, one-out element (an encoder) to total:
+ * from a buffer entering its sink pad to its output leaving the source pad,
+ * which happens inside the same chain call, on the same thread.
+ */
+void metrics_countCpu(GstElement* element, MetricsCpu* total){
+	MetricsCpuProbe* probe = g_new0 (MetricsCpuProbe, 1);
+	probe->total = total;
+	g_object_set_data_full (G_OBJECT (element), "metrics-cpu", probe, g_free);
+
+	GstPad* sinkpad = gst_element_get_static_pad (element, "sink");
+	GstPad* srcpad  = gst_element_get_static_pad (element, "src");
+	gst_pad_add_buffer_probe (sinkpad, G_CALLBACK (metrics_cpuSinkProbe), probe);
+	gst_pad_add_buffer_probe (srcpad,  G_CALLBACK (metrics_cpuSrcProbe),  probe);
+	gst_object_unref (sinkpad);
+	gst_object_unref (srcpad);
+}
+
+/*
+ * The clock rate of a payload type, looked up the way the jitterbuffer
+ * does: from the buffer's caps, else through rtpbin's pt map. 0 if unknown.
+ */
+static gint metrics_rtpClockRate(GstElement* element, GstBuffer* buffer, guint payload){
+	gint clockRate = 0, capsPayload = -1;
+	GstCaps* caps = GST_BUFFER_CAPS (buffer);
+	if (caps && gst_caps_get_size (caps)){
+		GstStructure* structure = gst_caps_get_structure (caps, 0);
+		gst_structure_get_int (structure, "payload", &capsPayload);
+		if (capsPayload == (gint) payload){
+			gst_structure_get_int (structure, "clock-rate", &clockRate);
+		}
+	}
+	if (clockRate > 0){
+		return clockRate;
+	}
+
+	caps = 0;
+	g_signal_emit_by_name (element, "request-pt-map", payload, &caps);
+	if (caps){
+		gst_structure_get_int (gst_caps_get_structure (caps, 0), "clock-rate", &clockRate);
+		gst_caps_unref (caps);
+	}
+	return MAX (clockRate, 0);
+}
+
+static gboolean metrics_jitterbufferSinkProbe(GstPad* pad, GstBuffer* buffer, gpointer data){
+	MetricsJitterbuffer* jitterbuffer = (MetricsJitterbuffer*) data;
+	if (GST_BUFFER_SIZE (buffer) < 12){
+		return TRUE;
+	}
+
+	guint payload = GST_BUFFER_DATA (buffer)[1] & 0x7f;
+	if ((gint) payload != jitterbuffer->payload){
+		jitterbuffer->payload = payload;
+		g_atomic_int_set (&jitterbuffer->clockRate, metrics_rtpClockRate(GST_PAD_PARENT (pad), buffer, payload));
+	}
+	jitterbuffer->in   = GST_READ_UINT32_BE (GST_BUFFER_DATA (buffer) + 4);
+	jitterbuffer->ssrc = GST_READ_UINT32_BE (GST_BUFFER_DATA (buffer) + 8);
+	return TRUE;
+}
+
+static gboolean metrics_jitterbufferSrcProbe(GstPad* pad, GstBuffer* buffer, gpointer data){
+	MetricsJitterbuffer* jitterbuffer = (MetricsJitterbuffer*) data;
+	if (GST_BUFFER_SIZE (buffer) < 12){
+		return TRUE;
+	}
+	jitterbuffer->out = GST_READ_UINT32_BE (GST_BUFFER_DATA (buffer) + 4);
+	g_atomic_int_set (&jitterbuffer->started, TRUE);
+	return TRUE;
+}
+
+static void metrics_rtpBinElementAdded(GstBin* bin, GstElement* element, gpointer data){
+	GstElementFactory* factory = gst_element_get_factory (element);
+	if (!factory || strcmp (GST_PLUGIN_FEATURE_NAME (factory), "gstrtpjitterbuffer")){
+		return;
+	}
+
+	MetricsJitterbuffer* jitterbuffer = g_new0 (MetricsJitterbuffer, 1);
+	jitterbuffer->payload = -1;
+	g_object_set_data_full (G_OBJECT (element), "metrics-jitterbuffer", jitterbuffer, g_free);
+
+	GstPad* sinkpad = gst_element_get_static_pad (element, "sink");
+	GstPad* srcpad  = gst_element_get_static_pad (element, "src");
+	gst_pad_add_buffer_probe (sinkpad, G_CALLBACK (metrics_jitterbufferSinkProbe), jitterbuffer);
+	gst_pad_add_buffer_probe (srcpad,  G_CALLBACK (metrics_jitterbufferSrcProbe),  jitterbuffer);
+	gst_object_unref (sinkpad);
+	gst_object_unref (srcpad);
+}
+
+/*
+ * Watches the jitterbuffers rtpbin creates for every sender. Their depth is
+ * the RTP time between the newest packet in and the last one out, which
+ * lost and dropped packets do not skew, at the clock rate of the newest
+ * packet's payload type. Call before the pipeline starts.
+ */
+void metrics_watchJitterbuffers(GstElement* rtpbin){
+	g_signal_connect (rtpbin, "element-added", G_CALLBACK (metrics_rtpBinElementAdded), NULL);
+}
+
+static void metrics_addJitterbuffer(gpointer item, gpointer data){
+	GstElement* element = GST_ELEMENT (item);
+	MetricsJitterbuffer* jitterbuffer = g_object_get_data (G_OBJECT (element), "metrics-jitterbuffer");
+
+	if (jitterbuffer && g_atomic_int_get (&jitterbuffer->started)){
+		MetricsSampleContext* context = (MetricsSampleContext*) data;
+
+		gint32 depth = (gint32) (jitterbuffer->in - jitterbuffer->out);
+		gint clockRate = g_atomic_int_get (&jitterbuffer->clockRate);
+		gchar* sampleLabels = g_strdup_printf ("%s%sparticipant=\"%u\"",
+			context->labels, *context->labels ? "," : "", jitterbuffer->ssrc);
+		if (clockRate > 0){
+			metrics_add(context->snapshot, "phone_jitterbuffer_depth_seconds", "gauge",
+				"RTP time queued in the participant's jitterbuffer", sampleLabels,
+				(gdouble) MAX (depth, 0) / clockRate);
+		}
+
+		guint latencyMs = 0;
+		g_object_get (G_OBJECT (element), "latency", &latencyMs, NULL);
+		metrics_add(context->snapshot, "phone_jitterbuffer_latency_seconds", "gauge",
+			"Playout delay the participant's jitterbuffer is set to", sampleLabels,
+			latencyMs / 1000.0);
+		g_free (sampleLabels);
+	}
+	gst_object_unref (element);
+}
+
+void metrics_collectJitterbuffers(MetricsSnapshot* snapshot, GstElement* rtpbin, const gchar* labels){
+	MetricsSampleContext context = { snapshot, labels };
+
+	GstIterator* children = gst_bin_iterate_elements (GST_BIN (rtpbin));
+	gst_iterator_foreach (children, metrics_addJitterbuffer, &context);
+	gst_iterator_free (children);
+}
+
+static guint64 metrics_structureUint64(const GstStructure* structure, const gchar* field){
+	guint64 value = 0;
+	gst_structure_get_uint64 (structure, field, &value);
+	return value;
+}
+
+/*
+ * Per participant receive stats from rtpbin's session: one set of samples
+ * per remote source, labelled with its SSRC. The session's own sender is
+ * reported as participant "all", as its packets go to everyone.
+ */
+void metrics_collectRtpSession(MetricsSnapshot* snapshot, GstElement* rtpbin, guint sessionId, const gchar* labels){
+	GObject* session = 0;
+	g_signal_emit_by_name (rtpbin, "get-internal-session", sessionId, &session);
+	if (!session){
+		return;
+	}
+
+	GValueArray* sources = 0;
+	g_object_get (session, "sources", &sources, NULL);
+
+	guint i;
+	for (i = 0; sources && i < sources->n_values; i++){
+		GObject* source = g_value_get_object (g_value_array_get_nth (sources, i));
+		GstStructure* stats = 0;
+		g_object_get (source, "stats", &stats, NULL);
+		if (!stats){
+			continue;
+		}
+
+		guint ssrc = 0;
+		gboolean internal = FALSE, sender = FALSE;
+		gst_structure_get_uint (stats, "ssrc", &ssrc);
+		gst_structure_get_boolean (stats, "internal", &internal);
+		gst_structure_get_boolean (stats, "is-sender", &sender);
+
+		const gchar* separator = *labels ? "," : "";
+
+		if (internal){
+			if (sender){
+				gchar* sampleLabels = g_strdup_printf ("%s%sparticipant=\"all\"", labels, separator);
+				metrics_add(snapshot, "phone_rtp_packets_sent_total", "counter",
+					"RTP packets sent to the participant", sampleLabels,
+					metrics_structureUint64(stats, "packets-sent"));
+				metrics_add(snapshot, "phone_rtp_bytes_sent_total", "counter",
+					"RTP payload bytes sent to the participant", sampleLabels,
+					metrics_structureUint64(stats, "octets-sent"));
+				g_free (sampleLabels);
+			}
+			gst_structure_free (stats);
+			continue;
+		}
+
+		gint lost = 0, clockRate = 0;
+		guint jitter = 0;
+		gst_structure_get_int (stats, "packets-lost", &lost);
+		gst_structure_get_int (stats, "clock-rate", &clockRate);
+		gst_structure_get_uint (stats, "jitter", &jitter);
+
+		gchar* sampleLabels = g_strdup_printf ("%s%sparticipant=\"%u\"", labels, separator, ssrc);
+		metrics_add(snapshot, "phone_rtp_packets_received_total", "counter",
+			"RTP packets received from the participant", sampleLabels,
+			metrics_structureUint64(stats, "packets-received"));
+		metrics_add(snapshot, "phone_rtp_bytes_received_total", "counter",
+			"RTP payload bytes received from the participant", sampleLabels,
+			metrics_structureUint64(stats, "octets-received"));
+		metrics_add(snapshot, "phone_rtp_packets_lost", "gauge",
+			"Packets lost from the participant, as RTP counts it", sampleLabels, lost);
+		metrics_add(snapshot, "phone_rtp_jitter_seconds", "gauge",
+			"Interarrival jitter of the participant's stream", sampleLabels,
+			clockRate > 0 ? (gdouble) jitter / clockRate : 0);
+		g_free (sampleLabels);
+
+		gst_structure_free (stats);
+	}
+
+	if (sources){
+		g_value_array_free (sources);
+	}
+	g_object_unref (session);
+}
+
+static void metricsEndpoint_closeClient(MetricsClient* client){
+	close (client->fd);
+	g_string_free (client->request, TRUE);
+	if (client->response){
+		g_string_free (client->response, TRUE);
+	}
+	g_free (client);
+}
+
+static gboolean metricsEndpoint_writeClient(GIOChannel* channel, GIOCondition condition, gpointer data){
+	MetricsClient* client = (MetricsClient*) data;
+
+	while (client->sent < client->response->len){
+		ssize_t written = send (client->fd, client->response->str + client->sent,
+			client->response->len - client->sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+		if (written < 0){
+			if (errno == EAGAIN || errno == EINTR){
+				return TRUE;
+			}
+			break;
+		}
+		client->sent += written;
+	}
+
+	metricsEndpoint_closeClient(client);
+	return FALSE;
+}
+
+static void metricsEndpoint_respond(MetricsClient* client){
+	gboolean found = g_str_has_prefix (client->request->str, "GET /metrics ")
+		|| g_str_has_prefix (client->request->str, "GET / ");
+
+	GString* body = found ? metrics_render() : g_string_new ("Not found\n");
+
+	client->response = g_string_new (NULL);
+	g_string_append_printf (client->response,
+		"HTTP/1.0 %s\r\n"
+		"Content-Type: text/plain; version=0.0.4\r\n"
+		"Content-Length: %" G_GSIZE_FORMAT "\r\n"
+		"Connection: close\r\n\r\n",
+		found ? "200 OK" : "404 Not Found", body->len);
+	g_string_append_len (client->response, body->str, body->len);
+	g_string_free (body, TRUE);
+
+	GIOChannel* channel = g_io_channel_unix_new (client->fd);
+	g_io_add_watch (channel, G_IO_OUT | G_IO_ERR | G_IO_HUP, metricsEndpoint_writeClient, client);
+	g_io_channel_unref (channel);
+}
+
+// Reads until the end of the request headers; the body, if any, is ignored.
+static gboolean metricsEndpoint_readClient(GIOChannel* channel, GIOCondition condition, gpointer data){
+	MetricsClient* client = (MetricsClient*) data;
+	gchar chunk[1024];
+
+	ssize_t count = recv (client->fd, chunk, sizeof (chunk), MSG_DONTWAIT);
+	if (count < 0 && (errno == EAGAIN || errno == EINTR)){
+		return TRUE;
+	}
+	if (count <= 0 || client->request->len + count > METRICS_REQUEST_MAX){
+		metricsEndpoint_closeClient(client);
+		return FALSE;
+	}
+
+	g_string_append_len (client->request, chunk, count);
+	if (!strstr (client->request->str, "\r\n\r\n") && !strstr (client->request->str, "\n\n")){
+		return TRUE;
+	}
+
+	metricsEndpoint_respond(client);
+	return FALSE;
+}
+
+static gboolean metricsEndpoint_accept(GIOChannel* channel, GIOCondition condition, gpointer data){
+	int fd = accept (metricsEndpoint_fd, NULL, NULL);
+	if (fd < 0){
+		return TRUE;
+	}
+	fcntl (fd, F_SETFL, fcntl (fd, F_GETFL) | O_NONBLOCK);
+
+	MetricsClient* client = g_new0 (MetricsClient, 1);
+	client->fd      = fd;
+	client->request = g_string_new (NULL);
+
+	GIOChannel* clientChannel = g_io_channel_unix_new (fd);
+	g_io_add_watch (clientChannel, G_IO_IN | G_IO_ERR | G_IO_HUP, metricsEndpoint_readClient, client);
+	g_io_channel_unref (clientChannel);
+	return TRUE;
+}
+
+/*
+ * Serves http://127.0.0.1:port/metrics from the default main context.
+ * Returns FALSE when the port cannot be bound.
+ */
+gboolean metricsEndpoint_start(int port, MetricsCollectFunc collect, gpointer data){
+	metricsEndpoint_collect = collect;
+	metricsEndpoint_data    = data;
+
+	metricsEndpoint_fd = socket (AF_INET, SOCK_STREAM, 0);
+	if (metricsEndpoint_fd < 0){
+		return FALSE;
+	}
+
+	int reuse = 1;
+	setsockopt (metricsEndpoint_fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof (reuse));
+
+	struct sockaddr_in address;
+	memset (&address, 0, sizeof (address));
+	address.sin_family      = AF_INET;
+	address.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+	address.sin_port        = htons (port);
+
+	if (bind (metricsEndpoint_fd, (struct sockaddr*) &address, sizeof (address)) != 0
+		|| listen (metricsEndpoint_fd, 16) != 0){
+
+		g_printerr ("Metrics: port %d: %s\n", port, g_strerror (errno));
+		close (metricsEndpoint_fd);
+		metricsEndpoint_fd = -1;
+		return FALSE;
+	}
+	fcntl (metricsEndpoint_fd, F_SETFL, fcntl (metricsEndpoint_fd, F_GETFL) | O_NONBLOCK);
+
+	GIOChannel* channel = g_io_channel_unix_new (metricsEndpoint_fd);
+	g_io_add_watch (channel, G_IO_IN, metricsEndpoint_accept, NULL);
+	g_io_channel_unref (channel);
+
+	g_print ("Metrics on http://127.0.0.1:%d/metrics\n", port);
+	return TRUE;
+}
+
+#endif
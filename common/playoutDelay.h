@@ -0,0 +1,309 @@
+#ifndef PLAYOUT_DELAY_H
+#define PLAYOUT_DELAY_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <gst/gst.h>
+
+#include "rtpDtx.h"
+
+/*
+ * Playout delay of rtpbin's jitterbuffers.
+ *
+ * The setting is either a fixed latency in milliseconds for every
+ * jitterbuffer, or "adaptive". In adaptive mode every participant's
+ * jitterbuffer is sized on its own from what its packets show on arrival:
+ *
+ * - the delay spread: how much later than the earliest packet of the last
+ *   two windows a packet arrives, relative to its RTP timestamp;
+ * - the interarrival jitter, smoothed as RFC 3550 does;
+ * - the loss: gaps in sequence numbers.
+ *
+ * Only media packets sent at the stream's packet time feed the jitter and
+ * the packet time, which pads the delay. Comfort noise packets (see
+ * rtpDtx.h) and the first packet of a talkspurt are contiguous in sequence
+ * but far apart in RTP time, and would make the packet time look like the
+ * silence in between; they still count for the spread and the loss. The
+ * packet time is an RTP step seen on two media packets in a row.
+ *
+ * A packet that arrives later than the current delay allows grows the
+ * delay right away. Once per window the delay is resized to cover the
+ * window's spread and four times the jitter; it is only shrunk after some
+ * windows in a row without loss, and then by a small step per window.
+ *
+ * RTP timestamps are read at the clock rate of the packet's payload type,
+ * found the way the jitterbuffer finds it: from the buffer's caps or else
+ * through its "request-pt-map" signal, once per payload type change. A
+ * payload type without a clock rate is not measured.
+ *
+ * All of it runs in a probe on the jitterbuffer's sink pad, i.e. in the
+ * thread that feeds that jitterbuffer: nothing is shared between
+ * participants and nothing is locked. Every change is printed; the current
+ * value can be read from the jitterbuffer's "latency" property.
+ */
+
+#define PLAYOUT_DELAY_INITIAL_MS       60
+#define PLAYOUT_DELAY_MIN_MS           20
+#define PLAYOUT_DELAY_MAX_MS           500
+#define PLAYOUT_DELAY_WINDOW_MS        1000
+#define PLAYOUT_DELAY_STABLE_WINDOWS   3
+#define PLAYOUT_DELAY_SHRINK_STEP_MS   10
+#define PLAYOUT_DELAY_GUARD_MS         10
+#define PLAYOUT_DELAY_JITTER_FACTOR    4
+#define PLAYOUT_DELAY_MAX_LOSS         0.01
+
+typedef struct {
+	gboolean adaptive;
+	guint latencyMs;
+} PlayoutDelaySetting;
+
+// Arrival time of a packet; gst_util_get_timestamp() outside tests.
+typedef GstClockTime (*PlayoutDelayClockFunc) ();
+
+typedef struct {
+	GstElement* jitterbuffer;
+	PlayoutDelayClockFunc now;
+	gboolean started;
+
+	guint32 ssrc;
+	gint payload;
+	gint clockRate;
+	guint16 lastSeq;
+	guint32 lastTimestamp;
+	guint32 lastStep;
+	gdouble lastTransitMs;
+	gdouble packetMs;
+
+	gdouble jitterMs;
+	gdouble baseTransitMs;
+	gdouble windowMinTransitMs;
+	gdouble previousMinTransitMs;
+	gdouble windowPeakMs;
+	guint windowReceived;
+	guint windowLost;
+	gdouble windowStartMs;
+	guint stableWindows;
+
+	guint latencyMs;
+} PlayoutDelay;
+
+/*
+ * Parses "adaptive" or a latency in milliseconds. Returns FALSE on
+ * anything else.
+ */
+gboolean playoutDelay_parse(const gchar* text, PlayoutDelaySetting* setting){
+	if (!strcmp (text, "adaptive")){
+		setting->adaptive  = TRUE;
+		setting->latencyMs = PLAYOUT_DELAY_INITIAL_MS;
+		return TRUE;
+	}
+
+	gchar* end = 0;
+	long latencyMs = strtol (text, &end, 10);
+	if (end == text || *end || latencyMs < 0 || latencyMs > G_MAXINT){
+		return FALSE;
+	}
+
+	setting->adaptive  = FALSE;
+	setting->latencyMs = latencyMs;
+	return TRUE;
+}
+
+static void playoutDelay_set(PlayoutDelay* delay, gdouble latencyMs){
+	guint clamped = CLAMP ((guint) ceil (latencyMs), PLAYOUT_DELAY_MIN_MS, PLAYOUT_DELAY_MAX_MS);
+	if (clamped == delay->latencyMs){
+		return;
+	}
+
+	g_print ("Participant %u: playout delay %u ms (jitter %.1f ms, spread %.1f ms, lost %u of %u).\n",
+		delay->ssrc, clamped, delay->jitterMs, delay->windowPeakMs,
+		delay->windowLost, delay->windowReceived + delay->windowLost);
+
+	delay->latencyMs = clamped;
+	g_object_set (G_OBJECT (delay->jitterbuffer), "latency", clamped, NULL);
+}
+
+static gdouble playoutDelay_guardMs(PlayoutDelay* delay){
+	return MAX (delay->packetMs, PLAYOUT_DELAY_GUARD_MS);
+}
+
+static void playoutDelay_endWindow(PlayoutDelay* delay, gdouble nowMs){
+	guint expected = delay->windowReceived + delay->windowLost;
+	gboolean lossy = expected && (gdouble) delay->windowLost / expected > PLAYOUT_DELAY_MAX_LOSS;
+
+	gdouble targetMs = MAX (delay->windowPeakMs, PLAYOUT_DELAY_JITTER_FACTOR * delay->jitterMs)
+		+ playoutDelay_guardMs(delay);
+
+	if (targetMs > delay->latencyMs){
+		delay->stableWindows = 0;
+		playoutDelay_set(delay, targetMs);
+	} else if (lossy){
+		delay->stableWindows = 0;
+	} else if (++delay->stableWindows >= PLAYOUT_DELAY_STABLE_WINDOWS){
+		playoutDelay_set(delay, MAX (targetMs, (gdouble) delay->latencyMs - PLAYOUT_DELAY_SHRINK_STEP_MS));
+	}
+
+	// The spread is measured against the earliest transit of this window
+	// and the previous one, so a slowly drifting clock cannot build it up.
+	delay->baseTransitMs        = MIN (delay->windowMinTransitMs, delay->previousMinTransitMs);
+	delay->previousMinTransitMs = delay->windowMinTransitMs;
+	delay->windowMinTransitMs   = G_MAXDOUBLE;
+	delay->windowPeakMs         = 0;
+	delay->windowReceived       = 0;
+	delay->windowLost           = 0;
+	delay->windowStartMs        = nowMs;
+}
+
+static void playoutDelay_start(PlayoutDelay* delay, guint16 seq, guint32 timestamp, gdouble transitMs, gdouble nowMs){
+	delay->started              = TRUE;
+	delay->lastSeq              = seq;
+	delay->lastTimestamp        = timestamp;
+	delay->lastTransitMs        = transitMs;
+	delay->baseTransitMs        = transitMs;
+	delay->windowMinTransitMs   = transitMs;
+	delay->previousMinTransitMs = transitMs;
+	delay->windowStartMs        = nowMs;
+	delay->windowReceived       = 1;
+}
+
+/*
+ * The clock rate of payload type payload: from the buffer's caps, else as
+ * rtpbin maps it for the jitterbuffer. 0 when neither knows it.
+ */
+static gint playoutDelay_clockRate(GstElement* jitterbuffer, GstBuffer* buffer, guint payload){
+	gint clockRate = 0;
+	GstCaps* caps = GST_BUFFER_CAPS (buffer);
+	gint capsPayload = -1;
+	if (caps && gst_caps_get_size (caps)){
+		GstStructure* structure = gst_caps_get_structure (caps, 0);
+		gst_structure_get_int (structure, "payload", &capsPayload);
+		if (capsPayload == (gint) payload){
+			gst_structure_get_int (structure, "clock-rate", &clockRate);
+		}
+	}
+	if (clockRate > 0){
+		return clockRate;
+	}
+
+	caps = 0;
+	g_signal_emit_by_name (jitterbuffer, "request-pt-map", payload, &caps);
+	if (caps){
+		gst_structure_get_int (gst_caps_get_structure (caps, 0), "clock-rate", &clockRate);
+		gst_caps_unref (caps);
+	}
+	return MAX (clockRate, 0);
+}
+
+static gboolean playoutDelay_sinkProbe(GstPad* pad, GstBuffer* buffer, gpointer data){
+	PlayoutDelay* delay = (PlayoutDelay*) data;
+	if (GST_BUFFER_SIZE (buffer) < 12){
+		return TRUE;
+	}
+
+	const guint8* header = GST_BUFFER_DATA (buffer);
+	guint payload     = header[1] & 0x7f;
+	guint16 seq       = GST_READ_UINT16_BE (header + 2);
+	guint32 timestamp = GST_READ_UINT32_BE (header + 4);
+	delay->ssrc       = GST_READ_UINT32_BE (header + 8);
+
+	if ((gint) payload != delay->payload){
+		delay->payload   = payload;
+		delay->clockRate = playoutDelay_clockRate(delay->jitterbuffer, buffer, payload);
+	}
+	if (!delay->clockRate){
+		return TRUE;
+	}
+
+	// Transit time up to an unknown constant: arrival minus RTP time.
+	gdouble nowMs     = delay->now () / (gdouble) GST_MSECOND;
+	gdouble transitMs = nowMs - timestamp * 1000.0 / delay->clockRate;
+
+	if (!delay->started){
+		playoutDelay_start(delay, seq, timestamp, transitMs, nowMs);
+		return TRUE;
+	}
+
+	guint16 seqDelta = seq - delay->lastSeq;
+	if (seqDelta == 0 || seqDelta >= 0x8000){
+		// A duplicate or a reordered packet: it was counted as lost when
+		// the gap opened, but its lateness still counts below.
+		if (delay->windowLost && seqDelta){
+			delay->windowLost--;
+			delay->windowReceived++;
+		}
+	} else {
+		delay->windowLost     += seqDelta - 1;
+		delay->windowReceived += 1;
+
+		if (!rtpDtx_isComfortNoisePayload(payload)){
+			guint32 step = (timestamp - delay->lastTimestamp) / seqDelta;
+			if (step == delay->lastStep){
+				delay->packetMs = step * 1000.0 / delay->clockRate;
+			}
+			if (step * 1000.0 / delay->clockRate <= delay->packetMs){
+				delay->jitterMs += (fabs (transitMs - delay->lastTransitMs) - delay->jitterMs) / 16;
+			}
+			delay->lastStep = step;
+		}
+
+		delay->lastSeq       = seq;
+		delay->lastTimestamp = timestamp;
+		delay->lastTransitMs = transitMs;
+	}
+
+	delay->windowMinTransitMs = MIN (delay->windowMinTransitMs, transitMs);
+	delay->baseTransitMs      = MIN (delay->baseTransitMs, transitMs);
+
+	gdouble spreadMs = transitMs - delay->baseTransitMs;
+	delay->windowPeakMs = MAX (delay->windowPeakMs, spreadMs);
+
+	// Late for the current delay: grow now rather than at the window's end.
+	gdouble guardMs = playoutDelay_guardMs(delay);
+	if (spreadMs + guardMs > delay->latencyMs){
+		delay->stableWindows = 0;
+		playoutDelay_set(delay, spreadMs + 2 * guardMs);
+	}
+
+	if (nowMs - delay->windowStartMs >= PLAYOUT_DELAY_WINDOW_MS){
+		playoutDelay_endWindow(delay, nowMs);
+	}
+	return TRUE;
+}
+
+static void playoutDelay_rtpBinElementAdded(GstBin* bin, GstElement* element, gpointer data){
+	GstElementFactory* factory = gst_element_get_factory (element);
+	if (!factory || strcmp (GST_PLUGIN_FEATURE_NAME (factory), "gstrtpjitterbuffer")){
+		return;
+	}
+
+	PlayoutDelay* delay = g_new0 (PlayoutDelay, 1);
+	delay->jitterbuffer = element;
+	delay->now          = gst_util_get_timestamp;
+	delay->payload      = -1;
+	g_object_get (G_OBJECT (element), "latency", &delay->latencyMs, NULL);
+	g_object_set_data_full (G_OBJECT (element), "playout-delay", delay, g_free);
+
+	GstPad* sinkpad = gst_element_get_static_pad (element, "sink");
+	gst_pad_add_buffer_probe (sinkpad, G_CALLBACK (playoutDelay_sinkProbe), delay);
+	gst_object_unref (sinkpad);
+}
+
+/*
+ * Applies the setting to rtpbin before the pipeline starts. Jitterbuffers
+ * start with the setting's latency; in adaptive mode each of them is then
+ * resized as its participant's packets arrive.
+ *
+ * A changed latency is posted as a latency message: the pipeline's bus
+ * handler should recalculate the pipeline latency then, so synchronised
+ * sinks follow.
+ */
+void playoutDelay_apply(GstElement* rtpbin, const PlayoutDelaySetting* setting){
+	g_object_set (G_OBJECT (rtpbin), "latency", setting->latencyMs, NULL);
+
+	if (setting->adaptive){
+		g_signal_connect (rtpbin, "element-added", G_CALLBACK (playoutDelay_rtpBinElementAdded), NULL);
+	}
+}
+
+#endif
@@ -0,0 +1,275 @@
+#ifndef RTP_DTX_H
+#define RTP_DTX_H
+
+#include <stdio.h>
+#include <gst/gst.h>
+
+/*
+ * "rtpdtx" - the RTP side of discontinuous transmission, put right after
+ * the payloader of a stream gated by dtxgate (see dtxGate.h).
+ *
+ * Every "comfort-noise" event becomes an RFC 3389 comfort noise packet:
+ * payload type 13 with the noise level as its only byte, sent with the
+ * stream's SSRC, the next sequence number and the RTP time the event
+ * applies to. Media packets are renumbered behind the inserted ones, so
+ * the sequence stays gapless and a receiver sees no loss. The first media
+ * packet after comfort noise starts a talkspurt and gets the marker bit.
+ *
+ * Comfort noise packets go out with the media caps; receivers tell them
+ * apart by payload type. They share the SSRC, and so the RTP clock, of the
+ * media: 8 kHz streams get the static payload type 13, 48 kHz ones (Opus)
+ * the dynamic RTP_DTX_WIDE_CN_PAYLOAD.
+ */
+
+#define RTP_DTX_CN_PAYLOAD       13
+#define RTP_DTX_CLOCK_RATE       8000
+#define RTP_DTX_WIDE_CN_PAYLOAD  98
+#define RTP_DTX_WIDE_CLOCK_RATE  48000
+#define RTP_DTX_HEADER_SIZE      12
+
+#define GST_TYPE_RTP_DTX (gst_rtp_dtx_get_type())
+#define GST_RTP_DTX(obj) (G_TYPE_CHECK_INSTANCE_CAST((obj), GST_TYPE_RTP_DTX, GstRtpDtx))
+
+typedef struct _GstRtpDtx      GstRtpDtx;
+typedef struct _GstRtpDtxClass GstRtpDtxClass;
+
+struct _GstRtpDtx {
+	GstElement element;
+
+	GstPad* sinkpad;
+	GstPad* srcpad;
+
+	// Only touched with the stream lock held.
+	gboolean started;
+	guint32 ssrc;
+	gint clockRate;
+	guint16 seqOffset;
+	guint16 lastSeq;
+	guint32 lastRtpTime;
+	GstClockTime lastTimestamp;
+	gboolean talkspurt;
+
+	volatile gint comfortNoisePackets;
+};
+
+struct _GstRtpDtxClass {
+	GstElementClass parent_class;
+};
+
+enum {
+	RTP_DTX_PROP_0,
+	RTP_DTX_PROP_COMFORT_NOISE_PACKETS
+};
+
+static GstStaticPadTemplate gst_rtp_dtx_sink_template = GST_STATIC_PAD_TEMPLATE ("sink",
+	GST_PAD_SINK, GST_PAD_ALWAYS, GST_STATIC_CAPS ("application/x-rtp"));
+
+static GstStaticPadTemplate gst_rtp_dtx_src_template = GST_STATIC_PAD_TEMPLATE ("src",
+	GST_PAD_SRC, GST_PAD_ALWAYS, GST_STATIC_CAPS ("application/x-rtp"));
+
+// Defined with G_DEFINE_TYPE rather than GST_BOILERPLATE, whose file-wide
+// parent_class would clash with the other elements built into a program.
+G_DEFINE_TYPE (GstRtpDtx, gst_rtp_dtx, GST_TYPE_ELEMENT);
+
+static void gst_rtp_dtx_get_property (GObject* object, guint id, GValue* value, GParamSpec* pspec);
+static GstFlowReturn gst_rtp_dtx_chain (GstPad* pad, GstBuffer* buffer);
+static gboolean gst_rtp_dtx_sink_event (GstPad* pad, GstEvent* event);
+static GstStateChangeReturn gst_rtp_dtx_change_state (GstElement* element, GstStateChange transition);
+
+static void gst_rtp_dtx_class_init (GstRtpDtxClass* klass){
+	GObjectClass*    gobject_class = G_OBJECT_CLASS (klass);
+	GstElementClass* element_class = GST_ELEMENT_CLASS (klass);
+
+	gst_element_class_add_pad_template (element_class, gst_static_pad_template_get (&gst_rtp_dtx_sink_template));
+	gst_element_class_add_pad_template (element_class, gst_static_pad_template_get (&gst_rtp_dtx_src_template));
+
+	gst_element_class_set_details_simple (element_class,
+		"RTP DTX", "Codec/Payloader/Network/RTP",
+		"Inserts RFC 3389 comfort noise packets into a DTX gated RTP stream",
+		"GStreamer Audio Echo");
+
+	gobject_class->get_property = gst_rtp_dtx_get_property;
+
+	g_object_class_install_property (gobject_class, RTP_DTX_PROP_COMFORT_NOISE_PACKETS,
+		g_param_spec_int ("comfort-noise-packets", "Comfort noise packets",
+			"Comfort noise packets sent", 0, G_MAXINT, 0, G_PARAM_READABLE));
+
+	element_class->change_state = GST_DEBUG_FUNCPTR (gst_rtp_dtx_change_state);
+}
+
+static void gst_rtp_dtx_init (GstRtpDtx* dtx){
+	dtx->sinkpad = gst_pad_new_from_static_template (&gst_rtp_dtx_sink_template, "sink");
+	gst_pad_set_chain_function (dtx->sinkpad, GST_DEBUG_FUNCPTR (gst_rtp_dtx_chain));
+	gst_pad_set_event_function (dtx->sinkpad, GST_DEBUG_FUNCPTR (gst_rtp_dtx_sink_event));
+	gst_element_add_pad (GST_ELEMENT (dtx), dtx->sinkpad);
+
+	dtx->srcpad = gst_pad_new_from_static_template (&gst_rtp_dtx_src_template, "src");
+	gst_element_add_pad (GST_ELEMENT (dtx), dtx->srcpad);
+
+	dtx->started   = FALSE;
+	dtx->clockRate = RTP_DTX_CLOCK_RATE;
+	dtx->seqOffset = 0;
+	dtx->talkspurt = FALSE;
+	dtx->comfortNoisePackets = 0;
+}
+
+static void gst_rtp_dtx_get_property (GObject* object, guint id, GValue* value, GParamSpec* pspec){
+	GstRtpDtx* dtx = GST_RTP_DTX (object);
+
+	switch (id) {
+		case RTP_DTX_PROP_COMFORT_NOISE_PACKETS:
+			g_value_set_int (value, g_atomic_int_get (&dtx->comfortNoisePackets));
+			break;
+		default:
+			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, id, pspec);
+			break;
+	}
+}
+
+static GstFlowReturn gst_rtp_dtx_chain (GstPad* pad, GstBuffer* buffer){
+	GstRtpDtx* dtx = GST_RTP_DTX (GST_PAD_PARENT (pad));
+
+	if (GST_BUFFER_SIZE (buffer) < RTP_DTX_HEADER_SIZE){
+		return gst_pad_push (dtx->srcpad, buffer);
+	}
+
+	buffer = gst_buffer_make_writable (buffer);
+	guint8* header = GST_BUFFER_DATA (buffer);
+
+	guint16 seq = GST_READ_UINT16_BE (header + 2) + dtx->seqOffset;
+	GST_WRITE_UINT16_BE (header + 2, seq);
+
+	if (dtx->talkspurt){
+		dtx->talkspurt = FALSE;
+		header[1] |= 0x80;
+	}
+
+	if (!dtx->started && GST_BUFFER_CAPS (buffer)){
+		GstStructure* structure = gst_caps_get_structure (GST_BUFFER_CAPS (buffer), 0);
+		gst_structure_get_int (structure, "clock-rate", &dtx->clockRate);
+	}
+
+	dtx->started       = TRUE;
+	dtx->lastSeq       = seq;
+	dtx->lastRtpTime   = GST_READ_UINT32_BE (header + 4);
+	dtx->ssrc          = GST_READ_UINT32_BE (header + 8);
+	dtx->lastTimestamp = GST_BUFFER_TIMESTAMP (buffer);
+
+	return gst_pad_push (dtx->srcpad, buffer);
+}
+
+static GstBuffer* gst_rtp_dtx_new_comfort_noise (GstRtpDtx* dtx, GstClockTime timestamp, gint level){
+	guint32 rtpTime = dtx->lastRtpTime;
+	if (GST_CLOCK_TIME_IS_VALID (timestamp) && GST_CLOCK_TIME_IS_VALID (dtx->lastTimestamp)
+			&& timestamp > dtx->lastTimestamp){
+		rtpTime += gst_util_uint64_scale_int (timestamp - dtx->lastTimestamp, dtx->clockRate, GST_SECOND);
+	}
+
+	GstBuffer* buffer = gst_buffer_new_and_alloc (RTP_DTX_HEADER_SIZE + 1);
+	guint8* data = GST_BUFFER_DATA (buffer);
+	data[0] = 0x80;
+	data[1] = dtx->clockRate == RTP_DTX_WIDE_CLOCK_RATE ? RTP_DTX_WIDE_CN_PAYLOAD : RTP_DTX_CN_PAYLOAD;
+	GST_WRITE_UINT16_BE (data + 2, dtx->lastSeq + 1);
+	GST_WRITE_UINT32_BE (data + 4, rtpTime);
+	GST_WRITE_UINT32_BE (data + 8, dtx->ssrc);
+	data[RTP_DTX_HEADER_SIZE] = (guint8) CLAMP (level, 0, 127);
+
+	GST_BUFFER_TIMESTAMP (buffer) = timestamp;
+	gst_buffer_set_caps (buffer, GST_PAD_CAPS (dtx->srcpad));
+	return buffer;
+}
+
+/*
+ * Comfort noise needs a media packet first: the SSRC, sequence and RTP
+ * time all continue from it.
+ */
+static gboolean gst_rtp_dtx_sink_event (GstPad* pad, GstEvent* event){
+	GstRtpDtx* dtx = GST_RTP_DTX (gst_pad_get_parent (pad));
+	const GstStructure* structure = gst_event_get_structure (event);
+
+	if (GST_EVENT_TYPE (event) != GST_EVENT_CUSTOM_DOWNSTREAM || !gst_structure_has_name (structure, "comfort-noise")){
+		gboolean result = gst_pad_push_event (dtx->srcpad, event);
+		gst_object_unref (dtx);
+		return result;
+	}
+
+	GstClockTime timestamp = GST_CLOCK_TIME_NONE;
+	gint level = 127;
+	gst_structure_get_clock_time (structure, "timestamp", &timestamp);
+	gst_structure_get_int (structure, "level", &level);
+	gst_event_unref (event);
+
+	if (dtx->started){
+		GstBuffer* buffer = gst_rtp_dtx_new_comfort_noise (dtx, timestamp, level);
+		dtx->lastSeq++;
+		dtx->seqOffset++;
+		dtx->talkspurt = TRUE;
+		g_atomic_int_inc (&dtx->comfortNoisePackets);
+		gst_pad_push (dtx->srcpad, buffer);
+	}
+
+	gst_object_unref (dtx);
+	return TRUE;
+}
+
+static GstStateChangeReturn gst_rtp_dtx_change_state (GstElement* element, GstStateChange transition){
+	GstStateChangeReturn result = GST_ELEMENT_CLASS (gst_rtp_dtx_parent_class)->change_state (element, transition);
+
+	GstRtpDtx* dtx = GST_RTP_DTX (element);
+	if (transition == GST_STATE_CHANGE_PAUSED_TO_READY){
+		dtx->started   = FALSE;
+		dtx->clockRate = RTP_DTX_CLOCK_RATE;
+		dtx->seqOffset = 0;
+		dtx->talkspurt = FALSE;
+	}
+	return result;
+}
+
+gboolean rtpDtx_isComfortNoisePayload(guint payload){
+	return payload == RTP_DTX_CN_PAYLOAD || payload == RTP_DTX_WIDE_CN_PAYLOAD;
+}
+
+/*
+ * The level of an RFC 3389 packet in -dBov, or -1 for any other packet.
+ */
+gint rtpDtx_comfortNoiseLevel(GstBuffer* buffer){
+	const guint8* data = GST_BUFFER_DATA (buffer);
+	if (GST_BUFFER_SIZE (buffer) < RTP_DTX_HEADER_SIZE || !rtpDtx_isComfortNoisePayload(data[1] & 0x7F)){
+		return -1;
+	}
+
+	guint offset = RTP_DTX_HEADER_SIZE + 4 * (data[0] & 0x0F);
+	if (GST_BUFFER_SIZE (buffer) <= offset){
+		return -1;
+	}
+	return data[offset] & 0x7F;
+}
+
+/*
+ * The caps rtpbin needs for comfort noise packets of a payload type, or
+ * NULL for any other payload type (see codec_mapPayloads() in codec.h).
+ */
+GstCaps* rtpDtx_comfortNoiseCaps(guint payload){
+	if (!rtpDtx_isComfortNoisePayload(payload)){
+		return NULL;
+	}
+	return gst_caps_new_simple ("application/x-rtp",
+		"media",         G_TYPE_STRING, "audio",
+		"clock-rate",    G_TYPE_INT,    payload == RTP_DTX_CN_PAYLOAD ? RTP_DTX_CLOCK_RATE : RTP_DTX_WIDE_CLOCK_RATE,
+		"encoding-name", G_TYPE_STRING, "CN",
+		"payload",       G_TYPE_INT,    payload,
+		NULL);
+}
+
+// rtpbin names its receive pads "recv_rtp_src_<session>_<ssrc>_<payload>".
+gboolean rtpDtx_isComfortNoisePad(GstPad* rtpBinPad){
+	guint session, ssrc, payload;
+	return sscanf (GST_PAD_NAME (rtpBinPad), "recv_rtp_src_%u_%u_%u", &session, &ssrc, &payload) == 3
+		&& rtpDtx_isComfortNoisePayload(payload);
+}
+
+void gst_rtp_dtx_register (){
+	gst_element_register (NULL, "rtpdtx", GST_RANK_NONE, GST_TYPE_RTP_DTX);
+}
+
+#endif
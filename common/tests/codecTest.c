@@ -0,0 +1,259 @@
+#include <stdlib.h>
+#include <math.h>
+#include <gst/gst.h>
+
+#include "g726Enc.h"
+#include "g726Dec.h"
+#include "codec.h"
+#include "testPads.h"
+
+/*
+ * Payload type mapping and RTP caps negotiation of every codec. A codec
+ * whose elements are not installed must not be mapped at all; for one that
+ * is, a short stream is encoded and payloaded, and the depayloader has to
+ * take both the caps the payloader sent and the caps rtpbin is given.
+ * g726enc must carry on from another encoder's state when told to.
+ */
+
+#define TEST_AUDIO_CAPS "audio/x-raw-int, rate = (int) 8000, channels = (int) 1, width = (int) 16, depth = (int) 16"
+#define TEST_BUFFERS    10
+#define FRAME_SAMPLES   160
+
+static void silence (const gchar* text){
+}
+
+gint capsInt(const GstCaps* caps, const gchar* field){
+	gint value = -1;
+	gst_structure_get_int (gst_caps_get_structure (caps, 0), field, &value);
+	return value;
+}
+
+const gchar* capsString(const GstCaps* caps, const gchar* field){
+	return gst_structure_get_string (gst_caps_get_structure (caps, 0), field);
+}
+
+GstPad* fakeRtpBinPad(guint payload){
+	gchar* name = g_strdup_printf ("recv_rtp_src_0_1234_%u", payload);
+	GstPad* pad = gst_pad_new (name, GST_PAD_SRC);
+	g_free (name);
+	return pad;
+}
+
+// Payload types are unique and clear of comfort noise, both ways.
+void testPayloadMapping(){
+	guint i, j;
+	for (i = 0; i < CODEC_COUNT; i++){
+		const Codec* codec = &codecs[i];
+		g_assert (codec_byPayload(codec->payload) == codec);
+		g_assert (codec_byName(codec->name) == codec);
+		g_assert (codec_index(codec) == i);
+		g_assert (!rtpDtx_isComfortNoisePayload(codec->payload));
+		for (j = i + 1; j < CODEC_COUNT; j++){
+			g_assert (codecs[j].payload != codec->payload);
+		}
+
+		GstPad* pad = fakeRtpBinPad(codec->payload);
+		g_assert (codec_ofPad(pad) == codec);
+		gst_object_unref (pad);
+	}
+
+	g_assert (codec_byName("opus")->payload == 97);
+	g_assert (codec_byName("g726") == CODEC_DEFAULT);
+	g_assert (!codec_byName("pcmu"));
+	g_assert (!codec_byPayload(RTP_DTX_CN_PAYLOAD));
+
+	GstPad* pad = fakeRtpBinPad(RTP_DTX_CN_PAYLOAD);
+	g_assert (!codec_ofPad(pad));
+	gst_object_unref (pad);
+
+	pad = gst_pad_new ("src", GST_PAD_SRC);
+	g_assert (!codec_ofPad(pad));
+	gst_object_unref (pad);
+}
+
+// What rtpbin is told for every payload type a packet may carry.
+void testRequestPtMap(){
+	guint i;
+	for (i = 0; i < CODEC_COUNT; i++){
+		const Codec* codec = &codecs[i];
+		GstCaps* caps = codec_requestPtMap(NULL, 0, codec->payload, NULL);
+
+		if (!codec_isAvailable(codec)){
+			g_printerr ("codecTest: %s is not installed, not mapped.\n", codec->name);
+			g_assert (!caps);
+			continue;
+		}
+
+		g_assert (caps);
+		g_assert (capsInt(caps, "payload") == (gint) codec->payload);
+		g_assert (capsInt(caps, "clock-rate") == codec->clockRate);
+		g_assert (g_str_equal (capsString(caps, "encoding-name"), codec->encodingName));
+		gst_caps_unref (caps);
+	}
+
+	GstCaps* caps = codec_requestPtMap(NULL, 0, RTP_DTX_CN_PAYLOAD, NULL);
+	g_assert (capsInt(caps, "clock-rate") == RTP_DTX_CLOCK_RATE);
+	gst_caps_unref (caps);
+
+	caps = codec_requestPtMap(NULL, 0, RTP_DTX_WIDE_CN_PAYLOAD, NULL);
+	g_assert (capsInt(caps, "clock-rate") == RTP_DTX_WIDE_CLOCK_RATE);
+	gst_caps_unref (caps);
+
+	g_assert (!codec_requestPtMap(NULL, 0, 99, NULL));
+}
+
+// Encodes a little audio and returns the caps the payloader sent it with.
+GstCaps* payloadedCaps(const Codec* codec){
+	GstElement* pipeline = gst_pipeline_new (NULL);
+	GstElement* source   = gst_element_factory_make ("audiotestsrc", NULL);
+	GstElement* filter   = gst_element_factory_make ("capsfilter", NULL);
+	GstElement* encoder  = codec_makeEncoder(codec, NULL);
+	GstElement* pay      = codec_makePayloader(codec, NULL);
+	GstElement* sink     = gst_element_factory_make ("fakesink", NULL);
+	g_assert (pipeline && source && filter && encoder && pay && sink);
+
+	GstCaps* audioCaps = gst_caps_from_string (TEST_AUDIO_CAPS);
+	g_object_set (G_OBJECT (source), "num-buffers", TEST_BUFFERS, NULL);
+	g_object_set (G_OBJECT (filter), "caps", audioCaps, NULL);
+	gst_caps_unref (audioCaps);
+
+	gst_bin_add_many (GST_BIN (pipeline), source, filter, encoder, pay, sink, NULL);
+	g_assert (gst_element_link_many (source, filter, encoder, pay, sink, NULL));
+
+	gst_element_set_state (pipeline, GST_STATE_PLAYING);
+	GstBus* bus = gst_element_get_bus (pipeline);
+	GstMessage* message = gst_bus_timed_pop_filtered (bus, 5 * GST_SECOND, GST_MESSAGE_EOS | GST_MESSAGE_ERROR);
+	g_assert (message && GST_MESSAGE_TYPE (message) == GST_MESSAGE_EOS);
+	gst_message_unref (message);
+	gst_object_unref (bus);
+
+	GstPad* srcpad = gst_element_get_static_pad (pay, "src");
+	GstCaps* caps = gst_pad_get_negotiated_caps (srcpad);
+	gst_object_unref (srcpad);
+
+	gst_element_set_state (pipeline, GST_STATE_NULL);
+	gst_object_unref (pipeline);
+	return caps;
+}
+
+gboolean depayloaderAccepts(const Codec* codec, const GstCaps* caps){
+	GstElement* depay = codec_makeDepayloader(codec, NULL);
+	g_assert (depay);
+	GstPad* sinkpad = gst_element_get_static_pad (depay, "sink");
+	gboolean accepts = gst_caps_can_intersect (caps, gst_pad_get_pad_template_caps (sinkpad));
+	gst_object_unref (sinkpad);
+	gst_object_unref (depay);
+	return accepts;
+}
+
+void testNegotiation(){
+	guint i;
+	for (i = 0; i < CODEC_COUNT; i++){
+		const Codec* codec = &codecs[i];
+		if (!codec_isAvailable(codec)){
+			continue;
+		}
+
+		GstCaps* sent = payloadedCaps(codec);
+		g_assert (sent);
+		g_assert (capsInt(sent, "payload") == (gint) codec->payload);
+		g_assert (capsInt(sent, "clock-rate") == codec->clockRate);
+		g_assert (depayloaderAccepts(codec, sent));
+		gst_caps_unref (sent);
+
+		GstCaps* mapped = codec_rtpCaps(codec);
+		g_assert (depayloaderAccepts(codec, mapped));
+		gst_caps_unref (mapped);
+
+		GstElement* decoder = codec_makeDecoder(codec, NULL);
+		g_assert (decoder);
+		gst_object_unref (decoder);
+
+		GstElement* converter = codec_makeConverter(codec);
+		g_assert (!converter == !codec->convert);
+		if (converter){
+			gst_object_unref (converter);
+		}
+	}
+}
+
+GstBuffer* toneFrame(int frame, gdouble frequency){
+	GstBuffer* buffer = gst_buffer_new_and_alloc (FRAME_SAMPLES * 2);
+	gint16* samples = (gint16*) GST_BUFFER_DATA (buffer);
+	int i;
+	for (i = 0; i < FRAME_SAMPLES; i++){
+		samples[i] = (gint16) (8000 * sin ((frame * FRAME_SAMPLES + i) * 2 * G_PI * frequency / G726_SAMPLE_RATE));
+	}
+
+	GstCaps* caps = gst_caps_new_simple ("audio/x-raw-int",
+		"endianness", G_TYPE_INT,     G_BYTE_ORDER,
+		"signed",     G_TYPE_BOOLEAN, TRUE,
+		"width",      G_TYPE_INT,     16,
+		"depth",      G_TYPE_INT,     16,
+		"rate",       G_TYPE_INT,     G726_SAMPLE_RATE,
+		"channels",   G_TYPE_INT,     1,
+		NULL);
+	gst_buffer_set_caps (buffer, caps);
+	gst_caps_unref (caps);
+	return buffer;
+}
+
+// The codes of the last buffer the element pushed.
+GstBuffer* lastCodes(TestPads* pads){
+	return (GstBuffer*) g_list_last (pads->buffers)->data;
+}
+
+/*
+ * A leg's encoder taking over a shared encoder's state codes on exactly
+ * as one encoder fed both signals would.
+ */
+void testCopyState(){
+	TestPads shared, own, single;
+	testPads_start(&shared, "g726enc");
+	testPads_start(&own, "g726enc");
+	testPads_start(&single, "g726enc");
+
+	g_assert (!gst_g726_enc_copy_state (own.element, shared.element));
+
+	int frame;
+	for (frame = 0; frame < TEST_BUFFERS; frame++){
+		g_assert (gst_pad_push (shared.src, toneFrame(frame, 300)) == GST_FLOW_OK);
+		g_assert (gst_pad_push (single.src, toneFrame(frame, 300)) == GST_FLOW_OK);
+	}
+	// Something coded before, to be overwritten.
+	g_assert (gst_pad_push (own.src, toneFrame(0, 2000)) == GST_FLOW_OK);
+
+	g_assert (gst_g726_enc_copy_state (own.element, shared.element));
+	for (; frame < 2 * TEST_BUFFERS; frame++){
+		g_assert (gst_pad_push (own.src, toneFrame(frame, 1100)) == GST_FLOW_OK);
+		g_assert (gst_pad_push (single.src, toneFrame(frame, 1100)) == GST_FLOW_OK);
+
+		GstBuffer* ownCodes    = lastCodes(&own);
+		GstBuffer* singleCodes = lastCodes(&single);
+		g_assert (GST_BUFFER_SIZE (ownCodes) == GST_BUFFER_SIZE (singleCodes));
+		g_assert (memcmp (GST_BUFFER_DATA (ownCodes), GST_BUFFER_DATA (singleCodes), GST_BUFFER_SIZE (ownCodes)) == 0);
+	}
+
+	GstElement* other = gst_element_factory_make ("fakesink", NULL);
+	g_assert (!gst_g726_enc_copy_state (own.element, other));
+	gst_object_unref (other);
+
+	testPads_stop(&shared);
+	testPads_stop(&own);
+	testPads_stop(&single);
+}
+
+int main(int argc, char *argv[]){
+	gst_init (&argc, &argv);
+	gst_g726_enc_register();
+	gst_g726_dec_register();
+	g_set_print_handler (silence);
+
+	testPayloadMapping();
+	testRequestPtMap();
+	testNegotiation();
+	testCopyState();
+
+	g_printerr ("codecTest: ok.\n");
+	return 0;
+}
@@ -0,0 +1,189 @@
+#include <stdlib.h>
+#include <math.h>
+#include <gst/gst.h>
+
+#include "dtxGate.h"
+#include "testPads.h"
+
+/*
+ * The dtxgate's talkspurt and comfort noise state machine, fed 20 ms
+ * frames of a steady background noise and of a tone well above it.
+ */
+
+#define FRAME_MS       20
+#define FRAME_SAMPLES  (VOICE_ACTIVITY_RATE * FRAME_MS / 1000)
+#define HANGOVER_FRAMES (VOICE_ACTIVITY_DEFAULT_HANGOVER_MS / FRAME_MS)
+#define SID_FRAMES     (DTX_GATE_DEFAULT_SID_INTERVAL_MS / FRAME_MS)
+#define NOISE          20
+#define QUIET_NOISE    5
+#define TONE           8000
+
+static void silence (const gchar* text){
+}
+
+// A square wave has the same power in every frame, so the noise level is exact.
+GstBuffer* noiseFrame(int frame, gint16 amplitude){
+	GstBuffer* buffer = gst_buffer_new_and_alloc (FRAME_SAMPLES * 2);
+	gint16* samples = (gint16*) GST_BUFFER_DATA (buffer);
+	int i;
+	for (i = 0; i < FRAME_SAMPLES; i++){
+		samples[i] = i & 1 ? amplitude : -amplitude;
+	}
+	GST_BUFFER_TIMESTAMP (buffer) = frame * FRAME_MS * GST_MSECOND;
+	return buffer;
+}
+
+GstBuffer* toneFrame(int frame){
+	GstBuffer* buffer = gst_buffer_new_and_alloc (FRAME_SAMPLES * 2);
+	gint16* samples = (gint16*) GST_BUFFER_DATA (buffer);
+	int i;
+	for (i = 0; i < FRAME_SAMPLES; i++){
+		samples[i] = (gint16) (TONE * sin ((frame * FRAME_SAMPLES + i) * 2 * G_PI * 440 / VOICE_ACTIVITY_RATE));
+	}
+	GST_BUFFER_TIMESTAMP (buffer) = frame * FRAME_MS * GST_MSECOND;
+	return buffer;
+}
+
+guint noiseLevel(gint16 amplitude){
+	return voiceActivity_level((gdouble) amplitude * amplitude / (32768.0 * 32768.0));
+}
+
+// Pushes one frame and returns whether it came out.
+gboolean pushFrame(TestPads* pads, GstBuffer* buffer){
+	guint before = g_list_length (pads->buffers);
+	g_assert (gst_pad_push (pads->src, buffer) == GST_FLOW_OK);
+	return g_list_length (pads->buffers) > before;
+}
+
+GstClockTime eventTimestamp(GstEvent* event){
+	GstClockTime timestamp = GST_CLOCK_TIME_NONE;
+	g_assert (gst_structure_get_clock_time (gst_event_get_structure (event), "timestamp", &timestamp));
+	return timestamp;
+}
+
+gint eventLevel(GstEvent* event){
+	gint level = -1;
+	g_assert (gst_structure_get_int (gst_event_get_structure (event), "level", &level));
+	return level;
+}
+
+GstEvent* lastEvent(TestPads* pads){
+	return (GstEvent*) g_list_last (pads->events)->data;
+}
+
+gboolean lastBufferIsDiscont(TestPads* pads){
+	return GST_BUFFER_FLAG_IS_SET (g_list_last (pads->buffers)->data, GST_BUFFER_FLAG_DISCONT);
+}
+
+/*
+ * A stream starts as speech for one hangover, then its silence is dropped
+ * with comfort noise at the start and every SID interval.
+ */
+void testStartAndRefresh(){
+	TestPads pads;
+	testPads_start(&pads, "dtxgate");
+
+	int frame;
+	for (frame = 0; frame < HANGOVER_FRAMES - 1; frame++){
+		g_assert (pushFrame(&pads, noiseFrame(frame, NOISE)));
+	}
+	g_assert (!pads.events);
+
+	for (; frame < HANGOVER_FRAMES - 1 + 3 * SID_FRAMES; frame++){
+		g_assert (!pushFrame(&pads, noiseFrame(frame, NOISE)));
+
+		guint expected = (frame - (HANGOVER_FRAMES - 1)) / SID_FRAMES + 1;
+		g_assert (g_list_length (pads.events) == expected);
+		g_assert (eventTimestamp(lastEvent(&pads)) == (GstClockTime) (frame - (frame - (HANGOVER_FRAMES - 1)) % SID_FRAMES) * FRAME_MS * GST_MSECOND);
+		g_assert (eventLevel(lastEvent(&pads)) == (gint) noiseLevel(NOISE));
+	}
+
+	gint suppressed;
+	g_object_get (G_OBJECT (pads.element), "buffers-suppressed", &suppressed, NULL);
+	g_assert (suppressed == 3 * SID_FRAMES);
+
+	testPads_stop(&pads);
+}
+
+/*
+ * Speech passes with its first frame flagged DISCONT and keeps the gate
+ * open for the hangover after it; the silence after that gets comfort
+ * noise at once.
+ */
+void testTalkspurtAndHangover(){
+	TestPads pads;
+	testPads_start(&pads, "dtxgate");
+
+	int frame = 0;
+	for (; frame < HANGOVER_FRAMES + SID_FRAMES / 2; frame++){
+		pushFrame(&pads, noiseFrame(frame, NOISE));
+	}
+	testPads_clear(&pads);
+
+	int talkspurt;
+	for (talkspurt = 0; talkspurt < 5; talkspurt++, frame++){
+		g_assert (pushFrame(&pads, toneFrame(frame)));
+		g_assert (lastBufferIsDiscont(&pads) == (talkspurt == 0));
+	}
+
+	int hangover;
+	for (hangover = 0; hangover < HANGOVER_FRAMES - 1; hangover++, frame++){
+		g_assert (pushFrame(&pads, noiseFrame(frame, NOISE)));
+		g_assert (!lastBufferIsDiscont(&pads));
+	}
+	g_assert (!pads.events);
+
+	g_assert (!pushFrame(&pads, noiseFrame(frame, NOISE)));
+	g_assert (g_list_length (pads.events) == 1);
+	g_assert (eventTimestamp(lastEvent(&pads)) == (GstClockTime) frame * FRAME_MS * GST_MSECOND);
+	g_assert (ABS (eventLevel(lastEvent(&pads)) - (gint) noiseLevel(NOISE)) <= 1);
+	frame++;
+
+	// A single frame of speech opens the gate for a full hangover again.
+	g_assert (pushFrame(&pads, toneFrame(frame++)));
+	g_assert (lastBufferIsDiscont(&pads));
+	for (hangover = 0; hangover < HANGOVER_FRAMES - 1; hangover++, frame++){
+		g_assert (pushFrame(&pads, noiseFrame(frame, NOISE)));
+	}
+	g_assert (!pushFrame(&pads, noiseFrame(frame, NOISE)));
+	g_assert (g_list_length (pads.events) == 2);
+
+	testPads_stop(&pads);
+}
+
+// A noticeable change of the background refreshes the comfort noise early.
+void testLevelChange(){
+	TestPads pads;
+	testPads_start(&pads, "dtxgate");
+
+	int frame;
+	for (frame = 0; frame < HANGOVER_FRAMES; frame++){
+		pushFrame(&pads, noiseFrame(frame, NOISE));
+	}
+	g_assert (g_list_length (pads.events) == 1);
+
+	int quiet;
+	for (quiet = 0; quiet < SID_FRAMES / 2; quiet++, frame++){
+		g_assert (!pushFrame(&pads, noiseFrame(frame, QUIET_NOISE)));
+	}
+	g_assert (g_list_length (pads.events) >= 2);
+
+	gint level = eventLevel(lastEvent(&pads));
+	g_assert (level >= (gint) noiseLevel(NOISE) + DTX_GATE_LEVEL_CHANGE);
+	g_assert (level <= (gint) noiseLevel(QUIET_NOISE));
+
+	testPads_stop(&pads);
+}
+
+int main(int argc, char *argv[]){
+	gst_init (&argc, &argv);
+	gst_dtx_gate_register();
+	g_set_print_handler (silence);
+
+	testStartAndRefresh();
+	testTalkspurtAndHangover();
+	testLevelChange();
+
+	g_printerr ("dtxGateTest: ok.\n");
+	return 0;
+}
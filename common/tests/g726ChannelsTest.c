@@ -0,0 +1,193 @@
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <glib.h>
+
+#include "g726.h"
+
+/*
+ * G.726 at every rate: the lane kernels against the scalar coder, and the
+ * scalar coder against the signal.
+ *
+ * Coded together, every channel must give the codes and samples, byte for
+ * byte, and end in the state that g726_encode() and g726_decode() give it
+ * alone; channel counts that leave scalar channels after the last full
+ * group included. Without AVX2 all channels are scalar and this still
+ * holds.
+ *
+ * Coded alone, the decoder must follow the encoder's state exactly, and a
+ * tone must come back with a signal-to-noise ratio that grows with the
+ * rate.
+ */
+
+#define CHUNKS        12
+#define MAX_CHANNELS  23
+#define TONE_SAMPLES  (G726_SAMPLE_RATE * 2)
+#define SETTLE_SAMPLES (G726_SAMPLE_RATE / 10)
+
+static void silence (const gchar* text){
+}
+
+static const gint bitrates[] = {16000, 24000, 32000, 40000};
+static const guint channelCounts[] = {1, 7, 8, 9, 17, MAX_CHANNELS};
+
+// Frame lengths of the calls, odd ones leaving a partial last byte.
+static const guint chunkSamples[CHUNKS] = {160, 160, 1, 7, 80, 160, 33, 240, 160, 3, 160, 160};
+
+// Channel c gets its own signal: tones, noise, full scale and silence.
+gint16 channelSample(GRand* generator, guint c, guint n){
+	switch (c % 6){
+	case 0:
+		return 8000 * sin (n * 2 * G_PI * (300 + 37 * c) / G726_SAMPLE_RATE);
+	case 1:
+		return g_rand_int_range (generator, G_MININT16, G_MAXINT16 + 1);
+	case 2:
+		return (n / 20) % 2 ? G_MAXINT16 : G_MININT16;
+	case 3:
+		return 0;
+	case 4:
+		return (n / 400) % 2 ? g_rand_int_range (generator, -200, 200)
+			: 20000 * sin (n * 2 * G_PI * 2900 / G726_SAMPLE_RATE);
+	default:
+		return 3000 * sin (n * 2 * G_PI * 1000 / G726_SAMPLE_RATE) + g_rand_int_range (generator, -3000, 3000);
+	}
+}
+
+void assertSameState(const G726State* a, const G726State* b){
+	g_assert (a->yl == b->yl && a->yu == b->yu);
+	g_assert (a->dms == b->dms && a->dml == b->dml);
+	g_assert (a->ap == b->ap && a->td == b->td);
+	g_assert (!memcmp (a->a, b->a, sizeof (a->a)));
+	g_assert (!memcmp (a->b, b->b, sizeof (a->b)));
+	g_assert (!memcmp (a->pk, b->pk, sizeof (a->pk)));
+	g_assert (!memcmp (a->dq, b->dq, sizeof (a->dq)));
+	g_assert (!memcmp (a->sr, b->sr, sizeof (a->sr)));
+}
+
+void testChannels(const G726Rate* rate, guint count){
+	GRand* generator = g_rand_new_with_seed (count);
+
+	G726Channels* encoder = g726Channels_new(rate, count);
+	G726Channels* decoder = g726Channels_new(rate, count);
+	g_assert (encoder->groups == (g726Kernels.encodeLanes ? count / G726_LANES : 0));
+
+	G726State encoderStates[MAX_CHANNELS], decoderStates[MAX_CHANNELS];
+	guint c;
+	for (c = 0; c < count; c++){
+		g726_initState(&encoderStates[c]);
+		g726_initState(&decoderStates[c]);
+	}
+
+	// Interleaved like a multichannel buffer, so the stride is count.
+	gint16 pcm[240 * MAX_CHANNELS];
+	gint16 decoded[240 * MAX_CHANNELS], expectedPcm[240];
+	guint8 codes[MAX_CHANNELS][240 * 5 / 8 + 1], expectedCodes[240 * 5 / 8 + 1];
+	const gint16* pcmIn[MAX_CHANNELS];
+	guint8* codesOut[MAX_CHANNELS];
+	gint16* decodedOut[MAX_CHANNELS];
+	for (c = 0; c < count; c++){
+		pcmIn[c]      = pcm + c;
+		codesOut[c]   = codes[c];
+		decodedOut[c] = decoded + c;
+	}
+
+	guint chunk, i, n = 0;
+	for (chunk = 0; chunk < CHUNKS; chunk++){
+		guint samples = chunkSamples[chunk];
+		gsize bytes = g726_encodedSize(rate, samples);
+		for (i = 0; i < samples; i++){
+			for (c = 0; c < count; c++){
+				pcm[i * count + c] = channelSample(generator, c, n + i);
+			}
+		}
+		n += samples;
+
+		g726Channels_encode(encoder, pcmIn, count, samples, codesOut);
+		g726Channels_decode(decoder, (const guint8* const*) codesOut, samples, decodedOut, count);
+
+		for (c = 0; c < count; c++){
+			g726_encode(rate, &encoderStates[c], pcmIn[c], count, samples, expectedCodes);
+			g_assert (!memcmp (codes[c], expectedCodes, bytes));
+
+			g726_decode(rate, &decoderStates[c], codes[c], samples, expectedPcm, 1);
+			for (i = 0; i < samples; i++){
+				g_assert (decoded[i * count + c] == expectedPcm[i]);
+			}
+		}
+	}
+
+	for (c = 0; c < count; c++){
+		G726State state;
+		g726Channels_getState(encoder, c, &state);
+		assertSameState(&state, &encoderStates[c]);
+		g726Channels_getState(decoder, c, &state);
+		assertSameState(&state, &decoderStates[c]);
+		assertSameState(&encoderStates[c], &decoderStates[c]);
+	}
+
+	g726Channels_free(encoder);
+	g726Channels_free(decoder);
+	g_rand_free (generator);
+}
+
+void testLanesMatchScalar(){
+	guint r, n;
+	g726_init();
+	g_print ("G.726 kernels: %s.\n", g726Kernels.name);
+	for (r = 0; r < G_N_ELEMENTS (bitrates); r++){
+		for (n = 0; n < G_N_ELEMENTS (channelCounts); n++){
+			testChannels(g726_rateForBitrate(bitrates[r]), channelCounts[n]);
+		}
+	}
+}
+
+// Signal-to-noise ratio of a two-tone signal after a round trip.
+gdouble roundTripSnr(const G726Rate* rate){
+	gint16 pcm[TONE_SAMPLES], decoded[TONE_SAMPLES];
+	guint8 codes[TONE_SAMPLES * 5 / 8 + 1];
+	int n;
+	for (n = 0; n < TONE_SAMPLES; n++){
+		pcm[n] = 6000 * sin (n * 2 * G_PI * 440 / G726_SAMPLE_RATE)
+			+ 3000 * sin (n * 2 * G_PI * 1300 / G726_SAMPLE_RATE);
+	}
+
+	G726State encoder, decoder;
+	g726_initState(&encoder);
+	g726_initState(&decoder);
+	g_assert (g726_encodedSize(rate, TONE_SAMPLES) == TONE_SAMPLES * rate->bits / 8);
+	g726_encode(rate, &encoder, pcm, 1, TONE_SAMPLES, codes);
+	g_assert (g726_decodedSamples(rate, g726_encodedSize(rate, TONE_SAMPLES)) == TONE_SAMPLES);
+	g726_decode(rate, &decoder, codes, TONE_SAMPLES, decoded, 1);
+	assertSameState(&encoder, &decoder);
+
+	gdouble signal = 0, noise = 0;
+	for (n = SETTLE_SAMPLES; n < TONE_SAMPLES; n++){
+		signal += (gdouble) pcm[n] * pcm[n];
+		noise  += ((gdouble) pcm[n] - decoded[n]) * (pcm[n] - decoded[n]);
+	}
+	return 10 * log10 (signal / noise);
+}
+
+void testRoundTrip(){
+	static const gdouble minSnr[] = {12, 20, 27, 34};
+	gdouble last = 0;
+	guint r;
+	for (r = 0; r < G_N_ELEMENTS (bitrates); r++){
+		gdouble snr = roundTripSnr(g726_rateForBitrate(bitrates[r]));
+		g_print ("%d bit/s: %.1f dB.\n", bitrates[r], snr);
+		g_assert (snr > minSnr[r]);
+		g_assert (snr > last);
+		last = snr;
+	}
+	g_assert (!g726_rateForBitrate(64000));
+}
+
+int main(int argc, char *argv[]){
+	g_set_print_handler (silence);
+
+	testLanesMatchScalar();
+	testRoundTrip();
+
+	g_printerr ("g726ChannelsTest: ok.\n");
+	return 0;
+}
@@ -0,0 +1,167 @@
+#include <stdlib.h>
+#include <math.h>
+#include <glib.h>
+
+#include "g726.h"
+
+/*
+ * Decode continuity of a mix-minus leg across the switches between the
+ * shared mix and the leg's own mix. The shared mix is encoded once for all
+ * silent legs, a talking leg has its own encoder, and the leg's RTP stream
+ * switches between the two encoders' codes.
+ *
+ * When the leg starts talking its encoder takes over the shared encoder's
+ * state, so from a decoder that has followed the shared encoder the first
+ * talkspurt decodes exactly as from one encoder fed the switched signal.
+ * Every later switch to the leg's own encoder must still decode far better
+ * than with the two encoders left unrelated. The way back cannot be
+ * exact, the shared encoder being everybody's; it must at least fade, as
+ * it does when a caller joins the shared encoder in mid-stream.
+ */
+
+#define SWITCH_SAMPLES (G726_SAMPLE_RATE / 5)
+#define SWITCHES       20
+#define FRAME_SAMPLES  160
+#define WINDOW_SAMPLES (G726_SAMPLE_RATE / 100)
+#define LATE_SAMPLES   (SWITCH_SAMPLES - WINDOW_SAMPLES)
+#define MIN_GAIN_DB    6.0
+#define MIN_FADE_DB    3.0
+
+static void silence (const gchar* text){
+}
+
+// The shared mix is two callers talking, the own mix leaves the first out.
+gint16 sharedMix(int n){
+	return (gint16) (6000 * sin (n * 2 * G_PI * 300 / G726_SAMPLE_RATE)
+		+ 5000 * sin (n * 2 * G_PI * 1100 / G726_SAMPLE_RATE + 1));
+}
+
+gint16 ownMix(int n){
+	return (gint16) (5000 * sin (n * 2 * G_PI * 1100 / G726_SAMPLE_RATE + 1));
+}
+
+// Even periods are silent (shared mix), odd ones talking (own mix).
+gboolean isTalking(int n){
+	return (n / SWITCH_SAMPLES) & 1;
+}
+
+gint16 switchedMix(int n){
+	return isTalking(n) ? ownMix(n) : sharedMix(n);
+}
+
+// SNR in dB over WINDOW_SAMPLES from first.
+gdouble windowSnr(const gint16* decoded, int first){
+	gdouble signal = 0, noise = 0;
+	int n;
+	for (n = first; n < first + WINDOW_SAMPLES; n++){
+		gdouble expected = switchedMix(n);
+		signal += expected * expected;
+		noise  += (decoded[n] - expected) * (decoded[n] - expected);
+	}
+	return 10 * log10 (signal / MAX (noise, 1));
+}
+
+// Worst SNR right after every switch to the own mix, or offset later after every switch back.
+gdouble worstSnr(const gint16* decoded, gboolean toOwn, int offset){
+	gdouble worst = G_MAXDOUBLE;
+	int s;
+	for (s = toOwn ? 1 : 2; s < SWITCHES; s += 2){
+		worst = MIN (worst, windowSnr(decoded, s * SWITCH_SAMPLES + offset));
+	}
+	return worst;
+}
+
+// One frame of one channel through G726Channels, as g726enc codes it.
+void encodeFrame(G726Channels* coder, gint16 (*mix)(int), int first, guint8* codes){
+	gint16 pcm[FRAME_SAMPLES];
+	int n;
+	for (n = 0; n < FRAME_SAMPLES; n++){
+		pcm[n] = mix(first + n);
+	}
+	const gint16* planes[1] = { pcm };
+	guint8* outputs[1] = { codes };
+	g726Channels_encode(coder, planes, 1, FRAME_SAMPLES, outputs);
+}
+
+/*
+ * The shared encoder codes every frame; the leg's encoder only while the
+ * leg talks, from the shared encoder's state when seeded.
+ */
+gint16* decodeSwitchedCodes(const G726Rate* rate, gboolean seeded){
+	G726Channels* shared = g726Channels_new(rate, 1);
+	G726Channels* own    = g726Channels_new(rate, 1);
+	G726State decoder;
+	g726_initState(&decoder);
+
+	gint16* decoded = g_new (gint16, SWITCHES * SWITCH_SAMPLES);
+	guint8 sharedCodes[FRAME_SAMPLES], ownCodes[FRAME_SAMPLES];
+	int n;
+	for (n = 0; n < SWITCHES * SWITCH_SAMPLES; n += FRAME_SAMPLES){
+		if (seeded && n % SWITCH_SAMPLES == 0 && isTalking(n)){
+			G726State state;
+			g726Channels_getState(shared, 0, &state);
+			g726Channels_setState(own, 0, &state);
+		}
+
+		encodeFrame(shared, sharedMix, n, sharedCodes);
+		if (isTalking(n)){
+			encodeFrame(own, ownMix, n, ownCodes);
+		}
+		g726_decode(rate, &decoder, isTalking(n) ? ownCodes : sharedCodes, FRAME_SAMPLES, decoded + n, 1);
+	}
+
+	g726Channels_free(shared);
+	g726Channels_free(own);
+	return decoded;
+}
+
+// One encoder fed the switched signal.
+gint16* decodeSwitchedPcm(const G726Rate* rate){
+	G726State encoder, decoder;
+	g726_initState(&encoder);
+	g726_initState(&decoder);
+
+	gint16* decoded = g_new (gint16, SWITCHES * SWITCH_SAMPLES);
+	int n;
+	for (n = 0; n < SWITCHES * SWITCH_SAMPLES; n++){
+		decoded[n] = g726_decodeSample(rate, &decoder, g726_encodeSample(rate, &encoder, switchedMix(n)));
+	}
+	return decoded;
+}
+
+void testSwitchContinuity(gint bitrate){
+	const G726Rate* rate = g726_rateForBitrate(bitrate);
+	g_assert (rate);
+
+	gint16* single   = decodeSwitchedPcm(rate);
+	gint16* seeded   = decodeSwitchedCodes(rate, TRUE);
+	gint16* unseeded = decodeSwitchedCodes(rate, FALSE);
+
+	// Up to the first way back the seeded leg is one encoder.
+	g_assert (memcmp (single, seeded, 2 * SWITCH_SAMPLES * sizeof (gint16)) == 0);
+
+	gdouble seededSnr   = worstSnr(seeded, TRUE, 0);
+	gdouble unseededSnr = worstSnr(unseeded, TRUE, 0);
+	gdouble backSnr     = worstSnr(seeded, FALSE, 0);
+	gdouble lateSnr     = worstSnr(seeded, FALSE, LATE_SAMPLES);
+	g_print ("%d bit/s: talking %.1f dB seeded, %.1f dB not; back %.1f dB, %.1f dB later.\n",
+		bitrate, seededSnr, unseededSnr, backSnr, lateSnr);
+
+	g_assert (seededSnr > unseededSnr + MIN_GAIN_DB);
+	g_assert (lateSnr > backSnr + MIN_FADE_DB);
+
+	g_free (single);
+	g_free (seeded);
+	g_free (unseeded);
+}
+
+int main(int argc, char *argv[]){
+	g_set_print_handler (silence);
+
+	testSwitchContinuity(24000);
+	testSwitchContinuity(32000);
+	testSwitchContinuity(40000);
+
+	g_printerr ("g726SwitchTest: ok.\n");
+	return 0;
+}
@@ -0,0 +1,176 @@
+#include <stdlib.h>
+#include <gst/gst.h>
+
+#include "playoutDelay.h"
+
+/*
+ * The adaptive playout delay fed through its jitterbuffer probe, on a
+ * clock of the test's own. A DTX stream keeps its sequence numbers going
+ * through the silences but sends a comfort noise packet every 200 ms, or
+ * nothing at all: neither may pass for the packet time, or pad the delay.
+ * Media at 8 and 48 kHz must give the same packet time.
+ */
+
+#define PACKET_MS      20
+#define CN_INTERVAL_MS 200
+#define TALK_PACKETS   100
+#define SILENCE_MS     3000
+#define LATE_MS        150
+
+static void silence (const gchar* text){
+}
+
+GstClockTime fakeNow;
+
+GstClockTime fakeClock(){
+	return fakeNow;
+}
+
+// Comfort noise has no caps here, so its clock rate is asked for.
+static GstCaps* requestPtMap (GstElement* jitterbuffer, guint pt, gpointer data){
+	return rtpDtx_comfortNoiseCaps(pt);
+}
+
+typedef struct {
+	PlayoutDelay delay;
+	GstPad* pad;
+	guint payload;
+	guint comfortNoisePayload;
+	gint clockRate;
+	guint16 seq;
+	guint32 timestamp;
+	guint maxLatencyMs;
+} Stream;
+
+void startStream(Stream* stream, guint payload, guint comfortNoisePayload, gint clockRate){
+	memset (stream, 0, sizeof (Stream));
+
+	GstElement* jitterbuffer = gst_element_factory_make ("gstrtpjitterbuffer", NULL);
+	g_assert (jitterbuffer);
+	g_signal_connect (jitterbuffer, "request-pt-map", G_CALLBACK (requestPtMap), NULL);
+	g_object_set (G_OBJECT (jitterbuffer), "latency", PLAYOUT_DELAY_INITIAL_MS, NULL);
+
+	stream->delay.jitterbuffer = jitterbuffer;
+	stream->delay.now          = fakeClock;
+	stream->delay.payload      = -1;
+	stream->delay.latencyMs    = PLAYOUT_DELAY_INITIAL_MS;
+	stream->pad = gst_element_get_static_pad (jitterbuffer, "sink");
+
+	stream->payload             = payload;
+	stream->comfortNoisePayload = comfortNoisePayload;
+	stream->clockRate           = clockRate;
+	stream->seq                 = 65500;
+	stream->timestamp           = 0x12345678;
+	fakeNow = 1000 * GST_SECOND;
+}
+
+void stopStream(Stream* stream){
+	gst_object_unref (stream->pad);
+	gst_object_unref (stream->delay.jitterbuffer);
+}
+
+// Sends one packet of the next sequence number, arriving extraMs late.
+void sendPacket(Stream* stream, gboolean comfortNoise, guint advanceMs, guint extraMs){
+	stream->seq++;
+	stream->timestamp += advanceMs * stream->clockRate / 1000;
+	fakeNow += advanceMs * GST_MSECOND;
+
+	GstBuffer* buffer = gst_buffer_new_and_alloc (12 + 20);
+	guint8* data = GST_BUFFER_DATA (buffer);
+	memset (data, 0, GST_BUFFER_SIZE (buffer));
+	data[0] = 0x80;
+	data[1] = comfortNoise ? stream->comfortNoisePayload : stream->payload;
+	GST_WRITE_UINT16_BE (data + 2, stream->seq);
+	GST_WRITE_UINT32_BE (data + 4, stream->timestamp);
+	GST_WRITE_UINT32_BE (data + 8, 0x1234);
+
+	if (!comfortNoise){
+		GstCaps* caps = gst_caps_new_simple ("application/x-rtp",
+			"payload",    G_TYPE_INT, stream->payload,
+			"clock-rate", G_TYPE_INT, stream->clockRate,
+			NULL);
+		gst_buffer_set_caps (buffer, caps);
+		gst_caps_unref (caps);
+	}
+
+	GstClockTime sent = fakeNow;
+	fakeNow += extraMs * GST_MSECOND;
+	g_assert (playoutDelay_sinkProbe(stream->pad, buffer, &stream->delay));
+	fakeNow = sent;
+	gst_buffer_unref (buffer);
+
+	stream->maxLatencyMs = MAX (stream->maxLatencyMs, stream->delay.latencyMs);
+}
+
+// A little jitter, never more than 4 ms.
+void talk(Stream* stream, guint firstAdvanceMs){
+	int i;
+	for (i = 0; i < TALK_PACKETS; i++){
+		sendPacket(stream, FALSE, i ? PACKET_MS : firstAdvanceMs, (i % 3) * 2);
+	}
+}
+
+void testDtxStream(guint payload, guint comfortNoisePayload, gint clockRate){
+	Stream stream;
+	startStream(&stream, payload, comfortNoisePayload, clockRate);
+
+	talk(&stream, PACKET_MS);
+	g_assert (stream.delay.packetMs == PACKET_MS);
+
+	guint ms;
+	for (ms = 0; ms < SILENCE_MS; ms += CN_INTERVAL_MS){
+		sendPacket(&stream, TRUE, CN_INTERVAL_MS, 0);
+	}
+	g_assert (stream.delay.clockRate == clockRate);
+
+	talk(&stream, CN_INTERVAL_MS);
+
+	g_print ("%d Hz: packet %.1f ms, jitter %.2f ms, delay up to %u ms.\n", clockRate,
+		stream.delay.packetMs, stream.delay.jitterMs, stream.maxLatencyMs);
+	g_assert (stream.delay.packetMs == PACKET_MS);
+	g_assert (stream.delay.jitterMs < 4);
+	g_assert (stream.maxLatencyMs <= PLAYOUT_DELAY_INITIAL_MS);
+
+	stopStream(&stream);
+}
+
+// Silence without comfort noise: one packet jumps a second ahead.
+void testSilentGap(){
+	Stream stream;
+	startStream(&stream, 96, RTP_DTX_CN_PAYLOAD, 8000);
+
+	talk(&stream, PACKET_MS);
+	talk(&stream, 1000);
+	talk(&stream, 2000);
+
+	g_assert (stream.delay.packetMs == PACKET_MS);
+	g_assert (stream.delay.jitterMs < 4);
+	g_assert (stream.maxLatencyMs <= PLAYOUT_DELAY_INITIAL_MS);
+
+	stopStream(&stream);
+}
+
+// A packet late for the delay still grows it at once, comfort noise too.
+void testLatePacket(){
+	Stream stream;
+	startStream(&stream, 96, RTP_DTX_CN_PAYLOAD, 8000);
+
+	talk(&stream, PACKET_MS);
+	sendPacket(&stream, TRUE, CN_INTERVAL_MS, LATE_MS);
+	g_assert (stream.delay.latencyMs >= LATE_MS + PACKET_MS);
+
+	stopStream(&stream);
+}
+
+int main(int argc, char *argv[]){
+	gst_init (&argc, &argv);
+	g_set_print_handler (silence);
+
+	testDtxStream(96, RTP_DTX_CN_PAYLOAD, 8000);
+	testDtxStream(97, RTP_DTX_WIDE_CN_PAYLOAD, 48000);
+	testSilentGap();
+	testLatePacket();
+
+	g_printerr ("playoutDelayTest: ok.\n");
+	return 0;
+}
@@ -0,0 +1,169 @@
+#include <stdlib.h>
+#include <gst/gst.h>
+
+#include "rtpDtx.h"
+#include "testPads.h"
+
+/*
+ * Sequence numbers, RTP times, payload types and marker bits of the packets
+ * rtpdtx sends, for comfort noise inserted between 20 ms media packets.
+ */
+
+#define FRAME_MS      20
+#define MEDIA_PAYLOAD 2
+#define MEDIA_BYTES   80
+#define TEST_SSRC     0x12345678
+
+static void silence (const gchar* text){
+}
+
+// A payloader's packet for the given frame; gated frames never reach it.
+GstBuffer* mediaPacket(guint16 seq, int frame, gint clockRate){
+	GstBuffer* buffer = gst_buffer_new_and_alloc (RTP_DTX_HEADER_SIZE + MEDIA_BYTES);
+	guint8* data = GST_BUFFER_DATA (buffer);
+	memset (data, 0, GST_BUFFER_SIZE (buffer));
+	data[0] = 0x80;
+	data[1] = MEDIA_PAYLOAD;
+	GST_WRITE_UINT16_BE (data + 2, seq);
+	GST_WRITE_UINT32_BE (data + 4, 1000 + frame * FRAME_MS * clockRate / 1000);
+	GST_WRITE_UINT32_BE (data + 8, TEST_SSRC);
+	GST_BUFFER_TIMESTAMP (buffer) = frame * FRAME_MS * GST_MSECOND;
+
+	GstCaps* caps = gst_caps_new_simple ("application/x-rtp", "clock-rate", G_TYPE_INT, clockRate, NULL);
+	gst_buffer_set_caps (buffer, caps);
+	gst_caps_unref (caps);
+	return buffer;
+}
+
+void pushComfortNoise(TestPads* pads, int frame, gint level){
+	GstStructure* structure = gst_structure_new ("comfort-noise",
+		"timestamp", G_TYPE_UINT64, (guint64) frame * FRAME_MS * GST_MSECOND,
+		"level",     G_TYPE_INT,    level,
+		NULL);
+	g_assert (gst_pad_push_event (pads->src, gst_event_new_custom (GST_EVENT_CUSTOM_DOWNSTREAM, structure)));
+}
+
+GstBuffer* packet(TestPads* pads, guint n){
+	GstBuffer* buffer = (GstBuffer*) g_list_nth_data (pads->buffers, n);
+	g_assert (buffer);
+	return buffer;
+}
+
+guint packetPayload(GstBuffer* buffer){
+	return GST_BUFFER_DATA (buffer)[1] & 0x7F;
+}
+
+gboolean packetMarker(GstBuffer* buffer){
+	return (GST_BUFFER_DATA (buffer)[1] & 0x80) != 0;
+}
+
+guint16 packetSeq(GstBuffer* buffer){
+	return GST_READ_UINT16_BE (GST_BUFFER_DATA (buffer) + 2);
+}
+
+guint32 packetRtpTime(GstBuffer* buffer){
+	return GST_READ_UINT32_BE (GST_BUFFER_DATA (buffer) + 4);
+}
+
+guint32 packetSsrc(GstBuffer* buffer){
+	return GST_READ_UINT32_BE (GST_BUFFER_DATA (buffer) + 8);
+}
+
+/*
+ * Frames 0-2 are sent, 3-9 gated with comfort noise at 3 and 8, and the
+ * talkspurt resumes at 10. The payloader numbers only what it sent.
+ */
+void testComfortNoiseBetweenTalkspurts(gint clockRate, guint cnPayload){
+	TestPads pads;
+	testPads_start(&pads, "rtpdtx");
+
+	int frame;
+	for (frame = 0; frame < 3; frame++){
+		g_assert (gst_pad_push (pads.src, mediaPacket(100 + frame, frame, clockRate)) == GST_FLOW_OK);
+	}
+	pushComfortNoise(&pads, 3, 60);
+	pushComfortNoise(&pads, 8, 62);
+	g_assert (gst_pad_push (pads.src, mediaPacket(103, 10, clockRate)) == GST_FLOW_OK);
+	g_assert (gst_pad_push (pads.src, mediaPacket(104, 11, clockRate)) == GST_FLOW_OK);
+
+	g_assert (g_list_length (pads.buffers) == 7);
+
+	// The numbering is gapless and every packet keeps the stream's SSRC.
+	guint i;
+	for (i = 0; i < 7; i++){
+		g_assert (packetSeq(packet(&pads, i)) == 100 + i);
+		g_assert (packetSsrc(packet(&pads, i)) == TEST_SSRC);
+	}
+
+	// Comfort noise goes out at the RTP time of the frame it replaces.
+	GstBuffer* first = packet(&pads, 3);
+	g_assert (packetPayload(first) == cnPayload);
+	g_assert (!packetMarker(first));
+	g_assert (packetRtpTime(first) == 1000 + 3 * FRAME_MS * clockRate / 1000);
+	g_assert (rtpDtx_comfortNoiseLevel(first) == 60);
+
+	GstBuffer* second = packet(&pads, 4);
+	g_assert (packetPayload(second) == cnPayload);
+	g_assert (packetRtpTime(second) == 1000 + 8 * FRAME_MS * clockRate / 1000);
+	g_assert (rtpDtx_comfortNoiseLevel(second) == 62);
+
+	// Only the first packet of the new talkspurt is marked, its time untouched.
+	g_assert (packetPayload(packet(&pads, 5)) == MEDIA_PAYLOAD);
+	g_assert (packetMarker(packet(&pads, 5)));
+	g_assert (packetRtpTime(packet(&pads, 5)) == 1000 + 10 * FRAME_MS * clockRate / 1000);
+	g_assert (!packetMarker(packet(&pads, 6)));
+	g_assert (rtpDtx_comfortNoiseLevel(packet(&pads, 6)) == -1);
+
+	for (i = 0; i < 3; i++){
+		g_assert (!packetMarker(packet(&pads, i)));
+	}
+
+	gint sent;
+	g_object_get (G_OBJECT (pads.element), "comfort-noise-packets", &sent, NULL);
+	g_assert (sent == 2);
+
+	testPads_stop(&pads);
+}
+
+// Without a media packet there is no SSRC or RTP time to continue from.
+void testComfortNoiseBeforeMedia(){
+	TestPads pads;
+	testPads_start(&pads, "rtpdtx");
+
+	pushComfortNoise(&pads, 0, 60);
+	g_assert (!pads.buffers);
+
+	g_assert (gst_pad_push (pads.src, mediaPacket(7, 1, RTP_DTX_CLOCK_RATE)) == GST_FLOW_OK);
+	g_assert (g_list_length (pads.buffers) == 1);
+	g_assert (packetSeq(packet(&pads, 0)) == 7);
+	g_assert (!packetMarker(packet(&pads, 0)));
+
+	testPads_stop(&pads);
+}
+
+void testComfortNoiseCaps(){
+	g_assert (rtpDtx_isComfortNoisePayload(RTP_DTX_CN_PAYLOAD));
+	g_assert (rtpDtx_isComfortNoisePayload(RTP_DTX_WIDE_CN_PAYLOAD));
+	g_assert (!rtpDtx_isComfortNoisePayload(MEDIA_PAYLOAD));
+	g_assert (!rtpDtx_comfortNoiseCaps(MEDIA_PAYLOAD));
+
+	GstCaps* caps = rtpDtx_comfortNoiseCaps(RTP_DTX_WIDE_CN_PAYLOAD);
+	gint clockRate = 0;
+	g_assert (gst_structure_get_int (gst_caps_get_structure (caps, 0), "clock-rate", &clockRate));
+	g_assert (clockRate == RTP_DTX_WIDE_CLOCK_RATE);
+	gst_caps_unref (caps);
+}
+
+int main(int argc, char *argv[]){
+	gst_init (&argc, &argv);
+	gst_rtp_dtx_register();
+	g_set_print_handler (silence);
+
+	testComfortNoiseBetweenTalkspurts(RTP_DTX_CLOCK_RATE, RTP_DTX_CN_PAYLOAD);
+	testComfortNoiseBetweenTalkspurts(RTP_DTX_WIDE_CLOCK_RATE, RTP_DTX_WIDE_CN_PAYLOAD);
+	testComfortNoiseBeforeMedia();
+	testComfortNoiseCaps();
+
+	g_printerr ("rtpDtxTest: ok.\n");
+	return 0;
+}
@@ -0,0 +1,88 @@
+#ifndef TEST_PADS_H
+#define TEST_PADS_H
+
+#include <gst/gst.h>
+
+/*
+ * Drives one element from the tests: buffers and events are pushed into
+ * its sink pad from testPads.src, and whatever it pushes out is collected
+ * in order, custom downstream events as GstEvents and buffers as
+ * GstBuffers. Everything runs in the calling thread.
+ */
+
+typedef struct {
+	GstElement* element;
+	GstPad* src;
+	GstPad* sink;
+	GList* buffers;
+	GList* events;
+} TestPads;
+
+static GstStaticPadTemplate testPads_srcTemplate = GST_STATIC_PAD_TEMPLATE ("src",
+	GST_PAD_SRC, GST_PAD_ALWAYS, GST_STATIC_CAPS_ANY);
+
+static GstStaticPadTemplate testPads_sinkTemplate = GST_STATIC_PAD_TEMPLATE ("sink",
+	GST_PAD_SINK, GST_PAD_ALWAYS, GST_STATIC_CAPS_ANY);
+
+static GstFlowReturn testPads_chain (GstPad* pad, GstBuffer* buffer){
+	TestPads* pads = (TestPads*) g_object_get_data (G_OBJECT (pad), "test-pads");
+	pads->buffers = g_list_append (pads->buffers, buffer);
+	return GST_FLOW_OK;
+}
+
+static gboolean testPads_event (GstPad* pad, GstEvent* event){
+	TestPads* pads = (TestPads*) g_object_get_data (G_OBJECT (pad), "test-pads");
+	if (GST_EVENT_TYPE (event) == GST_EVENT_CUSTOM_DOWNSTREAM){
+		pads->events = g_list_append (pads->events, event);
+	} else {
+		gst_event_unref (event);
+	}
+	return TRUE;
+}
+
+void testPads_start(TestPads* pads, const gchar* factory){
+	pads->element = gst_element_factory_make (factory, NULL);
+	g_assert (pads->element);
+	pads->buffers = NULL;
+	pads->events  = NULL;
+
+	pads->src  = gst_pad_new_from_static_template (&testPads_srcTemplate, "src");
+	pads->sink = gst_pad_new_from_static_template (&testPads_sinkTemplate, "sink");
+	g_object_set_data (G_OBJECT (pads->sink), "test-pads", pads);
+	gst_pad_set_chain_function (pads->sink, testPads_chain);
+	gst_pad_set_event_function (pads->sink, testPads_event);
+
+	GstPad* elementSink = gst_element_get_static_pad (pads->element, "sink");
+	GstPad* elementSrc  = gst_element_get_static_pad (pads->element, "src");
+	g_assert (gst_pad_link (pads->src, elementSink) == GST_PAD_LINK_OK);
+	g_assert (gst_pad_link (elementSrc, pads->sink) == GST_PAD_LINK_OK);
+	gst_object_unref (elementSink);
+	gst_object_unref (elementSrc);
+
+	gst_pad_set_active (pads->src, TRUE);
+	gst_pad_set_active (pads->sink, TRUE);
+	g_assert (gst_element_set_state (pads->element, GST_STATE_PLAYING) == GST_STATE_CHANGE_SUCCESS);
+}
+
+// Forgets what was collected so far.
+void testPads_clear(TestPads* pads){
+	g_list_foreach (pads->buffers, (GFunc) gst_mini_object_unref, NULL);
+	g_list_foreach (pads->events, (GFunc) gst_mini_object_unref, NULL);
+	g_list_free (pads->buffers);
+	g_list_free (pads->events);
+	pads->buffers = NULL;
+	pads->events  = NULL;
+}
+
+void testPads_stop(TestPads* pads){
+	gst_element_set_state (pads->element, GST_STATE_NULL);
+	gst_pad_set_active (pads->src, FALSE);
+	gst_pad_set_active (pads->sink, FALSE);
+	testPads_clear(pads);
+
+	gst_object_unref (pads->element);
+	gst_object_unref (pads->src);
+	gst_object_unref (pads->sink);
+}
+
+#endif
@@ -0,0 +1,106 @@
+#ifndef VOICE_ACTIVITY_H
+#define VOICE_ACTIVITY_H
+
+#include <math.h>
+#include <gst/gst.h>
+
+/*
+ * Energy based voice activity detector for 8 kHz S16 audio.
+ *
+ * The background noise level is tracked per call: it follows the signal
+ * down quickly and creeps up slowly, so it settles on the quiet parts
+ * between words. Audio counts as speech when it is VOICE_ACTIVITY_MARGIN_DB
+ * above that level and above an absolute floor. Speech is held for a
+ * hangover after the last active block, so word endings and short pauses
+ * are not clipped.
+ *
+ * Levels are in dBov as RFC 3389 uses them: 0 is a full scale square wave,
+ * 127 digital silence.
+ */
+
+#define VOICE_ACTIVITY_RATE             8000
+#define VOICE_ACTIVITY_MARGIN_DB        9.0
+#define VOICE_ACTIVITY_FLOOR_DBOV       55.0
+#define VOICE_ACTIVITY_NOISE_FALL_MS    20.0
+#define VOICE_ACTIVITY_NOISE_RISE_MS    4000.0
+#define VOICE_ACTIVITY_MAX_LEVEL        127
+#define VOICE_ACTIVITY_DEFAULT_HANGOVER_MS 200
+
+typedef struct {
+	gboolean started;
+	gdouble noisePower;
+	guint hangoverSamples;
+	guint hangoverLeft;
+	gboolean speech;
+} VoiceActivity;
+
+void voiceActivity_init(VoiceActivity* vad, guint hangoverMs){
+	vad->started         = FALSE;
+	vad->noisePower      = 0;
+	vad->hangoverSamples = hangoverMs * VOICE_ACTIVITY_RATE / 1000;
+	vad->hangoverLeft    = 0;
+	vad->speech          = FALSE;
+}
+
+// Mean power relative to full scale.
+gdouble voiceActivity_power(const gint16* samples, guint count){
+	gint64 sum = 0;
+	guint i;
+	for (i = 0; i < count; i++){
+		sum += (gint32) samples[i] * samples[i];
+	}
+	return count ? (gdouble) sum / count / (32768.0 * 32768.0) : 0;
+}
+
+guint voiceActivity_level(gdouble power){
+	if (power <= 0){
+		return VOICE_ACTIVITY_MAX_LEVEL;
+	}
+	gdouble level = -10 * log10 (power);
+	return (guint) CLAMP (level + 0.5, 0, VOICE_ACTIVITY_MAX_LEVEL);
+}
+
+gdouble voiceActivity_powerOfLevel(guint level){
+	return level >= VOICE_ACTIVITY_MAX_LEVEL ? 0 : pow (10, -(gdouble) level / 10);
+}
+
+/*
+ * Feeds a block of samples of any length and returns whether it is speech,
+ * hangover included.
+ */
+gboolean voiceActivity_update(VoiceActivity* vad, const gint16* samples, guint count){
+	if (!count){
+		return vad->speech;
+	}
+
+	gdouble power = voiceActivity_power(samples, count);
+
+	if (!vad->started){
+		vad->started    = TRUE;
+		vad->noisePower = power;
+	}
+
+	// Smoothing scaled to the block length, so any buffer size tracks alike.
+	gdouble blockMs = count * 1000.0 / VOICE_ACTIVITY_RATE;
+	gdouble timeMs  = power < vad->noisePower ? VOICE_ACTIVITY_NOISE_FALL_MS : VOICE_ACTIVITY_NOISE_RISE_MS;
+	vad->noisePower += (power - vad->noisePower) * (1 - exp (-blockMs / timeMs));
+
+	gboolean active = power > vad->noisePower * pow (10, VOICE_ACTIVITY_MARGIN_DB / 10)
+		&& power > voiceActivity_powerOfLevel(VOICE_ACTIVITY_FLOOR_DBOV);
+
+	if (active){
+		vad->hangoverLeft = vad->hangoverSamples;
+	} else {
+		vad->hangoverLeft -= MIN (vad->hangoverLeft, count);
+	}
+
+	vad->speech = active || vad->hangoverLeft > 0;
+	return vad->speech;
+}
+
+// The background noise as a comfort noise level.
+guint voiceActivity_noiseLevel(VoiceActivity* vad){
+	return voiceActivity_level(vad->noisePower);
+}
+
+#endif
@@ -0,0 +1,217 @@
+#ifndef LOOPBACK_LATENCY_H
+#define LOOPBACK_LATENCY_H
+
+#include <stdlib.h>
+#include <gst/gst.h>
+
+/*
+ * Round trip measurement for an output looped back to the input, by a cable
+ * or by a speaker next to the microphone.
+ *
+ * A generator plays silence with a short full scale click every
+ * LOOPBACK_LATENCY_INTERVAL; its probe writes the click into the buffer and
+ * notes the click's running time. The capture's probe looks for the first
+ * sample at or above the threshold after that time. Both sides are stamped
+ * on the pipeline clock: a generated buffer is played at its timestamp plus
+ * the pipeline latency, and a captured buffer is stamped with the time it
+ * was recorded. So the difference is what a sample of the echo spends from
+ * the microphone to the speaker: the pipeline latency plus whatever the
+ * converters and the driver add on top of it.
+ *
+ * A click not heard within LOOPBACK_LATENCY_TIMEOUT is counted as lost.
+ * Samples are 16-bit; a click is written to every channel and any channel
+ * may hear it.
+ */
+
+#define LOOPBACK_LATENCY_INTERVAL      (500 * GST_MSECOND)
+#define LOOPBACK_LATENCY_TIMEOUT       (400 * GST_MSECOND)
+#define LOOPBACK_LATENCY_CLICK_SAMPLES 8
+#define LOOPBACK_LATENCY_THRESHOLD     8000
+
+typedef struct {
+	guint rounds;
+	guint threshold;
+	GSourceFunc finished;
+
+	// Generator thread only.
+	GstClockTime nextClick;
+
+	// Guarded by the lock, shared with the capture thread.
+	GMutex* lock;
+	GstClockTime pendingClick;
+	guint heard;
+	guint lost;
+	GstClockTime min;
+	GstClockTime max;
+	GstClockTime total;
+	gboolean done;
+} LoopbackLatency;
+
+void loopbackLatency_init(LoopbackLatency* meter, guint rounds, guint threshold, GSourceFunc finished){
+	meter->rounds    = rounds;
+	meter->threshold = threshold;
+	meter->finished  = finished;
+
+	meter->nextClick = GST_CLOCK_TIME_NONE;
+
+	meter->lock         = g_mutex_new ();
+	meter->pendingClick = GST_CLOCK_TIME_NONE;
+	meter->heard = 0;
+	meter->lost  = 0;
+	meter->min   = GST_CLOCK_TIME_NONE;
+	meter->max   = 0;
+	meter->total = 0;
+	meter->done  = FALSE;
+}
+
+static void loopbackLatency_format(GstBuffer* buffer, gint* rate, gint* channels){
+	GstStructure* structure = gst_caps_get_structure (GST_BUFFER_CAPS (buffer), 0);
+	*rate     = 0;
+	*channels = 1;
+	gst_structure_get_int (structure, "rate", rate);
+	gst_structure_get_int (structure, "channels", channels);
+}
+
+// Called with the lock held. The program is told once, from the main loop.
+static void loopbackLatency_countRound(LoopbackLatency* meter){
+	if (!meter->done && meter->heard + meter->lost >= meter->rounds){
+		meter->done = TRUE;
+		g_idle_add (meter->finished, meter);
+	}
+}
+
+static gboolean loopbackLatency_clickProbe(GstPad* pad, GstBuffer* buffer, gpointer data){
+	LoopbackLatency* meter = (LoopbackLatency*) data;
+
+	gint rate, channels;
+	loopbackLatency_format(buffer, &rate, &channels);
+
+	GstClockTime start = GST_BUFFER_TIMESTAMP (buffer);
+	guint frames = GST_BUFFER_SIZE (buffer) / (2 * channels);
+	if (!rate || !GST_CLOCK_TIME_IS_VALID (start)){
+		return TRUE;
+	}
+
+	// The first click waits for the devices to settle.
+	if (!GST_CLOCK_TIME_IS_VALID (meter->nextClick)){
+		meter->nextClick = start + LOOPBACK_LATENCY_INTERVAL;
+	}
+	if (meter->nextClick < start){
+		meter->nextClick = start;
+	}
+
+	guint64 offset = gst_util_uint64_scale (meter->nextClick - start, rate, GST_SECOND);
+	if (offset >= frames){
+		return TRUE;
+	}
+
+	gint16* samples = (gint16*) GST_BUFFER_DATA (buffer);
+	guint end = MIN (frames, offset + LOOPBACK_LATENCY_CLICK_SAMPLES);
+	guint i;
+	for (i = offset * channels; i < end * channels; i++){
+		samples[i] = G_MAXINT16;
+	}
+
+	GstClockTime click = start + gst_util_uint64_scale (offset, GST_SECOND, rate);
+
+	g_mutex_lock (meter->lock);
+	if (GST_CLOCK_TIME_IS_VALID (meter->pendingClick)){
+		meter->lost++;
+		loopbackLatency_countRound(meter);
+	}
+	meter->pendingClick = meter->done ? GST_CLOCK_TIME_NONE : click;
+	g_mutex_unlock (meter->lock);
+
+	meter->nextClick = click + LOOPBACK_LATENCY_INTERVAL;
+	return TRUE;
+}
+
+static void loopbackLatency_record(LoopbackLatency* meter, GstClockTime roundTrip){
+	meter->heard++;
+	meter->total += roundTrip;
+	meter->min = MIN (meter->min, roundTrip);
+	meter->max = MAX (meter->max, roundTrip);
+	g_print ("\tClick %u heard after %.2f ms.\n", meter->heard, roundTrip / 1e6);
+}
+
+static gboolean loopbackLatency_captureProbe(GstPad* pad, GstBuffer* buffer, gpointer data){
+	LoopbackLatency* meter = (LoopbackLatency*) data;
+
+	gint rate, channels;
+	loopbackLatency_format(buffer, &rate, &channels);
+
+	GstClockTime start = GST_BUFFER_TIMESTAMP (buffer);
+	if (!rate || !GST_CLOCK_TIME_IS_VALID (start)){
+		return TRUE;
+	}
+
+	g_mutex_lock (meter->lock);
+
+	GstClockTime click = meter->pendingClick;
+	if (!GST_CLOCK_TIME_IS_VALID (click)){
+		g_mutex_unlock (meter->lock);
+		return TRUE;
+	}
+
+	const gint16* samples = (const gint16*) GST_BUFFER_DATA (buffer);
+	guint count = GST_BUFFER_SIZE (buffer) / 2;
+	guint i;
+	for (i = 0; i < count; i++){
+		if ((guint) abs (samples[i]) < meter->threshold){
+			continue;
+		}
+		GstClockTime heard = start + gst_util_uint64_scale (i / channels, GST_SECOND, rate);
+		if (heard < click){
+			continue;
+		}
+		loopbackLatency_record(meter, heard - click);
+		meter->pendingClick = GST_CLOCK_TIME_NONE;
+		loopbackLatency_countRound(meter);
+		break;
+	}
+
+	if (GST_CLOCK_TIME_IS_VALID (meter->pendingClick) && start > click + LOOPBACK_LATENCY_TIMEOUT){
+		g_print ("\tClick not heard.\n");
+		meter->lost++;
+		meter->pendingClick = GST_CLOCK_TIME_NONE;
+		loopbackLatency_countRound(meter);
+	}
+
+	g_mutex_unlock (meter->lock);
+	return TRUE;
+}
+
+/*
+ * Puts the probes on the generator's and the capture's source pads. The
+ * generator must produce writable 16-bit silence.
+ */
+void loopbackLatency_attach(LoopbackLatency* meter, GstElement* generator, GstElement* capture){
+	GstPad* pad = gst_element_get_static_pad (generator, "src");
+	gst_pad_add_buffer_probe (pad, G_CALLBACK (loopbackLatency_clickProbe), meter);
+	gst_object_unref (pad);
+
+	pad = gst_element_get_static_pad (capture, "src");
+	gst_pad_add_buffer_probe (pad, G_CALLBACK (loopbackLatency_captureProbe), meter);
+	gst_object_unref (pad);
+}
+
+// Returns FALSE when no click was heard at all.
+gboolean loopbackLatency_report(LoopbackLatency* meter){
+	g_mutex_lock (meter->lock);
+
+	gboolean heard = meter->heard > 0;
+	if (heard){
+		g_print ("Round trip latency over %u clicks: min %.2f ms, avg %.2f ms, max %.2f ms.\n",
+			meter->heard, meter->min / 1e6, meter->total / meter->heard / 1e6, meter->max / 1e6);
+	} else {
+		g_print ("No click was heard. Is the output looped back to the input?\n");
+	}
+	if (meter->lost){
+		g_print ("%u clicks were not heard; a lower --threshold may help.\n", meter->lost);
+	}
+
+	g_mutex_unlock (meter->lock);
+	return heard;
+}
+
+#endif
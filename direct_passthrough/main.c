@@ -1,35 +1,168 @@
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sched.h>
 #include <gst/gst.h>
 
+#include "latencyTracer.h"
+#include "loopbackLatency.h"
+
+void getParametersOrExit(int argc, char *argv[]);
+void getParameters(int argc, char *argv[]);
+void printParameters();
+gboolean isAlsaUsed();
+
 void createElementsOrExit();
 void createElements();
+GstElement* createAudioSource();
+GstElement* createAudioSink();
+void setAlsaParameters(GstElement* element);
+GstElement* createClickSource();
+GstElement* createCaptureSink();
 void exitOnInvalidElement();
 
+void linkElements();
+void linkFiltered(GstElement* src, GstElement* dest);
+void attachLoopbackLatency();
+static gboolean loopbackLatencyFinished (gpointer data);
+
 void registerBusCall();
+static GstBusSyncReply busSync (GstBus *bus, GstMessage *msg, gpointer data);
 static gboolean busCall (GstBus *bus, GstMessage *msg, gpointer data);
+void setRealtimeScheduling();
+void printPipelineLatency();
 
 void runLoop();
 void cleanUp();
 
+#define EXIT_NORMAL 0
+#define EXIT_ELEMENT_CREATION_FAILURE -1
+#define EXIT_ELEMENT_LINKING_FAILURE  -2
+#define EXIT_INVALID_PARAMETERS       -5
+#define EXIT_NOT_MEASURED             -6
+
+// --low-latency: four 2.5 ms ALSA periods.
+#define LOW_LATENCY_BUFFER_TIME  10000
+#define LOW_LATENCY_LATENCY_TIME 2500
+
+// GStreamer's own period, used by autoaudiosrc.
+#define DEFAULT_LATENCY_TIME 10000
+
+#define DEFAULT_ALSA_DEVICE "default"
+#define REALTIME_PRIORITY   70
+#define MEASURE_RATE        48000
+
+#define SAMPLE_CAPS \
+	"audio/x-raw-int, width = (int) 16, depth = (int) 16, " \
+	"signed = (boolean) true, endianness = (int) BYTE_ORDER"
+
+gboolean lowLatency = FALSE;
+int bufferTime = 0;
+int latencyTime = 0;
+gchar* alsaDevice = 0;
+gboolean realtime = FALSE;
+int measureRounds = 0;
+int threshold = LOOPBACK_LATENCY_THRESHOLD;
+
+static GOptionEntry options[] = {
+	{ "low-latency", 'l', 0, G_OPTION_ARG_NONE, &lowLatency,
+		"Echo through ALSA with a 10 ms buffer in 2.5 ms periods", NULL },
+	{ "buffer-time", 'b', 0, G_OPTION_ARG_INT, &bufferTime,
+		"ALSA buffer size in microseconds", "US" },
+	{ "latency-time", 't', 0, G_OPTION_ARG_INT, &latencyTime,
+		"ALSA period size in microseconds", "US" },
+	{ "device", 'd', 0, G_OPTION_ARG_STRING, &alsaDevice,
+		"ALSA device, e.g. hw:0 to bypass dmix (default: default)", "DEVICE" },
+	{ "realtime", 'R', 0, G_OPTION_ARG_NONE, &realtime,
+		"Run the streaming threads with real-time (SCHED_FIFO) priority", NULL },
+	{ "measure", 'm', 0, G_OPTION_ARG_INT, &measureRounds,
+		"Play N clicks into an output looped back to the input and report the round trip latency", "N" },
+	{ "threshold", 0, 0, G_OPTION_ARG_INT, &threshold,
+		"Captured level which counts as a click (default: 8000)", "LEVEL" },
+	{ NULL }
+};
+
 GMainLoop *loop;
 
 GstElement *pipeline, *source, *sink;
 
+// Only with --measure: the clicks played and the capture they are heard in.
+GstElement *clickSource, *captureSink;
+LoopbackLatency loopbackLatency;
+
+int exitCode = EXIT_NORMAL;
+
 int main(int argc, char *argv[]) {
     gst_init(NULL, NULL);
-	
+
+	getParametersOrExit(argc, argv);
+
 	loop = g_main_loop_new (NULL, FALSE);
 
 	createElementsOrExit();
 	registerBusCall();
-
-	gst_bin_add_many (GST_BIN (pipeline), source, sink, NULL);
-	gst_element_link (source, sink);
+	linkElements();
+	latencyTracer_attach(pipeline);
 
 	runLoop();
-	cleanUp(); // Under normal conditions this method will never be called
+	cleanUp(); // Only reached once a measurement is done, or on an error
+
+    return exitCode;
+}
+
+void getParametersOrExit(int argc, char *argv[]){
+	getParameters(argc, argv);
+	printParameters();
+}
+
+void getParameters(int argc, char *argv[]){
+	GError* error = 0;
+	GOptionContext* context = g_option_context_new (NULL);
+	g_option_context_add_main_entries (context, options, NULL);
+
+	if (!g_option_context_parse (context, &argc, &argv, &error)){
+		g_printerr ("%s\n", error->message);
+		exit(EXIT_INVALID_PARAMETERS);
+	}
+	g_option_context_free (context);
+
+	if (lowLatency){
+		bufferTime  = bufferTime  ? bufferTime  : LOW_LATENCY_BUFFER_TIME;
+		latencyTime = latencyTime ? latencyTime : LOW_LATENCY_LATENCY_TIME;
+	}
+}
 
-    return 0;
+void printParameters(){
+	if (bufferTime < 0 || latencyTime < 0 || (bufferTime && latencyTime > bufferTime)){
+		g_printerr ("Invalid buffer or latency time: %d/%d us.\n", bufferTime, latencyTime);
+		exit(EXIT_INVALID_PARAMETERS);
+	}
+	if (measureRounds < 0 || threshold <= 0 || threshold > G_MAXINT16){
+		g_printerr ("Invalid measurement: %d clicks, threshold %d.\n", measureRounds, threshold);
+		exit(EXIT_INVALID_PARAMETERS);
+	}
+
+	if (!isAlsaUsed()){
+		return;
+	}
+
+	g_print ("Audio parameters:\n");
+	g_print ("\tALSA device : %s.\n", alsaDevice ? alsaDevice : DEFAULT_ALSA_DEVICE);
+	if (bufferTime){
+		g_print ("\tBuffer time : %d us.\n", bufferTime);
+	}
+	if (latencyTime){
+		g_print ("\tLatency time: %d us.\n", latencyTime);
+	}
+}
+
+/*
+ * autoaudiosrc and autoaudiosink create their device elements only when
+ * they start, so buffer sizes can only be set on ALSA elements made here.
+ */
+gboolean isAlsaUsed(){
+	return bufferTime || latencyTime || alsaDevice;
 }
 
 void createElementsOrExit(){
@@ -39,23 +172,164 @@ void createElementsOrExit(){
 
 void createElements(){
 	pipeline = gst_pipeline_new ("audio-echo");
-	source   = gst_element_factory_make ("autoaudiosrc", "audio-input");
-	sink     = gst_element_factory_make ("autoaudiosink", "audio-output");
+	source   = createAudioSource();
+	sink     = createAudioSink();
+
+	if (measureRounds){
+		clickSource = createClickSource();
+		captureSink = createCaptureSink();
+	}
+}
+
+GstElement* createAudioSource(){
+	if (!isAlsaUsed()){
+		return gst_element_factory_make ("autoaudiosrc", "audio-input");
+	}
+	GstElement* elem = gst_element_factory_make ("alsasrc", "audio-input");
+	setAlsaParameters(elem);
+	return elem;
+}
+
+GstElement* createAudioSink(){
+	if (!isAlsaUsed()){
+		return gst_element_factory_make ("autoaudiosink", "audio-output");
+	}
+	GstElement* elem = gst_element_factory_make ("alsasink", "audio-output");
+	setAlsaParameters(elem);
+	return elem;
+}
+
+/*
+ * latency-time is the ALSA period and buffer-time the whole ring; the
+ * source's period is also the pipeline latency the sink plays with.
+ */
+void setAlsaParameters(GstElement* element){
+	if (!element){
+		return;
+	}
+	if (alsaDevice){
+		g_object_set (G_OBJECT (element), "device", alsaDevice, NULL);
+	}
+	if (bufferTime){
+		g_object_set (G_OBJECT (element), "buffer-time", (gint64) bufferTime, NULL);
+	}
+	if (latencyTime){
+		g_object_set (G_OBJECT (element), "latency-time", (gint64) latencyTime, NULL);
+	}
+}
+
+/*
+ * Live silence for the clicks, in buffers as long as a capture period so
+ * the measured pipeline runs with the echo's latency.
+ */
+GstElement* createClickSource(){
+	GstElement* elem = gst_element_factory_make ("audiotestsrc", "click-source");
+	if (!elem){
+		return 0;
+	}
+	gint period = latencyTime ? latencyTime : DEFAULT_LATENCY_TIME;
+	g_object_set (G_OBJECT (elem),
+		"is-live", TRUE,
+		"wave", 4, // silence
+		"samplesperbuffer", (gint) ((gint64) MEASURE_RATE * period / 1000000),
+		NULL);
+	return elem;
+}
+
+// The capture is only listened to for clicks, never played back.
+GstElement* createCaptureSink(){
+	GstElement* elem = gst_element_factory_make ("fakesink", "capture-sink");
+	if (elem){
+		g_object_set (G_OBJECT (elem), "sync", FALSE, "async", FALSE, NULL);
+	}
+	return elem;
 }
 
 void exitOnInvalidElement(){
-	if (!pipeline || !source || !sink) {
+	if (!pipeline || !source || !sink || (measureRounds && (!clickSource || !captureSink))) {
 		g_printerr ("One element could not be created. Exiting.\n");
-		exit(-1);
+		exit(EXIT_ELEMENT_CREATION_FAILURE);
+	}
+}
+
+/*
+ * The echo links the input straight to the output. A measurement plays
+ * clicks instead and takes the input apart from the output.
+ */
+void linkElements(){
+	if (!measureRounds){
+		gst_bin_add_many (GST_BIN (pipeline), source, sink, NULL);
+		gst_element_link (source, sink);
+		return;
+	}
+
+	gst_bin_add_many (GST_BIN (pipeline), clickSource, sink, source, captureSink, NULL);
+	linkFiltered(clickSource, sink);
+	linkFiltered(source, captureSink);
+	attachLoopbackLatency();
+}
+
+// Clicks are written and detected as 16-bit samples.
+void linkFiltered(GstElement* src, GstElement* dest){
+	GstCaps* caps = gst_caps_from_string (SAMPLE_CAPS);
+	if (!gst_element_link_filtered (src, dest, caps)){
+		g_printerr ("Failed to link %s and %s.\n", GST_ELEMENT_NAME (src), GST_ELEMENT_NAME (dest));
+		exit(EXIT_ELEMENT_LINKING_FAILURE);
 	}
+	gst_caps_unref (caps);
+}
+
+void attachLoopbackLatency(){
+	g_print ("Measuring round trip latency with %d clicks.\n", measureRounds);
+	loopbackLatency_init(&loopbackLatency, measureRounds, threshold, loopbackLatencyFinished);
+	loopbackLatency_attach(&loopbackLatency, clickSource, source);
+}
+
+static gboolean loopbackLatencyFinished (gpointer data){
+	if (!loopbackLatency_report((LoopbackLatency*) data)){
+		exitCode = EXIT_NOT_MEASURED;
+	}
+	g_main_loop_quit (loop);
+	return FALSE;
 }
 
 void registerBusCall(){
 	GstBus* bus = gst_pipeline_get_bus (GST_PIPELINE (pipeline));
+	if (realtime){
+		gst_bus_set_sync_handler (bus, busSync, NULL);
+	}
 	gst_bus_add_watch (bus, busCall, loop);
 	gst_object_unref (bus);
 }
 
+// Streaming threads post their STREAM_STATUS "enter" from the new thread.
+static GstBusSyncReply busSync (GstBus *bus, GstMessage *msg, gpointer data){
+	if (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_STREAM_STATUS){
+		GstStreamStatusType type;
+		GstElement* owner;
+		gst_message_parse_stream_status (msg, &type, &owner);
+
+		if (type == GST_STREAM_STATUS_TYPE_ENTER){
+			setRealtimeScheduling();
+		}
+	}
+	return GST_BUS_PASS;
+}
+
+/*
+ * Needs CAP_SYS_NICE or an rtprio limit (see limits.conf); without them
+ * the thread keeps its normal priority.
+ */
+void setRealtimeScheduling(){
+	struct sched_param param;
+	memset (&param, 0, sizeof (param));
+	param.sched_priority = REALTIME_PRIORITY;
+
+	if (sched_setscheduler (0, SCHED_FIFO, &param) != 0){
+		g_printerr ("No real-time priority for a streaming thread: %s.\n", g_strerror (errno));
+	}
+}
+
 static gboolean busCall (GstBus *bus, GstMessage *msg, gpointer data) {
 
 	GMainLoop *loop = (GMainLoop *) data;
@@ -81,6 +355,15 @@ static gboolean busCall (GstBus *bus, GstMessage *msg, gpointer data) {
 			break;
 		}
 
+		case GST_MESSAGE_STATE_CHANGED: {
+			GstState newState;
+			gst_message_parse_state_changed (msg, NULL, &newState, NULL);
+			if (GST_MESSAGE_SRC (msg) == GST_OBJECT (pipeline) && newState == GST_STATE_PLAYING){
+				printPipelineLatency();
+			}
+			break;
+		}
+
 		default:
 			break;
 	}
@@ -88,6 +371,18 @@ static gboolean busCall (GstBus *bus, GstMessage *msg, gpointer data) {
 	return TRUE;
 }
 
+// What the sink plays behind the capture, before the devices' own delay.
+void printPipelineLatency(){
+	GstQuery* query = gst_query_new_latency ();
+	if (gst_element_query (pipeline, query)){
+		gboolean live;
+		GstClockTime min, max;
+		gst_query_parse_latency (query, &live, &min, &max);
+		g_print ("Pipeline latency: %.2f ms.\n", min / 1e6);
+	}
+	gst_query_unref (query);
+}
+
 void runLoop(){
 	gst_element_set_state (pipeline, GST_STATE_PLAYING);
 	g_print ("Running...\n");
@@ -97,8 +392,8 @@ void runLoop(){
 void cleanUp(){
 	g_print ("Returned, stopping playback\n");
 	gst_element_set_state (pipeline, GST_STATE_NULL);
+	latencyTracer_dump();
 
 	g_print ("Deleting pipeline\n");
 	gst_object_unref (GST_OBJECT (pipeline));
 }
-
@@ -0,0 +1,1051 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <math.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <gst/gst.h>
+#include <gst/app/gstappsrc.h>
+#include <gst/app/gstappsink.h>
+
+#include "g726Enc.h"
+#include "g726Dec.h"
+
+/*
+ * Synthetic callers for phone_server.
+ *
+ * Every caller is a UDP socket on its own local port, sending hand-built
+ * G.726 RTP packets with its own SSRC every 20 ms. The payload is taken from
+ * patterns encoded once at startup, so the load on the generator itself is
+ * just a sendto() per packet and the measured numbers belong to the server.
+ *
+ * A few callers talk at a time, in turns; caller 0 sends a short probe tone
+ * every two seconds and caller 1 decodes what the server sends back and
+ * times when the probe arrives in the mix.
+ *
+ * With --bye a caller hanging up says so with an RTCP BYE, on the port
+ * its RTP goes to, instead of just going quiet.
+ *
+ * With --listener-port caller 1 calls another port of the server host,
+ * where a trunked phone_server shares the room, so the probe is timed
+ * across the trunk.
+ *
+ * With --churn the calls do not end after a fixed time: the callers other
+ * than these two hang up and call again, one every "ramp" milliseconds,
+ * until the given number of calls has been made, while the server's
+ * resident memory is sampled to see that it stays flat.
+ *
+ * While everybody is joined the mix each caller gets back is timed against
+ * its RTP timestamps: a packet arriving later after the previous one than
+ * the audio between them lasts is a gap in the caller's audio. Joins and
+ * leaves of the others must not cause any, which --max-gap checks.
+ */
+
+typedef struct {
+	guint8* data;
+	guint frames;
+} Pattern;
+
+typedef struct {
+	int index;
+	int fd;
+	int localPort;
+	guint32 ssrc;
+	guint16 seq;
+	guint32 timestamp;
+
+	gboolean joined;
+	guint rejoins;
+	gint64 firstSent;
+	guint64 sent;
+
+	gint64 firstReceived;
+	gint64 lastReceived;
+	guint64 received;
+	gboolean haveSeq;
+	guint32 baseSeq;
+	guint32 maxSeq;
+
+	guint32 lastTimestamp;
+	gint64 maxGap;
+	guint gaps;
+} Caller;
+
+void getParametersOrExit(int argc, char *argv[]);
+void getParameters(int argc, char *argv[]);
+void printParameters();
+
+void createPatternsOrExit();
+void encodePatternOrExit(Pattern* pattern, const gchar* source);
+
+void openCallersOrExit();
+void openCallerOrExit(Caller* caller, int index);
+
+void createListenerOrExit();
+static GstFlowReturn listenerNewBuffer(GstAppSink* sink, gpointer data);
+gdouble probeShare(const gint16* samples, guint count);
+void feedListener(const guint8* packet, gssize size);
+
+void startReceiver();
+static gpointer receiverRun(gpointer data);
+void receivePacket(Caller* caller, const guint8* packet, gssize size, gint64 now);
+void measureGap(Caller* caller, guint32 timestamp, gint64 now);
+
+void runCalls();
+gboolean churnTick(gint64 elapsed);
+void rejoinCaller(Caller* caller);
+void sampleServerRss(gboolean final);
+void sendTick(guint64 tick, gint64 elapsed);
+const Pattern* choosePattern(int index, guint64 tick);
+void sendPacket(Caller* caller, const Pattern* pattern, guint64 tick, gint64 now);
+void sendBye(Caller* caller);
+struct sockaddr_in* callerServer(Caller* caller);
+
+void waitForSilence();
+void stopReceiver();
+
+gint64 nowNs();
+void sleepUntil(gint64 deadline);
+gboolean readServerCpuTicks(guint64* ticks);
+gboolean readServerRss(guint64* bytes);
+
+int printReport();
+void cleanUp();
+
+#define EXIT_NORMAL 0
+#define EXIT_INVALID_PARAMETERS       -1
+#define EXIT_ELEMENT_CREATION_FAILURE -2
+#define EXIT_SOCKET_FAILURE           -3
+#define EXIT_NO_TRAFFIC               -4
+#define EXIT_RSS_GROWTH               -5
+#define EXIT_OUTPUT_GAP               -6
+
+#define DEFAULT_UDP_PORT 9559
+
+#define SAMPLE_RATE   8000
+#define FRAME_SAMPLES 160
+#define FRAME_BYTES   80
+#define FRAME_NS      (20 * GST_MSECOND)
+#define PATTERN_FRAMES 50
+
+#define RTP_HEADER_SIZE  12
+#define RTP_PAYLOAD_TYPE 96
+#define RTCP_RR          201
+#define RTCP_BYE         203
+#define MAX_PACKET_SIZE  1500
+
+#define PROBE_PERIOD_TICKS 100
+#define PROBE_LENGTH_TICKS 10
+#define PROBE_FREQUENCY    1700
+#define PROBE_SHARE        0.5
+#define QUIET_NS           (3 * GST_SECOND)
+#define GAP_NS             (3 * FRAME_NS)
+
+#define CHURN_SAMPLE_REJOINS 1000
+#define CHURN_WARMUP_PERCENT 10
+
+gchar* serverHost = "127.0.0.1";
+int serverPort    = DEFAULT_UDP_PORT;
+
+int callersCount  = 10;
+int duration      = 30;
+int ramp          = 20;
+int talkersCount  = 3;
+int basePort      = 20000;
+int serverPid     = 0;
+int leaveTimeout  = 30;
+int churn         = 0;
+int rssGrowth     = 10;
+int listenerPort  = 0;
+gboolean bye      = FALSE;
+int maxGap        = 0;
+
+GOptionEntry options[] = {
+	{ "callers", 'n', 0, G_OPTION_ARG_INT, &callersCount,
+		"Number of simulated callers (default: 10)", "N" },
+	{ "duration", 'd', 0, G_OPTION_ARG_INT, &duration,
+		"Seconds to talk once every caller has joined (default: 30)", "S" },
+	{ "ramp", 'r', 0, G_OPTION_ARG_INT, &ramp,
+		"Milliseconds between two joins (default: 20)", "MS" },
+	{ "talkers", 't', 0, G_OPTION_ARG_INT, &talkersCount,
+		"Callers talking at the same time (default: 3)", "K" },
+	{ "base-port", 'b', 0, G_OPTION_ARG_INT, &basePort,
+		"Local port of the first caller (default: 20000)", "P" },
+	{ "server-pid", 'p', 0, G_OPTION_ARG_INT, &serverPid,
+		"Process id of phone_server, to measure its CPU time", "PID" },
+	{ "leave-timeout", 'l', 0, G_OPTION_ARG_INT, &leaveTimeout,
+		"Seconds to wait for the server to drop the callers (default: 30)", "S" },
+	{ "churn", 'c', 0, G_OPTION_ARG_INT, &churn,
+		"Instead of a fixed duration, make N more calls, one every ramp, and check the server's memory", "N" },
+	{ "rss-growth", 'g', 0, G_OPTION_ARG_INT, &rssGrowth,
+		"Growth of the server's resident memory allowed with --churn (default: 10 %)", "PERCENT" },
+	{ "bye", 'y', 0, G_OPTION_ARG_NONE, &bye,
+		"Hang up with an RTCP BYE instead of just going quiet", NULL },
+	{ "listener-port", 'L', 0, G_OPTION_ARG_INT, &listenerPort,
+		"Make caller 1 call this port of the server host, e.g. a trunked server", "PORT" },
+	{ "max-gap", 'G', 0, G_OPTION_ARG_INT, &maxGap,
+		"Fail if a caller's audio stalls for more than MS while everybody is joined", "MS" },
+	{ NULL }
+};
+
+struct sockaddr_in serverAddress, listenerAddress;
+
+Pattern silence, background, probe;
+Caller* callers;
+
+GstElement *listener, *listenerSource;
+
+volatile gint receiving;
+GThread* receiver;
+
+GMutex* probeMutex;
+gint64 probeSent;
+GArray* mixingLatencies;
+
+gint64 measureStart, measureStop, callsStop;
+guint64 cpuTicksStart, cpuTicksStop;
+gboolean haveCpu;
+
+int rejoins;
+guint64 rssBaseline, rssFinal, rssPeak, rssDrained;
+
+int main(int argc, char *argv[]) {
+	g_thread_init (NULL);
+	gst_init (NULL, NULL);
+	gst_g726_enc_register();
+	gst_g726_dec_register();
+
+	getParametersOrExit(argc, argv);
+
+	createPatternsOrExit();
+	openCallersOrExit();
+	createListenerOrExit();
+
+	startReceiver();
+	runCalls();
+	waitForSilence();
+	stopReceiver();
+
+	if (churn){
+		readServerRss(&rssDrained);
+	}
+
+	int status = printReport();
+	cleanUp();
+
+	return status;
+}
+
+void getParametersOrExit(int argc, char *argv[]){
+	getParameters(argc, argv);
+	printParameters();
+}
+
+void getParameters(int argc, char *argv[]){
+	g_print ("Getting parameters.\n");
+
+	GError* error = 0;
+	GOptionContext* context = g_option_context_new ("[server_host] [server_port]");
+	g_option_context_add_main_entries (context, options, NULL);
+	if (!g_option_context_parse (context, &argc, &argv, &error)){
+		g_printerr ("%s\n", error->message);
+		exit(EXIT_INVALID_PARAMETERS);
+	}
+	g_option_context_free (context);
+
+	if (argc > 1){
+		g_print ("\tGetting server host.\n");
+		serverHost = argv[1];
+	}
+
+	if (argc > 2){
+		g_print ("\tGetting server port.\n");
+		serverPort = atoi(argv[2]);
+	}
+}
+
+void printParameters(){
+	if (   callersCount < 2
+		|| duration < 1
+		|| ramp < 0
+		|| talkersCount < 0
+		|| basePort < 1
+		|| basePort + callersCount > 65536
+		|| churn < 0
+		|| rssGrowth < 0
+		|| listenerPort < 0
+		|| listenerPort > 65535
+		|| maxGap < 0){
+
+		g_printerr ("Invalid parameters. Exiting.\n");
+		exit(EXIT_INVALID_PARAMETERS);
+	}
+
+	if (churn && (callersCount < 3 || !serverPid)){
+		g_printerr ("--churn needs at least 3 callers and --server-pid. Exiting.\n");
+		exit(EXIT_INVALID_PARAMETERS);
+	}
+
+	memset (&serverAddress, 0, sizeof (serverAddress));
+	serverAddress.sin_family = AF_INET;
+	serverAddress.sin_port   = htons (serverPort);
+	if (!inet_aton (serverHost, &serverAddress.sin_addr)){
+		g_printerr ("Server host must be an IPv4 address. Exiting.\n");
+		exit(EXIT_INVALID_PARAMETERS);
+	}
+
+	listenerAddress = serverAddress;
+	if (listenerPort){
+		listenerAddress.sin_port = htons (listenerPort);
+	}
+
+	g_print ("Load parameters:\n");
+	g_print ("\tServer        : %s:%d.\n", serverHost, serverPort);
+	if (listenerPort){
+		g_print ("\tListener      : %s:%d.\n", serverHost, listenerPort);
+	}
+	g_print ("\tCallers       : %d.\n", callersCount);
+	g_print ("\tTalkers       : %d.\n", talkersCount);
+	g_print ("\tJoin ramp     : %d ms.\n", ramp);
+	if (churn){
+		g_print ("\tChurn         : %d calls, %d %% RSS growth allowed.\n", churn, rssGrowth);
+	} else {
+		g_print ("\tDuration      : %d s.\n", duration);
+	}
+	g_print ("\tLocal ports   : %d-%d.\n", basePort, basePort + callersCount - 1);
+	if (bye){
+		g_print ("\tHang-up       : RTCP BYE.\n");
+	}
+	if (maxGap){
+		g_print ("\tMax gap       : %d ms.\n", maxGap);
+	}
+	if (serverPid){
+		g_print ("\tServer PID    : %d.\n", serverPid);
+	}
+}
+
+void createPatternsOrExit(){
+	g_print ("Encoding patterns.\n");
+
+	g_print ("\tEncoding silence.\n");
+	encodePatternOrExit(&silence,    "audiotestsrc wave=silence");
+
+	g_print ("\tEncoding background.\n");
+	encodePatternOrExit(&background, "audiotestsrc freq=440 volume=0.1");
+
+	g_print ("\tEncoding probe.\n");
+	encodePatternOrExit(&probe,      "audiotestsrc freq=1700 volume=0.3");
+}
+
+/*
+ * The pattern is one second of G.726 at 32 kbit/s, cut into 20 ms payloads.
+ * The encoder may return any amount of data per buffer, so everything is
+ * gathered first and cut afterwards.
+ */
+void encodePatternOrExit(Pattern* pattern, const gchar* source){
+	GError* error = 0;
+	gchar* description = g_strdup_printf (
+		"%s num-buffers=%d samplesperbuffer=%d "
+		"! audio/x-raw-int, rate=%d, depth=16, width=16, channels=1 "
+		"! g726enc bitrate=32000 "
+		"! appsink name=sink sync=false",
+		source, PATTERN_FRAMES, FRAME_SAMPLES, SAMPLE_RATE);
+
+	GstElement* pipeline = gst_parse_launch (description, &error);
+	g_free (description);
+
+	if (!pipeline){
+		g_printerr ("Failed to create encoder: %s. Exiting.\n", error->message);
+		exit(EXIT_ELEMENT_CREATION_FAILURE);
+	}
+
+	GstElement* sink = gst_bin_get_by_name (GST_BIN (pipeline), "sink");
+	GByteArray* encoded = g_byte_array_new ();
+	GstBuffer* buffer;
+
+	gst_element_set_state (pipeline, GST_STATE_PLAYING);
+	while ((buffer = gst_app_sink_pull_buffer (GST_APP_SINK (sink)))){
+		g_byte_array_append (encoded, GST_BUFFER_DATA (buffer), GST_BUFFER_SIZE (buffer));
+		gst_buffer_unref (buffer);
+	}
+	gst_element_set_state (pipeline, GST_STATE_NULL);
+
+	gst_object_unref (sink);
+	gst_object_unref (pipeline);
+
+	pattern->frames = encoded->len / FRAME_BYTES;
+	pattern->data   = g_byte_array_free (encoded, FALSE);
+
+	if (!pattern->frames){
+		g_printerr ("Encoder gave no data. Exiting.\n");
+		exit(EXIT_ELEMENT_CREATION_FAILURE);
+	}
+}
+
+void openCallersOrExit(){
+	g_print ("Opening %d callers.\n", callersCount);
+
+	callers = g_new0 (Caller, callersCount);
+
+	int i;
+	for (i = 0; i < callersCount; i++){
+		openCallerOrExit(&callers[i], i);
+	}
+}
+
+/*
+ * Replies come from the server's sending socket, not from the port the
+ * callers send to, so the sockets are bound but not connected.
+ */
+void openCallerOrExit(Caller* caller, int index){
+	caller->index     = index;
+	caller->localPort = basePort + index;
+	caller->ssrc      = g_random_int ();
+	caller->seq       = (guint16) g_random_int ();
+	caller->timestamp = g_random_int ();
+
+	caller->fd = socket (AF_INET, SOCK_DGRAM, 0);
+	if (caller->fd < 0){
+		g_printerr ("Caller %d: %s. Exiting.\n", index, strerror (errno));
+		exit(EXIT_SOCKET_FAILURE);
+	}
+
+	struct sockaddr_in local;
+	memset (&local, 0, sizeof (local));
+	local.sin_family      = AF_INET;
+	local.sin_addr.s_addr = htonl (INADDR_ANY);
+	local.sin_port        = htons (caller->localPort);
+
+	if (bind (caller->fd, (struct sockaddr*) &local, sizeof (local)) != 0){
+		g_printerr ("Caller %d: port %d: %s. Exiting.\n", index, caller->localPort, strerror (errno));
+		exit(EXIT_SOCKET_FAILURE);
+	}
+}
+
+/*
+ * Caller 1 listens to the mix:
+ *
+ *   appsrc -> rtpg726depay -> g726dec -> appsink
+ *
+ * and the decoded frames are searched for the probe tone.
+ */
+void createListenerOrExit(){
+	g_print ("Creating listener.\n");
+
+	GError* error = 0;
+	listener = gst_parse_launch (
+		"appsrc name=source is-live=true format=time do-timestamp=true "
+		"! rtpg726depay ! g726dec "
+		"! appsink name=sink sync=false emit-signals=true", &error);
+
+	if (!listener){
+		g_printerr ("Failed to create listener: %s. Exiting.\n", error->message);
+		exit(EXIT_ELEMENT_CREATION_FAILURE);
+	}
+
+	GstCaps *caps = gst_caps_new_simple (
+		"application/x-rtp",
+		"media",           G_TYPE_STRING, "audio",
+		"clock-rate",      G_TYPE_INT,    SAMPLE_RATE,
+		"encoding-name",   G_TYPE_STRING, "G726",
+		"encoding-params", G_TYPE_STRING, "1",
+		"channels",        G_TYPE_INT,    1,
+		"payload",         G_TYPE_INT,    RTP_PAYLOAD_TYPE,
+		NULL);
+
+	listenerSource = gst_bin_get_by_name (GST_BIN (listener), "source");
+	gst_app_src_set_caps (GST_APP_SRC (listenerSource), caps);
+	gst_caps_unref (caps);
+
+	GstElement* sink = gst_bin_get_by_name (GST_BIN (listener), "sink");
+	g_signal_connect (sink, "new-buffer", G_CALLBACK (listenerNewBuffer), NULL);
+	gst_object_unref (sink);
+
+	mixingLatencies = g_array_new (FALSE, FALSE, sizeof (gint64));
+	probeMutex      = g_mutex_new ();
+
+	gst_element_set_state (listener, GST_STATE_PLAYING);
+}
+
+static GstFlowReturn listenerNewBuffer(GstAppSink* sink, gpointer data){
+	GstBuffer* buffer = gst_app_sink_pull_buffer (sink);
+	if (!buffer){
+		return GST_FLOW_OK;
+	}
+
+	gdouble share = probeShare((const gint16*) GST_BUFFER_DATA (buffer), GST_BUFFER_SIZE (buffer) / 2);
+	gst_buffer_unref (buffer);
+
+	if (share < PROBE_SHARE){
+		return GST_FLOW_OK;
+	}
+
+	gint64 now = nowNs();
+
+	g_mutex_lock (probeMutex);
+	if (probeSent){
+		gint64 latency = now - probeSent;
+		g_array_append_val (mixingLatencies, latency);
+		probeSent = 0;
+	}
+	g_mutex_unlock (probeMutex);
+
+	return GST_FLOW_OK;
+}
+
+/*
+ * Goertzel filter at the probe frequency. For a pure tone the result is
+ * about half the frame's energy times its length, so the share of the probe
+ * in the frame comes out between 0 and 1.
+ */
+gdouble probeShare(const gint16* samples, guint count){
+	gdouble coefficient = 2.0 * cos (2.0 * G_PI * PROBE_FREQUENCY / SAMPLE_RATE);
+	gdouble s1 = 0, s2 = 0, energy = 0;
+	guint i;
+
+	for (i = 0; i < count; i++){
+		gdouble s0 = samples[i] + coefficient * s1 - s2;
+		s2 = s1;
+		s1 = s0;
+		energy += (gdouble) samples[i] * samples[i];
+	}
+
+	if (energy < 1e6 || !count){
+		return 0;
+	}
+
+	gdouble power = s1 * s1 + s2 * s2 - coefficient * s1 * s2;
+	return power / (energy * count / 2.0);
+}
+
+void feedListener(const guint8* packet, gssize size){
+	GstBuffer* buffer = gst_buffer_new_and_alloc (size);
+	memcpy (GST_BUFFER_DATA (buffer), packet, size);
+	gst_app_src_push_buffer (GST_APP_SRC (listenerSource), buffer);
+}
+
+void startReceiver(){
+	g_print ("Starting receiver.\n");
+
+	g_atomic_int_set (&receiving, TRUE);
+
+	GError* error = 0;
+	receiver = g_thread_create (receiverRun, NULL, TRUE, &error);
+	if (!receiver){
+		g_printerr ("Receiver: %s\n", error->message);
+		g_error_free (error);
+	}
+	g_assert (receiver);
+}
+
+static gpointer receiverRun(gpointer data){
+	int epollFd = epoll_create (callersCount);
+	g_assert (epollFd >= 0);
+
+	int i;
+	for (i = 0; i < callersCount; i++){
+		struct epoll_event event;
+		event.events   = EPOLLIN;
+		event.data.u32 = i;
+		epoll_ctl (epollFd, EPOLL_CTL_ADD, callers[i].fd, &event);
+	}
+
+	struct epoll_event events[64];
+	guint8 packet[MAX_PACKET_SIZE];
+
+	while (g_atomic_int_get (&receiving)){
+		int ready = epoll_wait (epollFd, events, G_N_ELEMENTS (events), 100);
+		int k;
+		for (k = 0; k < ready; k++){
+			Caller* caller = &callers[events[k].data.u32];
+			gssize size;
+			while ((size = recv (caller->fd, packet, sizeof (packet), MSG_DONTWAIT)) > 0){
+				receivePacket(caller, packet, size, nowNs());
+			}
+		}
+	}
+
+	close (epollFd);
+	return 0;
+}
+
+/*
+ * Loss is counted the RTP way, from the extended highest sequence number
+ * seen against the first one, so reordering is not taken for loss.
+ */
+void receivePacket(Caller* caller, const guint8* packet, gssize size, gint64 now){
+	if (size < RTP_HEADER_SIZE || (packet[0] >> 6) != 2){
+		return;
+	}
+
+	guint16 seq = (packet[2] << 8) | packet[3];
+	guint32 timestamp = GST_READ_UINT32_BE (packet + 4);
+
+	if (caller->haveSeq){
+		measureGap(caller, timestamp, now);
+	}
+	caller->lastTimestamp = timestamp;
+
+	if (!caller->haveSeq){
+		caller->haveSeq       = TRUE;
+		caller->baseSeq       = seq;
+		caller->maxSeq        = seq;
+		caller->firstReceived = now;
+	} else {
+		gint16 delta = (gint16) (seq - (guint16) caller->maxSeq);
+		if (delta > 0){
+			caller->maxSeq += delta;
+		}
+	}
+
+	caller->received++;
+	caller->lastReceived = now;
+
+	if (caller->index == 1){
+		feedListener(packet, size);
+	}
+}
+
+/*
+ * How much later than its audio's due time a packet came, compared with
+ * the previous one. Only counted while everybody is joined and before the
+ * calls stop, and only for callers keeping their call.
+ */
+void measureGap(Caller* caller, guint32 timestamp, gint64 now){
+	if (!measureStart || callsStop || caller->rejoins){
+		return;
+	}
+
+	gint64 media = (gint64) (gint32) (timestamp - caller->lastTimestamp) * GST_SECOND / SAMPLE_RATE;
+	gint64 gap   = (now - caller->lastReceived) - media;
+
+	caller->maxGap = MAX (caller->maxGap, gap);
+	if (gap > GAP_NS){
+		caller->gaps++;
+	}
+}
+
+/*
+ * The sending clock: every 20 ms tick each joined caller sends one frame.
+ * Callers join one by one, every "ramp" milliseconds, and all of them stop
+ * together after "duration" seconds of full load.
+ */
+void runCalls(){
+	g_print ("Running...\n");
+
+	gint64 start    = nowNs();
+	gint64 rampEnd  = start + (gint64) ramp * GST_MSECOND * callersCount;
+	gint64 stop     = churn ? G_MAXINT64 : rampEnd + (gint64) duration * GST_SECOND;
+	guint64 tick;
+
+	for (tick = 0; ; tick++){
+		gint64 deadline = start + (gint64) tick * FRAME_NS;
+		if (deadline >= stop){
+			break;
+		}
+		sleepUntil(deadline);
+
+		if (!measureStart && deadline >= rampEnd){
+			measureStart = nowNs();
+			haveCpu = readServerCpuTicks(&cpuTicksStart);
+			g_print ("\tAll callers joined.\n");
+		}
+
+		if (churn && measureStart && !churnTick(deadline - rampEnd)){
+			break;
+		}
+
+		sendTick(tick, deadline - start);
+	}
+
+	measureStop = callsStop = nowNs();
+	haveCpu = haveCpu && readServerCpuTicks(&cpuTicksStop);
+
+	int i;
+	for (i = 0; bye && i < callersCount; i++){
+		sendBye(&callers[i]);
+	}
+	g_print ("\tAll callers stopped.\n");
+}
+
+/*
+ * Keeps the calls going at one new call per ramp, the server dropping the
+ * hung up ones by itself. A caller calls again at most once per tick, so
+ * every call sends at least one packet. Returns FALSE once all calls are
+ * made.
+ */
+gboolean churnTick(gint64 elapsed){
+	gint64 due = elapsed / (MAX (ramp, 1) * GST_MSECOND) + 1;
+	int churners = callersCount - 2;
+	int made;
+
+	for (made = 0; made < churners && rejoins < MIN (due, churn); made++){
+		rejoinCaller(&callers[2 + rejoins % churners]);
+		rejoins++;
+
+		if (rejoins % CHURN_SAMPLE_REJOINS == 0 || rejoins == churn){
+			sampleServerRss(rejoins == churn);
+		}
+	}
+	return rejoins < churn;
+}
+
+// The same port calling again with a new SSRC is a new participant.
+void rejoinCaller(Caller* caller){
+	if (bye){
+		sendBye(caller);
+	}
+
+	guint32 previous = caller->ssrc;
+	while (caller->ssrc == previous){
+		caller->ssrc = g_random_int ();
+	}
+	caller->seq       = (guint16) g_random_int ();
+	caller->timestamp = g_random_int ();
+	caller->rejoins++;
+}
+
+/*
+ * The baseline is taken once CHURN_WARMUP_PERCENT of the calls are made:
+ * by then the bin pools, the registry and the allocator have grown to the
+ * number of calls alive at a time, which stays the same until the end.
+ */
+void sampleServerRss(gboolean final){
+	guint64 rss;
+	if (!readServerRss(&rss)){
+		return;
+	}
+
+	g_print ("\t%d calls made, server RSS %.1f MB.\n", rejoins, rss / 1048576.0);
+
+	rssPeak = MAX (rssPeak, rss);
+	if (!rssBaseline && rejoins >= (gint64) churn * CHURN_WARMUP_PERCENT / 100){
+		rssBaseline = rss;
+	}
+	if (final){
+		rssFinal = rss;
+	}
+}
+
+void sendTick(guint64 tick, gint64 elapsed){
+	gint64 sentAt = nowNs();
+	int i;
+	for (i = 0; i < callersCount; i++){
+		if (elapsed < (gint64) ramp * GST_MSECOND * i){
+			break;
+		}
+		sendPacket(&callers[i], choosePattern(i, tick), tick, sentAt);
+	}
+}
+
+/*
+ * Caller 0 carries the probe, caller 1 only listens, and the talkers among
+ * the rest change every second so that every leg gets mixed in turn.
+ */
+const Pattern* choosePattern(int index, guint64 tick){
+	if (index == 0){
+		if (tick % PROBE_PERIOD_TICKS < PROBE_LENGTH_TICKS){
+			return &probe;
+		}
+		return &silence;
+	}
+
+	int others = callersCount - 2;
+	if (index == 1 || others < 1){
+		return &silence;
+	}
+
+	int first  = (int) ((tick / 50) * talkersCount % others);
+	int offset = (index - 2 - first + others) % others;
+	return offset < talkersCount ? &background : &silence;
+}
+
+void sendPacket(Caller* caller, const Pattern* pattern, guint64 tick, gint64 now){
+	guint8 packet[RTP_HEADER_SIZE + FRAME_BYTES];
+
+	packet[0] = 0x80;
+	packet[1] = RTP_PAYLOAD_TYPE | (caller->joined ? 0 : 0x80);
+	packet[2] = caller->seq >> 8;
+	packet[3] = caller->seq & 0xFF;
+	packet[4] = caller->timestamp >> 24;
+	packet[5] = caller->timestamp >> 16;
+	packet[6] = caller->timestamp >> 8;
+	packet[7] = caller->timestamp & 0xFF;
+	packet[8] = caller->ssrc >> 24;
+	packet[9] = caller->ssrc >> 16;
+	packet[10] = caller->ssrc >> 8;
+	packet[11] = caller->ssrc & 0xFF;
+
+	memcpy (packet + RTP_HEADER_SIZE,
+		pattern->data + (tick % pattern->frames) * FRAME_BYTES, FRAME_BYTES);
+
+	if (pattern == &probe && tick % PROBE_PERIOD_TICKS == 0){
+		g_mutex_lock (probeMutex);
+		probeSent = now;
+		g_mutex_unlock (probeMutex);
+	}
+
+	struct sockaddr_in* to = callerServer(caller);
+	if (sendto (caller->fd, packet, sizeof (packet), 0, (struct sockaddr*) to, sizeof (*to)) < 0){
+		return;
+	}
+
+	if (!caller->joined){
+		caller->joined    = TRUE;
+		caller->firstSent = now;
+	}
+
+	caller->sent++;
+	caller->seq++;
+	caller->timestamp += FRAME_SAMPLES;
+}
+
+/*
+ * A compound RTCP packet of an empty receiver report and the BYE, sent
+ * where the caller's RTP goes (RFC 5761).
+ */
+void sendBye(Caller* caller){
+	guint8 packet[16];
+
+	packet[0] = 0x80;
+	packet[1] = RTCP_RR;
+	packet[2] = 0;
+	packet[3] = 1;
+	packet[8] = 0x81;
+	packet[9] = RTCP_BYE;
+	packet[10] = 0;
+	packet[11] = 1;
+
+	int i;
+	for (i = 0; i < 4; i++){
+		packet[4 + i] = packet[12 + i] = caller->ssrc >> (24 - 8 * i);
+	}
+
+	struct sockaddr_in* to = callerServer(caller);
+	sendto (caller->fd, packet, sizeof (packet), 0, (struct sockaddr*) to, sizeof (*to));
+}
+
+struct sockaddr_in* callerServer(Caller* caller){
+	return caller->index == 1 ? &listenerAddress : &serverAddress;
+}
+
+/*
+ * The server keeps sending to a caller until it notices that the caller is
+ * gone, which is what the leave latency measures. Wait for every leg to go
+ * quiet, or give up after the timeout.
+ */
+void waitForSilence(){
+	g_print ("Waiting for the server to drop the callers.\n");
+
+	gint64 giveUp = callsStop + (gint64) leaveTimeout * GST_SECOND;
+
+	while (nowNs() < giveUp){
+		gint64 lastReceived = 0;
+		int i;
+		for (i = 0; i < callersCount; i++){
+			lastReceived = MAX (lastReceived, callers[i].lastReceived);
+		}
+		if (nowNs() - MAX (lastReceived, callsStop) >= QUIET_NS){
+			return;
+		}
+		g_usleep (100 * 1000);
+	}
+
+	g_print ("\tSome callers are still receiving.\n");
+}
+
+void stopReceiver(){
+	g_atomic_int_set (&receiving, FALSE);
+	g_thread_join (receiver);
+	receiver = 0;
+}
+
+gint64 nowNs(){
+	struct timespec now;
+	clock_gettime (CLOCK_MONOTONIC, &now);
+	return (gint64) now.tv_sec * GST_SECOND + now.tv_nsec;
+}
+
+void sleepUntil(gint64 deadline){
+	struct timespec until;
+	until.tv_sec  = deadline / GST_SECOND;
+	until.tv_nsec = deadline % GST_SECOND;
+	while (clock_nanosleep (CLOCK_MONOTONIC, TIMER_ABSTIME, &until, NULL) == EINTR);
+}
+
+// utime and stime, fields 14 and 15 of /proc/PID/stat, in clock ticks.
+gboolean readServerCpuTicks(guint64* ticks){
+	if (!serverPid){
+		return FALSE;
+	}
+
+	gchar* path = g_strdup_printf ("/proc/%d/stat", serverPid);
+	gchar* contents = 0;
+	gboolean ok = g_file_get_contents (path, &contents, NULL, NULL);
+	g_free (path);
+
+	if (!ok){
+		return FALSE;
+	}
+
+	// The command name may contain spaces; fields are counted after it.
+	gchar* fields = strrchr (contents, ')');
+	unsigned long long utime, stime;
+	ok = fields && sscanf (fields + 2,
+		"%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %llu %llu",
+		&utime, &stime) == 2;
+
+	if (ok){
+		*ticks = utime + stime;
+	}
+
+	g_free (contents);
+	return ok;
+}
+
+// Resident pages, the second field of /proc/PID/statm.
+gboolean readServerRss(guint64* bytes){
+	gchar* path = g_strdup_printf ("/proc/%d/statm", serverPid);
+	gchar* contents = 0;
+	gboolean ok = g_file_get_contents (path, &contents, NULL, NULL);
+	g_free (path);
+
+	if (!ok){
+		return FALSE;
+	}
+
+	unsigned long long pages;
+	ok = sscanf (contents, "%*u %llu", &pages) == 1;
+	if (ok){
+		*bytes = pages * sysconf (_SC_PAGESIZE);
+	}
+
+	g_free (contents);
+	return ok;
+}
+
+static gint compareLatencies(gconstpointer a, gconstpointer b){
+	gint64 x = *(const gint64*) a;
+	gint64 y = *(const gint64*) b;
+	return x < y ? -1 : x > y;
+}
+
+int printReport(){
+	guint64 sent = 0, received = 0, expected = 0;
+	gint64 joinSum = 0, joinMax = 0, leaveSum = 0, leaveMax = 0, gapMax = 0;
+	int joined = 0, left = 0;
+	guint gaps = 0;
+	int i;
+
+	for (i = 0; i < callersCount; i++){
+		Caller* caller = &callers[i];
+		sent += caller->sent;
+
+		if (!caller->haveSeq){
+			continue;
+		}
+
+		// A caller that called again got several legs on its port.
+		if (!caller->rejoins){
+			received += caller->received;
+			expected += caller->maxSeq - caller->baseSeq + 1;
+			gapMax = MAX (gapMax, caller->maxGap);
+			gaps  += caller->gaps;
+		}
+
+		gint64 join = caller->firstReceived - caller->firstSent;
+		joinSum += join;
+		joinMax  = MAX (joinMax, join);
+		joined++;
+
+		if (caller->lastReceived > callsStop){
+			gint64 leave = caller->lastReceived - callsStop;
+			leaveSum += leave;
+			leaveMax  = MAX (leaveMax, leave);
+		}
+		left++;
+	}
+
+	g_print ("Report:\n");
+	g_print ("\tCallers        : %d, %d heard back.\n", callersCount, joined);
+	g_print ("\tPackets        : %" G_GUINT64_FORMAT " sent, %" G_GUINT64_FORMAT " received.\n", sent, received);
+
+	if (expected){
+		gdouble lost = expected > received ? (gdouble) (expected - received) : 0;
+		g_print ("\tPacket loss    : %.2f %%.\n", 100.0 * lost / expected);
+	}
+
+	if (joined){
+		g_print ("\tJoin latency   : avg %.1f ms, max %.1f ms.\n",
+			joinSum / joined / 1e6, joinMax / 1e6);
+		g_print ("\tLeave latency  : avg %.1f ms, max %.1f ms.\n",
+			leaveSum / left / 1e6, leaveMax / 1e6);
+	}
+
+	g_print ("\tAudio gaps     : %u over %d ms, longest %.1f ms late.\n",
+		gaps, (int) (GAP_NS / GST_MSECOND), gapMax / 1e6);
+
+	if (mixingLatencies->len){
+		g_array_sort (mixingLatencies, compareLatencies);
+		gint64* values = (gint64*) mixingLatencies->data;
+		guint count    = mixingLatencies->len;
+		g_print ("\tMixing latency : p50 %.1f ms, p99 %.1f ms, max %.1f ms, %u probes.\n",
+			values[count / 2] / 1e6, values[(count * 99) / 100] / 1e6, values[count - 1] / 1e6, count);
+	} else {
+		g_print ("\tMixing latency : probe not heard.\n");
+	}
+
+	if (haveCpu){
+		gdouble seconds = (measureStop - measureStart) / 1e9;
+		gdouble cpu = 100.0 * (cpuTicksStop - cpuTicksStart) / sysconf (_SC_CLK_TCK) / seconds;
+		g_print ("\tServer CPU     : %.1f %% total, %.3f %% per caller.\n", cpu, cpu / callersCount);
+	}
+
+	if (churn){
+		g_print ("\tChurn          : %d calls made.\n", rejoins);
+		g_print ("\tServer RSS     : %.1f MB after warm-up, %.1f MB at the end, %.1f MB peak, %.1f MB once drained.\n",
+			rssBaseline / 1048576.0, rssFinal / 1048576.0, rssPeak / 1048576.0, rssDrained / 1048576.0);
+	}
+
+	if (!received){
+		g_printerr ("No traffic came back from the server.\n");
+		return EXIT_NO_TRAFFIC;
+	}
+
+	if (churn && (!rssBaseline || !rssFinal || rssFinal > rssBaseline + rssBaseline * rssGrowth / 100)){
+		g_printerr ("Server RSS did not stay flat over the churn.\n");
+		return EXIT_RSS_GROWTH;
+	}
+
+	if (maxGap && gapMax > (gint64) maxGap * GST_MSECOND){
+		g_printerr ("A caller's audio stalled for longer than %d ms.\n", maxGap);
+		return EXIT_OUTPUT_GAP;
+	}
+	return EXIT_NORMAL;
+}
+
+void cleanUp(){
+	gst_element_set_state (listener, GST_STATE_NULL);
+	gst_object_unref (listenerSource);
+	gst_object_unref (GST_OBJECT (listener));
+
+	int i;
+	for (i = 0; i < callersCount; i++){
+		close (callers[i].fd);
+	}
+	g_free (callers);
+
+	g_free (silence.data);
+	g_free (background.data);
+	g_free (probe.data);
+
+	g_array_free (mixingLatencies, TRUE);
+	g_mutex_free (probeMutex);
+}
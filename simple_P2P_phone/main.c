@@ -1,7 +1,18 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <gst/gst.h>
 
+#include "latencyTracer.h"
+#include "metricsEndpoint.h"
+#include "playoutDelay.h"
+#include "g726Enc.h"
+#include "g726Dec.h"
+#include "voiceActivity.h"
+#include "dtxGate.h"
+#include "rtpDtx.h"
+#include "codec.h"
+
 void getParametersOrExit(int argc, char *argv[]);
 void checkParametersCountOrExit(int count);
 void getParameters(int argc, char *argv[]);
@@ -22,6 +33,8 @@ void createCodecElements();
 void createEncoder();
 
 void createPayDepayElements();
+void createDtxElements();
+void createComfortNoiseElements();
 
 void exitOnInvalidElement();
 
@@ -38,12 +51,20 @@ void linkRxPadsOrExit();
 void linkPads_Src2Bin_OrExit();
 void linkPads_Bin2Depay_OrExit();
 
-static void rtpBinPadAdded (GstElement * rtpbin, GstPad * new_pad, GstElement * depay);
+static void rtpBinPadAdded (GstElement * rtpbin, GstPad * new_pad, gpointer data);
+void linkMediaPad(GstPad* newPad, const Codec* padCodec);
+void linkComfortNoisePad(GstPad* newPad);
+static gboolean comfortNoiseProbe(GstPad* pad, GstBuffer* buffer, gpointer data);
+static gboolean speechProbe(GstPad* pad, GstBuffer* buffer, gpointer data);
+void setComfortNoiseLevel(gint level);
 
 void checkLinkingSuccessOrExit();
 void checkPadsLinkingSuccessOrExit();
 
 
+void startMetricsOrExit();
+void collectMetrics(MetricsSnapshot* snapshot, gpointer data);
+
 void registerBusCall();
 static gboolean busCall(GstBus *bus, GstMessage *msg, gpointer data);
 
@@ -55,20 +76,30 @@ void cleanUp();
 #define EXIT_ELEMENT_CREATION_FAILURE -2
 #define EXIT_ELEMENT_LINKING_FAILURE  -3
 #define EXIT_PADS_LINKING_FAILURE     -4
+#define EXIT_METRICS_FAILURE          -5
+#define EXIT_INVALID_PARAMETERS       -6
 
 #define DEFAULT_UDP_PORT 9559
 
 char* partnerHost;
 int partnerPort = DEFAULT_UDP_PORT;
 int localPort   = DEFAULT_UDP_PORT;
+int metricsPort = 0;
+gchar* playoutDelayText = 0;
+PlayoutDelaySetting playoutDelay;
+gboolean dtx = TRUE;
+const Codec* codec = CODEC_DEFAULT;
+
+MetricsCpu encoderCpu;
 
 GMainLoop  *loop;
 GstElement *pipeline;
 
 GstElement *audioSource, *audioSink;
 GstElement *udpSource,   *udpSink;
-GstElement *encoder,     *decoder;
-GstElement *rtpPay,      *rtpDepay;
+GstElement *encoder,     *rtpPay;
+GstElement *dtxGate,     *rtpDtx;
+GstElement *playbackMixer, *noiseSource;
 
 GstElement *rtpbin;
 GstPad     *srcpad, *sinkpad;
@@ -78,11 +109,17 @@ GstPadLinkReturn linkPad_ok;
 
 int main(int argc, char *argv[]) {
     gst_init(NULL, NULL);
+	gst_g726_enc_register();
+	gst_g726_dec_register();
+	gst_dtx_gate_register();
+	gst_rtp_dtx_register();
 	
 	getParametersOrExit(argc, argv);
 
 	createElementsOrExit();
 	addAndLinkElementsOrExit();
+	latencyTracer_attach(pipeline);
+	startMetricsOrExit();
 
 	loop = g_main_loop_new (NULL, FALSE);
 	registerBusCall();
@@ -126,6 +163,50 @@ void getParameters(int argc, char *argv[]){
 
 	g_print ("\tGetting local port.\n");
 	localPort = atoi(argv[3]);
+
+	if (argc<5){
+		return;
+	}
+
+	g_print ("\tGetting metrics port.\n");
+	metricsPort = atoi(argv[4]);
+
+	if (argc<6){
+		return;
+	}
+
+	g_print ("\tGetting playout delay.\n");
+	playoutDelayText = argv[5];
+	if (!playoutDelay_parse(playoutDelayText, &playoutDelay)){
+		g_printerr("Invalid playout delay: %s. Exiting.\n", playoutDelayText);
+		exit(EXIT_INVALID_PARAMETERS);
+	}
+
+	if (argc<7){
+		return;
+	}
+
+	g_print ("\tGetting DTX mode.\n");
+	if (strcmp (argv[6], "on") && strcmp (argv[6], "off")){
+		g_printerr("Invalid DTX mode: %s. Exiting.\n", argv[6]);
+		exit(EXIT_INVALID_PARAMETERS);
+	}
+	dtx = !strcmp (argv[6], "on");
+
+	if (argc<8){
+		return;
+	}
+
+	g_print ("\tGetting codec.\n");
+	codec = codec_byName(argv[7]);
+	if (!codec){
+		g_printerr("Unknown codec: %s. Exiting.\n", argv[7]);
+		exit(EXIT_INVALID_PARAMETERS);
+	}
+	if (!codec_isAvailable(codec)){
+		g_printerr("Codec %s is not installed. Exiting.\n", argv[7]);
+		exit(EXIT_INVALID_PARAMETERS);
+	}
 }
 
 void printParameters(){
@@ -133,6 +214,14 @@ void printParameters(){
 	g_print ("\tPartner's host: %s.\n", partnerHost);
 	g_print ("\tPartner's port: %d.\n", partnerPort);
 	g_print ("\tLocal port    : %d.\n", localPort);
+	if (metricsPort){
+		g_print ("\tMetrics port  : %d.\n", metricsPort);
+	}
+	if (playoutDelayText){
+		g_print ("\tPlayout delay : %s.\n", playoutDelayText);
+	}
+	g_print ("\tDTX           : %s.\n", dtx ? "on" : "off");
+	g_print ("\tCodec         : %s.\n", codec->name);
 }
 
 void createElementsOrExit(){
@@ -149,9 +238,18 @@ void createElements(){
 	createUdpElements();
 	createCodecElements();
 	createPayDepayElements();
+	createDtxElements();
+	createComfortNoiseElements();
 
 	g_print ("\tCreating RTP-bin.\n");
 	rtpbin = gst_element_factory_make ("gstrtpbin", "rtpbin");
+
+	if (rtpbin){
+		codec_mapPayloads(rtpbin);
+	}
+	if (rtpbin && playoutDelayText){
+		playoutDelay_apply(rtpbin, &playoutDelay);
+	}
 }
 
 void createAudioElements(){
@@ -183,18 +281,12 @@ void createUdpElements(){
     createUdpSink();
 }
 
+// The partner is expected to send what we send; any other codec is
+// looked up by rtpbin, see codec_mapPayloads().
 void createUdpSource(){
 	g_print ("\t\tCreating UDP source.\n");
 
-	GstCaps *caps = gst_caps_new_simple (
-		"application/x-rtp",	     
-		"media",           G_TYPE_STRING, "audio",
-		"clock-rate",      G_TYPE_INT,    8000,
-		"encoding-name",   G_TYPE_STRING, "G726",
-		"encoding-params", G_TYPE_STRING, "1",
-		"channels",        G_TYPE_INT,    1,
-		"payload",         G_TYPE_INT,    96,
-		NULL);
+	GstCaps *caps = codec_rtpCaps(codec);
 
 	udpSource = gst_element_factory_make ("udpsrc", "net-input");
 
@@ -213,29 +305,59 @@ void createUdpSink(){
 	g_object_set (G_OBJECT (udpSink), "async", FALSE, "sync", FALSE, NULL);
 }
 
+/*
+ * Only the sending side is fixed. The partner's stream is decoded with
+ * whatever codec its payload type names, see linkMediaPad().
+ */
 void createCodecElements(){
 	g_print ("\tCreating codec elements.\n");
 	createEncoder();
-
-	g_print ("\t\tCreating decoder.\n");
-	decoder = gst_element_factory_make ("ffdec_g726", "G.726-decoder");
 }
 
 void createEncoder(){
-	g_print ("\t\tCreating encoder.\n");
+	g_print ("\t\tCreating %s encoder.\n", codec->name);
 
-	encoder = gst_element_factory_make ("ffenc_g726", "G.726-coder");
-	g_object_set (G_OBJECT (encoder), "bitrate", 32000, NULL);
+	encoder = codec_makeEncoder(codec, "encoder");
 }
 
 void createPayDepayElements(){
-	g_print ("\tCreating pay-depay elements.\n");
+	g_print ("\tCreating pay elements.\n");
 
 	g_print ("\t\tCreating RTP-pay.\n");
-	rtpPay   = gst_element_factory_make ("rtpg726pay",   "rtp-pay");
+	rtpPay = codec_makePayloader(codec, "rtp-pay");
+}
+
+/*
+ * The microphone is gated in front of the encoder and comfort noise packets
+ * are added after the payloader (see dtxGate.h, rtpDtx.h).
+ */
+void createDtxElements(){
+	if (!dtx){
+		return;
+	}
+
+	g_print ("\tCreating DTX elements.\n");
+	dtxGate = gst_element_factory_make ("dtxgate", "dtx-gate");
+	rtpDtx  = gst_element_factory_make ("rtpdtx",  "rtp-dtx");
+}
 
-	g_print ("\t\tCreating RTP-depay.\n");
-	rtpDepay = gst_element_factory_make ("rtpg726depay", "rtp-depay");
+/*
+ * While the partner sends comfort noise, white noise of its level is mixed
+ * into the playback; the partner's speech mutes it again. Done whether or
+ * not we send DTX ourselves, the partner may.
+ */
+void createComfortNoiseElements(){
+	g_print ("\tCreating comfort noise elements.\n");
+
+	playbackMixer = gst_element_factory_make ("liveadder", "playback-mixer");
+	if (playbackMixer){
+		g_object_set (G_OBJECT (playbackMixer), "latency", 20, NULL);
+	}
+
+	noiseSource = gst_element_factory_make ("audiotestsrc", "comfort-noise");
+	if (noiseSource){
+		g_object_set (G_OBJECT (noiseSource), "is-live", TRUE, "wave", 5, "volume", 0.0, NULL);
+	}
 }
 
 void exitOnInvalidElement(){
@@ -246,9 +368,10 @@ void exitOnInvalidElement(){
 		 || !udpSource
 		 || !udpSink
 		 || !encoder
-		 || !decoder
 		 || !rtpPay
-		 || !rtpDepay) {
+		 || !playbackMixer
+		 || !noiseSource
+		 || (dtx && (!dtxGate || !rtpDtx))) {
 
 		g_printerr ("Some element could not be created. Exiting.\n");
 		exit(EXIT_ELEMENT_CREATION_FAILURE);
@@ -267,14 +390,30 @@ void addAndLinkElementsOrExit(){
 }
 
 void addAndLinkTxElementsOrExit(){
-	gst_bin_add_many (GST_BIN (pipeline), udpSource, rtpDepay, decoder, audioSink, NULL);
-	link_ok = gst_element_link_many (rtpDepay, decoder, audioSink, NULL);
+	gst_bin_add_many (GST_BIN (pipeline), udpSource, playbackMixer, audioSink, noiseSource, NULL);
+	link_ok = gst_element_link (playbackMixer, audioSink);
+	checkLinkingSuccessOrExit();
+
+	GstCaps* caps = gst_caps_new_simple (
+		"audio/x-raw-int",
+		"rate",     G_TYPE_INT, 8000,
+		"depth",    G_TYPE_INT, 16,
+		"channels", G_TYPE_INT, 1,
+		NULL);
+	link_ok = gst_element_link_filtered (noiseSource, playbackMixer, caps);
+	gst_caps_unref (caps);
 	checkLinkingSuccessOrExit();
 }
 
 void addAndLinkRxElementsOrExit(){
 	gst_bin_add_many (GST_BIN (pipeline), audioSource, encoder, rtpPay, udpSink, NULL);
-	link_ok = gst_element_link_many (audioSource, encoder, rtpPay, NULL);
+
+	if (dtx){
+		gst_bin_add_many (GST_BIN (pipeline), dtxGate, rtpDtx, NULL);
+		link_ok = gst_element_link_many (audioSource, dtxGate, encoder, rtpPay, rtpDtx, NULL);
+	} else {
+		link_ok = gst_element_link_many (audioSource, encoder, rtpPay, NULL);
+	}
 	checkLinkingSuccessOrExit();
 }
 
@@ -285,7 +424,7 @@ void linkTxPadsOrExit(){
 
 void linkPads_Pay2Bin_OrExit(){
 	sinkpad = gst_element_get_request_pad (rtpbin, "send_rtp_sink_0");
-	srcpad = gst_element_get_static_pad (rtpPay, "src");
+	srcpad = gst_element_get_static_pad (dtx ? rtpDtx : rtpPay, "src");
 	linkPad_ok = gst_pad_link (srcpad, sinkpad);
 	checkPadsLinkingSuccessOrExit();
 	gst_object_unref (srcpad);
@@ -316,19 +455,111 @@ void linkPads_Src2Bin_OrExit(){
 
 void linkPads_Bin2Depay_OrExit(){
 	// must be last-called because of dynamic linking
-	g_signal_connect (rtpbin, "pad-added", G_CALLBACK (rtpBinPadAdded), rtpDepay);
+	g_signal_connect (rtpbin, "pad-added", G_CALLBACK (rtpBinPadAdded), NULL);
 }
 
-static void rtpBinPadAdded (GstElement * rtpbin, GstPad * new_pad, GstElement * depay){
+// rtpbin only maps payload types of installed codecs and comfort noise.
+static void rtpBinPadAdded (GstElement * rtpbin, GstPad * new_pad, gpointer data){
 	g_print ("New payload on pad: %s\n", GST_PAD_NAME (new_pad));
 
-	sinkpad = gst_element_get_static_pad (depay, "sink"); 
-	linkPad_ok = gst_pad_link (new_pad, sinkpad);
+	if (rtpDtx_isComfortNoisePad(new_pad)){
+		linkComfortNoisePad(new_pad);
+		return;
+	}
+
+	linkMediaPad(new_pad, codec_ofPad(new_pad));
+}
+
+/*
+ * Every stream of the partner gets a depayloader and decoder of its codec,
+ * mixed into the playback next to the comfort noise.
+ */
+void linkMediaPad(GstPad* newPad, const Codec* padCodec){
+	g_print ("\tLinking %s decoder.\n", padCodec->name);
+
+	GstElement* depay     = codec_makeDepayloader(padCodec, NULL);
+	GstElement* decoder   = codec_makeDecoder(padCodec, NULL);
+	GstElement* converter = codec_makeConverter(padCodec);
+	if (!depay || !decoder || (padCodec->convert && !converter)){
+		g_printerr ("Some element could not be created. Exiting.\n");
+		exit(EXIT_ELEMENT_CREATION_FAILURE);
+	}
+
+	gst_bin_add_many (GST_BIN (pipeline), depay, decoder, NULL);
+	link_ok = gst_element_link (depay, decoder);
+	checkLinkingSuccessOrExit();
+
+	GstElement* last = decoder;
+	if (converter){
+		gst_bin_add (GST_BIN (pipeline), converter);
+		link_ok = gst_element_link (decoder, converter);
+		checkLinkingSuccessOrExit();
+		last = converter;
+	}
+
+	link_ok = gst_element_link (last, playbackMixer);
+	checkLinkingSuccessOrExit();
+
+	if (converter){
+		gst_element_sync_state_with_parent (converter);
+	}
+	gst_element_sync_state_with_parent (decoder);
+	gst_element_sync_state_with_parent (depay);
+
+	sinkpad = gst_element_get_static_pad (depay, "sink");
+	linkPad_ok = gst_pad_link (newPad, sinkpad);
+	checkPadsLinkingSuccessOrExit();
+
+	gst_pad_add_buffer_probe (sinkpad, G_CALLBACK (speechProbe), NULL);
+	gst_object_unref (sinkpad);
+}
+
+// Comfort noise packets are only read for their level.
+void linkComfortNoisePad(GstPad* newPad){
+	g_print ("\tLinking comfort noise sink.\n");
+
+	GstElement* sink = gst_element_factory_make ("fakesink", NULL);
+	g_object_set (G_OBJECT (sink), "async", FALSE, "sync", FALSE, NULL);
+	gst_bin_add (GST_BIN (pipeline), sink);
+	gst_element_sync_state_with_parent (sink);
+
+	sinkpad = gst_element_get_static_pad (sink, "sink");
+	linkPad_ok = gst_pad_link (newPad, sinkpad);
 	checkPadsLinkingSuccessOrExit();
 
+	gst_pad_add_buffer_probe (sinkpad, G_CALLBACK (comfortNoiseProbe), NULL);
 	gst_object_unref (sinkpad);
 }
 
+// Both probes run in the thread of the partner's jitterbuffer.
+static gboolean comfortNoiseProbe(GstPad* pad, GstBuffer* buffer, gpointer data){
+	gint level = rtpDtx_comfortNoiseLevel(buffer);
+	if (level >= 0){
+		setComfortNoiseLevel(level);
+	}
+	return TRUE;
+}
+
+static gboolean speechProbe(GstPad* pad, GstBuffer* buffer, gpointer data){
+	setComfortNoiseLevel(VOICE_ACTIVITY_MAX_LEVEL);
+	return TRUE;
+}
+
+/*
+ * Uniform white noise of amplitude A has a power of A^2 / 3, which is
+ * matched to the level's power relative to full scale.
+ */
+void setComfortNoiseLevel(gint level){
+	static gint currentLevel = VOICE_ACTIVITY_MAX_LEVEL;
+	if (level == currentLevel){
+		return;
+	}
+	currentLevel = level;
+
+	gdouble volume = MIN (sqrt (3 * voiceActivity_powerOfLevel(level)), 1.0);
+	g_object_set (G_OBJECT (noiseSource), "volume", volume, NULL);
+}
+
 void checkLinkingSuccessOrExit(){
 	if (!link_ok) {
     	g_printerr ("Failed to link elements.");
@@ -343,6 +574,28 @@ void checkPadsLinkingSuccessOrExit(){
   	}
 }
 
+void startMetricsOrExit(){
+	if (!metricsPort){
+		return;
+	}
+
+	metrics_watchJitterbuffers(rtpbin);
+	metrics_countCpu(encoder, &encoderCpu);
+
+	if (!metricsEndpoint_start(metricsPort, collectMetrics, NULL)){
+		exit(EXIT_METRICS_FAILURE);
+	}
+}
+
+// Runs in the main thread on every scrape.
+void collectMetrics(MetricsSnapshot* snapshot, gpointer data){
+	metrics_collectRtpSession(snapshot, rtpbin, 0, "");
+	metrics_collectJitterbuffers(snapshot, rtpbin, "");
+
+	metrics_add(snapshot, "phone_encoder_cpu_seconds_total", "counter",
+		"CPU time spent encoding the microphone", "", encoderCpu.ns / 1e9);
+}
+
 void registerBusCall(){
 	g_print ("Registering bus call.\n");
 	GstBus* bus = gst_pipeline_get_bus (GST_PIPELINE (pipeline));
@@ -375,6 +628,10 @@ static gboolean busCall (GstBus *bus, GstMessage *msg, gpointer data) {
 			break;
 		}
 
+		case GST_MESSAGE_LATENCY:
+			gst_bin_recalculate_latency (GST_BIN (pipeline));
+			break;
+
 		default:
 			break;
 	}
@@ -392,6 +649,7 @@ void runLoop(){
 void cleanUp(){
 	g_print ("Returned, stopping playback\n");
 	gst_element_set_state (pipeline, GST_STATE_NULL);
+	latencyTracer_dump();
 
 	g_print ("Deleting pipeline\n");
 	gst_object_unref (GST_OBJECT (pipeline));
@@ -0,0 +1,186 @@
+#ifndef BIN_POOL_H
+#define BIN_POOL_H
+
+#include <gst/gst.h>
+
+#include "roomWorker.h"
+
+/*
+ * Pool of ready-made participant bins.
+ *
+ * A join takes a bin from the pool instead of building one, so the
+ * streaming thread it runs in does no factory lookups, no element
+ * construction and no NULL to READY changes (udpsink opens its socket
+ * there). A leave gives the bin back once it is out of the pipeline.
+ *
+ * Pooled bins are kept outside the pipeline in READY: everything is
+ * allocated, but no pad is active and no streaming thread is parked.
+ * Whenever fewer than the low-water mark are left, the pool is topped up
+ * again on the room's worker. Up to twice the mark are kept when bins come
+ * back, the rest is destroyed. A mark of 0 turns pooling off: every join
+ * builds its bin, every leave destroys it.
+ *
+ * Taking, giving back and refilling all run on the room's worker. The idle
+ * list is still locked for binPool_idleCount(), which the metrics page
+ * calls from the main loop.
+ */
+
+typedef GstElement* (*BinPoolBuildFunc) (gpointer data);
+
+typedef struct {
+	gchar* name;
+	RoomWorker* worker;
+	guint lowWater;
+	BinPoolBuildFunc build;
+	gpointer buildData;
+
+	GMutex* lock;
+	GQueue idle;
+	gboolean refillScheduled;
+
+	// Joins that found the pool empty and built their own bin.
+	volatile gint misses;
+} BinPool;
+
+static GstElement* binPool_build(BinPool* pool){
+	GstElement* bin = pool->build (pool->buildData);
+	gst_object_ref (bin);
+	gst_object_sink (bin);
+	g_object_set_data (G_OBJECT (bin), "bin-pool", pool);
+
+	g_assert (gst_element_set_state (bin, GST_STATE_READY) == GST_STATE_CHANGE_SUCCESS);
+	return bin;
+}
+
+static gboolean binPool_refillIdle(gpointer data){
+	BinPool* pool = (BinPool*) data;
+
+	g_mutex_lock (pool->lock);
+	pool->refillScheduled = FALSE;
+	guint missing = pool->lowWater - MIN (pool->lowWater, g_queue_get_length (&pool->idle));
+	g_mutex_unlock (pool->lock);
+
+	if (!missing){
+		return FALSE;
+	}
+
+	g_print ("Pre-building %u %s bins.\n", missing, pool->name);
+	while (missing--){
+		GstElement* bin = binPool_build(pool);
+
+		g_mutex_lock (pool->lock);
+		g_queue_push_tail (&pool->idle, bin);
+		g_mutex_unlock (pool->lock);
+	}
+	return FALSE;
+}
+
+// Called with the lock held.
+static void binPool_refillOnDemand(BinPool* pool){
+	if (pool->refillScheduled || g_queue_get_length (&pool->idle) >= pool->lowWater){
+		return;
+	}
+	pool->refillScheduled = TRUE;
+	roomWorker_idleAdd(pool->worker, binPool_refillIdle, pool);
+}
+
+/*
+ * The first fill is done by the worker too, so with the worker not running
+ * yet it happens as soon as it starts.
+ */
+void binPool_init(BinPool* pool, const gchar* name, RoomWorker* worker, guint lowWater, BinPoolBuildFunc build, gpointer buildData){
+	pool->name      = g_strdup (name);
+	pool->worker    = worker;
+	pool->lowWater  = lowWater;
+	pool->build     = build;
+	pool->buildData = buildData;
+	pool->lock      = g_mutex_new ();
+	pool->misses    = 0;
+	pool->refillScheduled = FALSE;
+	g_queue_init (&pool->idle);
+
+	g_mutex_lock (pool->lock);
+	binPool_refillOnDemand(pool);
+	g_mutex_unlock (pool->lock);
+}
+
+/*
+ * Returns a bin in READY, with a reference for the caller: once the bin is
+ * added to the pipeline, the caller drops it. Per-participant settings (a
+ * host to send to, counters) are for the caller to make.
+ */
+GstElement* binPool_take(BinPool* pool){
+	g_mutex_lock (pool->lock);
+	GstElement* bin = (GstElement*) g_queue_pop_head (&pool->idle);
+	guint left = g_queue_get_length (&pool->idle);
+	binPool_refillOnDemand(pool);
+	g_mutex_unlock (pool->lock);
+
+	if (bin){
+		g_print ("\t\tTaken %s bin from pool (%u left).\n", pool->name, left);
+		return bin;
+	}
+
+	if (pool->lowWater){
+		g_atomic_int_inc (&pool->misses);
+		g_print ("\t\tPool of %s bins is empty, building one.\n", pool->name);
+	}
+	return binPool_build(pool);
+}
+
+/*
+ * Takes a bin out of its pipeline and back to READY, which flushes it and
+ * resets its elements, and keeps it for the next join of its pool. Must not
+ * be called from the bin's own streaming threads.
+ */
+void binPool_recycle(GstElement* bin){
+	BinPool* pool = (BinPool*) g_object_get_data (G_OBJECT (bin), "bin-pool");
+	g_assert (pool);
+
+	gst_element_set_state (bin, GST_STATE_READY);
+	GstObject* parent = gst_object_get_parent (GST_OBJECT (bin));
+	if (parent){
+		// The pool takes over the reference the pipeline drops.
+		gst_object_ref (bin);
+		gst_bin_remove (GST_BIN (parent), bin);
+		gst_object_unref (parent);
+	}
+
+	g_mutex_lock (pool->lock);
+	gboolean keep = g_queue_get_length (&pool->idle) < 2 * pool->lowWater;
+	if (keep){
+		g_queue_push_tail (&pool->idle, bin);
+	}
+	g_mutex_unlock (pool->lock);
+
+	if (!keep){
+		gst_element_set_state (bin, GST_STATE_NULL);
+		gst_object_unref (bin);
+	}
+}
+
+guint binPool_idleCount(BinPool* pool){
+	g_mutex_lock (pool->lock);
+	guint count = g_queue_get_length (&pool->idle);
+	g_mutex_unlock (pool->lock);
+	return count;
+}
+
+void binPool_clear(BinPool* pool){
+	g_mutex_lock (pool->lock);
+	GstElement* bin;
+	while ((bin = (GstElement*) g_queue_pop_head (&pool->idle))){
+		gst_element_set_state (bin, GST_STATE_NULL);
+		gst_object_unref (bin);
+	}
+	g_mutex_unlock (pool->lock);
+}
+
+// Only once nothing can take from or give back to the pool anymore.
+void binPool_free(BinPool* pool){
+	binPool_clear(pool);
+	g_mutex_free (pool->lock);
+	g_free (pool->name);
+}
+
+#endif
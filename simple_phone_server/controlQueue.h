@@ -0,0 +1,105 @@
+#ifndef CONTROL_QUEUE_H
+#define CONTROL_QUEUE_H
+
+#include <gst/gst.h>
+
+#include "roomWorker.h"
+
+/*
+ * Hands events from any thread over to a worker, which handles them one at
+ * a time and in the order they were posted.
+ *
+ * Posting never takes a lock: the event is pushed onto a stack with a
+ * compare-and-swap. Whoever pushes onto an empty stack schedules one
+ * dispatch on the worker, which takes the whole stack in one swap and
+ * handles it oldest first. A post racing with the dispatch finds the stack
+ * empty again and schedules the next one, so no event waits for a later
+ * post to be noticed. Only that one post per batch goes through the
+ * worker's context lock.
+ *
+ * An event is about a pad, which it holds a reference to until it has been
+ * handled, or about an SSRC alone.
+ */
+
+typedef struct _ControlEvent ControlEvent;
+
+struct _ControlEvent {
+	ControlEvent* next;
+	gint type;
+	GstPad* pad;
+	guint32 ssrc;
+};
+
+typedef void (*ControlEventFunc) (gint type, GstPad* pad, guint32 ssrc, gpointer data);
+
+typedef struct {
+	ControlEvent* volatile head;
+	RoomWorker* worker;
+	ControlEventFunc handle;
+	gpointer data;
+
+	volatile gint posted;
+	volatile gint batches;
+} ControlQueue;
+
+void controlQueue_init(ControlQueue* queue, RoomWorker* worker, ControlEventFunc handle, gpointer data){
+	queue->head    = NULL;
+	queue->worker  = worker;
+	queue->handle  = handle;
+	queue->data    = data;
+	queue->posted  = 0;
+	queue->batches = 0;
+}
+
+static gboolean controlQueue_dispatch(gpointer data){
+	ControlQueue* queue = (ControlQueue*) data;
+
+	ControlEvent* batch;
+	do {
+		batch = (ControlEvent*) g_atomic_pointer_get (&queue->head);
+	} while (!g_atomic_pointer_compare_and_exchange ((gpointer*) &queue->head, batch, NULL));
+
+	// Newest first on the stack, so turned around.
+	ControlEvent* ordered = NULL;
+	while (batch){
+		ControlEvent* next = batch->next;
+		batch->next = ordered;
+		ordered = batch;
+		batch = next;
+	}
+
+	while (ordered){
+		ControlEvent* event = ordered;
+		ordered = event->next;
+
+		queue->handle(event->type, event->pad, event->ssrc, queue->data);
+		if (event->pad){
+			gst_object_unref (event->pad);
+		}
+		g_slice_free (ControlEvent, event);
+	}
+
+	g_atomic_int_inc (&queue->batches);
+	return FALSE;
+}
+
+void controlQueue_post(ControlQueue* queue, gint type, GstPad* pad, guint32 ssrc){
+	ControlEvent* event = g_slice_new (ControlEvent);
+	event->type = type;
+	event->pad  = pad ? gst_object_ref (pad) : 0;
+	event->ssrc = ssrc;
+
+	ControlEvent* head;
+	do {
+		head = (ControlEvent*) g_atomic_pointer_get (&queue->head);
+		event->next = head;
+	} while (!g_atomic_pointer_compare_and_exchange ((gpointer*) &queue->head, head, event));
+
+	g_atomic_int_inc (&queue->posted);
+
+	if (!head){
+		roomWorker_idleAdd(queue->worker, controlQueue_dispatch, queue);
+	}
+}
+
+#endif
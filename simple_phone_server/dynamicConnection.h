@@ -2,90 +2,237 @@
 #define DYNAMIC_CONNECTION_H
 
 #include <gst/gst.h>
-#include <string.h> 
-#include <stdlib.h> 
+#include <string.h>
+#include <stdlib.h>
+#include <arpa/inet.h>
+
+/*
+ * Registry of connected participants.
+ *
+ * Connections live in fixed-size chunks which are never moved, so a pointer
+ * returned by the registry stays valid until its connection is removed.
+ * Callers that keep a reference across joins and leaves should keep a handle
+ * instead: a handle carries a generation counter and simply stops resolving
+ * once its slot has been reused.
+ *
+ * Every lookup (by rtpbin pad, by SSRC and by binary host:port) is a single
+ * hash table probe, so join and leave cost does not depend on the number of
+ * participants.
+ *
+ * The slots are the only per-caller memory of the server: a connection is
+ * stored by value, host text included, and chunks are kept for reuse rather
+ * than freed, so a room's footprint follows its largest attendance, not the
+ * number of calls it has seen. The pad and the bins are borrowed: rtpbin
+ * owns the pad, the pipeline or a bin pool owns the bins.
+ */
+
+#define DYNAMIC_CONNECTION_CHUNK_BITS 8
+#define DYNAMIC_CONNECTION_CHUNK_SIZE (1 << DYNAMIC_CONNECTION_CHUNK_BITS)
+#define DYNAMIC_CONNECTION_INDEX_BITS 20
+#define DYNAMIC_CONNECTION_INDEX_MASK ((1 << DYNAMIC_CONNECTION_INDEX_BITS) - 1)
+#define DYNAMIC_CONNECTION_MAX        DYNAMIC_CONNECTION_INDEX_MASK
+
+#define DYNAMIC_CONNECTION_NO_HANDLE 0
+
+typedef guint32 DynamicConnectionHandle;
 
 typedef struct {
 	GstPad* rptBinPad;
 	GstElement* decoderBin;
 	GstElement* outputBin;
-	gchar* host;
+	gchar host[INET_ADDRSTRLEN];
+	guint32 ssrc;
+	guint64 hostKey;
 } DynamicConnection;
 
-struct DCLE {
-	DynamicConnection* connection;
-	struct DCLE* next;
-};
-
-typedef struct DCLE DynamicConnectionListElement;
+typedef struct {
+	DynamicConnection connection;
+	guint32 generation;
+	gint nextFree;
+	gboolean used;
+} DynamicConnectionSlot;
 
 typedef struct {
-	DynamicConnectionListElement* head;
+	DynamicConnectionSlot** chunks;
+	int chunksCount;
+	int firstFree;
 	int size;
-} DynamicConnectionList;
 
-void dynamicConnectionList_addFirst(DynamicConnectionList* list, DynamicConnection* connection){
+	GHashTable* byPad;
+	GHashTable* bySsrc;
+	GHashTable* byHost;
+} DynamicConnectionRegistry;
+
+guint64 dynamicConnection_hostKey(guint32 address, guint16 port){
+	return ((guint64) address << 16) | port;
+}
 
-	DynamicConnectionListElement* newElement = 
-		(DynamicConnectionListElement*) malloc( sizeof(DynamicConnectionListElement));
+void dynamicConnectionRegistry_init(DynamicConnectionRegistry* registry){
+	registry->chunks      = 0;
+	registry->chunksCount = 0;
+	registry->firstFree   = -1;
+	registry->size        = 0;
 
-	newElement->connection = connection;
-	newElement->next = list->head;
+	registry->byPad  = g_hash_table_new (g_direct_hash, g_direct_equal);
+	registry->bySsrc = g_hash_table_new (g_direct_hash, g_direct_equal);
+	registry->byHost = g_hash_table_new (g_int64_hash, g_int64_equal);
+}
 
-	list->head = newElement;
-	list->size++;
+// Forgets every connection and frees the chunks; for shutting down.
+void dynamicConnectionRegistry_clear(DynamicConnectionRegistry* registry){
+	g_hash_table_destroy (registry->byPad);
+	g_hash_table_destroy (registry->bySsrc);
+	g_hash_table_destroy (registry->byHost);
 
-	g_print ("Added new connection to list. New size: %d.\n", list->size);
+	int i;
+	for (i = 0; i < registry->chunksCount; i++){
+		g_free (registry->chunks[i]);
+	}
+	g_free (registry->chunks);
+
+	registry->chunks      = 0;
+	registry->chunksCount = 0;
+	registry->firstFree   = -1;
+	registry->size        = 0;
 }
 
-DynamicConnection* dynamicConnectionList_removeByRtpBinPad(DynamicConnectionList* list, GstPad* pad){
+DynamicConnectionSlot* dynamicConnectionRegistry_slot(DynamicConnectionRegistry* registry, int index){
+	return &registry->chunks[index >> DYNAMIC_CONNECTION_CHUNK_BITS][index & (DYNAMIC_CONNECTION_CHUNK_SIZE - 1)];
+}
 
-	DynamicConnectionListElement* previousElement = 0;
-	DynamicConnectionListElement* currentElement  = list->head;
+void dynamicConnectionRegistry_grow(DynamicConnectionRegistry* registry){
+	int chunk = registry->chunksCount;
+	g_assert ((chunk + 1) * DYNAMIC_CONNECTION_CHUNK_SIZE <= DYNAMIC_CONNECTION_MAX);
+
+	registry->chunks = g_renew (DynamicConnectionSlot*, registry->chunks, chunk + 1);
+	registry->chunks[chunk] = g_new0 (DynamicConnectionSlot, DYNAMIC_CONNECTION_CHUNK_SIZE);
+	registry->chunksCount++;
+
+	// Thread the new slots onto the free list, lowest index first.
+	int first = chunk * DYNAMIC_CONNECTION_CHUNK_SIZE;
+	int i;
+	for (i = DYNAMIC_CONNECTION_CHUNK_SIZE - 1; i >= 0; i--){
+		DynamicConnectionSlot* slot = &registry->chunks[chunk][i];
+		slot->nextFree = registry->firstFree;
+		registry->firstFree = first + i;
+	}
+}
 
-	while (currentElement){
+DynamicConnectionHandle dynamicConnectionRegistry_handle(DynamicConnectionSlot* slot, int index){
+	return (slot->generation << DYNAMIC_CONNECTION_INDEX_BITS) | index;
+}
 
-		DynamicConnection* connection = currentElement->connection;
-		DynamicConnectionListElement* nextElement = currentElement->next;
+DynamicConnection* dynamicConnectionRegistry_get(DynamicConnectionRegistry* registry, DynamicConnectionHandle handle){
+	if (handle == DYNAMIC_CONNECTION_NO_HANDLE){
+		return 0;
+	}
 
-		if (connection->rptBinPad == pad){
+	int index = handle & DYNAMIC_CONNECTION_INDEX_MASK;
+	if (index >= registry->chunksCount * DYNAMIC_CONNECTION_CHUNK_SIZE){
+		return 0;
+	}
 
-			if (previousElement){
-				previousElement->next = nextElement;
-			} else {
-				list->head = nextElement;
-			}
+	DynamicConnectionSlot* slot = dynamicConnectionRegistry_slot(registry, index);
+	if (!slot->used || dynamicConnectionRegistry_handle(slot, index) != handle){
+		return 0;
+	}
+	return &slot->connection;
+}
 
-			free(currentElement);			
-			list->size--;
+DynamicConnectionHandle dynamicConnectionRegistry_add(DynamicConnectionRegistry* registry, const DynamicConnection* connection){
 
-			g_print ("Connection removed from list. New size: %d.\n", list->size);
+	if (registry->firstFree < 0){
+		dynamicConnectionRegistry_grow(registry);
+	}
 
-			return connection;
-		}
+	int index = registry->firstFree;
+	DynamicConnectionSlot* slot = dynamicConnectionRegistry_slot(registry, index);
+	registry->firstFree = slot->nextFree;
 
-		previousElement = currentElement;
-		currentElement  = nextElement;
+	// Generation 0 is never handed out, so no valid handle equals NO_HANDLE.
+	slot->generation = (slot->generation + 1) & ((1 << (32 - DYNAMIC_CONNECTION_INDEX_BITS)) - 1);
+	if (slot->generation == 0){
+		slot->generation = 1;
 	}
+	slot->connection = *connection;
+	slot->used = TRUE;
+	registry->size++;
+
+	DynamicConnectionHandle handle = dynamicConnectionRegistry_handle(slot, index);
+	DynamicConnection* stored = &slot->connection;
+
+	g_hash_table_insert (registry->byPad,  stored->rptBinPad, GUINT_TO_POINTER (handle));
+	g_hash_table_insert (registry->bySsrc, GUINT_TO_POINTER (stored->ssrc), GUINT_TO_POINTER (handle));
+	// The key points into the slot, so a rejoin from the same host must
+	// swap it for its own: insert would keep the old slot's, which changes
+	// once that slot is freed and reused.
+	g_hash_table_replace (registry->byHost, &stored->hostKey, GUINT_TO_POINTER (handle));
+
+	g_print ("Added new connection to registry. New size: %d.\n", registry->size);
+
+	return handle;
+}
+
+// A key may have been taken over by a newer connection, which must keep it.
+void dynamicConnectionRegistry_unindex(GHashTable* index, gconstpointer key, DynamicConnectionHandle handle){
+	if (GPOINTER_TO_UINT (g_hash_table_lookup (index, key)) == handle){
+		g_hash_table_remove (index, key);
+	}
+}
+
+gboolean dynamicConnectionRegistry_remove(DynamicConnectionRegistry* registry, DynamicConnectionHandle handle, DynamicConnection* removed){
+
+	DynamicConnection* connection = dynamicConnectionRegistry_get(registry, handle);
+	if (!connection){
+		g_print ("No matches in connections registry.\n");
+		return FALSE;
+	}
+
+	dynamicConnectionRegistry_unindex(registry->byPad,  connection->rptBinPad, handle);
+	dynamicConnectionRegistry_unindex(registry->bySsrc, GUINT_TO_POINTER (connection->ssrc), handle);
+	dynamicConnectionRegistry_unindex(registry->byHost, &connection->hostKey, handle);
+
+	if (removed){
+		*removed = *connection;
+	}
+
+	int index = handle & DYNAMIC_CONNECTION_INDEX_MASK;
+	DynamicConnectionSlot* slot = dynamicConnectionRegistry_slot(registry, index);
+	slot->used = FALSE;
+	slot->nextFree = registry->firstFree;
+	registry->firstFree = index;
+	registry->size--;
+
+	g_print ("Connection removed from registry. New size: %d.\n", registry->size);
+
+	return TRUE;
+}
+
+DynamicConnectionHandle dynamicConnectionRegistry_findByRtpBinPad(DynamicConnectionRegistry* registry, GstPad* pad){
+	return GPOINTER_TO_UINT (g_hash_table_lookup (registry->byPad, pad));
+}
+
+DynamicConnectionHandle dynamicConnectionRegistry_findBySsrc(DynamicConnectionRegistry* registry, guint32 ssrc){
+	return GPOINTER_TO_UINT (g_hash_table_lookup (registry->bySsrc, GUINT_TO_POINTER (ssrc)));
+}
+
+DynamicConnectionHandle dynamicConnectionRegistry_findByHost(DynamicConnectionRegistry* registry, guint32 address, guint16 port){
+	guint64 key = dynamicConnection_hostKey(address, port);
+	return GPOINTER_TO_UINT (g_hash_table_lookup (registry->byHost, &key));
+}
 
-	g_print ("No matches in connections list.\n");
-	return 0;
+gboolean dynamicConnectionRegistry_removeByRtpBinPad(DynamicConnectionRegistry* registry, GstPad* pad, DynamicConnection* removed){
+	return dynamicConnectionRegistry_remove(registry, dynamicConnectionRegistry_findByRtpBinPad(registry, pad), removed);
 }
 
-gboolean dynamicConnectionList_isEmpty(DynamicConnectionList* list){
-	return list->size == 0;
+gboolean dynamicConnectionRegistry_isEmpty(DynamicConnectionRegistry* registry){
+	return registry->size == 0;
 }
 
-gboolean dynamicConnectionList_isHostNotRegistered(DynamicConnectionList* list, gchar* host){
-	DynamicConnectionListElement* elem = list->head;
-	
-	while (elem){
-		gchar* currentHost = elem->connection->host;
-		if (strcmp(currentHost, host)==0){
-			g_print ("Host is already registered: %s.\n", host);
-			return FALSE;
-		}
-		elem = elem->next;
+gboolean dynamicConnectionRegistry_isHostNotRegistered(DynamicConnectionRegistry* registry, guint32 address, guint16 port){
+	if (dynamicConnectionRegistry_findByHost(registry, address, port) != DYNAMIC_CONNECTION_NO_HANDLE){
+		g_print ("Host is already registered.\n");
+		return FALSE;
 	}
 	return TRUE;
 }
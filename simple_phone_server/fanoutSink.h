@@ -0,0 +1,364 @@
+#ifndef FANOUT_SINK_H
+#define FANOUT_SINK_H
+
+#include <gst/gst.h>
+#include <gst/base/gstbasesink.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+/*
+ * "fanoutsink" - sends every buffer to all destinations of a table.
+ *
+ * It replaces a tee with one queue and udpsink per participant: there is a
+ * single socket and no extra streaming threads, and a packet goes out to
+ * all destinations with one sendmmsg() call (a few for very large tables),
+ * all messages sharing the same payload iovec.
+ *
+ * Destinations are keyed by the caller's 64-bit key (the server uses the
+ * stream's SSRC) and can be added and removed while playing. The
+ * table is only locked while it is copied out for a send, which is also
+ * when every destination's packets and bytes are counted. The table's keys
+ * are slice-allocated once per destination and follow it when it moves, so
+ * a caller's join and leave cost one slab cell.
+ */
+
+#define FANOUT_SINK_MAX_BATCH 1024
+
+#define GST_TYPE_FANOUT_SINK (gst_fanout_sink_get_type())
+#define GST_FANOUT_SINK(obj) (G_TYPE_CHECK_INSTANCE_CAST((obj), GST_TYPE_FANOUT_SINK, GstFanoutSink))
+
+typedef struct _GstFanoutSink      GstFanoutSink;
+typedef struct _GstFanoutSinkClass GstFanoutSinkClass;
+
+typedef struct {
+	guint64 key;
+	struct sockaddr_in address;
+	guint64 packets;
+	guint64 bytes;
+} FanoutSinkDestination;
+
+struct _GstFanoutSink {
+	GstBaseSink parent;
+
+	int sockfd;
+	gboolean ownSocket;
+
+	GArray* destinations;
+	GHashTable* byKey;
+
+	// Send side, only touched from the streaming thread.
+	struct mmsghdr* messages;
+	struct sockaddr_in* addresses;
+	guint messagesSize;
+	struct iovec iov;
+
+	guint64 packetsSent;
+	guint64 sendCalls;
+};
+
+struct _GstFanoutSinkClass {
+	GstBaseSinkClass parent_class;
+};
+
+enum {
+	FANOUT_SINK_PROP_0,
+	FANOUT_SINK_PROP_SOCKFD,
+	FANOUT_SINK_PROP_DESTINATIONS,
+	FANOUT_SINK_PROP_PACKETS_SENT,
+	FANOUT_SINK_PROP_SEND_CALLS
+};
+
+static GstStaticPadTemplate gst_fanout_sink_sink_template = GST_STATIC_PAD_TEMPLATE ("sink",
+	GST_PAD_SINK, GST_PAD_ALWAYS, GST_STATIC_CAPS_ANY);
+
+// Defined with G_DEFINE_TYPE rather than GST_BOILERPLATE, whose file-wide
+// parent_class would clash with the other elements built into the server.
+G_DEFINE_TYPE (GstFanoutSink, gst_fanout_sink, GST_TYPE_BASE_SINK);
+
+static void gst_fanout_sink_set_property (GObject* object, guint id, const GValue* value, GParamSpec* pspec);
+static void gst_fanout_sink_get_property (GObject* object, guint id, GValue* value, GParamSpec* pspec);
+static void gst_fanout_sink_finalize (GObject* object);
+static gboolean gst_fanout_sink_start (GstBaseSink* base);
+static gboolean gst_fanout_sink_stop (GstBaseSink* base);
+static GstFlowReturn gst_fanout_sink_render (GstBaseSink* base, GstBuffer* buffer);
+
+static void gst_fanout_sink_class_init (GstFanoutSinkClass* klass){
+	GObjectClass*     gobject_class = G_OBJECT_CLASS (klass);
+	GstBaseSinkClass* basesink_class = GST_BASE_SINK_CLASS (klass);
+	GstElementClass* element_class = GST_ELEMENT_CLASS (klass);
+
+	gst_element_class_add_pad_template (element_class, gst_static_pad_template_get (&gst_fanout_sink_sink_template));
+
+	gst_element_class_set_details_simple (element_class,
+		"Fan-out UDP sink", "Sink/Network",
+		"Sends every packet to a table of UDP destinations with sendmmsg",
+		"GStreamer Audio Echo");
+
+	gobject_class->set_property = gst_fanout_sink_set_property;
+	gobject_class->get_property = gst_fanout_sink_get_property;
+	gobject_class->finalize     = gst_fanout_sink_finalize;
+
+	g_object_class_install_property (gobject_class, FANOUT_SINK_PROP_SOCKFD,
+		g_param_spec_int ("sockfd", "Socket",
+			"Socket to send from, -1 to open one", -1, G_MAXINT, -1, G_PARAM_READWRITE));
+
+	g_object_class_install_property (gobject_class, FANOUT_SINK_PROP_DESTINATIONS,
+		g_param_spec_uint ("destinations", "Destinations",
+			"Number of destinations in the table", 0, G_MAXUINT, 0, G_PARAM_READABLE));
+
+	g_object_class_install_property (gobject_class, FANOUT_SINK_PROP_PACKETS_SENT,
+		g_param_spec_uint64 ("packets-sent", "Packets sent",
+			"Datagrams handed to the kernel", 0, G_MAXUINT64, 0, G_PARAM_READABLE));
+
+	g_object_class_install_property (gobject_class, FANOUT_SINK_PROP_SEND_CALLS,
+		g_param_spec_uint64 ("send-calls", "Send calls",
+			"sendmmsg() calls made", 0, G_MAXUINT64, 0, G_PARAM_READABLE));
+
+	basesink_class->start  = GST_DEBUG_FUNCPTR (gst_fanout_sink_start);
+	basesink_class->stop   = GST_DEBUG_FUNCPTR (gst_fanout_sink_stop);
+	basesink_class->render = GST_DEBUG_FUNCPTR (gst_fanout_sink_render);
+}
+
+static void gst_fanout_sink_free_key (gpointer key){
+	g_slice_free (guint64, key);
+}
+
+static void gst_fanout_sink_init (GstFanoutSink* sink){
+	sink->sockfd    = -1;
+	sink->ownSocket = FALSE;
+
+	sink->destinations = g_array_new (FALSE, FALSE, sizeof (FanoutSinkDestination));
+	sink->byKey = g_hash_table_new_full (g_int64_hash, g_int64_equal, gst_fanout_sink_free_key, NULL);
+
+	sink->messages     = 0;
+	sink->addresses    = 0;
+	sink->messagesSize = 0;
+
+	sink->packetsSent = 0;
+	sink->sendCalls   = 0;
+
+	// Packets are sent as they come, like the udpsink this replaces.
+	gst_base_sink_set_sync (GST_BASE_SINK (sink), FALSE);
+	g_object_set (G_OBJECT (sink), "async", FALSE, NULL);
+}
+
+static void gst_fanout_sink_set_property (GObject* object, guint id, const GValue* value, GParamSpec* pspec){
+	GstFanoutSink* sink = GST_FANOUT_SINK (object);
+
+	switch (id) {
+		case FANOUT_SINK_PROP_SOCKFD:
+			sink->sockfd = g_value_get_int (value);
+			break;
+		default:
+			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, id, pspec);
+			break;
+	}
+}
+
+static void gst_fanout_sink_get_property (GObject* object, guint id, GValue* value, GParamSpec* pspec){
+	GstFanoutSink* sink = GST_FANOUT_SINK (object);
+
+	GST_OBJECT_LOCK (sink);
+	switch (id) {
+		case FANOUT_SINK_PROP_SOCKFD:
+			g_value_set_int (value, sink->sockfd);
+			break;
+		case FANOUT_SINK_PROP_DESTINATIONS:
+			g_value_set_uint (value, sink->destinations->len);
+			break;
+		case FANOUT_SINK_PROP_PACKETS_SENT:
+			g_value_set_uint64 (value, sink->packetsSent);
+			break;
+		case FANOUT_SINK_PROP_SEND_CALLS:
+			g_value_set_uint64 (value, sink->sendCalls);
+			break;
+		default:
+			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, id, pspec);
+			break;
+	}
+	GST_OBJECT_UNLOCK (sink);
+}
+
+static void gst_fanout_sink_finalize (GObject* object){
+	GstFanoutSink* sink = GST_FANOUT_SINK (object);
+
+	g_array_free (sink->destinations, TRUE);
+	g_hash_table_destroy (sink->byKey);
+	g_free (sink->messages);
+	g_free (sink->addresses);
+
+	G_OBJECT_CLASS (gst_fanout_sink_parent_class)->finalize (object);
+}
+
+static gboolean gst_fanout_sink_start (GstBaseSink* base){
+	GstFanoutSink* sink = GST_FANOUT_SINK (base);
+
+	if (sink->sockfd >= 0){
+		sink->ownSocket = FALSE;
+		return TRUE;
+	}
+
+	sink->sockfd = socket (AF_INET, SOCK_DGRAM, 0);
+	if (sink->sockfd < 0){
+		g_printerr ("Fan-out sink: cannot open socket: %s\n", g_strerror (errno));
+		return FALSE;
+	}
+	sink->ownSocket = TRUE;
+	return TRUE;
+}
+
+static gboolean gst_fanout_sink_stop (GstBaseSink* base){
+	GstFanoutSink* sink = GST_FANOUT_SINK (base);
+
+	if (sink->ownSocket){
+		close (sink->sockfd);
+		sink->sockfd    = -1;
+		sink->ownSocket = FALSE;
+	}
+	return TRUE;
+}
+
+// Every message points at its own address slot and at the shared payload.
+static void gst_fanout_sink_grow (GstFanoutSink* sink, guint size){
+	sink->messagesSize = size;
+	sink->messages  = g_renew (struct mmsghdr, sink->messages, size);
+	sink->addresses = g_renew (struct sockaddr_in, sink->addresses, size);
+
+	guint i;
+	for (i = 0; i < size; i++){
+		memset (&sink->messages[i], 0, sizeof (struct mmsghdr));
+		sink->messages[i].msg_hdr.msg_name    = &sink->addresses[i];
+		sink->messages[i].msg_hdr.msg_namelen = sizeof (struct sockaddr_in);
+		sink->messages[i].msg_hdr.msg_iov     = &sink->iov;
+		sink->messages[i].msg_hdr.msg_iovlen  = 1;
+	}
+}
+
+static GstFlowReturn gst_fanout_sink_render (GstBaseSink* base, GstBuffer* buffer){
+	GstFanoutSink* sink = GST_FANOUT_SINK (base);
+
+	guint size = GST_BUFFER_SIZE (buffer);
+
+	GST_OBJECT_LOCK (sink);
+	guint count = sink->destinations->len;
+	if (count > sink->messagesSize){
+		gst_fanout_sink_grow (sink, count * 2);
+	}
+
+	guint i;
+	for (i = 0; i < count; i++){
+		FanoutSinkDestination* destination = &g_array_index (sink->destinations, FanoutSinkDestination, i);
+		sink->addresses[i] = destination->address;
+		destination->packets++;
+		destination->bytes += size;
+	}
+	GST_OBJECT_UNLOCK (sink);
+
+	sink->iov.iov_base = GST_BUFFER_DATA (buffer);
+	sink->iov.iov_len  = size;
+
+	guint sent = 0;
+	guint calls = 0;
+	while (sent < count){
+		int result = sendmmsg (sink->sockfd, sink->messages + sent, MIN (count - sent, FANOUT_SINK_MAX_BATCH), 0);
+		calls++;
+
+		if (result < 0){
+			if (errno == EINTR){
+				continue;
+			}
+			// The message at the head of the batch failed, the rest are
+			// still worth sending.
+			g_printerr ("Fan-out sink: send failed: %s\n", g_strerror (errno));
+			sent++;
+			continue;
+		}
+		sent += result;
+	}
+
+	GST_OBJECT_LOCK (sink);
+	sink->packetsSent += count;
+	sink->sendCalls   += calls;
+	GST_OBJECT_UNLOCK (sink);
+
+	return GST_FLOW_OK;
+}
+
+/*
+ * Adds or updates a destination. The address and port are in host order;
+ * an updated destination keeps its counters.
+ */
+void gst_fanout_sink_add_destination (GstElement* element, guint64 key, guint32 address, guint16 port){
+	GstFanoutSink* sink = GST_FANOUT_SINK (element);
+
+	FanoutSinkDestination destination;
+	memset (&destination, 0, sizeof (destination));
+	destination.key = key;
+	destination.address.sin_family      = AF_INET;
+	destination.address.sin_addr.s_addr = htonl (address);
+	destination.address.sin_port        = htons (port);
+
+	GST_OBJECT_LOCK (sink);
+	gpointer index = g_hash_table_lookup (sink->byKey, &key);
+	if (index){
+		g_array_index (sink->destinations, FanoutSinkDestination, GPOINTER_TO_UINT (index) - 1).address = destination.address;
+	} else {
+		g_array_append_val (sink->destinations, destination);
+		g_hash_table_insert (sink->byKey, g_slice_dup (guint64, &key),
+			GUINT_TO_POINTER (sink->destinations->len));
+	}
+	GST_OBJECT_UNLOCK (sink);
+}
+
+/*
+ * The last destination takes the removed one's place, so removal does not
+ * depend on the size of the table.
+ */
+gboolean gst_fanout_sink_remove_destination (GstElement* element, guint64 key){
+	GstFanoutSink* sink = GST_FANOUT_SINK (element);
+
+	GST_OBJECT_LOCK (sink);
+	guint index = GPOINTER_TO_UINT (g_hash_table_lookup (sink->byKey, &key));
+	if (index == 0){
+		GST_OBJECT_UNLOCK (sink);
+		return FALSE;
+	}
+	g_hash_table_remove (sink->byKey, &key);
+
+	guint last = sink->destinations->len - 1;
+	if (index - 1 != last){
+		FanoutSinkDestination* moved = &g_array_index (sink->destinations, FanoutSinkDestination, last);
+		g_array_index (sink->destinations, FanoutSinkDestination, index - 1) = *moved;
+
+		// The moved destination keeps its key cell, only its index changes.
+		gpointer movedKey;
+		g_assert (g_hash_table_lookup_extended (sink->byKey, &moved->key, &movedKey, NULL));
+		g_hash_table_steal (sink->byKey, movedKey);
+		g_hash_table_insert (sink->byKey, movedKey, GUINT_TO_POINTER (index));
+	}
+	g_array_set_size (sink->destinations, last);
+	GST_OBJECT_UNLOCK (sink);
+
+	return TRUE;
+}
+
+// A copy of the destination table, with the packets and bytes sent so far.
+GArray* gst_fanout_sink_copy_destinations (GstElement* element){
+	GstFanoutSink* sink = GST_FANOUT_SINK (element);
+
+	GST_OBJECT_LOCK (sink);
+	GArray* copy = g_array_sized_new (FALSE, FALSE, sizeof (FanoutSinkDestination), sink->destinations->len);
+	g_array_append_vals (copy, sink->destinations->data, sink->destinations->len);
+	GST_OBJECT_UNLOCK (sink);
+
+	return copy;
+}
+
+void gst_fanout_sink_register (){
+	gst_element_register (NULL, "fanoutsink", GST_RANK_NONE, GST_TYPE_FANOUT_SINK);
+}
+
+#endif
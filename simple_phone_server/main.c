@@ -1,99 +1,404 @@
+#define _GNU_SOURCE
+
 #include <stdlib.h>
 #include <stdio.h>
 #include <gst/gst.h>
 
 #include "dynamicConnection.h"
+#include "phoneMixer.h"
+#include "fanoutSink.h"
+#include "mmsgSrc.h"
+#include "roomWorker.h"
+#include "binPool.h"
+#include "latencyTracer.h"
+#include "metricsEndpoint.h"
+#include "playoutDelay.h"
+#include "g726Enc.h"
+#include "g726Dec.h"
+#include "dtxGate.h"
+#include "rtpDtx.h"
+#include "codec.h"
+#include "recordTap.h"
+#include "trunk.h"
+#include "controlQueue.h"
+
+typedef struct _Room Room;
+
+/*
+ * The mix encoded for the callers of one codec. With mix-minus the tee
+ * carries the encoded mix to their output bins, otherwise the payloaded
+ * stream goes to the codec's own fan-out sink.
+ */
+typedef struct {
+	GstElement *encoder, *pay, *rtpDtx, *tee, *fanout;
+} MixBranch;
+
+/*
+ * What a room keeps per codec. The branch is added to the mixing bin when
+ * the first caller of the codec joins and stays as long as the mixing bin.
+ */
+typedef struct {
+	Room* room;
+	const Codec* codec;
+
+	// Bins for joining callers; output bins are only pooled with mix-minus.
+	BinPool decoderPool;
+	BinPool outputPool;
+
+	MixBranch branch;
+} RoomCodec;
+
+/*
+ * One conference. Every room listens on its own port and runs its own
+ * pipeline; rooms share nothing but the worker hosting them.
+ *
+ * The port is read by --receive-threads sources, each feeding its own
+ * rtpbin session, so the callers' packets are received and demuxed in as
+ * many threads. Callers of every session join and leave on the room's
+ * worker, which alone changes the room's elements and registry: rtpbin's
+ * signals only post to its control queue.
+ *
+ * The mix is gated once and split to one branch per codec in use.
+ *
+ * With --record every conference, from the first join to the last leave,
+ * is recorded into a file of its own, numbered by the room.
+ *
+ * With --trunk the room is also a leg of the same room of other servers
+ * (see trunk.h), each sending it one stream, under the room's trunk SSRC.
+ *
+ * With --admit-load and --degrade-load the room keeps its mixer within its
+ * frame time: new callers are held out of the mix, then fewer speakers are
+ * mixed, while the mixer's load is over either threshold.
+ */
+struct _Room {
+	int port;
+	RoomWorker* worker;
+	gboolean running;
+
+	GstElement *pipeline;
+	GstElement *rtpBin;
+	GstElement **udpSources;
+	GstElement *adder, *dtxGate, *splitter;
+
+	ControlQueue controlQueue;
+	DynamicConnectionRegistry connectionRegistry;
+
+	// Only codecs whose elements are installed are set up.
+	RoomCodec roomCodecs[CODEC_COUNT];
+
+	// The current conference's recording and the files made so far.
+	RecordTap* mixRecording;
+	guint recordings;
+
+	// The peers' rooms of this room's port.
+	Trunk* trunks;
+	guint32 trunkSsrc;
+
+	// Legs dropped before rtpbin's own timeout, for the metrics.
+	volatile gint byeEvictions;
+	volatile gint idleEvictions;
+
+	// Output bins waiting for their tee pad to block, see
+	// unlinkRtpOutputWhenBlocked(). The lock is shared with the blocked
+	// callbacks, which run in the streaming threads.
+	GMutex* blockingLock;
+	GSList* blockingOutputs;
+
+	// Set by checkOverload() on the room's worker, read by the metrics.
+	volatile gint admissionLimited;
+	volatile gint degraded;
+	volatile gint listenOnlyJoins;
+	volatile gint rejectedJoins;
+
+	// What the metrics endpoint reads from the main thread. The lock
+	// guards the mixing bin pointers against deleteMixingBin() and the
+	// mix-minus outputs, by SSRC.
+	GMutex* metricsLock;
+	GHashTable* meteredOutputs;
+	MetricsCpu mixerCpu;
+	MetricsCpu encoderCpu;
+};
 
 void getParametersOrExit(int argc, char *argv[]);
 void getParameters(int argc, char *argv[]);
 void printParameters();
 
-void createPrimaryElements();
-void createRtpBin();
-void createUdpSource();
+void createWorkers();
+void createRooms();
+void createRoom(Room* room, int port, RoomWorker* worker);
+
+void createPrimaryElements(Room* room);
+void createRtpBin(Room* room);
+void createUdpSources(Room* room);
+GstElement* createUdpSource(Room* room, int index);
 
-void addPrimaryElements();
+void addPrimaryElements(Room* room);
 
-void linkPrimaryElements();
-void linkPads_src2Bin();
-void linkRtpBinCallbacks();
-void linkRtpBin_PAD_ADDED_callback();
-void linkRtpBin_PAD_REMOVED_callback();
+void linkPrimaryElements(Room* room);
+void linkPads_src2Bin(Room* room, GstElement* udpSource);
+void linkRtpBinCallbacks(Room* room);
+void linkRtpBin_PAD_ADDED_callback(Room* room);
+void linkRtpBin_PAD_REMOVED_callback(Room* room);
 
 static void rtpBinPadAdded (GstElement * rtpbin, GstPad * new_pad, gpointer user_data);
+static void newPadBlocked (GstPad* pad, gboolean blocked, gpointer user_data);
 static void rtpBinPadRemoved (GstElement * rtpbin, GstPad * pad, gpointer user_data);
-
-GstElement* createRtpDecoderBin();
+static void handleRoomEvent (gint type, GstPad* pad, guint32 ssrc, gpointer data);
+void joinLeg(Room* room, GstPad* newPad);
+void joinLimitedLeg(Room* room, RoomCodec* roomCodec, GstPad* newPad, gchar* host, guint64 hostKey);
+void leaveLeg(Room* room, GstPad* pad);
+
+static void udpSourceBye (GstElement* udpSource, guint ssrc, gpointer user_data);
+static gboolean sweepIdleLegs (gpointer user_data);
+gboolean evictLeg(Room* room, guint32 ssrc, const gchar* reason);
+GstElement* findSsrcDemux(GstPad* rtpBinPad);
+
+static gboolean checkOverload (gpointer user_data);
+gboolean isOverloaded(guint load, int threshold, gboolean overloaded);
+void setDegraded(Room* room, gboolean degraded, guint load);
+
+void addRtpOutput(Room* room, RoomCodec* roomCodec, GstPad* newPad, GstElement* rtpOutput, guint64 hostKey);
+void linkNewPadAndRtpDecoder(GstPad* newPad, GstElement* rtpDecoder);
+void linkComfortNoisePad(Room* room, GstPad* newPad);
+GstElement* linkDiscardSink(Room* room, GstPad* newPad, const gchar* key);
+void linkRtpDecoderAndMixingBin(Room* room, GstElement* rtpDecoder, GstElement* rtpOutput);
+void linkMinusPadAndRtpOutput(Room* room, GstPad* mixerSinkPad, GstElement* rtpOutput);
+void linkMixingBinAndRtpOutput(RoomCodec* roomCodec, GstElement* rtpOutput);
+void startBin(GstElement* bin);
+
+gchar* createRecordingPath(Room* room, guint32 ssrc);
+void recordMix(Room* room, GstElement* adder);
+void recordLeg(Room* room, GstElement* rtpDecoder, guint32 ssrc);
+RecordTap* stopRecordingLeg(GstElement* rtpDecoder);
+
+RoomCodec* getPadCodec(Room* room, GstPad* rtpBinPad);
+gboolean isCodecServed(RoomCodec* roomCodec);
+
+GstElement* createRtpDecoderBin(RoomCodec* roomCodec);
+GstElement* buildRtpDecoderBin(gpointer data);
+void addToPipeline(Room* room, GstElement* bin);
 GstElement* createRtpDecoderBinElement();
 GstElement* createRtpSrcQueue();
-GstElement* createRtpDepay();
-GstElement* createDecoder();
+GstElement* createRtpDepay(const Codec* codec);
+GstElement* createDecoder(const Codec* codec);
+GstElement* createDecoderConverter(const Codec* codec);
 void createRtpDecoderPads(GstElement* bin, GstElement* sinkPadOwner, GstElement* srcPadOwner);
 void createRtpDecoderSinkPad(GstElement* bin, GstElement* padOwner);
 void createRtpDecoderSrcPad(GstElement* bin, GstElement* padOwner);
 
-GstElement* createRtpOutputBin(gchar* host);
-GstElement* createRtpOutputBinElement();
+GstElement* createMixMinusRtpOutputBin(RoomCodec* roomCodec, gchar* host, guint64 hostKey);
+GstElement* createTrunkRtpOutputBin(RoomCodec* roomCodec, Trunk* trunk, gchar* host);
+GstElement* buildMixMinusRtpOutputBin(gpointer data);
+void resetRtpOutput(GstElement* bin, gchar* host, int port);
+GstElement* createRtpOutputBinElement(Room* room);
 GstElement* createRtpSinkQueue();
-GstElement* createUdpSink(gchar* host);
-void createRtpOutputSinkPad(GstElement* bin, GstElement* padOwner);
-
-gchar* getOneNewHost ();
-gchar* getPeerHostOrZero (GObject* source);
-
-void registerConnection(GstPad* rtpBinPad, GstElement* decoderBin, GstElement* outputBin, gchar* host);
-
-void createMixingBinOnDemand();
-gboolean isMixingBinNotCreated();
-void createMixingBin();
+GstElement* createUdpSink();
+GstElement* createOutputSelector();
+GstElement* createDtxGate();
+GstElement* createRtpDtx();
+GstPad* createRtpOutputSelectorPad(GstElement* bin, GstElement* selector, const gchar* name);
+void createRtpOutputMinusPad(GstElement* bin, GstPad* target);
+
+static void mixerLegActivity (GstElement* mixer, GstPad* sinkpad, gboolean talking, gpointer user_data);
+
+gboolean getPeerHost (Room* room, GstPad* rtpBinPad, gchar* host, guint64* hostKey);
+guint32 getPadSsrc (GstPad* rtpBinPad);
+guint getPadSession (GstPad* rtpBinPad);
+
+int getReplyPort(guint64 hostKey);
+
+void createTrunks(Room* room);
+Trunk* findTrunk(Room* room, guint64 hostKey);
+static gboolean sayTrunkHellos (gpointer user_data);
+int getRoomSocket(Room* room);
+
+void registerConnection(Room* room, GstPad* rtpBinPad, GstElement* decoderBin, GstElement* outputBin, gchar* host, guint64 hostKey);
+
+void addFanoutDestination(RoomCodec* roomCodec, guint32 ssrc, guint64 hostKey);
+void removeFanoutDestination(RoomCodec* roomCodec, guint32 ssrc);
+
+void unlinkDiscardSink(Room* room, GstPad* pad, const gchar* key);
+void unlinkRtpDecoder(Room* room, GstElement* decoderBin);
+void unlinkRtpOutput(RoomCodec* roomCodec, GstElement* outputBin);
+void unlinkRtpOutputWhenBlocked(GstElement* outputBin);
+static void rtpOutputBlocked (GstPad* teePad, gboolean blocked, gpointer user_data);
+gboolean takeBlockingOutput(Room* room, GstElement* outputBin);
+void unlinkBlockingOutputs(Room* room);
+void unlinkRtpOutputFromTee(Room* room, GstPad* teePad, GstElement* outputBin);
+void releaseOnIdle(Room* room, GstElement* owner, GstPad* requestPad, GstElement* bin);
+static gboolean releaseIdle (gpointer user_data);
+
+void createMixingBinOnDemand(Room* room);
+gboolean isMixingBinNotCreated(Room* room);
+void createMixingBin(Room* room);
+void createMixBranchOnDemand(RoomCodec* roomCodec);
+void createMixBranch(RoomCodec* roomCodec);
+void linkSplitterAndMixBranch(Room* room, MixBranch* branch);
+void addLinkAndStartChain(Room* room, GstElement** chain, guint length);
 GstElement* createMixingBinElement();
-GstElement* createLiveAdder();
-GstElement* createEncoder();
-GstElement* createRtpPay();
+GstElement* createMixer();
+GstElement* createEncoder(const Codec* codec);
+GstElement* createRtpPay(const Codec* codec);
 GstElement* createOutputTee();
+GstElement* createFanoutSink();
 
-void deleteMixingBinOnDemand();
-void deleteMixingBin();
+void deleteMixingBinOnDemand(Room* room);
+void deleteMixingBin(Room* room);
+static gboolean deleteMixingBinIdle (gpointer user_data);
+void stopAndRemove(Room* room, GstElement* element);
 
-void registerBusCall();
+void registerBusCall(Room* room);
 static gboolean busCall(GstBus *bus, GstMessage *msg, gpointer data);
 
 void runLoop();
 void cleanUp();
+void freeRoom(Room* room);
 
-void pipeline_run();
-void pipeline_pause();
-void pipeline_stop();
+void pipeline_run(Room* room);
+void pipeline_stop(Room* room);
+
+void startMetricsOrExit();
+void meterRtpOutput(Room* room, guint32 ssrc, GstElement* rtpOutput);
+void unmeterRtpOutput(Room* room, guint32 ssrc);
+void collectMetrics(MetricsSnapshot* snapshot, gpointer data);
+void collectRoomMetrics(MetricsSnapshot* snapshot, Room* room);
+void collectReceiveMetrics(MetricsSnapshot* snapshot, const gchar* labels, int index, GstElement* udpSource);
+void collectSentMetrics(MetricsSnapshot* snapshot, const gchar* labels, guint32 ssrc, guint64 packets, guint64 bytes);
+void collectBinPoolMetrics(MetricsSnapshot* snapshot, const gchar* labels, BinPool* pool);
 
 #define EXIT_NORMAL 0
 #define EXIT_NOT_ENOUGH_PARAMETERS    -1
 #define EXIT_ELEMENT_CREATION_FAILURE -2
 #define EXIT_ELEMENT_LINKING_FAILURE  -3
 #define EXIT_PADS_LINKING_FAILURE     -4
+#define EXIT_INVALID_PARAMETERS       -5
 
 #define DEFAULT_UDP_PORT 9559
+#define DEFAULT_BIN_POOL 4
+#define RTP_HEADER_SIZE  12
+
+// What rtpbin's signals post to a room's control queue.
+#define ROOM_EVENT_PAD_ADDED   0
+#define ROOM_EVENT_PAD_REMOVED 1
+#define ROOM_EVENT_BYE         2
+
+// Most idle legs a sweep evicts per socket; the rest wait for the next one.
+#define SWEEP_BATCH 64
+
+// How often the mixer's load is checked (ms), how far under a threshold it
+// must drop again (percent of it) and how many speakers a degraded room mixes.
+#define OVERLOAD_CHECK_INTERVAL 200
+#define OVERLOAD_RECOVERY       80
+#define DEGRADED_SPEAKERS       3
 
 int listenPort = DEFAULT_UDP_PORT;
+gboolean mixMinus = FALSE;
+int roomsCount = 1;
+int workersCount = 0;
+gboolean symmetricRtp = FALSE;
+int metricsPort = 0;
+gchar* playoutDelayText = 0;
+PlayoutDelaySetting playoutDelay;
+int binPoolSize = DEFAULT_BIN_POOL;
+gboolean dtx = TRUE;
+int maxSpeakers = 0;
+int receiveThreads = 1;
+int inactivityTimeout = 0;
+int admitLoad = 0;
+gboolean rejectOverload = FALSE;
+int degradeLoad = 0;
+gchar* recordDir = 0;
+gboolean recordLegs = FALSE;
+gchar** trunkTexts = 0;
+Trunk* trunks = 0;
+int trunksCount = 0;
+
+static GOptionEntry options[] = {
+	{ "mix-minus", 'm', 0, G_OPTION_ARG_NONE, &mixMinus,
+		"Send every participant the mix without their own voice", NULL },
+	{ "rooms", 'r', 0, G_OPTION_ARG_INT, &roomsCount,
+		"Number of rooms, one per port starting at listen_port (default: 1)", "N" },
+	{ "workers", 'w', 0, G_OPTION_ARG_INT, &workersCount,
+		"Number of worker threads, one per CPU (default: one per CPU)", "N" },
+	{ "symmetric-rtp", 's', 0, G_OPTION_ARG_NONE, &symmetricRtp,
+		"Answer every caller on the port it sends from", NULL },
+	{ "metrics-port", 0, 0, G_OPTION_ARG_INT, &metricsPort,
+		"Serve Prometheus metrics on http://127.0.0.1:PORT/metrics", "PORT" },
+	{ "playout-delay", 'd', 0, G_OPTION_ARG_STRING, &playoutDelayText,
+		"Jitterbuffer latency in ms, or \"adaptive\" to size it per caller (default: rtpbin's)", "MS|adaptive" },
+	{ "bin-pool", 'p', 0, G_OPTION_ARG_INT, &binPoolSize,
+		"Participant bins kept ready per room, 0 to build them on join (default: 4)", "N" },
+	{ "no-dtx", 0, G_OPTION_FLAG_REVERSE, G_OPTION_ARG_NONE, &dtx,
+		"Keep sending the mix while nobody talks, instead of comfort noise", NULL },
+	{ "max-speakers", 'k', 0, G_OPTION_ARG_INT, &maxSpeakers,
+		"Mix only the N loudest callers, 0 to mix everybody (default: 0)", "N" },
+	{ "receive-threads", 't', 0, G_OPTION_ARG_INT, &receiveThreads,
+		"Sockets sharing each room's port, each read by its own thread (default: 1)", "N" },
+	{ "inactivity-timeout", 'i', 0, G_OPTION_ARG_INT, &inactivityTimeout,
+		"Drop a caller silent for MS, 0 to wait for rtpbin's timeout (default: 0)", "MS" },
+	{ "admit-load", 'a', 0, G_OPTION_ARG_INT, &admitLoad,
+		"Let new callers only listen while mixing takes over PERCENT of the frame time, 0 for never (default: 0)", "PERCENT" },
+	{ "reject-overload", 0, 0, G_OPTION_ARG_NONE, &rejectOverload,
+		"With --admit-load, ignore new callers instead of letting them listen", NULL },
+	{ "degrade-load", 'g', 0, G_OPTION_ARG_INT, &degradeLoad,
+		"Mix only the 3 loudest callers while mixing takes over PERCENT of the frame time, 0 for never (default: 0)", "PERCENT" },
+	{ "record", 0, 0, G_OPTION_ARG_STRING, &recordDir,
+		"Record every conference's mix into DIR, as .au files", "DIR" },
+	{ "record-legs", 0, 0, G_OPTION_ARG_NONE, &recordLegs,
+		"With --record, record every caller's own audio too", NULL },
+	{ "trunk", 0, 0, G_OPTION_ARG_STRING_ARRAY, &trunkTexts,
+		"Share the rooms with the phone_server on HOST:PORT, once per peer (needs --mix-minus)", "HOST:PORT" },
+	{ NULL }
+};
 
 GMainLoop  *loop;
 
-GstElement *pipeline;
-GstElement *rtpBin, *udpSource;
-GstElement *adder, *encoder, *pay, *tee;
-
-DynamicConnectionList connectionList;
+RoomWorker* workers;
+Room* rooms;
+
+// The process exits once the last room has stopped.
+volatile gint runningRooms;
+
+/*
+ * Everything that must be released from the main loop once the streaming
+ * threads are done with it: a request pad to give back to its owner and/or
+ * a bin to stop and remove from the pipeline.
+ */
+typedef struct {
+	Room* room;
+	GstElement* owner;
+	GstPad* requestPad;
+	GstElement* bin;
+} PendingRelease;
+
+typedef struct {
+	Room* room;
+	GstElement *adder, *dtxGate, *splitter;
+	MixBranch branches[CODEC_COUNT];
+	RecordTap* recording;
+} PendingMixingBin;
 
 int main(int argc, char *argv[]) {
     gst_init(NULL, NULL);
+	gst_phone_mixer_register();
+	gst_fanout_sink_register();
+	gst_mmsg_src_register();
+	gst_g726_enc_register();
+	gst_g726_dec_register();
+	gst_dtx_gate_register();
+	gst_rtp_dtx_register();
 
 	getParametersOrExit(argc, argv);
 
-	createPrimaryElements();
-	addPrimaryElements();
-	linkPrimaryElements();
-
 	loop = g_main_loop_new (NULL, FALSE);
-	registerBusCall();
+
+	if (recordDir){
+		recordWriter_start();
+	}
+
+	createWorkers();
+	createRooms();
+	startMetricsOrExit();
 
 	runLoop();
 	cleanUp(); // Normally never will be called
@@ -107,77 +412,309 @@ void getParametersOrExit(int argc, char *argv[]){
 }
 
 void getParameters(int argc, char *argv[]){
+	g_print ("Getting parameters.\n");
+
+	GError* error = 0;
+	GOptionContext* context = g_option_context_new ("[listen_port]");
+	g_option_context_add_main_entries (context, options, NULL);
+
+	if (!g_option_context_parse (context, &argc, &argv, &error)){
+		g_printerr ("%s\n", error->message);
+		exit(EXIT_INVALID_PARAMETERS);
+	}
+	g_option_context_free (context);
+
+	if (playoutDelayText && !playoutDelay_parse(playoutDelayText, &playoutDelay)){
+		g_printerr ("Invalid playout delay: %s.\n", playoutDelayText);
+		exit(EXIT_INVALID_PARAMETERS);
+	}
+
+	trunksCount = trunkTexts ? g_strv_length (trunkTexts) : 0;
+	trunks = g_new0 (Trunk, trunksCount);
+
+	int i;
+	for (i = 0; i < trunksCount; i++){
+		if (!trunk_parse(trunkTexts[i], &trunks[i])){
+			g_printerr ("Invalid trunk: %s.\n", trunkTexts[i]);
+			exit(EXIT_INVALID_PARAMETERS);
+		}
+	}
 
 	if (argc < 2) {
 		return;
 	}
 
-	g_print ("Getting parameters.\n");
 	g_print ("\tGetting port to listen.\n");
 	listenPort = atoi(argv[1]);
 }
 
 void printParameters(){
+	if (roomsCount < 1 || listenPort + roomsCount - 1 > G_MAXUINT16){
+		g_printerr ("Invalid number of rooms: %d.\n", roomsCount);
+		exit(EXIT_INVALID_PARAMETERS);
+	}
+	if (workersCount <= 0){
+		workersCount = roomWorker_cpuCount();
+	}
+	workersCount = MIN (workersCount, roomsCount);
+	if (binPoolSize < 0){
+		g_printerr ("Invalid bin pool size: %d.\n", binPoolSize);
+		exit(EXIT_INVALID_PARAMETERS);
+	}
+	if (maxSpeakers < 0){
+		g_printerr ("Invalid number of speakers: %d.\n", maxSpeakers);
+		exit(EXIT_INVALID_PARAMETERS);
+	}
+	if (receiveThreads < 1){
+		g_printerr ("Invalid number of receive threads: %d.\n", receiveThreads);
+		exit(EXIT_INVALID_PARAMETERS);
+	}
+	if (inactivityTimeout < 0){
+		g_printerr ("Invalid inactivity timeout: %d.\n", inactivityTimeout);
+		exit(EXIT_INVALID_PARAMETERS);
+	}
+	if (admitLoad < 0 || degradeLoad < 0){
+		g_printerr ("Invalid load threshold: %d.\n", MIN (admitLoad, degradeLoad));
+		exit(EXIT_INVALID_PARAMETERS);
+	}
+	if (rejectOverload && !admitLoad){
+		g_printerr ("--reject-overload needs --admit-load.\n");
+		exit(EXIT_INVALID_PARAMETERS);
+	}
+	if (recordLegs && !recordDir){
+		g_printerr ("--record-legs needs --record.\n");
+		exit(EXIT_INVALID_PARAMETERS);
+	}
+	if (recordDir && !g_file_test (recordDir, G_FILE_TEST_IS_DIR)){
+		g_printerr ("Not a directory to record into: %s.\n", recordDir);
+		exit(EXIT_INVALID_PARAMETERS);
+	}
+	if (trunksCount && !mixMinus){
+		g_printerr ("--trunk needs --mix-minus.\n");
+		exit(EXIT_INVALID_PARAMETERS);
+	}
+
+	int i;
+	for (i = 0; i < trunksCount; i++){
+		if (trunks[i].port + roomsCount - 1 > G_MAXUINT16){
+			g_printerr ("Trunk %s has no room for %d rooms.\n", trunkTexts[i], roomsCount);
+			exit(EXIT_INVALID_PARAMETERS);
+		}
+	}
+
 	g_print ("Connection parameters:\n");
-	g_print ("\tPort to listen: %d.\n", listenPort);
+	g_print ("\tPorts to listen: %d-%d.\n", listenPort, listenPort + roomsCount - 1);
+	g_print ("\tRooms          : %d.\n", roomsCount);
+	g_print ("\tWorkers        : %d.\n", workersCount);
+	g_print ("\tReceive threads: %d per room.\n", receiveThreads);
+	g_print ("\tMix-minus      : %s.\n", mixMinus ? "on" : "off");
+	g_print ("\tSymmetric RTP  : %s.\n", symmetricRtp ? "on" : "off");
+	g_print ("\tBin pool       : %d.\n", binPoolSize);
+	g_print ("\tDTX            : %s.\n", dtx ? "on" : "off");
+	if (maxSpeakers){
+		g_print ("\tMax speakers   : %d.\n", maxSpeakers);
+	}
+	if (inactivityTimeout){
+		g_print ("\tInactivity     : %d ms.\n", inactivityTimeout);
+	}
+	if (admitLoad){
+		g_print ("\tAdmission      : %s above %d%% load.\n", rejectOverload ? "reject" : "listen-only", admitLoad);
+	}
+	if (degradeLoad){
+		g_print ("\tDegradation    : %d speakers above %d%% load.\n", DEGRADED_SPEAKERS, degradeLoad);
+	}
+	if (recordDir){
+		g_print ("\tRecording      : %s%s.\n", recordDir, recordLegs ? ", every caller too" : "");
+	}
+	for (i = 0; i < trunksCount; i++){
+		g_print ("\tTrunk          : %s.\n", trunkTexts[i]);
+	}
+
+	g_print ("\tCodecs         :");
+	for (i = 0; i < CODEC_COUNT; i++){
+		if (codec_isAvailable(&codecs[i])){
+			g_print (" %s (%u)", codecs[i].name, codecs[i].payload);
+		}
+	}
+	g_print (".\n");
+	if (playoutDelayText){
+		g_print ("\tPlayout delay  : %s.\n", playoutDelayText);
+	}
+	if (metricsPort){
+		g_print ("\tMetrics port   : %d.\n", metricsPort);
+	}
 }
 
-void createPrimaryElements(){
+void createWorkers(){
+	g_print ("Creating workers.\n");
+
+	int cpus = roomWorker_cpuCount();
+	workers = g_new0 (RoomWorker, workersCount);
+
+	int i;
+	for (i = 0; i < workersCount; i++){
+		roomWorker_init(&workers[i], i, i % cpus);
+	}
+}
+
+/*
+ * Rooms are dealt out to the workers round-robin, so neighbouring ports
+ * land on different cores.
+ */
+void createRooms(){
+	g_print ("Creating rooms.\n");
+
+	rooms = g_new0 (Room, roomsCount);
+	runningRooms = roomsCount;
+
+	int i;
+	for (i = 0; i < roomsCount; i++){
+		createRoom(&rooms[i], listenPort + i, &workers[i % workersCount]);
+	}
+}
+
+void createRoom(Room* room, int port, RoomWorker* worker){
+	g_print ("Creating room on port %d (worker %d).\n", port, worker->index);
+
+	room->port   = port;
+	room->worker = worker;
+	controlQueue_init(&room->controlQueue, worker, handleRoomEvent, room);
+	dynamicConnectionRegistry_init(&room->connectionRegistry);
+
+	room->metricsLock    = g_mutex_new ();
+	room->blockingLock   = g_mutex_new ();
+	room->meteredOutputs = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, gst_object_unref);
+
+	guint i;
+	for (i = 0; i < CODEC_COUNT; i++){
+		RoomCodec* roomCodec = &room->roomCodecs[i];
+		roomCodec->room  = room;
+		roomCodec->codec = &codecs[i];
+
+		if (!isCodecServed(roomCodec)){
+			continue;
+		}
+		gchar* name = g_strdup_printf ("%s RTP-decoder", codecs[i].name);
+		binPool_init(&roomCodec->decoderPool, name, worker, binPoolSize, buildRtpDecoderBin, roomCodec);
+		g_free (name);
+
+		name = g_strdup_printf ("%s RTP-output", codecs[i].name);
+		binPool_init(&roomCodec->outputPool, name, worker, mixMinus ? binPoolSize : 0, buildMixMinusRtpOutputBin, roomCodec);
+		g_free (name);
+	}
+
+	createPrimaryElements(room);
+	addPrimaryElements(room);
+	linkPrimaryElements(room);
+	latencyTracer_attach(room->pipeline);
+
+	if (trunksCount){
+		createTrunks(room);
+	}
+	if (inactivityTimeout){
+		roomWorker_timeoutAdd(worker, MAX (inactivityTimeout / 2, 1), sweepIdleLegs, room);
+	}
+	if (admitLoad || degradeLoad){
+		roomWorker_timeoutAdd(worker, OVERLOAD_CHECK_INTERVAL, checkOverload, room);
+	}
+
+	if (metricsPort){
+		metrics_watchJitterbuffers(room->rtpBin);
+	}
+
+	registerBusCall(room);
+}
+
+void createPrimaryElements(Room* room){
 	g_print ("Creating primary elements.\n");
 
 	g_print ("\tCreating pipeline.\n");
-	pipeline  = gst_pipeline_new ("simple-phone");
+	gchar* name = g_strdup_printf ("simple-phone-%d", room->port);
+	room->pipeline = gst_pipeline_new (name);
+	g_free (name);
 	
-	createUdpSource();
-	createRtpBin();
+	createUdpSources(room);
+	createRtpBin(room);
 }
 
-void createRtpBin(){
+void createRtpBin(Room* room){
 	g_print ("\tCreating RTP-bin.\n");
-	rtpBin = gst_element_factory_make ("gstrtpbin", "rtpbin");
-	g_assert (rtpBin);
-	g_object_set (G_OBJECT (rtpBin), "autoremove", TRUE, NULL);
+	room->rtpBin = gst_element_factory_make ("gstrtpbin", "rtpbin");
+	g_assert (room->rtpBin);
+	g_object_set (G_OBJECT (room->rtpBin), "autoremove", TRUE, NULL);
+	codec_mapPayloads(room->rtpBin);
+
+	if (playoutDelayText){
+		playoutDelay_apply(room->rtpBin, &playoutDelay);
+	}
 }
 
-void createUdpSource(){
+void createUdpSources(Room* room){
+	room->udpSources = g_new0 (GstElement*, receiveThreads);
+
+	int i;
+	for (i = 0; i < receiveThreads; i++){
+		room->udpSources[i] = createUdpSource(room, i);
+	}
+}
+
+/*
+ * Every source is a live source with its own streaming thread. More than
+ * one share the port with SO_REUSEPORT, and the kernel keeps sending a
+ * caller's packets to the same one. Their threads are spread over the
+ * CPUs, so receiving is not bound to the room worker's core.
+ */
+GstElement* createUdpSource(Room* room, int index){
 	g_print ("\t\tCreating UDP source.\n");
 
-	udpSource = gst_element_factory_make ("udpsrc", "net-input");
+	gchar* name = g_strdup_printf ("net-input-%d", index);
+	GstElement* udpSource = gst_element_factory_make ("mmsgsrc", name);
+	g_free (name);
 	g_assert (udpSource);
 
-	GstCaps *caps = gst_caps_new_simple (
-		"application/x-rtp",	     
-		"media",           G_TYPE_STRING, "audio",
-		"clock-rate",      G_TYPE_INT,    8000,
-		"encoding-name",   G_TYPE_STRING, "G726",
-		"encoding-params", G_TYPE_STRING, "1",
-		"channels",        G_TYPE_INT,    1,
-		"payload",         G_TYPE_INT,    96,
-		NULL);
-	g_assert (caps);	
+	// Other payload types are looked up by rtpbin, see codec_mapPayloads().
+	GstCaps *caps = codec_rtpCaps(CODEC_DEFAULT);
+	g_assert (caps);
 
 	g_object_set (G_OBJECT (udpSource), "caps", caps,      NULL);
-	g_object_set (G_OBJECT (udpSource), "port", listenPort, NULL);
+	g_object_set (G_OBJECT (udpSource), "port", room->port, NULL);
+	g_object_set (G_OBJECT (udpSource), "reuse-port", receiveThreads > 1, NULL);
+
+	// The first source stays on the room's CPU, the others take the next.
+	roomWorker_setElementCpu(udpSource, (room->worker->cpu + index) % roomWorker_cpuCount());
+
+	g_signal_connect (udpSource, "bye-ssrc", G_CALLBACK (udpSourceBye), room);
 
 	gst_caps_unref (caps);
+	return udpSource;
 }
 
-void addPrimaryElements(){
+void addPrimaryElements(Room* room){
 	g_print ("Adding primary elements.\n");
-	gst_bin_add_many (GST_BIN (pipeline), rtpBin, udpSource, NULL);
+	gst_bin_add (GST_BIN (room->pipeline), room->rtpBin);
+
+	int i;
+	for (i = 0; i < receiveThreads; i++){
+		gst_bin_add (GST_BIN (room->pipeline), room->udpSources[i]);
+	}
 }
 
-void linkPrimaryElements(){
+void linkPrimaryElements(Room* room){
 	g_print ("Linking primary elements.\n");
-	linkPads_src2Bin();
-	linkRtpBinCallbacks();
+
+	int i;
+	for (i = 0; i < receiveThreads; i++){
+		linkPads_src2Bin(room, room->udpSources[i]);
+	}
+	linkRtpBinCallbacks(room);
 }
 
-void linkPads_src2Bin(){
+// The n-th source feeds rtpbin's session n.
+void linkPads_src2Bin(Room* room, GstElement* udpSource){
 	g_print ("\tLinking UDP-source and RTP-bin.\n");
 
 	GstPad* srcpad = gst_element_get_static_pad (udpSource, "src");
-	GstPad* sinkpad = gst_element_get_request_pad (rtpBin, "recv_rtp_sink_%d");
+	GstPad* sinkpad = gst_element_get_request_pad (room->rtpBin, "recv_rtp_sink_%d");
 
 	g_assert (gst_pad_link (srcpad, sinkpad) == GST_PAD_LINK_OK);
 
@@ -185,79 +722,380 @@ void linkPads_src2Bin(){
 	gst_object_unref (sinkpad);
 }
 
-void linkRtpBinCallbacks(){
-	linkRtpBin_PAD_ADDED_callback();
-	linkRtpBin_PAD_REMOVED_callback();
+void linkRtpBinCallbacks(Room* room){
+	linkRtpBin_PAD_ADDED_callback(room);
+	linkRtpBin_PAD_REMOVED_callback(room);
 }
 
-void linkRtpBin_PAD_ADDED_callback(){
+void linkRtpBin_PAD_ADDED_callback(Room* room){
 	g_print ("\tAdding RTP-bin \"pad-added\" callback.\n");
-	g_signal_connect (rtpBin, "pad-added", G_CALLBACK (rtpBinPadAdded), NULL);
+	g_signal_connect (room->rtpBin, "pad-added", G_CALLBACK (rtpBinPadAdded), room);
 }
 
-void linkRtpBin_PAD_REMOVED_callback(){
+void linkRtpBin_PAD_REMOVED_callback(Room* room){
 	g_print ("\tAdding RTP-bin \"pad-removed\" callback.\n");
-	g_signal_connect (rtpBin, "pad-removed", G_CALLBACK (rtpBinPadRemoved), NULL);
+	g_signal_connect (room->rtpBin, "pad-removed", G_CALLBACK (rtpBinPadRemoved), room);
 }
 
+/*
+ * rtpbin's signals come from streaming threads, one per session, and only
+ * post to the room's control queue; the room's worker does the rest. A new
+ * pad is blocked first, asynchronously: rtpbin announces it from the very
+ * thread that is about to push on it, so a synchronous block would wait on
+ * itself. The first push then stops at the pad, in the leg's own
+ * jitterbuffer thread, until the worker has linked the pad and lets it go.
+ */
 static void rtpBinPadAdded (GstElement * rtpbin, GstPad * new_pad, gpointer user_data){
-	g_print ("New payload on pad: %s\n", GST_PAD_NAME (new_pad));
+	Room* room = (Room*) user_data;
+	gst_pad_set_blocked_async (new_pad, TRUE, newPadBlocked, NULL);
+	controlQueue_post(&room->controlQueue, ROOM_EVENT_PAD_ADDED, new_pad, 0);
+}
 
-	pipeline_pause();
+// The worker does not wait for either: the pad is linked before it is let go.
+static void newPadBlocked (GstPad* pad, gboolean blocked, gpointer user_data){
+}
 
-	GstElement* rtpDecoder = createRtpDecoderBin();
+static void rtpBinPadRemoved (GstElement * rtpbin, GstPad * pad, gpointer user_data){
+	Room* room = (Room*) user_data;
+	controlQueue_post(&room->controlQueue, ROOM_EVENT_PAD_REMOVED, pad, 0);
+}
 
-	gchar* host = getOneNewHost();
+// A caller's RTCP BYE, from the streaming thread of the socket it came on.
+// mmsgsrc only announces BYEs sent from the caller's own RTP address.
+static void udpSourceBye (GstElement* udpSource, guint ssrc, gpointer user_data){
+	Room* room = (Room*) user_data;
+	controlQueue_post(&room->controlQueue, ROOM_EVENT_BYE, NULL, ssrc);
+}
+
+// Runs on the room's worker, one event at a time, in the order rtpbin sent them.
+static void handleRoomEvent (gint type, GstPad* pad, guint32 ssrc, gpointer data){
+	Room* room = (Room*) data;
+
+	switch (type) {
+		case ROOM_EVENT_PAD_ADDED:
+			joinLeg(room, pad);
+			break;
+		case ROOM_EVENT_PAD_REMOVED:
+			leaveLeg(room, pad);
+			break;
+		case ROOM_EVENT_BYE:
+			if (evictLeg(room, ssrc, "BYE")){
+				g_atomic_int_inc (&room->byeEvictions);
+			}
+			break;
+	}
+}
+
+/*
+ * Runs on the room's worker while the rest of the bridge keeps playing.
+ * New bins are brought up to the pipeline's state before they are linked,
+ * and they are linked from downstream to upstream, so the first buffer of
+ * the new leg always finds a running path and no other leg has to wait for
+ * it. The pad is let go once everything is in place.
+ *
+ * Without mix-minus every caller of a codec gets the same packets, so a
+ * caller's output is just an entry in the codec's fan-out sink's
+ * destination table.
+ *
+ * The payload type of the pad picks the codec: the caller's stream is
+ * decoded with it and the caller is answered with it.
+ *
+ * Trunks are always let in: a trunk carries a whole conference. A stream
+ * whose sender the source no longer knows is turned away like an
+ * overloaded one; the caller gets a new pad if it keeps sending.
+ */
+void joinLeg(Room* room, GstPad* new_pad){
+	g_print ("Room %d: new payload on pad: %s\n", room->port, GST_PAD_NAME (new_pad));
+
+	if (rtpDtx_isComfortNoisePad(new_pad)){
+		linkComfortNoisePad(room, new_pad);
+		gst_pad_set_blocked_async (new_pad, FALSE, newPadBlocked, NULL);
+		return;
+	}
+
+	RoomCodec* roomCodec = getPadCodec(room, new_pad);
+	g_print ("\tCodec: %s.\n", roomCodec->codec->name);
+
+	gchar host[INET_ADDRSTRLEN];
+	guint64 hostKey;
+	if (!getPeerHost(room, new_pad, host, &hostKey)){
+		g_print ("\tRejected, the sender is not known.\n");
+		linkDiscardSink(room, new_pad, "rejected-sink");
+		gst_pad_set_blocked_async (new_pad, FALSE, newPadBlocked, NULL);
+		return;
+	}
 	g_print ("\tSelected peer's host: %s.\n", host);
 
-	GstElement* rtpOutput = createRtpOutputBin(host);
+	Trunk* trunk = findTrunk(room, hostKey);
+	if (trunk){
+		g_print ("\tTrunk from %s:%u.\n", host, trunk->port);
+	}
+
+	if (!trunk && g_atomic_int_get (&room->admissionLimited)){
+		joinLimitedLeg(room, roomCodec, new_pad, host, hostKey);
+		gst_pad_set_blocked_async (new_pad, FALSE, newPadBlocked, NULL);
+		return;
+	}
+
+	GstElement* rtpDecoder = createRtpDecoderBin(roomCodec);
+	GstElement* rtpOutput = trunk ? createTrunkRtpOutputBin(roomCodec, trunk, host)
+		: mixMinus ? createMixMinusRtpOutputBin(roomCodec, host, hostKey) : 0;
+
+	createMixingBinOnDemand(room);
+	createMixBranchOnDemand(roomCodec);
+	addRtpOutput(room, roomCodec, new_pad, rtpOutput, hostKey);
+
+	startBin(rtpDecoder);
+	linkRtpDecoderAndMixingBin(room, rtpDecoder, rtpOutput);
+	if (recordLegs){
+		recordLeg(room, rtpDecoder, getPadSsrc(new_pad));
+	}
+	linkNewPadAndRtpDecoder(new_pad, rtpDecoder);
+
+	registerConnection(room, new_pad, rtpDecoder, rtpOutput, host, hostKey);
+
+	gst_pad_set_blocked_async (new_pad, FALSE, newPadBlocked, NULL);
+}
+
+/*
+ * While the room is over --admit-load a new caller is heard by nobody: its
+ * packets end in a sink, so it adds no decoding and no mixing. It is sent
+ * the plain mix, which with mix-minus is what it should hear anyway, from
+ * the shared encoder. With --reject-overload it is not answered at all.
+ * Either way it stays so until it comes back under another SSRC.
+ */
+void joinLimitedLeg(Room* room, RoomCodec* roomCodec, GstPad* newPad, gchar* host, guint64 hostKey){
+	if (rejectOverload){
+		g_print ("\tRejected, the room is overloaded.\n");
+		linkDiscardSink(room, newPad, "rejected-sink");
+		g_atomic_int_inc (&room->rejectedJoins);
+		return;
+	}
+
+	g_print ("\tListen-only, the room is overloaded.\n");
+	GstElement* rtpOutput = mixMinus ? createMixMinusRtpOutputBin(roomCodec, host, hostKey) : 0;
+
+	createMixingBinOnDemand(room);
+	createMixBranchOnDemand(roomCodec);
+	addRtpOutput(room, roomCodec, newPad, rtpOutput, hostKey);
+
+	// Stands in for the decoder bin in the registry.
+	GstElement* sink = linkDiscardSink(room, newPad, "listen-only-sink");
+	g_object_set_data (G_OBJECT (sink), "room-codec", roomCodec);
+
+	registerConnection(room, newPad, sink, rtpOutput, host, hostKey);
+	g_atomic_int_inc (&room->listenOnlyJoins);
+}
+
+void addRtpOutput(Room* room, RoomCodec* roomCodec, GstPad* newPad, GstElement* rtpOutput, guint64 hostKey){
+	if (rtpOutput){
+		meterRtpOutput(room, getPadSsrc(newPad), rtpOutput);
+		startBin(rtpOutput);
+		linkMixingBinAndRtpOutput(roomCodec, rtpOutput);
+	} else {
+		addFanoutDestination(roomCodec, getPadSsrc(newPad), hostKey);
+	}
+}
 
+void linkNewPadAndRtpDecoder(GstPad* newPad, GstElement* rtpDecoder){
 	g_print ("\tLinking pad and RTP-decoder.\n");
 	GstPad* sinkpad = gst_element_get_static_pad (rtpDecoder, "sink");
 	g_assert (sinkpad);
-	g_assert (gst_pad_link (new_pad, sinkpad) == GST_PAD_LINK_OK);
+	g_assert (gst_pad_link (newPad, sinkpad) == GST_PAD_LINK_OK);
 	gst_object_unref (sinkpad);
+}
+
+/*
+ * A caller's comfort noise packets (see rtpDtx.h) come out of rtpbin on a
+ * pad of their own. A silent caller is left out of the mix anyway, so they
+ * are only consumed.
+ */
+void linkComfortNoisePad(Room* room, GstPad* newPad){
+	g_print ("\tLinking comfort noise sink.\n");
+	linkDiscardSink(room, newPad, "comfort-noise-sink");
+}
+
+// The sink is kept on the pad under the key, for the pad's removal.
+GstElement* linkDiscardSink(Room* room, GstPad* newPad, const gchar* key){
+	GstElement* sink = gst_element_factory_make ("fakesink", NULL);
+	g_assert (sink);
+	g_object_set (G_OBJECT (sink), "async", FALSE, "sync", FALSE, NULL);
 
-	createMixingBinOnDemand();
+	gst_bin_add (GST_BIN (room->pipeline), sink);
+	startBin(sink);
+
+	GstPad* sinkpad = gst_element_get_static_pad (sink, "sink");
+	g_assert (gst_pad_link (newPad, sinkpad) == GST_PAD_LINK_OK);
+	gst_object_unref (sinkpad);
+
+	g_object_set_data (G_OBJECT (newPad), key, sink);
+	return sink;
+}
 
+void linkRtpDecoderAndMixingBin(Room* room, GstElement* rtpDecoder, GstElement* rtpOutput){
 	g_print ("\tLinking RTP-decoder and mixing bin.\n");
-	sinkpad = gst_element_get_request_pad (adder, "sink%d");
+	GstPad* sinkpad = gst_element_get_request_pad (room->adder, "sink%d");
+
+	if (mixMinus){
+		linkMinusPadAndRtpOutput(room, sinkpad, rtpOutput);
+	}
+
 	GstPad* srcpad  = gst_element_get_static_pad (rtpDecoder, "src");
 	g_assert (gst_pad_link (srcpad, sinkpad) == GST_PAD_LINK_OK);
 	gst_object_unref (srcpad);
 	gst_object_unref (sinkpad);
+}
+
+/*
+ * The output bin is remembered on the mixer's sink pad, so the activity
+ * callback can switch the leg between the shared and its own mix.
+ */
+void linkMinusPadAndRtpOutput(Room* room, GstPad* mixerSinkPad, GstElement* rtpOutput){
+	g_print ("\tLinking mix-minus and RTP-output.\n");
+	GstPad* srcpad  = gst_phone_mixer_get_minus_pad (room->adder, mixerSinkPad);
+	GstPad* sinkpad = gst_element_get_static_pad (rtpOutput, "minus");
+	g_assert (gst_pad_link (srcpad, sinkpad) == GST_PAD_LINK_OK);
+	gst_object_unref (srcpad);
+	gst_object_unref (sinkpad);
+
+	g_object_set_data_full (G_OBJECT (mixerSinkPad), "rtp-output",
+		gst_object_ref (rtpOutput), (GDestroyNotify) gst_object_unref);
+}
 
+void linkMixingBinAndRtpOutput(RoomCodec* roomCodec, GstElement* rtpOutput){
 	g_print ("\tLinking mixing bin and RTP-output.\n");
-	sinkpad = gst_element_get_static_pad (rtpOutput, "sink");
-	srcpad  = gst_element_get_request_pad (tee, "src%d");
+	GstPad* sinkpad = gst_element_get_static_pad (rtpOutput, "sink");
+	GstPad* srcpad  = gst_element_get_request_pad (roomCodec->branch.tee, "src%d");
 	g_assert (gst_pad_link (srcpad, sinkpad) == GST_PAD_LINK_OK);
 	gst_object_unref (srcpad);
 	gst_object_unref (sinkpad);
+}
+
+void startBin(GstElement* bin){
+	g_print ("\tStarting %s.\n", GST_ELEMENT_NAME (bin));
+	g_assert (gst_element_sync_state_with_parent (bin));
+}
+
+// "room-9559-7-mix.au" for the 7th recording's mix, "room-9559-8-caller-SSRC.au" for a caller.
+gchar* createRecordingPath(Room* room, guint32 ssrc){
+	guint number = ++room->recordings;
+	gchar* name = ssrc
+		? g_strdup_printf ("room-%d-%u-caller-%u.au", room->port, number, ssrc)
+		: g_strdup_printf ("room-%d-%u-mix.au", room->port, number);
+	gchar* path = g_build_filename (recordDir, name, NULL);
+	g_free (name);
+	return path;
+}
+
+/*
+ * The mixer's own thread copies every mixed frame into the tap, before DTX
+ * gates it, so the recording has the silences too.
+ */
+void recordMix(Room* room, GstElement* adder){
+	gchar* path = createRecordingPath(room, 0);
+	g_print ("\t\tRecording mix into %s.\n", path);
+	room->mixRecording = recordTap_new(path, PHONE_MIXER_RATE, 1);
+	g_free (path);
+
+	GstPad* srcpad = gst_element_get_static_pad (adder, "src");
+	recordTap_attach(room->mixRecording, srcpad);
+	gst_object_unref (srcpad);
+}
+
+/*
+ * The decoded audio, as it goes into the mixer. The tap and its probe are
+ * kept on the decoder bin, which is pooled and must be clean for its next
+ * caller.
+ */
+void recordLeg(Room* room, GstElement* rtpDecoder, guint32 ssrc){
+	gchar* path = createRecordingPath(room, ssrc);
+	g_print ("\tRecording caller into %s.\n", path);
+	RecordTap* tap = recordTap_new(path, PHONE_MIXER_RATE, 1);
+	g_free (path);
+
+	GstPad* srcpad = gst_element_get_static_pad (rtpDecoder, "src");
+	gulong probe = recordTap_attach(tap, srcpad);
+	gst_object_unref (srcpad);
+
+	g_object_set_data (G_OBJECT (rtpDecoder), "record-tap", tap);
+	g_object_set_data (G_OBJECT (rtpDecoder), "record-probe", GUINT_TO_POINTER (probe));
+}
 
-	pipeline_run();
+/*
+ * Takes the probe off a leaving caller's decoder bin. The tap is returned
+ * to be closed once the bin is stopped: only then is no probe call left in
+ * its streaming thread.
+ */
+RecordTap* stopRecordingLeg(GstElement* rtpDecoder){
+	RecordTap* tap = (RecordTap*) g_object_get_data (G_OBJECT (rtpDecoder), "record-tap");
+	if (!tap){
+		return 0;
+	}
+
+	GstPad* srcpad = gst_element_get_static_pad (rtpDecoder, "src");
+	gst_pad_remove_buffer_probe (srcpad, GPOINTER_TO_UINT (g_object_get_data (G_OBJECT (rtpDecoder), "record-probe")));
+	gst_object_unref (srcpad);
+
+	g_object_set_data (G_OBJECT (rtpDecoder), "record-tap", NULL);
+	return tap;
+}
+
+/*
+ * Payload types are only mapped for installed codecs and comfort noise,
+ * so a media pad always has a codec the room serves.
+ */
+RoomCodec* getPadCodec(Room* room, GstPad* rtpBinPad){
+	const Codec* codec = codec_ofPad(rtpBinPad);
+	g_assert (codec);
+	return &room->roomCodecs[codec_index(codec)];
+}
 
-	registerConnection(new_pad, rtpDecoder, rtpOutput, host);
+gboolean isCodecServed(RoomCodec* roomCodec){
+	return codec_isAvailable(roomCodec->codec);
 }
 
-GstElement* createRtpDecoderBin(){
+GstElement* createRtpDecoderBin(RoomCodec* roomCodec){
 	g_print ("\tCreating RTP-decoder.\n");
 
-	GstElement* bin 	= createRtpDecoderBinElement();
-	GstElement* queue   = createRtpSrcQueue();
-	GstElement* depay   = createRtpDepay();
-	GstElement* decoder = createDecoder();
+	GstElement* bin = binPool_take(&roomCodec->decoderPool);
+	addToPipeline(roomCodec->room, bin);
+	return bin;
+}
 
-	gst_bin_add_many (GST_BIN (bin), queue, depay, decoder, NULL);
-	
-	createRtpDecoderPads(bin, queue, decoder);	
+/*
+ * Builds a decoder bin for a codec's pool, on the room's worker. The codec
+ * is kept on the bin for the caller's leave.
+ */
+GstElement* buildRtpDecoderBin(gpointer data){
+	RoomCodec* roomCodec = (RoomCodec*) data;
 
-	g_print ("\t\tAdding to pipeline.\n");
-	gst_bin_add (GST_BIN (pipeline), bin);
+	GstElement* bin 	  = createRtpDecoderBinElement();
+	GstElement* queue     = createRtpSrcQueue();
+	GstElement* depay     = createRtpDepay(roomCodec->codec);
+	GstElement* decoder   = createDecoder(roomCodec->codec);
+	GstElement* converter = createDecoderConverter(roomCodec->codec);
+
+	gst_bin_add_many (GST_BIN (bin), queue, depay, decoder, NULL);
 	g_assert (gst_element_link_many (queue, depay, decoder, NULL));
 
+	if (converter){
+		gst_bin_add (GST_BIN (bin), converter);
+		g_assert (gst_element_link (decoder, converter));
+	}
+
+	createRtpDecoderPads(bin, queue, converter ? converter : decoder);
+
+	g_object_set_data (G_OBJECT (bin), "room-codec", roomCodec);
 	return bin;
 }
 
+// The pipeline takes over the reference the pool handed out.
+void addToPipeline(Room* room, GstElement* bin){
+	g_print ("\t\tAdding to pipeline.\n");
+	gst_bin_add (GST_BIN (room->pipeline), bin);
+	gst_object_unref (bin);
+}
+
 GstElement* createRtpDecoderBinElement(){
 	g_print ("\t\tCreating bin.\n");
 	GstElement* elem = gst_bin_new (NULL);
@@ -272,16 +1110,27 @@ GstElement* createRtpSrcQueue(){
 	return elem;
 }
 
-GstElement* createRtpDepay(){
+GstElement* createRtpDepay(const Codec* codec){
 	g_print ("\t\tCreating RTP depay loader.\n");
-	GstElement* elem = gst_element_factory_make ("rtpg726depay", NULL);
+	GstElement* elem = codec_makeDepayloader(codec, NULL);
 	g_assert(elem);
 	return elem;
 }
 
-GstElement* createDecoder(){
-	g_print ("\t\tCreating G.726 decoder.\n");
-	GstElement* elem = gst_element_factory_make ("ffdec_g726", NULL);
+GstElement* createDecoder(const Codec* codec){
+	g_print ("\t\tCreating %s decoder.\n", codec->name);
+	GstElement* elem = codec_makeDecoder(codec, NULL);
+	g_assert(elem);
+	return elem;
+}
+
+// Returns NULL when the decoder's output can be mixed as it is.
+GstElement* createDecoderConverter(const Codec* codec){
+	if (!codec->convert){
+		return NULL;
+	}
+	g_print ("\t\tCreating decoder converter.\n");
+	GstElement* elem = codec_makeConverter(codec);
 	g_assert(elem);
 	return elem;
 }
@@ -306,82 +1155,183 @@ void createRtpDecoderSrcPad(GstElement* bin, GstElement* padOwner){
 	gst_object_unref (GST_OBJECT (pad));
 }
 
-gchar* getOneNewHost (){
-	GObject *session;
-	GValueArray *arr;
-	GValue *val;
-	guint i;
-
-	g_signal_emit_by_name (rtpBin, "get-internal-session", 0, &session);
-	g_object_get (session, "sources", &arr, NULL);
-
-	gchar* host = 0;
-	gchar** tokens;
-	gchar* socketDescr;
+/*
+ * Maps the new pad to its sender: the SSRC comes from the pad name and its
+ * binary address from the source feeding the pad's session, which records
+ * the sender of every SSRC it receives. Callers sharing one IP are told apart by port, and
+ * nothing is allocated on the way.
+ */
+gboolean getPeerHost (Room* room, GstPad* rtpBinPad, gchar* host, guint64* hostKey){
+	guint32 ssrc = getPadSsrc(rtpBinPad);
+	guint32 address;
+	guint16 port;
+
+	if (!gst_mmsg_src_get_peer (room->udpSources[getPadSession(rtpBinPad)], ssrc, &address, &port)){
+		g_printerr ("No sender known for SSRC %u.\n", ssrc);
+		return FALSE;
+	}
 
-	for (i = 0; i < arr->n_values; i++) {
-		val = g_value_array_get_nth (arr, i);
-		GObject *source = (GObject *)g_value_get_object (val);      
-		socketDescr = getPeerHostOrZero(source);
+	// A caller restarting from the same address comes back with a new SSRC
+	// before its old one times out; both stay registered until then.
+	if (!dynamicConnectionRegistry_isHostNotRegistered(&room->connectionRegistry, address, port)){
+		g_print ("\tHost rejoined as SSRC %u.\n", ssrc);
+	}
 
-		if (!socketDescr){
-			continue;
-		}
+	struct in_addr inAddress = { htonl (address) };
+	inet_ntop (AF_INET, &inAddress, host, INET_ADDRSTRLEN);
+	*hostKey = dynamicConnection_hostKey(address, port);
+	return TRUE;
+}
 
-		if (dynamicConnectionList_isHostNotRegistered(&connectionList, socketDescr)){
-			tokens = g_strsplit(socketDescr,":",0);
-			int len = g_utf8_strlen(tokens[0], -1);
-			host = malloc(len*sizeof(gchar));
-			g_utf8_strncpy(host, tokens[0]+1, len);
-			break;
-		}
+// rtpbin names its receive pads "recv_rtp_src_<session>_<ssrc>_<payload>".
+guint32 getPadSsrc (GstPad* rtpBinPad){
+	guint session, ssrc, payload;
+	if (sscanf (GST_PAD_NAME (rtpBinPad), "recv_rtp_src_%u_%u_%u", &session, &ssrc, &payload) != 3){
+		return 0;
 	}
+	return ssrc;
+}
 
-	g_value_array_free (arr);
-	g_object_unref (session);
+guint getPadSession (GstPad* rtpBinPad){
+	guint session, ssrc, payload;
+	if (sscanf (GST_PAD_NAME (rtpBinPad), "recv_rtp_src_%u_%u_%u", &session, &ssrc, &payload) != 3){
+		return 0;
+	}
+	return session;
+}
 
-	return host;
+/*
+ * In mix-minus mode the payloader moves from the shared chain into every
+ * output bin, so the leg's RTP stream stays continuous while an
+ * input-selector switches it between the shared mix (encoded once for all
+ * silent legs) and the leg's own mix-minus encoder:
+ *
+ *   sink  -------------------> selector -> pay -> queue -> udpsink
+ *   minus ---> encoder ----------'
+ *
+ * G.726 is adaptive, so the leg's encoder is made to carry on from the
+ * shared encoder's state when the leg starts talking, see mixerLegActivity().
+ *
+ * With DTX the leg's own mix is gated in front of its encoder and comfort
+ * noise is added after the payloader.
+ *
+ * Output bins come from the room's pool and only get their caller's
+ * address here.
+ */
+GstElement* createMixMinusRtpOutputBin(RoomCodec* roomCodec, gchar* host, guint64 hostKey){
+	g_print ("\tCreating mix-minus RTP-output.\n");
+
+	GstElement* bin = binPool_take(&roomCodec->outputPool);
+	resetRtpOutput(bin, host, getReplyPort(hostKey));
+	addToPipeline(roomCodec->room, bin);
+	return bin;
 }
 
-gchar* getPeerHostOrZero (GObject* source){
-	GstStructure* stats;
-	g_object_get (source, "stats", &stats, NULL);
+// Builds an output bin for a codec's pool, on the room's worker.
+GstElement* buildMixMinusRtpOutputBin(gpointer data){
+	RoomCodec* roomCodec = (RoomCodec*) data;
+	Room* room = roomCodec->room;
+
+	GstElement* bin      = createRtpOutputBinElement(room);
+	GstElement* encoder  = createEncoder(roomCodec->codec);
+	GstElement* selector = createOutputSelector();
+	GstElement* pay      = createRtpPay(roomCodec->codec);
+	GstElement* queue    = createRtpSinkQueue();
+	GstElement* sink     = createUdpSink();
+	GstElement* gate     = dtx ? createDtxGate() : 0;
+	GstElement* rtpDtx   = dtx ? createRtpDtx() : 0;
+
+	gst_bin_add_many (GST_BIN (bin), encoder, selector, pay, queue, sink, NULL);
+	if (dtx){
+		gst_bin_add_many (GST_BIN (bin), gate, rtpDtx, NULL);
+	}
+
+	if (metricsPort){
+		metrics_countCpu(encoder, &room->encoderCpu);
 
-	gchar* host = 0;
+		MetricsTraffic* traffic = g_new0 (MetricsTraffic, 1);
+		g_object_set_data_full (G_OBJECT (bin), "metrics-traffic", traffic, g_free);
 
-	const GValue* val = gst_structure_get_value(stats, "rtp-from");
-	if (!val){
-		return host;
+		GstPad* sinkpad = gst_element_get_static_pad (sink, "sink");
+		metrics_countTraffic(sinkpad, traffic);
+		gst_object_unref (sinkpad);
 	}
 
-	host = g_strdup_value_contents (val);
-	gst_structure_free (stats);
+	// The first requested selector pad becomes the active one.
+	createRtpOutputSelectorPad(bin, selector, "full-mix-pad");
+	GstPad* ownMixPad = createRtpOutputSelectorPad(bin, selector, "own-mix-pad");
 
-	return host;
-}
+	GstPad* srcpad = gst_element_get_static_pad (encoder, "src");
+	g_assert (gst_pad_link (srcpad, ownMixPad) == GST_PAD_LINK_OK);
+	gst_object_unref (srcpad);
 
-GstElement* createRtpOutputBin(gchar* host){
-	g_print ("\tCreating RTP-output.\n");
+	GstPad* sinkpad = gst_element_get_static_pad (dtx ? gate : encoder, "sink");
+	createRtpOutputMinusPad(bin, sinkpad);
+	gst_object_unref (sinkpad);
 
-	GstElement* bin   = createRtpOutputBinElement();
-	GstElement* queue = createRtpSinkQueue();
-	GstElement* sink  = createUdpSink(host);
+	if (dtx){
+		g_assert (gst_element_link (gate, encoder));
+		g_assert (gst_element_link_many (selector, pay, rtpDtx, queue, sink, NULL));
+	} else {
+		g_assert (gst_element_link_many (selector, pay, queue, sink, NULL));
+	}
 
-	gst_bin_add_many (GST_BIN (bin), queue, sink, NULL);
-	
-	createRtpOutputSinkPad(bin, queue);	
+	g_object_set_data (G_OBJECT (bin), "room-codec", roomCodec);
+	g_object_set_data (G_OBJECT (bin), "encoder", encoder);
+	g_object_set_data (G_OBJECT (bin), "selector", selector);
+	g_object_set_data (G_OBJECT (bin), "pay", pay);
+	g_object_set_data (G_OBJECT (bin), "udpsink", sink);
 
-	g_print ("\t\tAdding to pipeline.\n");
-	gst_bin_add (GST_BIN (pipeline), bin);
-	g_assert (gst_element_link_many (queue, sink, NULL));
+	return bin;
+}
+
+/*
+ * Points a pooled output bin at its new caller. A reused bin may still
+ * have the previous caller's own mix selected and counted traffic.
+ */
+void resetRtpOutput(GstElement* bin, gchar* host, int port){
+	GstElement* sink = (GstElement*) g_object_get_data (G_OBJECT (bin), "udpsink");
+	g_object_set (G_OBJECT (sink), "host", host, "port", port, NULL);
+
+	GstElement* selector = (GstElement*) g_object_get_data (G_OBJECT (bin), "selector");
+	GstPad* fullMixPad   = (GstPad*) g_object_get_data (G_OBJECT (bin), "full-mix-pad");
+	g_object_set (G_OBJECT (selector), "active-pad", fullMixPad, NULL);
+
+	MetricsTraffic* traffic = g_object_get_data (G_OBJECT (bin), "metrics-traffic");
+	if (traffic){
+		traffic->packets = 0;
+		traffic->bytes   = 0;
+	}
+}
 
+/*
+ * A trunk's output bin is built for it instead of taken from the pool, as
+ * it sends from the room's own socket, which it must not close, and goes
+ * on from the trunk's hellos.
+ */
+GstElement* createTrunkRtpOutputBin(RoomCodec* roomCodec, Trunk* trunk, gchar* host){
+	g_print ("\tCreating trunk RTP-output.\n");
+	Room* room = roomCodec->room;
+
+	GstElement* bin  = buildMixMinusRtpOutputBin(roomCodec);
+	GstElement* pay  = (GstElement*) g_object_get_data (G_OBJECT (bin), "pay");
+	GstElement* sink = (GstElement*) g_object_get_data (G_OBJECT (bin), "udpsink");
+
+	g_object_set (G_OBJECT (pay), "ssrc", room->trunkSsrc,
+		"seqnum-offset", (gint) trunk->sequence, "timestamp-offset", trunk->timestamp, NULL);
+	g_object_set (G_OBJECT (sink), "sockfd", getRoomSocket(room), "closefd", FALSE, NULL);
+
+	resetRtpOutput(bin, host, trunk->port);
+	addToPipeline(room, bin);
 	return bin;
 }
 
-GstElement* createRtpOutputBinElement(){
+// The room is kept on the bin for the tee pad blocked callback.
+GstElement* createRtpOutputBinElement(Room* room){
 	g_print ("\t\tCreating bin.\n");
 	GstElement* elem = gst_bin_new (NULL);
 	g_assert(elem);
+	g_object_set_data (G_OBJECT (elem), "room", room);
 	return elem;
 }
 
@@ -392,54 +1342,280 @@ GstElement* createRtpSinkQueue(){
 	return elem;
 }
 
-GstElement* createUdpSink(gchar* host){
+GstElement* createUdpSink(){
 	g_print ("\t\tCreating UDP sink.\n");
 
-	GstElement* elem = gst_element_factory_make ("udpsink", "rtp-output");
+	GstElement* elem = gst_element_factory_make ("udpsink", NULL);
 	g_assert(elem);
-	g_object_set (G_OBJECT (elem), "host", host, NULL);
-	g_object_set (G_OBJECT (elem), "port", DEFAULT_UDP_PORT, NULL);
 	g_object_set (G_OBJECT (elem), "async", FALSE, "sync", FALSE, NULL);
 	return elem;
 }
 
-void createRtpOutputSinkPad(GstElement* bin, GstElement* padOwner){
-	g_print ("\t\t\tAdding sink pad.\n");
-	GstPad* pad = gst_element_get_static_pad (padOwner, "sink");
-	gst_element_add_pad (bin, gst_ghost_pad_new ("sink", pad));
+GstElement* createOutputSelector(){
+	g_print ("\t\tCreating output selector.\n");
+	GstElement* elem = gst_element_factory_make ("input-selector", NULL);
+	g_assert(elem);
+	return elem;
+}
+
+GstElement* createDtxGate(){
+	g_print ("\t\tCreating DTX gate.\n");
+	GstElement* elem = gst_element_factory_make ("dtxgate", NULL);
+	g_assert(elem);
+	return elem;
+}
+
+GstElement* createRtpDtx(){
+	g_print ("\t\tCreating RTP DTX.\n");
+	GstElement* elem = gst_element_factory_make ("rtpdtx", NULL);
+	g_assert(elem);
+	return elem;
+}
+
+/*
+ * Requests a selector input and remembers it on the bin under "name". The
+ * full mix input is also exposed as the bin's "sink" pad. The selector
+ * keeps the pad alive for as long as the bin.
+ */
+GstPad* createRtpOutputSelectorPad(GstElement* bin, GstElement* selector, const gchar* name){
+	GstPad* pad = gst_element_get_request_pad (selector, "sink%d");
+	g_assert (pad);
+	g_object_set_data (G_OBJECT (bin), name, pad);
+
+	if (g_str_equal (name, "full-mix-pad")){
+		g_print ("\t\t\tAdding sink pad.\n");
+		gst_element_add_pad (bin, gst_ghost_pad_new ("sink", pad));
+	}
 	gst_object_unref (GST_OBJECT (pad));
+	return pad;
 }
 
-void registerConnection(GstPad* rtpBinPad, GstElement* decoderBin, GstElement* outputBin, gchar* host){
-	DynamicConnection* dCon = (DynamicConnection*) malloc( sizeof(DynamicConnection));
-	dCon->rptBinPad  = rtpBinPad;
-	dCon->decoderBin = decoderBin;
-	dCon->outputBin  = outputBin;
-	dCon->host = host;
-	dynamicConnectionList_addFirst(&connectionList, dCon);
+void createRtpOutputMinusPad(GstElement* bin, GstPad* target){
+	g_print ("\t\t\tAdding mix-minus pad.\n");
+	gst_element_add_pad (bin, gst_ghost_pad_new ("minus", target));
 }
 
-void createMixingBinOnDemand(){
-	if (isMixingBinNotCreated()){
-		createMixingBin();
+/*
+ * Runs in the mixing thread, before the frame is pushed. A talking leg is
+ * switched to its own encoder, a silent one back to the shared mix.
+ *
+ * The caller's decoder has so far followed the shared encoder, so the
+ * leg's encoder first takes over that encoder's state, exactly as it
+ * stands after the last frame the caller got from it. Going back cannot be
+ * made exact the same way, as the shared encoder is everybody's: the
+ * decoder is left with the leg's encoder's history, which G.726's
+ * adaptation leaks away within a few hundred milliseconds.
+ */
+static void mixerLegActivity (GstElement* mixer, GstPad* sinkpad, gboolean talking, gpointer user_data){
+	GstElement* rtpOutput = (GstElement*) g_object_get_data (G_OBJECT (sinkpad), "rtp-output");
+	if (!rtpOutput){
+		return;
 	}
+
+	RoomCodec* roomCodec = (RoomCodec*) g_object_get_data (G_OBJECT (rtpOutput), "room-codec");
+	GstElement* sharedEncoder = roomCodec->branch.encoder;
+	if (talking && sharedEncoder){
+		GstElement* encoder = (GstElement*) g_object_get_data (G_OBJECT (rtpOutput), "encoder");
+		gst_g726_enc_copy_state (encoder, sharedEncoder);
+	}
+
+	GstElement* selector = (GstElement*) g_object_get_data (G_OBJECT (rtpOutput), "selector");
+	GstPad* pad = (GstPad*) g_object_get_data (G_OBJECT (rtpOutput), talking ? "own-mix-pad" : "full-mix-pad");
+
+	g_object_set (G_OBJECT (selector), "active-pad", pad, NULL);
 }
 
-gboolean isMixingBinNotCreated(){
-	return adder == 0;
+// The leg's sender stays known until it leaves, however long it is quiet.
+void registerConnection(Room* room, GstPad* rtpBinPad, GstElement* decoderBin, GstElement* outputBin, gchar* host, guint64 hostKey){
+	DynamicConnection dCon;
+	dCon.rptBinPad  = rtpBinPad;
+	dCon.decoderBin = decoderBin;
+	dCon.outputBin  = outputBin;
+	g_strlcpy (dCon.host, host, sizeof (dCon.host));
+	dCon.ssrc    = getPadSsrc(rtpBinPad);
+	dCon.hostKey = hostKey;
+	dynamicConnectionRegistry_add(&room->connectionRegistry, &dCon);
+	gst_mmsg_src_keep_peer (room->udpSources[getPadSession(rtpBinPad)], dCon.ssrc);
 }
 
-void createMixingBin(){
+/*
+ * Callers are answered on the well known port, as the P2P phone expects,
+ * or with --symmetric-rtp on the port they send from, so that many callers
+ * can share one address (see load_generator).
+ */
+int getReplyPort(guint64 hostKey){
+	return symmetricRtp ? (int) (hostKey & 0xFFFF) : DEFAULT_UDP_PORT;
+}
+
+/*
+ * The room's trunks lead to the peers' rooms of the same offset from their
+ * first port.
+ */
+void createTrunks(Room* room){
+	g_print ("Creating trunks.\n");
+	room->trunks    = g_memdup (trunks, trunksCount * sizeof (Trunk));
+	room->trunkSsrc = g_random_int ();
+
+	int i;
+	for (i = 0; i < trunksCount; i++){
+		room->trunks[i].port += room->port - listenPort;
+	}
+
+	roomWorker_timeoutAdd(room->worker, TRUNK_HELLO_INTERVAL, sayTrunkHellos, room);
+}
+
+Trunk* findTrunk(Room* room, guint64 hostKey){
+	int i;
+	for (i = 0; i < trunksCount; i++){
+		if (trunk_isPeer(&room->trunks[i], hostKey >> 16, hostKey & 0xFFFF)){
+			return &room->trunks[i];
+		}
+	}
+	return NULL;
+}
+
+// Runs on the room's worker, for as long as the worker runs.
+static gboolean sayTrunkHellos (gpointer user_data){
+	Room* room = (Room*) user_data;
+
+	int sockfd = getRoomSocket(room);
+	if (sockfd < 0){
+		return TRUE;
+	}
+
+	int i;
+	for (i = 0; i < trunksCount; i++){
+		Trunk* trunk = &room->trunks[i];
+		if (dynamicConnectionRegistry_isHostNotRegistered(&room->connectionRegistry, trunk->address, trunk->port)){
+			trunk_sendHello(trunk, sockfd, room->trunkSsrc, CODEC_DEFAULT->payload);
+		}
+	}
+
+	return TRUE;
+}
+
+// The first source's socket, open while the room plays.
+int getRoomSocket(Room* room){
+	int sockfd;
+	g_object_get (G_OBJECT (room->udpSources[0]), "sockfd", &sockfd, NULL);
+	return sockfd;
+}
+
+// Destinations are keyed by SSRC, so a caller rejoining from the same
+// address is not dropped when its old stream times out.
+void addFanoutDestination(RoomCodec* roomCodec, guint32 ssrc, guint64 hostKey){
+	g_print ("\tAdding fan-out destination.\n");
+	gst_fanout_sink_add_destination (roomCodec->branch.fanout, ssrc, hostKey >> 16, getReplyPort(hostKey));
+}
+
+void removeFanoutDestination(RoomCodec* roomCodec, guint32 ssrc){
+	g_print ("\tRemoving fan-out destination.\n");
+	g_assert (gst_fanout_sink_remove_destination (roomCodec->branch.fanout, ssrc));
+}
+
+void createMixingBinOnDemand(Room* room){
+	if (isMixingBinNotCreated(room)){
+		createMixingBin(room);
+	}
+}
+
+gboolean isMixingBinNotCreated(Room* room){
+	return room->adder == 0;
+}
+
+/*
+ * The mixer and what all codecs share: with DTX the mix is gated before it
+ * is split, so while nobody talks nothing is encoded or sent but comfort
+ * noise packets, added after each branch's payloader.
+ */
+void createMixingBin(Room* room){
 	g_print ("\tCreating mixing bin.\n");
 
-	adder   = createLiveAdder();
-	encoder = createEncoder();
-	pay 	= createRtpPay();
-	tee 	= createOutputTee();
+	GstElement* adder = createMixer();
 
+	g_mutex_lock (room->metricsLock);
+	room->adder    = adder;
+	room->dtxGate  = dtx ? createDtxGate() : 0;
+	room->splitter = createOutputTee();
+	g_mutex_unlock (room->metricsLock);
+
+	if (recordDir){
+		recordMix(room, adder);
+	}
+
+	GstElement* chain[] = { room->adder, room->dtxGate, room->splitter };
+	addLinkAndStartChain(room, chain, G_N_ELEMENTS (chain));
+}
+
+void createMixBranchOnDemand(RoomCodec* roomCodec){
+	if (!roomCodec->branch.encoder){
+		createMixBranch(roomCodec);
+	}
+}
+
+/*
+ * In mix-minus mode the tee carries the codec's encoded shared mix and
+ * every output bin has its own payloader, see createMixMinusRtpOutputBin().
+ * Otherwise the codec's single RTP stream goes straight to its fan-out
+ * sink. The branch is started before it is linked to the running splitter.
+ */
+void createMixBranch(RoomCodec* roomCodec){
+	g_print ("\tCreating %s mix branch.\n", roomCodec->codec->name);
+
+	Room* room = roomCodec->room;
+	MixBranch* branch = &roomCodec->branch;
+
+	g_mutex_lock (room->metricsLock);
+	branch->encoder = createEncoder(roomCodec->codec);
+	branch->pay     = mixMinus ? 0 : createRtpPay(roomCodec->codec);
+	branch->rtpDtx  = dtx && !mixMinus ? createRtpDtx() : 0;
+	branch->tee     = mixMinus ? createOutputTee() : 0;
+	branch->fanout  = mixMinus ? 0 : createFanoutSink();
+	g_mutex_unlock (room->metricsLock);
+
+	if (metricsPort){
+		metrics_countCpu(branch->encoder, &room->encoderCpu);
+	}
+
+	GstElement* chain[] = { branch->encoder, branch->pay, branch->rtpDtx, branch->tee, branch->fanout };
+	addLinkAndStartChain(room, chain, G_N_ELEMENTS (chain));
+	linkSplitterAndMixBranch(room, branch);
+}
+
+void linkSplitterAndMixBranch(Room* room, MixBranch* branch){
+	g_print ("\t\tLinking splitter and mix branch.\n");
+	GstPad* srcpad  = gst_element_get_request_pad (room->splitter, "src%d");
+	GstPad* sinkpad = gst_element_get_static_pad (branch->encoder, "sink");
+	g_assert (gst_pad_link (srcpad, sinkpad) == GST_PAD_LINK_OK);
+	gst_object_unref (srcpad);
+	gst_object_unref (sinkpad);
+}
+
+/*
+ * Adds the elements which are set, links them in order and starts them
+ * from downstream to upstream.
+ */
+void addLinkAndStartChain(Room* room, GstElement** chain, guint length){
 	g_print ("\t\tAdding to pipeline.\n");
-	gst_bin_add_many (GST_BIN (pipeline), adder, encoder, pay, tee, NULL);
-	g_assert (gst_element_link_many (adder, encoder, pay, tee, NULL));	
+
+	GstElement* previous = 0;
+	guint i;
+	for (i = 0; i < length; i++){
+		if (!chain[i]){
+			continue;
+		}
+		gst_bin_add (GST_BIN (room->pipeline), chain[i]);
+		if (previous){
+			g_assert (gst_element_link (previous, chain[i]));
+		}
+		previous = chain[i];
+	}
+
+	for (i = length; i > 0; i--){
+		if (chain[i - 1]){
+			startBin(chain[i - 1]);
+		}
+	}
 }
 
 GstElement* createMixingBinElement(){
@@ -449,117 +1625,503 @@ GstElement* createMixingBinElement(){
 	return elem;
 }
 
-GstElement* createLiveAdder(){
-	g_print ("\t\tCreating live adder.\n");
-	GstElement* elem = gst_element_factory_make ("liveadder", "adder");
+GstElement* createMixer(){
+	g_print ("\t\tCreating mixer.\n");
+	GstElement* elem = gst_element_factory_make ("phonemixer", NULL);
 	g_assert (elem);
+
+	g_object_set (G_OBJECT (elem), "max-speakers", maxSpeakers, NULL);
+
+	if (mixMinus){
+		g_object_set (G_OBJECT (elem), "mix-minus", TRUE, NULL);
+		g_signal_connect (elem, "leg-activity", G_CALLBACK (mixerLegActivity), NULL);
+	}
 	return elem;
 }
 
-GstElement* createEncoder(){
-	g_print ("\t\tCreating encoder.\n");
+GstElement* createEncoder(const Codec* codec){
+	g_print ("\t\tCreating %s encoder.\n", codec->name);
 
-	GstElement* elem = gst_element_factory_make ("ffenc_g726", "G.726-coder");
-	g_object_set (G_OBJECT (elem), "bitrate", 32000, NULL);
+	GstElement* elem = codec_makeEncoder(codec, NULL);
 	g_assert (elem);
 	return elem;
 }
 
-GstElement* createRtpPay(){
+GstElement* createRtpPay(const Codec* codec){
 	g_print ("\t\tCreating RTP-pay.\n");
-	GstElement* elem = gst_element_factory_make ("rtpg726pay", "rtp-pay");
+	GstElement* elem = codec_makePayloader(codec, NULL);
 	g_assert (elem);
 	return elem;
 }
 
 GstElement* createOutputTee(){
 	g_print ("\t\tCreating output tee.\n");
-	GstElement* elem = gst_element_factory_make ("tee", "output-tee");
+	GstElement* elem = gst_element_factory_make ("tee", NULL);
 	g_assert (elem);
 	return elem;
 }
 
-static void rtpBinPadRemoved (GstElement * rtpbin, GstPad * pad, gpointer user_data){
-	g_print ("Removing pad: %s\n", GST_PAD_NAME (pad));
+GstElement* createFanoutSink(){
+	g_print ("\t\tCreating fan-out sink.\n");
+	GstElement* elem = gst_element_factory_make ("fanoutsink", NULL);
+	g_assert (elem);
+	return elem;
+}
+
+/*
+ * The leaving leg is detached while every other leg keeps streaming. The
+ * decoder bin has already lost its upstream, so it can be unlinked right
+ * away. The output bin still hangs off the running tee, so its tee pad is
+ * blocked first and unlinked from the blocked callback. Stopping the bins
+ * and giving the request pads back is left to a later idle call, after
+ * the blocked callback has run.
+ *
+ * A pad removed before its join was handled is still joined first: the
+ * events come in order, and the event's reference keeps the pad alive.
+ */
+void leaveLeg(Room* room, GstPad* pad){
+	g_print ("Room %d: removing pad: %s\n", room->port, GST_PAD_NAME (pad));
+
+	if (rtpDtx_isComfortNoisePad(pad)){
+		unlinkDiscardSink(room, pad, "comfort-noise-sink");
+		return;
+	}
+	if (g_object_get_data (G_OBJECT (pad), "rejected-sink")){
+		unlinkDiscardSink(room, pad, "rejected-sink");
+		return;
+	}
+
+	DynamicConnection dCon;
+	g_assert (dynamicConnectionRegistry_removeByRtpBinPad(&room->connectionRegistry, pad, &dCon));
+
+	GstElement* decoderBin = dCon.decoderBin;
+	GstElement* outputBin  = dCon.outputBin;
+	RoomCodec* roomCodec   = (RoomCodec*) g_object_get_data (G_OBJECT (decoderBin), "room-codec");
+
+	gst_mmsg_src_forget_peer (room->udpSources[getPadSession(pad)], dCon.ssrc);
+	if (g_object_get_data (G_OBJECT (pad), "listen-only-sink")){
+		unlinkDiscardSink(room, pad, "listen-only-sink");
+	} else {
+		unlinkRtpDecoder(room, decoderBin);
+	}
+
+	if (outputBin){
+		unmeterRtpOutput(room, dCon.ssrc);
+	}
+
+	if (!outputBin){
+		removeFanoutDestination(roomCodec, dCon.ssrc);
+	} else if (dynamicConnectionRegistry_isEmpty(&room->connectionRegistry)){
+		// Nothing is fed into the mixing bin anymore, so the tee would
+		// never reach a blocked state. The whole chain goes away instead.
+		unlinkRtpOutput(roomCodec, outputBin);
+	} else {
+		unlinkRtpOutputWhenBlocked(outputBin);
+	}
 
-	DynamicConnection* dCon = dynamicConnectionList_removeByRtpBinPad(&connectionList, pad);	
-	g_assert (dCon);
+	deleteMixingBinOnDemand(room);
 
-	GstElement* decoderBin = dCon->decoderBin;
-	GstElement* outputBin  = dCon->outputBin;
-	free(dCon->host);
-	free(dCon);
+	g_print ("\tPad removed.\n");
+}
 
-	pipeline_pause();
+/*
+ * Runs on the room's worker every half --inactivity-timeout. An SSRC idle
+ * for the timeout is evicted if it is a leg, and forgotten either way, so
+ * stray senders do not come up again on every sweep.
+ */
+static gboolean sweepIdleLegs (gpointer user_data){
+	Room* room = (Room*) user_data;
+	guint32 ssrcs[SWEEP_BATCH];
+
+	int s;
+	for (s = 0; s < receiveThreads; s++){
+		guint count = gst_mmsg_src_get_idle_peers (room->udpSources[s],
+			inactivityTimeout * GST_MSECOND, ssrcs, SWEEP_BATCH);
+
+		guint i;
+		for (i = 0; i < count; i++){
+			if (evictLeg(room, ssrcs[i], "inactive")){
+				g_atomic_int_inc (&room->idleEvictions);
+			}
+			gst_mmsg_src_forget_peer (room->udpSources[s], ssrcs[i]);
+		}
+	}
+	return TRUE;
+}
 
+/*
+ * Has rtpbin drop a leg's SSRC now, the way it does itself once the SSRC
+ * times out: the session's SSRC demuxer removes the leg's pads, and the
+ * leave comes through the control queue like any other. Returns FALSE for
+ * an SSRC that is no joined leg, or one already on its way out.
+ */
+gboolean evictLeg(Room* room, guint32 ssrc, const gchar* reason){
+	DynamicConnectionRegistry* registry = &room->connectionRegistry;
+	DynamicConnection* dCon = dynamicConnectionRegistry_get(registry, dynamicConnectionRegistry_findBySsrc(registry, ssrc));
+	if (!dCon){
+		return FALSE;
+	}
+
+	GstElement* demux = findSsrcDemux(dCon->rptBinPad);
+	if (!demux){
+		return FALSE;
+	}
+
+	g_print ("Room %d: evicting SSRC %u (%s).\n", room->port, ssrc, reason);
+	g_signal_emit_by_name (demux, "clear-ssrc", ssrc, NULL);
+	gst_object_unref (demux);
+	return TRUE;
+}
+
+/*
+ * Inside rtpbin a leg runs from the SSRC demuxer through its jitterbuffer
+ * and payload demuxer to the ghost pad. Walks that up to the first element
+ * with a "clear-ssrc" signal; a pad rtpbin has let go of leads nowhere.
+ */
+GstElement* findSsrcDemux(GstPad* rtpBinPad){
+	GstPad* target = gst_ghost_pad_get_target (GST_GHOST_PAD (rtpBinPad));
+	if (!target){
+		return NULL;
+	}
+	GstElement* element = gst_pad_get_parent_element (target);
+	gst_object_unref (target);
+
+	while (element && !g_signal_lookup ("clear-ssrc", G_OBJECT_TYPE (element))){
+		GstPad* sinkpad = gst_element_get_static_pad (element, "sink");
+		GstPad* peer    = sinkpad ? gst_pad_get_peer (sinkpad) : 0;
+		gst_object_unref (element);
+		element = peer ? gst_pad_get_parent_element (peer) : 0;
+
+		if (sinkpad){
+			gst_object_unref (sinkpad);
+		}
+		if (peer){
+			gst_object_unref (peer);
+		}
+	}
+	return element;
+}
+
+/*
+ * Runs on the room's worker every OVERLOAD_CHECK_INTERVAL. A limit is set
+ * once the mixer's load reaches its threshold and lifted once the load is
+ * back under OVERLOAD_RECOVERY percent of it, so a room hovering at a
+ * threshold does not flip on every check.
+ */
+static gboolean checkOverload (gpointer user_data){
+	Room* room = (Room*) user_data;
+	if (isMixingBinNotCreated(room)){
+		return TRUE;
+	}
+
+	guint load;
+	g_object_get (G_OBJECT (room->adder), "load", &load, NULL);
+
+	gboolean limited = isOverloaded(load, admitLoad, room->admissionLimited);
+	if (limited != room->admissionLimited){
+		g_print ("Room %d: mixer load %u%%, %s new callers.\n", room->port, load / 10,
+			!limited ? "admitting" : rejectOverload ? "rejecting" : "only letting listen");
+		g_atomic_int_set (&room->admissionLimited, limited);
+	}
+
+	gboolean degraded = isOverloaded(load, degradeLoad, room->degraded);
+	if (degraded != room->degraded){
+		setDegraded(room, degraded, load);
+	}
+	return TRUE;
+}
+
+// The load is in per mille of the frame time, the threshold in percent.
+gboolean isOverloaded(guint load, int threshold, gboolean overloaded){
+	if (!threshold){
+		return FALSE;
+	}
+	guint limit = threshold * 10;
+	return load >= (overloaded ? limit * OVERLOAD_RECOVERY / 100 : limit);
+}
+
+/*
+ * A degraded room mixes at most DEGRADED_SPEAKERS, so a frame costs the
+ * same however many callers talk, and with mix-minus everybody else is
+ * fed from the shared encoder. The callers talking at the switch are not
+ * cut off: they keep their slots until they fall silent.
+ */
+void setDegraded(Room* room, gboolean degraded, guint load){
+	guint speakers = !degraded ? maxSpeakers
+		: maxSpeakers ? MIN (maxSpeakers, DEGRADED_SPEAKERS) : DEGRADED_SPEAKERS;
+
+	g_print ("Room %d: mixer load %u%%, %s.\n", room->port, load / 10,
+		degraded ? "mixing fewer speakers" : "mixing normally");
+	g_object_set (G_OBJECT (room->adder), "max-speakers", speakers, NULL);
+	g_atomic_int_set (&room->degraded, degraded);
+}
+
+// rtpbin has unlinked the pad already, only its sink is left to release.
+void unlinkDiscardSink(Room* room, GstPad* pad, const gchar* key){
+	GstElement* sink = (GstElement*) g_object_get_data (G_OBJECT (pad), key);
+	if (sink){
+		releaseOnIdle(room, NULL, NULL, sink);
+	}
+}
+
+void unlinkRtpDecoder(Room* room, GstElement* decoderBin){
 	g_print ("\tUnlinking RTP-decoder and mixing bin.\n");
 	GstPad* srcpad  = gst_element_get_static_pad (decoderBin, "src");
 	GstPad* sinkpad = gst_pad_get_peer(srcpad);
 	g_assert (gst_pad_unlink (srcpad, sinkpad));
-	gst_object_unref (sinkpad);
 	gst_object_unref (srcpad);
 
+	releaseOnIdle(room, room->adder, sinkpad, decoderBin);
+}
+
+void unlinkRtpOutput(RoomCodec* roomCodec, GstElement* outputBin){
 	g_print ("\tUnlinking RTP-output and mixing bin.\n");
-	sinkpad = gst_element_get_static_pad (outputBin, "sink");
-	srcpad  = gst_pad_get_peer(sinkpad);
+	GstPad* sinkpad = gst_element_get_static_pad (outputBin, "sink");
+	GstPad* srcpad  = gst_pad_get_peer(sinkpad);
 	g_assert (gst_pad_unlink (srcpad, sinkpad));
 	gst_object_unref (sinkpad);
+
+	releaseOnIdle(roomCodec->room, roomCodec->branch.tee, srcpad, outputBin);
+}
+
+/*
+ * The bin is listed as blocking until either the blocked callback or the
+ * mixing bin's teardown takes it over, whichever comes first: a tee that
+ * is stopped before its pad blocks never calls back.
+ */
+void unlinkRtpOutputWhenBlocked(GstElement* outputBin){
+	g_print ("\tBlocking RTP-output.\n");
+	Room* room = (Room*) g_object_get_data (G_OBJECT (outputBin), "room");
+
+	GstPad* sinkpad = gst_element_get_static_pad (outputBin, "sink");
+	GstPad* srcpad  = gst_pad_get_peer(sinkpad);
+	gst_object_unref (sinkpad);
+
+	g_mutex_lock (room->blockingLock);
+	room->blockingOutputs = g_slist_prepend (room->blockingOutputs, gst_object_ref (outputBin));
+	g_mutex_unlock (room->blockingLock);
+
+	gst_pad_set_blocked_async (srcpad, TRUE, rtpOutputBlocked, room);
 	gst_object_unref (srcpad);
+}
 
-	g_print ("\tStopping RTP-decoder.\n");
-	gst_element_set_state (decoderBin, GST_STATE_NULL);
-	gst_bin_remove (GST_BIN (pipeline), decoderBin);
+/*
+ * The bin is found through the pad's peer rather than passed along: once
+ * the teardown has taken it over, it may be back in its pool already.
+ */
+static void rtpOutputBlocked (GstPad* teePad, gboolean blocked, gpointer user_data){
+	if (!blocked){
+		return;
+	}
 
-	g_print ("\tStopping RTP-output.\n");
-	gst_element_set_state (outputBin, GST_STATE_NULL);
-	gst_bin_remove (GST_BIN (pipeline), outputBin);
+	Room* room      = (Room*) user_data;
+	GstPad* sinkpad = gst_pad_get_peer (teePad);
+	GstElement* outputBin = sinkpad ? gst_pad_get_parent_element (sinkpad) : 0;
 
-	deleteMixingBinOnDemand();
+	if (sinkpad){
+		gst_object_unref (sinkpad);
+	}
 
-	g_print ("\tPad removed.\n");
-	pipeline_run();
+	if (outputBin && takeBlockingOutput(room, outputBin)){
+		g_print ("RTP-output blocked, unlinking.\n");
+		unlinkRtpOutputFromTee(room, teePad, outputBin);
+		gst_object_unref (outputBin); // The list's reference.
+	} else {
+		gst_pad_set_blocked_async (teePad, FALSE, rtpOutputBlocked, room);
+	}
+
+	if (outputBin){
+		gst_object_unref (outputBin);
+	}
 }
 
-void deleteMixingBinOnDemand(){
-	if (dynamicConnectionList_isEmpty(&connectionList)){
-		deleteMixingBin();
+// Returns FALSE if the bin was taken over already.
+gboolean takeBlockingOutput(Room* room, GstElement* outputBin){
+	g_mutex_lock (room->blockingLock);
+	GSList* link = g_slist_find (room->blockingOutputs, outputBin);
+	room->blockingOutputs = g_slist_delete_link (room->blockingOutputs, link);
+	g_mutex_unlock (room->blockingLock);
+	return link != NULL;
+}
+
+/*
+ * Runs on the room's worker before the mixing bin goes. Whatever is still
+ * waiting for its tee pad to block is unlinked at once, as the last leg's
+ * output is: nothing is mixed for it anymore.
+ */
+void unlinkBlockingOutputs(Room* room){
+	g_mutex_lock (room->blockingLock);
+	GSList* outputs = room->blockingOutputs;
+	room->blockingOutputs = 0;
+	g_mutex_unlock (room->blockingLock);
+
+	GSList* walk;
+	for (walk = outputs; walk; walk = walk->next){
+		GstElement* outputBin = GST_ELEMENT (walk->data);
+		g_print ("\tUnlinking RTP-output still blocking.\n");
+
+		GstPad* sinkpad = gst_element_get_static_pad (outputBin, "sink");
+		GstPad* teePad  = gst_pad_get_peer(sinkpad);
+		gst_object_unref (sinkpad);
+
+		unlinkRtpOutputFromTee(room, teePad, outputBin);
+		gst_object_unref (teePad);
+		gst_object_unref (outputBin);
 	}
+	g_slist_free (outputs);
+}
+
+void unlinkRtpOutputFromTee(Room* room, GstPad* teePad, GstElement* outputBin){
+	GstElement* owner = gst_pad_get_parent_element (teePad);
+
+	GstPad* sinkpad = gst_element_get_static_pad (outputBin, "sink");
+	g_assert (gst_pad_unlink (teePad, sinkpad));
+	gst_object_unref (sinkpad);
+
+	// The tee only skips a not-linked pad, it must not stay blocked on it.
+	gst_pad_set_blocked_async (teePad, FALSE, rtpOutputBlocked, room);
+
+	releaseOnIdle(room, owner, gst_object_ref (teePad), outputBin);
+	gst_object_unref (owner);
+}
+
+void releaseOnIdle(Room* room, GstElement* owner, GstPad* requestPad, GstElement* bin){
+	PendingRelease* release = g_slice_new (PendingRelease);
+	release->room       = room;
+	release->owner      = owner ? gst_object_ref (owner) : 0;
+	release->requestPad = requestPad;
+	release->bin        = bin;
+	roomWorker_idleAdd(room->worker, releaseIdle, release);
 }
 
-void deleteMixingBin(){
+static gboolean releaseIdle (gpointer user_data){
+	PendingRelease* release = (PendingRelease*) user_data;
+
+	g_print ("Releasing %s.\n", GST_ELEMENT_NAME (release->bin));
+
+	if (release->owner){
+		gst_element_release_request_pad (release->owner, release->requestPad);
+		gst_object_unref (release->requestPad);
+		gst_object_unref (release->owner);
+	}
+
+	RecordTap* recording = stopRecordingLeg(release->bin);
+
+	if (g_object_get_data (G_OBJECT (release->bin), "bin-pool")){
+		binPool_recycle(release->bin);
+	} else {
+		stopAndRemove(release->room, release->bin);
+	}
+
+	if (recording){
+		recordTap_close(recording);
+	}
+
+	g_slice_free (PendingRelease, release);
+	return FALSE;
+}
+
+void deleteMixingBinOnDemand(Room* room){
+	if (dynamicConnectionRegistry_isEmpty(&room->connectionRegistry)){
+		deleteMixingBin(room);
+	}
+}
+
+/*
+ * The room's elements are cleared immediately, so a participant joining
+ * before the main loop gets to the old chain is given a fresh one.
+ */
+void deleteMixingBin(Room* room){
 	g_print ("\tDeleting mixing bin.\n");
+	unlinkBlockingOutputs(room);
 
-	gst_element_set_state (adder, GST_STATE_NULL);
-	gst_bin_remove (GST_BIN (pipeline), adder);
+	PendingMixingBin* mixingBin = g_slice_new (PendingMixingBin);
+	mixingBin->room     = room;
+	mixingBin->adder    = room->adder;
+	mixingBin->dtxGate  = room->dtxGate;
+	mixingBin->splitter = room->splitter;
+	mixingBin->recording = room->mixRecording;
+	room->mixRecording = 0;
 
-	gst_element_set_state (encoder, GST_STATE_NULL);
-	gst_bin_remove (GST_BIN (pipeline), encoder);
+	// Queued after the releases above, so the request pads go back first.
+	roomWorker_idleAdd(room->worker, deleteMixingBinIdle, mixingBin);
 
-	gst_element_set_state (pay, GST_STATE_NULL);
-	gst_bin_remove (GST_BIN (pipeline), pay);
+	// A new mixer starts out unloaded.
+	g_atomic_int_set (&room->admissionLimited, FALSE);
+	g_atomic_int_set (&room->degraded, FALSE);
 
-	gst_element_set_state (tee, GST_STATE_NULL);
-	gst_bin_remove (GST_BIN (pipeline), tee);
+	// The mixer's CPU time outlives it, so the room's counter never drops.
+	guint64 mixTime;
 
-	adder = 0;
+	g_mutex_lock (room->metricsLock);
+	g_object_get (G_OBJECT (room->adder), "mix-time", &mixTime, NULL);
+	room->mixerCpu.ns += mixTime;
+	room->adder = 0;
+
+	guint i;
+	for (i = 0; i < CODEC_COUNT; i++){
+		mixingBin->branches[i] = room->roomCodecs[i].branch;
+		memset (&room->roomCodecs[i].branch, 0, sizeof (MixBranch));
+	}
+	g_mutex_unlock (room->metricsLock);
 }
 
-void registerBusCall(){
+static gboolean deleteMixingBinIdle (gpointer user_data){
+	PendingMixingBin* mixingBin = (PendingMixingBin*) user_data;
+
+	g_print ("Stopping mixing bin.\n");
+
+	stopAndRemove(mixingBin->room, mixingBin->adder);
+	stopAndRemove(mixingBin->room, mixingBin->dtxGate);
+	stopAndRemove(mixingBin->room, mixingBin->splitter);
+
+	// The mixer is stopped, its probe will not push anymore.
+	if (mixingBin->recording){
+		recordTap_close(mixingBin->recording);
+	}
+
+	guint i;
+	for (i = 0; i < CODEC_COUNT; i++){
+		MixBranch* branch = &mixingBin->branches[i];
+		stopAndRemove(mixingBin->room, branch->encoder);
+		stopAndRemove(mixingBin->room, branch->pay);
+		stopAndRemove(mixingBin->room, branch->rtpDtx);
+		stopAndRemove(mixingBin->room, branch->tee);
+		stopAndRemove(mixingBin->room, branch->fanout);
+	}
+
+	g_slice_free (PendingMixingBin, mixingBin);
+	return FALSE;
+}
+
+void stopAndRemove(Room* room, GstElement* element){
+	if (!element){
+		return;
+	}
+	gst_element_set_state (element, GST_STATE_NULL);
+	gst_bin_remove (GST_BIN (room->pipeline), element);
+}
+
+void registerBusCall(Room* room){
 	g_print ("Registering bus call.\n");
-	GstBus* bus = gst_pipeline_get_bus (GST_PIPELINE (pipeline));
-	gst_bus_add_watch (bus, busCall, loop);
+	GstBus* bus = gst_pipeline_get_bus (GST_PIPELINE (room->pipeline));
+	roomWorker_addBusWatch(room->worker, bus, busCall, room);
 	gst_object_unref (bus);
 }
 
+/*
+ * Runs on the room's worker. A failing room is stopped on its own, the
+ * others keep running.
+ */
 static gboolean busCall (GstBus *bus, GstMessage *msg, gpointer data) {
 
-	GMainLoop *loop = (GMainLoop *) data;
+	Room* room = (Room*) data;
 
 	switch (GST_MESSAGE_TYPE (msg)) {
 
 		case GST_MESSAGE_EOS:
-			g_print ("End of stream\n");
-			g_main_loop_quit (loop);
+			g_print ("Room %d: end of stream\n", room->port);
+			pipeline_stop(room);
 			break;
 
 		case GST_MESSAGE_ERROR: {
@@ -569,13 +2131,17 @@ static gboolean busCall (GstBus *bus, GstMessage *msg, gpointer data) {
 			gst_message_parse_error (msg, &error, &debug);
 			g_free (debug);
 
-			g_printerr ("Error: %s\n", error->message);
+			g_printerr ("Room %d: error: %s\n", room->port, error->message);
 			g_error_free (error);
 
-			g_main_loop_quit (loop);
+			pipeline_stop(room);
 			break;
 		}
 
+		case GST_MESSAGE_LATENCY:
+			gst_bin_recalculate_latency (GST_BIN (room->pipeline));
+			break;
+
 		default:
 			break;
 	}
@@ -584,31 +2150,258 @@ static gboolean busCall (GstBus *bus, GstMessage *msg, gpointer data) {
 }
 
 void runLoop(){
-	pipeline_run();	
+	int i;
+	for (i = 0; i < roomsCount; i++){
+		pipeline_run(&rooms[i]);
+	}
+	for (i = 0; i < workersCount; i++){
+		roomWorker_start(&workers[i]);
+	}
+
 	g_print ("Running...\n");
 	g_main_loop_run (loop);
 }
 
 void cleanUp(){
 	g_print ("Returned from main loop.\n");
-	pipeline_stop();
 
-	g_print ("Deleting pipeline\n");
-	gst_object_unref (GST_OBJECT (pipeline));
+	int i;
+	for (i = 0; i < workersCount; i++){
+		roomWorker_stop(&workers[i]);
+	}
+
+	for (i = 0; i < roomsCount; i++){
+		pipeline_stop(&rooms[i]);
+
+		g_print ("Deleting pipeline\n");
+		gst_object_unref (GST_OBJECT (rooms[i].pipeline));
+
+		freeRoom(&rooms[i]);
+	}
+	g_free (rooms);
+
+	if (recordDir){
+		recordWriter_stop();
+	}
+
+	latencyTracer_dump();
+}
+
+/*
+ * Everything a room allocated is either its own (locks, tables, the
+ * registry's chunks) or held by the pipeline, which is gone by now.
+ */
+void freeRoom(Room* room){
+	guint c;
+	for (c = 0; c < CODEC_COUNT; c++){
+		RoomCodec* roomCodec = &room->roomCodecs[c];
+		if (isCodecServed(roomCodec)){
+			binPool_free(&roomCodec->decoderPool);
+			binPool_free(&roomCodec->outputPool);
+		}
+	}
+
+	dynamicConnectionRegistry_clear(&room->connectionRegistry);
+	g_hash_table_destroy (room->meteredOutputs);
+	g_mutex_free (room->metricsLock);
+	g_mutex_free (room->blockingLock);
+	g_free (room->udpSources);
+	g_free (room->trunks);
+}
+
+void startMetricsOrExit(){
+	if (!metricsPort){
+		return;
+	}
+	if (!metricsEndpoint_start(metricsPort, collectMetrics, NULL)){
+		exit(EXIT_INVALID_PARAMETERS);
+	}
 }
 
-void pipeline_run(){
-	g_print ("Starting pipeline.\n");
-	gst_element_set_state (pipeline, GST_STATE_PLAYING);
+// The metrics endpoint finds a mix-minus output's traffic counter by SSRC.
+void meterRtpOutput(Room* room, guint32 ssrc, GstElement* rtpOutput){
+	g_mutex_lock (room->metricsLock);
+	g_hash_table_insert (room->meteredOutputs, GUINT_TO_POINTER (ssrc), gst_object_ref (rtpOutput));
+	g_mutex_unlock (room->metricsLock);
 }
 
-void pipeline_pause(){
-	g_print ("Pausing pipeline.\n");
-	gst_element_set_state (pipeline, GST_STATE_PAUSED);
+void unmeterRtpOutput(Room* room, guint32 ssrc){
+	g_mutex_lock (room->metricsLock);
+	g_hash_table_remove (room->meteredOutputs, GUINT_TO_POINTER (ssrc));
+	g_mutex_unlock (room->metricsLock);
 }
 
-void pipeline_stop(){
-	g_print ("Stopping pipeline.\n");
-	gst_element_set_state (pipeline, GST_STATE_NULL);
+/*
+ * Runs in the main thread on every scrape. Receive side stats come from
+ * rtpbin, send side ones from the fan-out sink's table or, with mix-minus,
+ * the counters of every output bin.
+ */
+void collectMetrics(MetricsSnapshot* snapshot, gpointer data){
+	int i;
+	for (i = 0; i < roomsCount; i++){
+		collectRoomMetrics(snapshot, &rooms[i]);
+	}
+
+	if (recordDir){
+		metrics_add(snapshot, "phone_recording_frames_total", "counter",
+			"Frames copied into a recording", "", (guint) g_atomic_int_get (&recordWriter.framesRecorded));
+		metrics_add(snapshot, "phone_recording_frames_dropped_total", "counter",
+			"Frames left out of a recording because the disk fell behind", "", (guint) g_atomic_int_get (&recordWriter.framesDropped));
+	}
 }
 
+void collectRoomMetrics(MetricsSnapshot* snapshot, Room* room){
+	gchar* labels = g_strdup_printf ("room=\"%d\"", room->port);
+
+	int s;
+	for (s = 0; s < receiveThreads; s++){
+		metrics_collectRtpSession(snapshot, room->rtpBin, s, labels);
+		collectReceiveMetrics(snapshot, labels, s, room->udpSources[s]);
+	}
+	metrics_collectJitterbuffers(snapshot, room->rtpBin, labels);
+
+	g_mutex_lock (room->metricsLock);
+
+	GstElement* fanouts[CODEC_COUNT];
+	guint64 mixerCpu = room->mixerCpu.ns;
+
+	guint c;
+	for (c = 0; c < CODEC_COUNT; c++){
+		GstElement* fanout = room->roomCodecs[c].branch.fanout;
+		fanouts[c] = fanout ? gst_object_ref (fanout) : 0;
+	}
+
+	guint mixerLoad = 0;
+	if (room->adder){
+		guint64 mixTime;
+		g_object_get (G_OBJECT (room->adder), "mix-time", &mixTime, "load", &mixerLoad, NULL);
+		mixerCpu += mixTime;
+	}
+
+	GHashTableIter outputs;
+	gpointer key, value;
+	g_hash_table_iter_init (&outputs, room->meteredOutputs);
+	while (g_hash_table_iter_next (&outputs, &key, &value)){
+		MetricsTraffic* traffic = g_object_get_data (G_OBJECT (value), "metrics-traffic");
+		collectSentMetrics(snapshot, labels, GPOINTER_TO_UINT (key), traffic->packets, traffic->bytes);
+	}
+
+	g_mutex_unlock (room->metricsLock);
+
+	for (c = 0; c < CODEC_COUNT; c++){
+		if (!fanouts[c]){
+			continue;
+		}
+		GArray* destinations = gst_fanout_sink_copy_destinations (fanouts[c]);
+		guint d;
+		for (d = 0; d < destinations->len; d++){
+			FanoutSinkDestination* destination = &g_array_index (destinations, FanoutSinkDestination, d);
+			collectSentMetrics(snapshot, labels, (guint32) destination->key, destination->packets, destination->bytes);
+		}
+		g_array_free (destinations, TRUE);
+		gst_object_unref (fanouts[c]);
+	}
+
+	metrics_add(snapshot, "phone_mixer_cpu_seconds_total", "counter",
+		"CPU time spent mixing", labels, mixerCpu / 1e9);
+	metrics_add(snapshot, "phone_encoder_cpu_seconds_total", "counter",
+		"CPU time spent encoding the mixes", labels, room->encoderCpu.ns / 1e9);
+	metrics_add(snapshot, "phone_control_events_total", "counter",
+		"Joins and leaves posted to the room's worker", labels, g_atomic_int_get (&room->controlQueue.posted));
+	metrics_add(snapshot, "phone_control_batches_total", "counter",
+		"Runs of the room's worker over its control queue", labels, g_atomic_int_get (&room->controlQueue.batches));
+
+	gchar* evictionLabels = g_strdup_printf ("%s,reason=\"bye\"", labels);
+	metrics_add(snapshot, "phone_evictions_total", "counter",
+		"Legs dropped before rtpbin's timeout", evictionLabels, g_atomic_int_get (&room->byeEvictions));
+	g_free (evictionLabels);
+
+	evictionLabels = g_strdup_printf ("%s,reason=\"inactive\"", labels);
+	metrics_add(snapshot, "phone_evictions_total", "counter",
+		"Legs dropped before rtpbin's timeout", evictionLabels, g_atomic_int_get (&room->idleEvictions));
+	g_free (evictionLabels);
+
+	metrics_add(snapshot, "phone_mixer_load", "gauge",
+		"Share of the frame time the mixer takes, smoothed", labels, mixerLoad / 1000.0);
+	metrics_add(snapshot, "phone_admission_limited", "gauge",
+		"1 while new callers are kept out of the mix", labels, g_atomic_int_get (&room->admissionLimited));
+	metrics_add(snapshot, "phone_degraded", "gauge",
+		"1 while fewer speakers are mixed to save CPU", labels, g_atomic_int_get (&room->degraded));
+
+	gchar* joinLabels = g_strdup_printf ("%s,mode=\"listen-only\"", labels);
+	metrics_add(snapshot, "phone_limited_joins_total", "counter",
+		"Callers kept out of the mix on joining an overloaded room", joinLabels, g_atomic_int_get (&room->listenOnlyJoins));
+	g_free (joinLabels);
+
+	joinLabels = g_strdup_printf ("%s,mode=\"rejected\"", labels);
+	metrics_add(snapshot, "phone_limited_joins_total", "counter",
+		"Callers kept out of the mix on joining an overloaded room", joinLabels, g_atomic_int_get (&room->rejectedJoins));
+	g_free (joinLabels);
+
+	for (c = 0; c < CODEC_COUNT; c++){
+		RoomCodec* roomCodec = &room->roomCodecs[c];
+		if (!isCodecServed(roomCodec)){
+			continue;
+		}
+		collectBinPoolMetrics(snapshot, labels, &roomCodec->decoderPool);
+		if (mixMinus){
+			collectBinPoolMetrics(snapshot, labels, &roomCodec->outputPool);
+		}
+	}
+
+	g_free (labels);
+}
+
+// Shows how evenly the kernel spreads the callers over the sockets.
+void collectReceiveMetrics(MetricsSnapshot* snapshot, const gchar* labels, int index, GstElement* udpSource){
+	guint64 packets, byesDropped;
+	g_object_get (G_OBJECT (udpSource), "packets-received", &packets, "byes-dropped", &byesDropped, NULL);
+
+	gchar* socketLabels = g_strdup_printf ("%s,socket=\"%d\"", labels, index);
+	metrics_add(snapshot, "phone_socket_packets_received_total", "counter",
+		"Datagrams read by the receive socket", socketLabels, packets);
+	metrics_add(snapshot, "phone_socket_byes_dropped_total", "counter",
+		"RTCP BYEs not sent from the SSRC's RTP sender", socketLabels, byesDropped);
+	g_free (socketLabels);
+}
+
+// Bytes are counted without the RTP header, as rtpbin counts received ones.
+void collectSentMetrics(MetricsSnapshot* snapshot, const gchar* labels, guint32 ssrc, guint64 packets, guint64 bytes){
+	bytes -= MIN (bytes, packets * RTP_HEADER_SIZE);
+
+	gchar* sampleLabels = g_strdup_printf ("%s,participant=\"%u\"", labels, ssrc);
+	metrics_add(snapshot, "phone_rtp_packets_sent_total", "counter",
+		"RTP packets sent to the participant", sampleLabels, packets);
+	metrics_add(snapshot, "phone_rtp_bytes_sent_total", "counter",
+		"RTP payload bytes sent to the participant", sampleLabels, bytes);
+	g_free (sampleLabels);
+}
+
+void collectBinPoolMetrics(MetricsSnapshot* snapshot, const gchar* labels, BinPool* pool){
+	gchar* poolLabels = g_strdup_printf ("%s,pool=\"%s\"", labels, pool->name);
+	metrics_add(snapshot, "phone_bin_pool_idle", "gauge",
+		"Participant bins ready for joining callers", poolLabels, binPool_idleCount(pool));
+	metrics_add(snapshot, "phone_bin_pool_misses_total", "counter",
+		"Joins that found the bin pool empty", poolLabels, g_atomic_int_get (&pool->misses));
+	g_free (poolLabels);
+}
+
+void pipeline_run(Room* room){
+	g_print ("Starting pipeline on port %d.\n", room->port);
+	gst_element_set_state (room->pipeline, GST_STATE_PLAYING);
+	room->running = TRUE;
+}
+
+void pipeline_stop(Room* room){
+	if (!room->running){
+		return;
+	}
+
+	g_print ("Stopping pipeline on port %d.\n", room->port);
+	gst_element_set_state (room->pipeline, GST_STATE_NULL);
+	room->running = FALSE;
+
+	if (g_atomic_int_dec_and_test (&runningRooms)){
+		g_main_loop_quit (loop);
+	}
+}
@@ -0,0 +1,197 @@
+#ifndef MIX_KERNELS_H
+#define MIX_KERNELS_H
+
+#include <glib.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define MIX_KERNELS_X86 1
+#endif
+
+/*
+ * Inner loops of the phone mixer on 16-bit PCM.
+ *
+ * The sum of all active inputs is accumulated in 32 bits, so a leg's own
+ * frame can still be subtracted exactly for its mix-minus, and it is only
+ * saturated to 16 bits on the way out. The inputs are walked block by block,
+ * so every output block is finished in registers in a single pass over all
+ * inputs.
+ *
+ * mixKernels_init() picks AVX2, SSE2 or plain C once at startup.
+ */
+
+typedef void (*MixKernelsSumFunc) (const gint16** frames, guint count, gint32* sum, gint16* mix, guint samples);
+typedef void (*MixKernelsMinusFunc) (const gint32* sum, const gint16* frame, gint16* out, guint samples);
+typedef guint64 (*MixKernelsEnergyFunc) (const gint16* frame, guint samples);
+
+typedef struct {
+	const gchar* name;
+	MixKernelsSumFunc sum;
+	MixKernelsMinusFunc minus;
+	MixKernelsEnergyFunc energy;
+} MixKernels;
+
+static MixKernels mixKernels;
+
+static gint16 mixKernels_saturate (gint32 sample){
+	return (gint16) CLAMP (sample, G_MININT16, G_MAXINT16);
+}
+
+static void mixKernels_sumTail (const gint16** frames, guint count, gint32* sum, gint16* mix, guint from, guint samples){
+	guint i, k;
+	for (i = from; i < samples; i++){
+		gint32 value = 0;
+		for (k = 0; k < count; k++){
+			value += frames[k][i];
+		}
+		sum[i] = value;
+		mix[i] = mixKernels_saturate(value);
+	}
+}
+
+static void mixKernels_minusTail (const gint32* sum, const gint16* frame, gint16* out, guint from, guint samples){
+	guint i;
+	for (i = from; i < samples; i++){
+		out[i] = mixKernels_saturate(sum[i] - frame[i]);
+	}
+}
+
+static guint64 mixKernels_energyTail (const gint16* frame, guint from, guint samples){
+	guint64 energy = 0;
+	guint i;
+	for (i = from; i < samples; i++){
+		energy += (guint64) ((gint32) frame[i] * frame[i]);
+	}
+	return energy;
+}
+
+static void mixKernels_sumScalar (const gint16** frames, guint count, gint32* sum, gint16* mix, guint samples){
+	mixKernels_sumTail(frames, count, sum, mix, 0, samples);
+}
+
+static void mixKernels_minusScalar (const gint32* sum, const gint16* frame, gint16* out, guint samples){
+	mixKernels_minusTail(sum, frame, out, 0, samples);
+}
+
+static guint64 mixKernels_energyScalar (const gint16* frame, guint samples){
+	return mixKernels_energyTail(frame, 0, samples);
+}
+
+#ifdef MIX_KERNELS_X86
+
+__attribute__((target("sse2")))
+static void mixKernels_sumSse2 (const gint16** frames, guint count, gint32* sum, gint16* mix, guint samples){
+	guint i, k;
+	for (i = 0; i + 8 <= samples; i += 8){
+		__m128i lo = _mm_setzero_si128();
+		__m128i hi = _mm_setzero_si128();
+
+		for (k = 0; k < count; k++){
+			__m128i x = _mm_loadu_si128((const __m128i*) (frames[k] + i));
+			lo = _mm_add_epi32(lo, _mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16));
+			hi = _mm_add_epi32(hi, _mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16));
+		}
+
+		_mm_storeu_si128((__m128i*) (sum + i),     lo);
+		_mm_storeu_si128((__m128i*) (sum + i + 4), hi);
+		_mm_storeu_si128((__m128i*) (mix + i), _mm_packs_epi32(lo, hi));
+	}
+	mixKernels_sumTail(frames, count, sum, mix, i, samples);
+}
+
+__attribute__((target("sse2")))
+static void mixKernels_minusSse2 (const gint32* sum, const gint16* frame, gint16* out, guint samples){
+	guint i;
+	for (i = 0; i + 8 <= samples; i += 8){
+		__m128i x  = _mm_loadu_si128((const __m128i*) (frame + i));
+		__m128i lo = _mm_sub_epi32(_mm_loadu_si128((const __m128i*) (sum + i)),
+			_mm_srai_epi32(_mm_unpacklo_epi16(x, x), 16));
+		__m128i hi = _mm_sub_epi32(_mm_loadu_si128((const __m128i*) (sum + i + 4)),
+			_mm_srai_epi32(_mm_unpackhi_epi16(x, x), 16));
+		_mm_storeu_si128((__m128i*) (out + i), _mm_packs_epi32(lo, hi));
+	}
+	mixKernels_minusTail(sum, frame, out, i, samples);
+}
+
+// Each pair sum of squares is at most 2^31, so it is widened as unsigned.
+__attribute__((target("sse2")))
+static guint64 mixKernels_energySse2 (const gint16* frame, guint samples){
+	__m128i zero = _mm_setzero_si128();
+	__m128i acc  = _mm_setzero_si128();
+	guint i;
+	for (i = 0; i + 8 <= samples; i += 8){
+		__m128i x = _mm_loadu_si128((const __m128i*) (frame + i));
+		__m128i squares = _mm_madd_epi16(x, x);
+		acc = _mm_add_epi64(acc, _mm_unpacklo_epi32(squares, zero));
+		acc = _mm_add_epi64(acc, _mm_unpackhi_epi32(squares, zero));
+	}
+
+	guint64 lanes[2];
+	_mm_storeu_si128((__m128i*) lanes, acc);
+	return lanes[0] + lanes[1] + mixKernels_energyTail(frame, i, samples);
+}
+
+__attribute__((target("avx2")))
+static void mixKernels_sumAvx2 (const gint16** frames, guint count, gint32* sum, gint16* mix, guint samples){
+	guint i, k;
+	for (i = 0; i + 16 <= samples; i += 16){
+		__m256i lo = _mm256_setzero_si256();
+		__m256i hi = _mm256_setzero_si256();
+
+		for (k = 0; k < count; k++){
+			lo = _mm256_add_epi32(lo, _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*) (frames[k] + i))));
+			hi = _mm256_add_epi32(hi, _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*) (frames[k] + i + 8))));
+		}
+
+		_mm256_storeu_si256((__m256i*) (sum + i),     lo);
+		_mm256_storeu_si256((__m256i*) (sum + i + 8), hi);
+
+		// packs works per 128-bit lane; put the quarters back in order.
+		__m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(lo, hi), 0xD8);
+		_mm256_storeu_si256((__m256i*) (mix + i), packed);
+	}
+	mixKernels_sumTail(frames, count, sum, mix, i, samples);
+}
+
+__attribute__((target("avx2")))
+static void mixKernels_minusAvx2 (const gint32* sum, const gint16* frame, gint16* out, guint samples){
+	guint i;
+	for (i = 0; i + 16 <= samples; i += 16){
+		__m256i lo = _mm256_sub_epi32(_mm256_loadu_si256((const __m256i*) (sum + i)),
+			_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*) (frame + i))));
+		__m256i hi = _mm256_sub_epi32(_mm256_loadu_si256((const __m256i*) (sum + i + 8)),
+			_mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*) (frame + i + 8))));
+
+		__m256i packed = _mm256_permute4x64_epi64(_mm256_packs_epi32(lo, hi), 0xD8);
+		_mm256_storeu_si256((__m256i*) (out + i), packed);
+	}
+	mixKernels_minusTail(sum, frame, out, i, samples);
+}
+
+#endif
+
+void mixKernels_init (){
+	mixKernels.name   = "scalar";
+	mixKernels.sum    = mixKernels_sumScalar;
+	mixKernels.minus  = mixKernels_minusScalar;
+	mixKernels.energy = mixKernels_energyScalar;
+
+#ifdef MIX_KERNELS_X86
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("sse2")){
+		mixKernels.name   = "sse2";
+		mixKernels.sum    = mixKernels_sumSse2;
+		mixKernels.minus  = mixKernels_minusSse2;
+		mixKernels.energy = mixKernels_energySse2;
+	}
+
+	if (__builtin_cpu_supports("avx2")){
+		mixKernels.name   = "avx2";
+		mixKernels.sum    = mixKernels_sumAvx2;
+		mixKernels.minus  = mixKernels_minusAvx2;
+	}
+#endif
+}
+
+#endif
@@ -0,0 +1,652 @@
+#ifndef MMSG_SRC_H
+#define MMSG_SRC_H
+
+#include <gst/gst.h>
+#include <gst/base/gstpushsrc.h>
+#include <gst/netbuffer/gstnetbuffer.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+/*
+ * "mmsgsrc" - a live UDP source which reads datagrams in batches.
+ *
+ * Once the socket is readable, one recvmmsg() call takes up to
+ * "batch-size" datagrams into preallocated slots; they are then pushed one
+ * by one without touching the socket again. Buffers are GstNetBuffers
+ * carrying the sender address, just like udpsrc's, so rtpbin still knows
+ * where each source sends from.
+ *
+ * The source also remembers the binary sender address of every RTP SSRC it
+ * sees, updated once per batch. gst_mmsg_src_get_peer() answers "who sends
+ * this SSRC" with a single hash lookup, without going through rtpbin's
+ * per-source statistics. Peers are slice-allocated; the server keeps a
+ * caller's peer with gst_mmsg_src_keep_peer() while the caller is in, silent
+ * or on hold, and forgets it when the caller leaves. A kept peer's address
+ * is pinned: packets under its SSRC from anywhere else neither move it nor
+ * count as the caller being heard from. Peers that never
+ * became a caller (stray packets, a straggler after the leave) are swept
+ * once they have been quiet for MMSG_SRC_PEER_TIMEOUT.
+ *
+ * RTCP may share the port (RFC 5761). RTCP packets are not pushed; the
+ * SSRCs of every BYE in them are announced with the "bye-ssrc" signal,
+ * from the streaming thread, once the batch is taken. A BYE counts only
+ * when it comes from the address and port the SSRC's RTP comes from (the
+ * pinned one for a joined caller), as it does with RTCP on the RTP port;
+ * anybody else's BYE, or one for an SSRC never heard, is dropped and
+ * counted in "byes-dropped".
+ *
+ * With "reuse-port" several sources may bind the same port: the socket is
+ * opened with SO_REUSEPORT and the kernel hashes every sender (by address
+ * and port) to one of the sockets, so each source, in its own streaming
+ * thread, reads a fixed share of the senders. A sender's packets always
+ * reach the same source.
+ */
+
+#define MMSG_SRC_DEFAULT_PORT       9559
+#define MMSG_SRC_DEFAULT_BATCH_SIZE 64
+#define MMSG_SRC_MAX_PACKET         1500
+#define MMSG_SRC_PEER_TIMEOUT       (30 * GST_SECOND)
+
+#define MMSG_SRC_RTCP_FIRST 200
+#define MMSG_SRC_RTCP_LAST  204
+#define MMSG_SRC_RTCP_BYE   203
+
+#define GST_TYPE_MMSG_SRC (gst_mmsg_src_get_type())
+#define GST_MMSG_SRC(obj) (G_TYPE_CHECK_INSTANCE_CAST((obj), GST_TYPE_MMSG_SRC, GstMmsgSrc))
+
+typedef struct _GstMmsgSrc      GstMmsgSrc;
+typedef struct _GstMmsgSrcClass GstMmsgSrcClass;
+
+// Host order, like the connection registry's host keys.
+typedef struct {
+	guint32 address;
+	guint16 port;
+	GstClockTime seen;
+	gboolean kept;
+} MmsgSrcPeer;
+
+struct _GstMmsgSrc {
+	GstPushSrc parent;
+
+	gint port;
+	GstCaps* caps;
+	guint batchSize;
+	gboolean reusePort;
+
+	int sockfd;
+	GstPoll* poll;
+	GstPollFD pollFd;
+
+	struct mmsghdr* messages;
+	struct iovec* iovecs;
+	struct sockaddr_in* addresses;
+	guint8* slots;
+	guint received;
+	guint next;
+
+	GHashTable* peers;
+	GstClockTime peersSwept;
+
+	// Of the current batch, announced after the object lock is let go.
+	GArray* byes;
+
+	guint64 packetsReceived;
+	guint64 receiveCalls;
+	guint64 byesDropped;
+};
+
+struct _GstMmsgSrcClass {
+	GstPushSrcClass parent_class;
+};
+
+enum {
+	MMSG_SRC_PROP_0,
+	MMSG_SRC_PROP_PORT,
+	MMSG_SRC_PROP_CAPS,
+	MMSG_SRC_PROP_BATCH_SIZE,
+	MMSG_SRC_PROP_REUSE_PORT,
+	MMSG_SRC_PROP_SOCKFD,
+	MMSG_SRC_PROP_PACKETS_RECEIVED,
+	MMSG_SRC_PROP_RECEIVE_CALLS,
+	MMSG_SRC_PROP_BYES_DROPPED
+};
+
+enum {
+	MMSG_SRC_SIGNAL_BYE_SSRC,
+	MMSG_SRC_SIGNAL_LAST
+};
+
+static guint gst_mmsg_src_signals[MMSG_SRC_SIGNAL_LAST];
+
+static GstStaticPadTemplate gst_mmsg_src_src_template = GST_STATIC_PAD_TEMPLATE ("src",
+	GST_PAD_SRC, GST_PAD_ALWAYS, GST_STATIC_CAPS_ANY);
+
+G_DEFINE_TYPE (GstMmsgSrc, gst_mmsg_src, GST_TYPE_PUSH_SRC);
+
+static void gst_mmsg_src_set_property (GObject* object, guint id, const GValue* value, GParamSpec* pspec);
+static void gst_mmsg_src_get_property (GObject* object, guint id, GValue* value, GParamSpec* pspec);
+static void gst_mmsg_src_finalize (GObject* object);
+static GstCaps* gst_mmsg_src_get_caps (GstBaseSrc* base);
+static gboolean gst_mmsg_src_start (GstBaseSrc* base);
+static gboolean gst_mmsg_src_stop (GstBaseSrc* base);
+static gboolean gst_mmsg_src_unlock (GstBaseSrc* base);
+static gboolean gst_mmsg_src_unlock_stop (GstBaseSrc* base);
+static GstFlowReturn gst_mmsg_src_create (GstPushSrc* base, GstBuffer** buffer);
+
+static void gst_mmsg_src_free_peer (gpointer peer){
+	g_slice_free (MmsgSrcPeer, peer);
+}
+
+static void gst_mmsg_src_class_init (GstMmsgSrcClass* klass){
+	GObjectClass*    gobject_class = G_OBJECT_CLASS (klass);
+	GstBaseSrcClass* basesrc_class = GST_BASE_SRC_CLASS (klass);
+	GstPushSrcClass* pushsrc_class = GST_PUSH_SRC_CLASS (klass);
+	GstElementClass* element_class = GST_ELEMENT_CLASS (klass);
+
+	gst_element_class_add_pad_template (element_class, gst_static_pad_template_get (&gst_mmsg_src_src_template));
+
+	gst_element_class_set_details_simple (element_class,
+		"Batched UDP source", "Source/Network",
+		"Receives UDP packets in batches with recvmmsg",
+		"GStreamer Audio Echo");
+
+	gobject_class->set_property = gst_mmsg_src_set_property;
+	gobject_class->get_property = gst_mmsg_src_get_property;
+	gobject_class->finalize     = gst_mmsg_src_finalize;
+
+	g_object_class_install_property (gobject_class, MMSG_SRC_PROP_PORT,
+		g_param_spec_int ("port", "Port",
+			"UDP port to listen on", 0, G_MAXUINT16, MMSG_SRC_DEFAULT_PORT, G_PARAM_READWRITE));
+
+	g_object_class_install_property (gobject_class, MMSG_SRC_PROP_CAPS,
+		g_param_spec_boxed ("caps", "Caps",
+			"Caps of the received packets", GST_TYPE_CAPS, G_PARAM_READWRITE));
+
+	g_object_class_install_property (gobject_class, MMSG_SRC_PROP_BATCH_SIZE,
+		g_param_spec_uint ("batch-size", "Batch size",
+			"Most datagrams read with one recvmmsg() call", 1, 1024,
+			MMSG_SRC_DEFAULT_BATCH_SIZE, G_PARAM_READWRITE));
+
+	g_object_class_install_property (gobject_class, MMSG_SRC_PROP_REUSE_PORT,
+		g_param_spec_boolean ("reuse-port", "Reuse port",
+			"Share the port with other sockets, which split the senders", FALSE, G_PARAM_READWRITE));
+
+	g_object_class_install_property (gobject_class, MMSG_SRC_PROP_SOCKFD,
+		g_param_spec_int ("sockfd", "Socket",
+			"The bound socket, -1 when stopped", -1, G_MAXINT, -1, G_PARAM_READABLE));
+
+	g_object_class_install_property (gobject_class, MMSG_SRC_PROP_PACKETS_RECEIVED,
+		g_param_spec_uint64 ("packets-received", "Packets received",
+			"Datagrams read from the socket", 0, G_MAXUINT64, 0, G_PARAM_READABLE));
+
+	g_object_class_install_property (gobject_class, MMSG_SRC_PROP_RECEIVE_CALLS,
+		g_param_spec_uint64 ("receive-calls", "Receive calls",
+			"recvmmsg() calls which returned data", 0, G_MAXUINT64, 0, G_PARAM_READABLE));
+
+	g_object_class_install_property (gobject_class, MMSG_SRC_PROP_BYES_DROPPED,
+		g_param_spec_uint64 ("byes-dropped", "BYEs dropped",
+			"BYE SSRCs not sent from their RTP sender", 0, G_MAXUINT64, 0, G_PARAM_READABLE));
+
+	gst_mmsg_src_signals[MMSG_SRC_SIGNAL_BYE_SSRC] = g_signal_new ("bye-ssrc",
+		G_TYPE_FROM_CLASS (klass), G_SIGNAL_RUN_LAST, 0, NULL, NULL, NULL,
+		G_TYPE_NONE, 1, G_TYPE_UINT);
+
+	basesrc_class->get_caps    = GST_DEBUG_FUNCPTR (gst_mmsg_src_get_caps);
+	basesrc_class->start       = GST_DEBUG_FUNCPTR (gst_mmsg_src_start);
+	basesrc_class->stop        = GST_DEBUG_FUNCPTR (gst_mmsg_src_stop);
+	basesrc_class->unlock      = GST_DEBUG_FUNCPTR (gst_mmsg_src_unlock);
+	basesrc_class->unlock_stop = GST_DEBUG_FUNCPTR (gst_mmsg_src_unlock_stop);
+	pushsrc_class->create      = GST_DEBUG_FUNCPTR (gst_mmsg_src_create);
+}
+
+static void gst_mmsg_src_init (GstMmsgSrc* src){
+	src->port      = MMSG_SRC_DEFAULT_PORT;
+	src->caps      = 0;
+	src->batchSize = MMSG_SRC_DEFAULT_BATCH_SIZE;
+	src->reusePort = FALSE;
+
+	src->sockfd = -1;
+	src->poll   = gst_poll_new (TRUE);
+
+	src->messages  = 0;
+	src->iovecs    = 0;
+	src->addresses = 0;
+	src->slots     = 0;
+	src->received  = 0;
+	src->next      = 0;
+
+	src->peers = g_hash_table_new_full (g_direct_hash, g_direct_equal, NULL, gst_mmsg_src_free_peer);
+	src->peersSwept = 0;
+	src->byes = g_array_new (FALSE, FALSE, sizeof (guint32));
+
+	src->packetsReceived = 0;
+	src->receiveCalls    = 0;
+	src->byesDropped     = 0;
+
+	gst_base_src_set_live (GST_BASE_SRC (src), TRUE);
+	gst_base_src_set_format (GST_BASE_SRC (src), GST_FORMAT_TIME);
+	gst_base_src_set_do_timestamp (GST_BASE_SRC (src), TRUE);
+}
+
+static void gst_mmsg_src_set_property (GObject* object, guint id, const GValue* value, GParamSpec* pspec){
+	GstMmsgSrc* src = GST_MMSG_SRC (object);
+
+	switch (id) {
+		case MMSG_SRC_PROP_PORT:
+			src->port = g_value_get_int (value);
+			break;
+		case MMSG_SRC_PROP_CAPS: {
+			const GstCaps* caps = gst_value_get_caps (value);
+			GstCaps* old = src->caps;
+			src->caps = caps ? gst_caps_copy (caps) : 0;
+			if (old){
+				gst_caps_unref (old);
+			}
+			gst_pad_set_caps (GST_BASE_SRC_PAD (src), src->caps);
+			break;
+		}
+		case MMSG_SRC_PROP_BATCH_SIZE:
+			src->batchSize = g_value_get_uint (value);
+			break;
+		case MMSG_SRC_PROP_REUSE_PORT:
+			src->reusePort = g_value_get_boolean (value);
+			break;
+		default:
+			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, id, pspec);
+			break;
+	}
+}
+
+static void gst_mmsg_src_get_property (GObject* object, guint id, GValue* value, GParamSpec* pspec){
+	GstMmsgSrc* src = GST_MMSG_SRC (object);
+
+	switch (id) {
+		case MMSG_SRC_PROP_PORT:
+			g_value_set_int (value, src->port);
+			break;
+		case MMSG_SRC_PROP_CAPS:
+			gst_value_set_caps (value, src->caps);
+			break;
+		case MMSG_SRC_PROP_BATCH_SIZE:
+			g_value_set_uint (value, src->batchSize);
+			break;
+		case MMSG_SRC_PROP_REUSE_PORT:
+			g_value_set_boolean (value, src->reusePort);
+			break;
+		case MMSG_SRC_PROP_SOCKFD:
+			g_value_set_int (value, src->sockfd);
+			break;
+		case MMSG_SRC_PROP_PACKETS_RECEIVED:
+			GST_OBJECT_LOCK (src);
+			g_value_set_uint64 (value, src->packetsReceived);
+			GST_OBJECT_UNLOCK (src);
+			break;
+		case MMSG_SRC_PROP_RECEIVE_CALLS:
+			GST_OBJECT_LOCK (src);
+			g_value_set_uint64 (value, src->receiveCalls);
+			GST_OBJECT_UNLOCK (src);
+			break;
+		case MMSG_SRC_PROP_BYES_DROPPED:
+			GST_OBJECT_LOCK (src);
+			g_value_set_uint64 (value, src->byesDropped);
+			GST_OBJECT_UNLOCK (src);
+			break;
+		default:
+			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, id, pspec);
+			break;
+	}
+}
+
+static void gst_mmsg_src_finalize (GObject* object){
+	GstMmsgSrc* src = GST_MMSG_SRC (object);
+
+	if (src->caps){
+		gst_caps_unref (src->caps);
+	}
+	gst_poll_free (src->poll);
+	g_hash_table_destroy (src->peers);
+	g_array_free (src->byes, TRUE);
+
+	G_OBJECT_CLASS (gst_mmsg_src_parent_class)->finalize (object);
+}
+
+static GstCaps* gst_mmsg_src_get_caps (GstBaseSrc* base){
+	GstMmsgSrc* src = GST_MMSG_SRC (base);
+	return src->caps ? gst_caps_ref (src->caps) : gst_caps_new_any ();
+}
+
+static void gst_mmsg_src_free_slots (GstMmsgSrc* src){
+	g_free (src->messages);
+	g_free (src->iovecs);
+	g_free (src->addresses);
+	g_free (src->slots);
+	src->messages  = 0;
+	src->iovecs    = 0;
+	src->addresses = 0;
+	src->slots     = 0;
+}
+
+static void gst_mmsg_src_alloc_slots (GstMmsgSrc* src){
+	guint size = src->batchSize;
+
+	src->messages  = g_new0 (struct mmsghdr, size);
+	src->iovecs    = g_new0 (struct iovec, size);
+	src->addresses = g_new0 (struct sockaddr_in, size);
+	src->slots     = g_malloc (size * MMSG_SRC_MAX_PACKET);
+
+	guint i;
+	for (i = 0; i < size; i++){
+		src->iovecs[i].iov_base = src->slots + i * MMSG_SRC_MAX_PACKET;
+		src->iovecs[i].iov_len  = MMSG_SRC_MAX_PACKET;
+		src->messages[i].msg_hdr.msg_iov    = &src->iovecs[i];
+		src->messages[i].msg_hdr.msg_iovlen = 1;
+		src->messages[i].msg_hdr.msg_name   = &src->addresses[i];
+	}
+
+	src->received = 0;
+	src->next     = 0;
+}
+
+static gboolean gst_mmsg_src_start (GstBaseSrc* base){
+	GstMmsgSrc* src = GST_MMSG_SRC (base);
+
+	src->sockfd = socket (AF_INET, SOCK_DGRAM, 0);
+	if (src->sockfd < 0){
+		g_printerr ("Batched UDP source: cannot open socket: %s\n", g_strerror (errno));
+		return FALSE;
+	}
+
+	int reuse = 1;
+	setsockopt (src->sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof (reuse));
+
+	if (src->reusePort && setsockopt (src->sockfd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof (reuse)) < 0){
+		g_printerr ("Batched UDP source: cannot share port %d: %s\n", src->port, g_strerror (errno));
+		close (src->sockfd);
+		src->sockfd = -1;
+		return FALSE;
+	}
+
+	struct sockaddr_in address;
+	memset (&address, 0, sizeof (address));
+	address.sin_family      = AF_INET;
+	address.sin_addr.s_addr = htonl (INADDR_ANY);
+	address.sin_port        = htons (src->port);
+
+	if (bind (src->sockfd, (struct sockaddr*) &address, sizeof (address)) < 0){
+		g_printerr ("Batched UDP source: cannot bind port %d: %s\n", src->port, g_strerror (errno));
+		close (src->sockfd);
+		src->sockfd = -1;
+		return FALSE;
+	}
+
+	gst_poll_fd_init (&src->pollFd);
+	src->pollFd.fd = src->sockfd;
+	gst_poll_add_fd (src->poll, &src->pollFd);
+	gst_poll_fd_ctl_read (src->poll, &src->pollFd, TRUE);
+
+	gst_mmsg_src_alloc_slots (src);
+	return TRUE;
+}
+
+static gboolean gst_mmsg_src_stop (GstBaseSrc* base){
+	GstMmsgSrc* src = GST_MMSG_SRC (base);
+
+	if (src->sockfd >= 0){
+		gst_poll_remove_fd (src->poll, &src->pollFd);
+		close (src->sockfd);
+		src->sockfd = -1;
+	}
+	gst_mmsg_src_free_slots (src);
+	return TRUE;
+}
+
+static gboolean gst_mmsg_src_unlock (GstBaseSrc* base){
+	gst_poll_set_flushing (GST_MMSG_SRC (base)->poll, TRUE);
+	return TRUE;
+}
+
+static gboolean gst_mmsg_src_unlock_stop (GstBaseSrc* base){
+	gst_poll_set_flushing (GST_MMSG_SRC (base)->poll, FALSE);
+	return TRUE;
+}
+
+static gboolean gst_mmsg_src_is_peer_quiet (gpointer key, gpointer value, gpointer data){
+	MmsgSrcPeer* peer = (MmsgSrcPeer*) value;
+	return !peer->kept && peer->seen + MMSG_SRC_PEER_TIMEOUT < *(GstClockTime*) data;
+}
+
+static gboolean gst_mmsg_src_is_rtcp (const guint8* data, guint size){
+	return size >= 8 && (data[0] >> 6) == 2
+		&& data[1] >= MMSG_SRC_RTCP_FIRST && data[1] <= MMSG_SRC_RTCP_LAST;
+}
+
+// A BYE must come from where the SSRC's RTP comes from.
+static gboolean gst_mmsg_src_is_bye_sender (GstMmsgSrc* src, guint32 ssrc, guint32 address, guint16 port){
+	MmsgSrcPeer* peer = (MmsgSrcPeer*) g_hash_table_lookup (src->peers, GUINT_TO_POINTER (ssrc));
+	return peer && peer->address == address && peer->port == port;
+}
+
+/*
+ * Walks a compound RTCP packet for BYEs; a malformed tail is ignored.
+ * Called with the object lock held.
+ */
+static void gst_mmsg_src_read_byes (GstMmsgSrc* src, const guint8* data, guint size, guint32 address, guint16 port){
+	guint offset = 0;
+	while (offset + 4 <= size){
+		const guint8* packet = data + offset;
+		guint length = (GST_READ_UINT16_BE (packet + 2) + 1) * 4;
+		if (offset + length > size){
+			return;
+		}
+
+		if (packet[1] == MMSG_SRC_RTCP_BYE){
+			guint count = packet[0] & 0x1f;
+			guint j;
+			for (j = 0; j < count && 8 + 4 * j <= length; j++){
+				guint32 ssrc = GST_READ_UINT32_BE (packet + 4 + 4 * j);
+				if (gst_mmsg_src_is_bye_sender (src, ssrc, address, port)){
+					g_array_append_val (src->byes, ssrc);
+				} else {
+					src->byesDropped++;
+				}
+			}
+		}
+		offset += length;
+	}
+}
+
+// Called with the object lock held. Only a new SSRC allocates.
+static void gst_mmsg_src_update_peers (GstMmsgSrc* src){
+	GstClockTime now = gst_util_get_timestamp ();
+	guint i;
+	for (i = 0; i < src->received; i++){
+		const guint8* data = (const guint8*) src->iovecs[i].iov_base;
+		guint32 address = ntohl (src->addresses[i].sin_addr.s_addr);
+		guint16 port    = ntohs (src->addresses[i].sin_port);
+
+		if (gst_mmsg_src_is_rtcp (data, src->messages[i].msg_len)){
+			gst_mmsg_src_read_byes (src, data, src->messages[i].msg_len, address, port);
+			continue;
+		}
+		if (src->messages[i].msg_len < 12 || (data[0] >> 6) != 2){
+			continue;
+		}
+
+		guint32 ssrc = GST_READ_UINT32_BE (data + 8);
+
+		MmsgSrcPeer* peer = (MmsgSrcPeer*) g_hash_table_lookup (src->peers, GUINT_TO_POINTER (ssrc));
+		if (!peer){
+			peer = g_slice_new (MmsgSrcPeer);
+			peer->kept = FALSE;
+			g_hash_table_insert (src->peers, GUINT_TO_POINTER (ssrc), peer);
+		} else if (peer->kept && (peer->address != address || peer->port != port)){
+			// A joined caller's SSRC sent from elsewhere takes nothing over.
+			continue;
+		}
+		peer->address = address;
+		peer->port    = port;
+		peer->seen    = now;
+	}
+
+	if (now >= src->peersSwept + MMSG_SRC_PEER_TIMEOUT){
+		g_hash_table_foreach_remove (src->peers, gst_mmsg_src_is_peer_quiet, &now);
+		src->peersSwept = now;
+	}
+}
+
+/*
+ * Waits until the socket is readable and takes everything the kernel has
+ * queued, up to one batch.
+ */
+static GstFlowReturn gst_mmsg_src_receive (GstMmsgSrc* src){
+	while (TRUE){
+		if (gst_poll_wait (src->poll, GST_CLOCK_TIME_NONE) < 0){
+			if (errno == EBUSY){
+				return GST_FLOW_WRONG_STATE;
+			}
+			if (errno != EINTR && errno != EAGAIN){
+				g_printerr ("Batched UDP source: poll failed: %s\n", g_strerror (errno));
+				return GST_FLOW_ERROR;
+			}
+			continue;
+		}
+
+		guint i;
+		for (i = 0; i < src->batchSize; i++){
+			src->messages[i].msg_hdr.msg_namelen = sizeof (struct sockaddr_in);
+		}
+
+		int result = recvmmsg (src->sockfd, src->messages, src->batchSize, MSG_DONTWAIT, NULL);
+		if (result > 0){
+			src->received = result;
+			src->next     = 0;
+
+			GST_OBJECT_LOCK (src);
+			src->packetsReceived += result;
+			src->receiveCalls++;
+			gst_mmsg_src_update_peers (src);
+			GST_OBJECT_UNLOCK (src);
+
+			for (i = 0; i < src->byes->len; i++){
+				g_signal_emit (src, gst_mmsg_src_signals[MMSG_SRC_SIGNAL_BYE_SSRC], 0, g_array_index (src->byes, guint32, i));
+			}
+			g_array_set_size (src->byes, 0);
+			return GST_FLOW_OK;
+		}
+
+		if (result < 0 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR){
+			g_printerr ("Batched UDP source: receive failed: %s\n", g_strerror (errno));
+			return GST_FLOW_ERROR;
+		}
+	}
+}
+
+static GstFlowReturn gst_mmsg_src_create (GstPushSrc* base, GstBuffer** buffer){
+	GstMmsgSrc* src = GST_MMSG_SRC (base);
+
+	guint slot, size;
+	do {
+		if (src->next >= src->received){
+			GstFlowReturn result = gst_mmsg_src_receive (src);
+			if (result != GST_FLOW_OK){
+				return result;
+			}
+		}
+
+		slot = src->next++;
+		size = src->messages[slot].msg_len;
+	} while (gst_mmsg_src_is_rtcp ((const guint8*) src->iovecs[slot].iov_base, size));
+
+	// Phone packets are far smaller than a slot, so they are copied out
+	// and the slot is reused right away.
+	GstNetBuffer* netBuffer = gst_netbuffer_new ();
+	guint8* data = g_malloc (size);
+	memcpy (data, src->iovecs[slot].iov_base, size);
+
+	GST_BUFFER_DATA (netBuffer)       = data;
+	GST_BUFFER_MALLOCDATA (netBuffer) = data;
+	GST_BUFFER_SIZE (netBuffer)       = size;
+
+	gst_netaddress_set_ip4_address (&netBuffer->from,
+		src->addresses[slot].sin_addr.s_addr, src->addresses[slot].sin_port);
+
+	if (src->caps){
+		gst_buffer_set_caps (GST_BUFFER (netBuffer), src->caps);
+	}
+
+	*buffer = GST_BUFFER (netBuffer);
+	return GST_FLOW_OK;
+}
+
+/*
+ * Looks up the latest sender address of an SSRC, in host order.
+ */
+gboolean gst_mmsg_src_get_peer (GstElement* element, guint32 ssrc, guint32* address, guint16* port){
+	GstMmsgSrc* src = GST_MMSG_SRC (element);
+
+	GST_OBJECT_LOCK (src);
+	MmsgSrcPeer* peer = (MmsgSrcPeer*) g_hash_table_lookup (src->peers, GUINT_TO_POINTER (ssrc));
+	if (peer){
+		*address = peer->address;
+		*port    = peer->port;
+	}
+	GST_OBJECT_UNLOCK (src);
+
+	return peer != 0;
+}
+
+/*
+ * Fills ssrcs with up to max SSRCs not heard from for idle or longer, and
+ * returns how many it found.
+ */
+guint gst_mmsg_src_get_idle_peers (GstElement* element, GstClockTime idle, guint32* ssrcs, guint max){
+	GstMmsgSrc* src = GST_MMSG_SRC (element);
+	GstClockTime now = gst_util_get_timestamp ();
+	guint count = 0;
+
+	GST_OBJECT_LOCK (src);
+	GHashTableIter iter;
+	gpointer key, value;
+	g_hash_table_iter_init (&iter, src->peers);
+	while (count < max && g_hash_table_iter_next (&iter, &key, &value)){
+		if (((MmsgSrcPeer*) value)->seen + idle <= now){
+			ssrcs[count++] = GPOINTER_TO_UINT (key);
+		}
+	}
+	GST_OBJECT_UNLOCK (src);
+
+	return count;
+}
+
+/*
+ * Exempts a joined SSRC from the sweep until it is forgotten, so a caller
+ * who stays silent or on hold keeps its sender address.
+ */
+void gst_mmsg_src_keep_peer (GstElement* element, guint32 ssrc){
+	GstMmsgSrc* src = GST_MMSG_SRC (element);
+
+	GST_OBJECT_LOCK (src);
+	MmsgSrcPeer* peer = (MmsgSrcPeer*) g_hash_table_lookup (src->peers, GUINT_TO_POINTER (ssrc));
+	if (peer){
+		peer->kept = TRUE;
+	}
+	GST_OBJECT_UNLOCK (src);
+}
+
+// Drops a departed SSRC, so the table does not grow with every call made.
+void gst_mmsg_src_forget_peer (GstElement* element, guint32 ssrc){
+	GstMmsgSrc* src = GST_MMSG_SRC (element);
+
+	GST_OBJECT_LOCK (src);
+	g_hash_table_remove (src->peers, GUINT_TO_POINTER (ssrc));
+	GST_OBJECT_UNLOCK (src);
+}
+
+void gst_mmsg_src_register (){
+	gst_element_register (NULL, "mmsgsrc", GST_RANK_NONE, GST_TYPE_MMSG_SRC);
+}
+
+#endif
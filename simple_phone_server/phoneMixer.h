@@ -0,0 +1,990 @@
+#ifndef PHONE_MIXER_H
+#define PHONE_MIXER_H
+
+#include <gst/gst.h>
+#include <string.h>
+#include <time.h>
+
+#include "mixKernels.h"
+
+/*
+ * "phonemixer" - a clocked mixer for 8 kHz mono S16 phone legs.
+ *
+ * Every 20 ms, "deadline" after the end of the frame, the mixing task takes
+ * one frame from each leg's ring and sums the legs whose energy is above
+ * "silence-threshold" in a single SIMD pass (see mixKernels.h). A leg which
+ * has not delivered its frame by the deadline counts as silent for that
+ * frame. That is expected from a silent leg whose sender stopped sending
+ * between talkspurts (see dtxGate.h), so only frames a talking leg misses
+ * are counted ("frames-missing"); a leg which has fallen more than
+ * PHONE_MIXER_MAX_LAG_FRAMES behind has its oldest frames dropped
+ * ("frames-late"). The sum is pushed on the always "src" pad. Output buffers
+ * are carved from a preallocated pool and return to it when released.
+ * The CPU time of the mixing itself is kept in "mix-time". "load" is the
+ * share of the frame time, in per mille, the task needs for a whole frame,
+ * pushing downstream included, smoothed over PHONE_MIXER_LOAD_SMOOTHING
+ * frames: above 1000 the task falls behind the clock.
+ *
+ * Legs are fed from their own streaming threads, so a leg's frames travel
+ * through a single-producer single-consumer ring: the leg's thread cuts its
+ * buffers into frames and publishes them by moving the ring's head, the
+ * mixing task takes them by moving its tail. Neither takes a lock, so no
+ * leg waits for the mix or for another leg.
+ *
+ * With "mix-minus" enabled every requested "sink%d" pad gets a companion
+ * "minus%d" source pad. While a leg is talking, its minus pad carries the
+ * sum with the leg's own frame subtracted. A silent leg is not part of the
+ * sum, so the plain mix already is its mix-minus and its minus pad stays
+ * idle. The "leg-activity" signal tells the application when a leg switches
+ * between the two, so the leg can be fed from the shared mix encoder while
+ * silent and only needs its own encoder while talking. It is emitted from
+ * the mixing task before the frame it applies to is pushed anywhere, so a
+ * stateful encoder can take over the shared one's state at that point
+ * (see gst_g726_enc_copy_state()).
+ *
+ * With "max-speakers" set, at most that many legs are mixed: the active
+ * speakers. Every leg's frame energy is still measured, which is cheap, but
+ * only the speakers' frames are summed and only speakers get a mix-minus,
+ * so a frame costs the same with ten callers or with hundreds, and the
+ * background noise of the others stays out of the mix. A talking leg takes
+ * a free speaker slot at once. When all are taken, it replaces the quietest
+ * speaker only once that one has held its slot for
+ * PHONE_MIXER_SPEAKER_HOLD_FRAMES and the newcomer's smoothed level is
+ * PHONE_MIXER_SPEAKER_MARGIN times higher, so speakers do not flap on every
+ * syllable. A speaker silent for the hold time gives its slot up. A speaker
+ * counts as talking (see "leg-activity") while its frames are mixed.
+ * Setting "max-speakers" while mixing lets the legs talking at that moment
+ * keep their slots, beyond the new number if need be, until they fall
+ * silent.
+ */
+
+#define PHONE_MIXER_RATE          8000
+#define PHONE_MIXER_FRAME_SAMPLES 160
+#define PHONE_MIXER_FRAME_BYTES   (PHONE_MIXER_FRAME_SAMPLES * 2)
+#define PHONE_MIXER_FRAME_DURATION (20 * GST_MSECOND)
+#define PHONE_MIXER_MAX_QUEUED_FRAMES 5
+#define PHONE_MIXER_RING_FRAMES       8
+#define PHONE_MIXER_MAX_LAG_FRAMES    2
+#define PHONE_MIXER_POOL_SIZE         64
+
+#define PHONE_MIXER_DEFAULT_SILENCE_THRESHOLD 100
+#define PHONE_MIXER_DEFAULT_DEADLINE (5 * GST_MSECOND)
+
+#define PHONE_MIXER_SPEAKER_HOLD_FRAMES 15
+#define PHONE_MIXER_SPEAKER_MARGIN      2
+
+#define PHONE_MIXER_LOAD_SMOOTHING 8
+
+#define PHONE_MIXER_CAPS \
+	"audio/x-raw-int, "              \
+	"endianness = (int) BYTE_ORDER, " \
+	"signed = (boolean) true, "       \
+	"width = (int) 16, "              \
+	"depth = (int) 16, "              \
+	"rate = (int) 8000, "             \
+	"channels = (int) 1"
+
+#define GST_TYPE_PHONE_MIXER (gst_phone_mixer_get_type())
+#define GST_PHONE_MIXER(obj) (G_TYPE_CHECK_INSTANCE_CAST((obj), GST_TYPE_PHONE_MIXER, GstPhoneMixer))
+
+typedef struct _GstPhoneMixer      GstPhoneMixer;
+typedef struct _GstPhoneMixerClass GstPhoneMixerClass;
+
+/*
+ * Output frames are handed out from a free list of preallocated blocks.
+ * Only the mixing task takes blocks and any thread may give them back, so a
+ * plain compare-and-swap stack is safe here. Every outstanding block holds a
+ * reference on the pool, which therefore outlives the mixer if downstream
+ * still holds buffers.
+ */
+typedef struct _PhoneMixerBlock PhoneMixerBlock;
+
+typedef struct {
+	volatile gint refcount;
+	PhoneMixerBlock* volatile freeList;
+	GSList* blocks;
+} PhoneMixerPool;
+
+struct _PhoneMixerBlock {
+	PhoneMixerPool* pool;
+	PhoneMixerBlock* next;
+	gint16 data[PHONE_MIXER_FRAME_SAMPLES];
+};
+
+/*
+ * The ring's head and tail count frames and only ever grow; a frame lives in
+ * slot (count % PHONE_MIXER_RING_FRAMES). The leg's streaming thread owns the
+ * head and fills the slot at the head, which the mixing task never reads,
+ * before publishing it. The mixing task owns the tail. Since at most
+ * PHONE_MIXER_MAX_QUEUED_FRAMES are queued, the slot being filled is never
+ * one being taken.
+ */
+typedef struct {
+	GstPad* sinkpad;
+	GstPad* minuspad;
+
+	gint16 ring[PHONE_MIXER_RING_FRAMES][PHONE_MIXER_FRAME_SAMPLES];
+	volatile gint head;
+	volatile gint tail;
+	volatile gint flushed;
+	guint filled;
+
+	gboolean talking;
+	gboolean minusSegmentSent;
+
+	// Active speaker selection, see "max-speakers".
+	gboolean voiced;
+	gboolean speaker;
+	guint64 level;
+	guint quietFrames;
+	guint speakerFrames;
+	gint16 frame[PHONE_MIXER_FRAME_SAMPLES];
+} GstPhoneMixerLeg;
+
+struct _GstPhoneMixer {
+	GstElement element;
+
+	GstPad* srcpad;
+	GstCaps* caps;
+
+	// Guarded by the object lock.
+	GSList* legs;
+	gint padCount;
+	GstClockID clockId;
+	gboolean flushing;
+	gboolean playing;
+
+	// Only touched by the mixing task.
+	GstClockTime nextRunningTime;
+	guint64 offset;
+	gboolean segmentSent;
+	gint32 sum[PHONE_MIXER_FRAME_SAMPLES];
+	const gint16** activeFrames;
+	guint activeFramesSize;
+	PhoneMixerPool* pool;
+
+	gboolean mixMinus;
+	guint silenceThreshold;
+	guint maxSpeakers;
+	GstClockTime deadline;
+
+	guint64 framesMissing;
+	guint64 framesLate;
+	guint64 mixTime;
+	guint64 speakerChanges;
+
+	// Written by the mixing task only.
+	volatile gint load;
+};
+
+struct _GstPhoneMixerClass {
+	GstElementClass parent_class;
+};
+
+// A buffer to push and/or an activity change to signal, collected under the
+// object lock and delivered after it has been released.
+typedef struct {
+	GstPad* pad;
+	GstBuffer* buffer;
+	gboolean newSegment;
+	gint activity;
+} GstPhoneMixerOutput;
+
+enum {
+	PHONE_MIXER_SIGNAL_LEG_ACTIVITY,
+	PHONE_MIXER_LAST_SIGNAL
+};
+
+enum {
+	PHONE_MIXER_PROP_0,
+	PHONE_MIXER_PROP_MIX_MINUS,
+	PHONE_MIXER_PROP_SILENCE_THRESHOLD,
+	PHONE_MIXER_PROP_DEADLINE,
+	PHONE_MIXER_PROP_MAX_SPEAKERS,
+	PHONE_MIXER_PROP_FRAMES_MISSING,
+	PHONE_MIXER_PROP_FRAMES_LATE,
+	PHONE_MIXER_PROP_MIX_TIME,
+	PHONE_MIXER_PROP_SPEAKER_CHANGES,
+	PHONE_MIXER_PROP_LOAD
+};
+
+static guint gst_phone_mixer_signals[PHONE_MIXER_LAST_SIGNAL] = { 0 };
+
+static GstStaticPadTemplate gst_phone_mixer_src_template = GST_STATIC_PAD_TEMPLATE ("src",
+	GST_PAD_SRC, GST_PAD_ALWAYS, GST_STATIC_CAPS (PHONE_MIXER_CAPS));
+
+static GstStaticPadTemplate gst_phone_mixer_minus_template = GST_STATIC_PAD_TEMPLATE ("minus%d",
+	GST_PAD_SRC, GST_PAD_SOMETIMES, GST_STATIC_CAPS (PHONE_MIXER_CAPS));
+
+static GstStaticPadTemplate gst_phone_mixer_sink_template = GST_STATIC_PAD_TEMPLATE ("sink%d",
+	GST_PAD_SINK, GST_PAD_REQUEST, GST_STATIC_CAPS (PHONE_MIXER_CAPS));
+
+GST_BOILERPLATE (GstPhoneMixer, gst_phone_mixer, GstElement, GST_TYPE_ELEMENT);
+
+static void gst_phone_mixer_set_property (GObject* object, guint id, const GValue* value, GParamSpec* pspec);
+static void gst_phone_mixer_get_property (GObject* object, guint id, GValue* value, GParamSpec* pspec);
+static void gst_phone_mixer_finalize (GObject* object);
+static GstPad* gst_phone_mixer_request_new_pad (GstElement* element, GstPadTemplate* templ, const gchar* name);
+static void gst_phone_mixer_release_pad (GstElement* element, GstPad* pad);
+static GstStateChangeReturn gst_phone_mixer_change_state (GstElement* element, GstStateChange transition);
+static gboolean gst_phone_mixer_src_activate_push (GstPad* pad, gboolean active);
+static GstFlowReturn gst_phone_mixer_chain (GstPad* pad, GstBuffer* buffer);
+static gboolean gst_phone_mixer_sink_event (GstPad* pad, GstEvent* event);
+static void gst_phone_mixer_loop (GstPad* srcpad);
+static void gst_phone_mixer_update_load (GstPhoneMixer* mixer, GstClockTime elapsed);
+static gboolean gst_phone_mixer_wait (GstPhoneMixer* mixer);
+static void gst_phone_mixer_set_max_speakers (GstPhoneMixer* mixer, guint maxSpeakers);
+static void gst_phone_mixer_select_speakers (GstPhoneMixer* mixer);
+static GSList* gst_phone_mixer_mix_frame (GstPhoneMixer* mixer);
+static void gst_phone_mixer_deliver (GstPhoneMixer* mixer, GSList* outputs);
+
+static void phone_mixer_pool_push (PhoneMixerPool* pool, PhoneMixerBlock* block){
+	PhoneMixerBlock* head;
+
+	do {
+		head = (PhoneMixerBlock*) g_atomic_pointer_get (&pool->freeList);
+		block->next = head;
+	} while (!g_atomic_pointer_compare_and_exchange ((gpointer*) &pool->freeList, head, block));
+}
+
+// The block list is only touched by the mixing task and the final unref.
+static void phone_mixer_pool_add_block (PhoneMixerPool* pool){
+	PhoneMixerBlock* block = g_slice_new0 (PhoneMixerBlock);
+	block->pool = pool;
+	pool->blocks = g_slist_prepend (pool->blocks, block);
+	phone_mixer_pool_push(pool, block);
+}
+
+static PhoneMixerPool* phone_mixer_pool_new (guint size){
+	PhoneMixerPool* pool = g_slice_new0 (PhoneMixerPool);
+	pool->refcount = 1;
+
+	guint i;
+	for (i = 0; i < size; i++){
+		phone_mixer_pool_add_block(pool);
+	}
+	return pool;
+}
+
+static void phone_mixer_pool_unref (PhoneMixerPool* pool){
+	if (!g_atomic_int_dec_and_test (&pool->refcount)){
+		return;
+	}
+
+	GSList* walk;
+	for (walk = pool->blocks; walk; walk = walk->next){
+		g_slice_free (PhoneMixerBlock, walk->data);
+	}
+	g_slist_free (pool->blocks);
+	g_slice_free (PhoneMixerPool, pool);
+}
+
+static void phone_mixer_pool_release (gpointer data){
+	PhoneMixerBlock* block = (PhoneMixerBlock*) ((guint8*) data - G_STRUCT_OFFSET (PhoneMixerBlock, data));
+	PhoneMixerPool* pool = block->pool;
+
+	phone_mixer_pool_push(pool, block);
+	phone_mixer_pool_unref(pool);
+}
+
+// Mixing task only. The pool grows when downstream holds on to more
+// buffers than were preallocated.
+static GstBuffer* phone_mixer_pool_acquire (PhoneMixerPool* pool){
+	PhoneMixerBlock* block;
+
+	do {
+		block = (PhoneMixerBlock*) g_atomic_pointer_get (&pool->freeList);
+		if (!block){
+			phone_mixer_pool_add_block(pool);
+			continue;
+		}
+	} while (!block || !g_atomic_pointer_compare_and_exchange ((gpointer*) &pool->freeList, block, block->next));
+
+	g_atomic_int_inc (&pool->refcount);
+
+	GstBuffer* buffer = gst_buffer_new ();
+	GST_BUFFER_DATA (buffer)       = (guint8*) block->data;
+	GST_BUFFER_MALLOCDATA (buffer) = (guint8*) block->data;
+	GST_BUFFER_FREE_FUNC (buffer)  = phone_mixer_pool_release;
+	GST_BUFFER_SIZE (buffer)       = PHONE_MIXER_FRAME_BYTES;
+	return buffer;
+}
+
+static void gst_phone_mixer_base_init (gpointer g_class){
+	GstElementClass* element_class = GST_ELEMENT_CLASS (g_class);
+
+	gst_element_class_add_pad_template (element_class, gst_static_pad_template_get (&gst_phone_mixer_src_template));
+	gst_element_class_add_pad_template (element_class, gst_static_pad_template_get (&gst_phone_mixer_minus_template));
+	gst_element_class_add_pad_template (element_class, gst_static_pad_template_get (&gst_phone_mixer_sink_template));
+
+	gst_element_class_set_details_simple (element_class,
+		"Phone mixer", "Filter/Audio",
+		"Clocked 8 kHz phone leg mixer with optional mix-minus outputs",
+		"GStreamer Audio Echo");
+}
+
+static void gst_phone_mixer_class_init (GstPhoneMixerClass* klass){
+	GObjectClass*    gobject_class = G_OBJECT_CLASS (klass);
+	GstElementClass* element_class = GST_ELEMENT_CLASS (klass);
+
+	gobject_class->set_property = gst_phone_mixer_set_property;
+	gobject_class->get_property = gst_phone_mixer_get_property;
+	gobject_class->finalize     = gst_phone_mixer_finalize;
+
+	g_object_class_install_property (gobject_class, PHONE_MIXER_PROP_MIX_MINUS,
+		g_param_spec_boolean ("mix-minus", "Mix-minus",
+			"Add a minus%d source pad for every sink pad", FALSE, G_PARAM_READWRITE));
+
+	g_object_class_install_property (gobject_class, PHONE_MIXER_PROP_SILENCE_THRESHOLD,
+		g_param_spec_uint ("silence-threshold", "Silence threshold",
+			"RMS level below which a leg is left out of the mix", 0, G_MAXINT16,
+			PHONE_MIXER_DEFAULT_SILENCE_THRESHOLD, G_PARAM_READWRITE));
+
+	g_object_class_install_property (gobject_class, PHONE_MIXER_PROP_DEADLINE,
+		g_param_spec_uint64 ("deadline", "Deadline",
+			"How long after the end of a frame late legs are waited for (ns)", 0, G_MAXUINT64,
+			PHONE_MIXER_DEFAULT_DEADLINE, G_PARAM_READWRITE));
+
+	g_object_class_install_property (gobject_class, PHONE_MIXER_PROP_MAX_SPEAKERS,
+		g_param_spec_uint ("max-speakers", "Max speakers",
+			"How many of the loudest legs are mixed, 0 for all", 0, G_MAXINT,
+			0, G_PARAM_READWRITE));
+
+	g_object_class_install_property (gobject_class, PHONE_MIXER_PROP_FRAMES_MISSING,
+		g_param_spec_uint64 ("frames-missing", "Frames missing",
+			"Frames of talking legs not received by their deadline and mixed as silence", 0, G_MAXUINT64,
+			0, G_PARAM_READABLE));
+
+	g_object_class_install_property (gobject_class, PHONE_MIXER_PROP_FRAMES_LATE,
+		g_param_spec_uint64 ("frames-late", "Frames late",
+			"Leg frames dropped because they arrived too far behind the mix", 0, G_MAXUINT64,
+			0, G_PARAM_READABLE));
+
+	g_object_class_install_property (gobject_class, PHONE_MIXER_PROP_MIX_TIME,
+		g_param_spec_uint64 ("mix-time", "Mix time",
+			"CPU time spent mixing, without pushing downstream (ns)", 0, G_MAXUINT64,
+			0, G_PARAM_READABLE));
+
+	g_object_class_install_property (gobject_class, PHONE_MIXER_PROP_SPEAKER_CHANGES,
+		g_param_spec_uint64 ("speaker-changes", "Speaker changes",
+			"Legs that took a speaker slot with max-speakers set", 0, G_MAXUINT64,
+			0, G_PARAM_READABLE));
+
+	g_object_class_install_property (gobject_class, PHONE_MIXER_PROP_LOAD,
+		g_param_spec_uint ("load", "Load",
+			"Smoothed CPU time a frame takes, in per mille of the frame's duration", 0, G_MAXINT,
+			0, G_PARAM_READABLE));
+
+	mixKernels_init();
+	g_print ("Phone mixer uses %s kernels.\n", mixKernels.name);
+
+	gst_phone_mixer_signals[PHONE_MIXER_SIGNAL_LEG_ACTIVITY] = g_signal_new ("leg-activity",
+		G_TYPE_FROM_CLASS (klass), G_SIGNAL_RUN_LAST, 0, NULL, NULL, NULL,
+		G_TYPE_NONE, 2, GST_TYPE_PAD, G_TYPE_BOOLEAN);
+
+	element_class->request_new_pad = GST_DEBUG_FUNCPTR (gst_phone_mixer_request_new_pad);
+	element_class->release_pad     = GST_DEBUG_FUNCPTR (gst_phone_mixer_release_pad);
+	element_class->change_state    = GST_DEBUG_FUNCPTR (gst_phone_mixer_change_state);
+}
+
+static void gst_phone_mixer_init (GstPhoneMixer* mixer, GstPhoneMixerClass* klass){
+	mixer->caps = gst_caps_from_string (PHONE_MIXER_CAPS);
+
+	mixer->srcpad = gst_pad_new_from_static_template (&gst_phone_mixer_src_template, "src");
+	gst_pad_use_fixed_caps (mixer->srcpad);
+	gst_pad_set_caps (mixer->srcpad, mixer->caps);
+	gst_pad_set_activatepush_function (mixer->srcpad, GST_DEBUG_FUNCPTR (gst_phone_mixer_src_activate_push));
+	gst_element_add_pad (GST_ELEMENT (mixer), mixer->srcpad);
+
+	mixer->legs     = 0;
+	mixer->padCount = 0;
+	mixer->clockId  = 0;
+	mixer->flushing = TRUE;
+	mixer->playing  = FALSE;
+
+	mixer->activeFrames     = 0;
+	mixer->activeFramesSize = 0;
+	mixer->pool = phone_mixer_pool_new (PHONE_MIXER_POOL_SIZE);
+
+	mixer->mixMinus = FALSE;
+	mixer->silenceThreshold = PHONE_MIXER_DEFAULT_SILENCE_THRESHOLD;
+	mixer->deadline = PHONE_MIXER_DEFAULT_DEADLINE;
+	mixer->maxSpeakers = 0;
+
+	mixer->framesMissing = 0;
+	mixer->framesLate    = 0;
+	mixer->mixTime       = 0;
+	mixer->speakerChanges = 0;
+	mixer->load = 0;
+}
+
+static void gst_phone_mixer_set_property (GObject* object, guint id, const GValue* value, GParamSpec* pspec){
+	GstPhoneMixer* mixer = GST_PHONE_MIXER (object);
+
+	switch (id) {
+		case PHONE_MIXER_PROP_MIX_MINUS:
+			mixer->mixMinus = g_value_get_boolean (value);
+			break;
+		case PHONE_MIXER_PROP_SILENCE_THRESHOLD:
+			mixer->silenceThreshold = g_value_get_uint (value);
+			break;
+		case PHONE_MIXER_PROP_DEADLINE:
+			mixer->deadline = g_value_get_uint64 (value);
+			break;
+		case PHONE_MIXER_PROP_MAX_SPEAKERS:
+			GST_OBJECT_LOCK (mixer);
+			gst_phone_mixer_set_max_speakers (mixer, g_value_get_uint (value));
+			GST_OBJECT_UNLOCK (mixer);
+			break;
+		default:
+			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, id, pspec);
+			break;
+	}
+}
+
+static void gst_phone_mixer_get_property (GObject* object, guint id, GValue* value, GParamSpec* pspec){
+	GstPhoneMixer* mixer = GST_PHONE_MIXER (object);
+
+	switch (id) {
+		case PHONE_MIXER_PROP_MIX_MINUS:
+			g_value_set_boolean (value, mixer->mixMinus);
+			break;
+		case PHONE_MIXER_PROP_SILENCE_THRESHOLD:
+			g_value_set_uint (value, mixer->silenceThreshold);
+			break;
+		case PHONE_MIXER_PROP_DEADLINE:
+			g_value_set_uint64 (value, mixer->deadline);
+			break;
+		case PHONE_MIXER_PROP_MAX_SPEAKERS:
+			g_value_set_uint (value, mixer->maxSpeakers);
+			break;
+		case PHONE_MIXER_PROP_FRAMES_MISSING:
+			GST_OBJECT_LOCK (mixer);
+			g_value_set_uint64 (value, mixer->framesMissing);
+			GST_OBJECT_UNLOCK (mixer);
+			break;
+		case PHONE_MIXER_PROP_FRAMES_LATE:
+			GST_OBJECT_LOCK (mixer);
+			g_value_set_uint64 (value, mixer->framesLate);
+			GST_OBJECT_UNLOCK (mixer);
+			break;
+		case PHONE_MIXER_PROP_MIX_TIME:
+			GST_OBJECT_LOCK (mixer);
+			g_value_set_uint64 (value, mixer->mixTime);
+			GST_OBJECT_UNLOCK (mixer);
+			break;
+		case PHONE_MIXER_PROP_SPEAKER_CHANGES:
+			GST_OBJECT_LOCK (mixer);
+			g_value_set_uint64 (value, mixer->speakerChanges);
+			GST_OBJECT_UNLOCK (mixer);
+			break;
+		case PHONE_MIXER_PROP_LOAD:
+			g_value_set_uint (value, g_atomic_int_get (&mixer->load));
+			break;
+		default:
+			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, id, pspec);
+			break;
+	}
+}
+
+static void gst_phone_mixer_free_leg (GstPhoneMixerLeg* leg){
+	g_slice_free (GstPhoneMixerLeg, leg);
+}
+
+static void gst_phone_mixer_finalize (GObject* object){
+	GstPhoneMixer* mixer = GST_PHONE_MIXER (object);
+
+	g_slist_foreach (mixer->legs, (GFunc) gst_phone_mixer_free_leg, NULL);
+	g_slist_free (mixer->legs);
+	g_free (mixer->activeFrames);
+	phone_mixer_pool_unref (mixer->pool);
+	gst_caps_unref (mixer->caps);
+
+	G_OBJECT_CLASS (parent_class)->finalize (object);
+}
+
+static GstPad* gst_phone_mixer_request_new_pad (GstElement* element, GstPadTemplate* templ, const gchar* unused){
+	GstPhoneMixer* mixer = GST_PHONE_MIXER (element);
+
+	GST_OBJECT_LOCK (mixer);
+	gint index = mixer->padCount++;
+	GST_OBJECT_UNLOCK (mixer);
+
+	GstPhoneMixerLeg* leg = g_slice_new0 (GstPhoneMixerLeg);
+
+	gchar* name = g_strdup_printf ("sink%d", index);
+	leg->sinkpad = gst_pad_new_from_template (templ, name);
+	g_free (name);
+
+	gst_pad_set_chain_function (leg->sinkpad, GST_DEBUG_FUNCPTR (gst_phone_mixer_chain));
+	gst_pad_set_event_function (leg->sinkpad, GST_DEBUG_FUNCPTR (gst_phone_mixer_sink_event));
+	gst_pad_set_element_private (leg->sinkpad, leg);
+
+	if (mixer->mixMinus){
+		name = g_strdup_printf ("minus%d", index);
+		leg->minuspad = gst_pad_new_from_static_template (&gst_phone_mixer_minus_template, name);
+		g_free (name);
+
+		gst_pad_use_fixed_caps (leg->minuspad);
+		gst_pad_set_caps (leg->minuspad, mixer->caps);
+		gst_pad_set_active (leg->minuspad, TRUE);
+		gst_element_add_pad (element, leg->minuspad);
+	}
+
+	gst_pad_set_active (leg->sinkpad, TRUE);
+	gst_element_add_pad (element, leg->sinkpad);
+
+	GST_OBJECT_LOCK (mixer);
+	mixer->legs = g_slist_prepend (mixer->legs, leg);
+	GST_OBJECT_UNLOCK (mixer);
+
+	return leg->sinkpad;
+}
+
+static void gst_phone_mixer_release_pad (GstElement* element, GstPad* pad){
+	GstPhoneMixer* mixer = GST_PHONE_MIXER (element);
+	GstPhoneMixerLeg* leg = (GstPhoneMixerLeg*) gst_pad_get_element_private (pad);
+
+	GST_OBJECT_LOCK (mixer);
+	mixer->legs = g_slist_remove (mixer->legs, leg);
+	GST_OBJECT_UNLOCK (mixer);
+
+	if (leg->minuspad){
+		gst_pad_set_active (leg->minuspad, FALSE);
+		gst_element_remove_pad (element, leg->minuspad);
+	}
+
+	gst_pad_set_active (leg->sinkpad, FALSE);
+	gst_element_remove_pad (element, leg->sinkpad);
+
+	gst_phone_mixer_free_leg (leg);
+}
+
+/*
+ * Returns the minus%d pad belonging to a sink%d pad (with a reference), or
+ * NULL when the mixer runs without mix-minus.
+ */
+GstPad* gst_phone_mixer_get_minus_pad (GstElement* element, GstPad* sinkpad){
+	GstPhoneMixerLeg* leg = (GstPhoneMixerLeg*) gst_pad_get_element_private (sinkpad);
+	return leg->minuspad ? gst_object_ref (leg->minuspad) : NULL;
+}
+
+static GstStateChangeReturn gst_phone_mixer_change_state (GstElement* element, GstStateChange transition){
+	GstPhoneMixer* mixer = GST_PHONE_MIXER (element);
+
+	switch (transition) {
+		case GST_STATE_CHANGE_PAUSED_TO_PLAYING:
+			GST_OBJECT_LOCK (mixer);
+			mixer->playing = TRUE;
+			mixer->nextRunningTime = GST_CLOCK_TIME_NONE;
+			GST_OBJECT_UNLOCK (mixer);
+			break;
+		case GST_STATE_CHANGE_PLAYING_TO_PAUSED:
+			GST_OBJECT_LOCK (mixer);
+			mixer->playing = FALSE;
+			if (mixer->clockId){
+				gst_clock_id_unschedule (mixer->clockId);
+			}
+			GST_OBJECT_UNLOCK (mixer);
+			break;
+		default:
+			break;
+	}
+
+	GstStateChangeReturn result = GST_ELEMENT_CLASS (parent_class)->change_state (element, transition);
+
+	// Like any live source, the mixer has nothing to preroll with.
+	if (transition == GST_STATE_CHANGE_READY_TO_PAUSED && result == GST_STATE_CHANGE_SUCCESS){
+		result = GST_STATE_CHANGE_NO_PREROLL;
+	}
+
+	return result;
+}
+
+static gboolean gst_phone_mixer_src_activate_push (GstPad* pad, gboolean active){
+	GstPhoneMixer* mixer = GST_PHONE_MIXER (GST_PAD_PARENT (pad));
+
+	if (active){
+		GST_OBJECT_LOCK (mixer);
+		mixer->flushing = FALSE;
+		mixer->segmentSent = FALSE;
+		mixer->offset = 0;
+		GST_OBJECT_UNLOCK (mixer);
+		return gst_pad_start_task (pad, (GstTaskFunction) gst_phone_mixer_loop, pad);
+	}
+
+	GST_OBJECT_LOCK (mixer);
+	mixer->flushing = TRUE;
+	if (mixer->clockId){
+		gst_clock_id_unschedule (mixer->clockId);
+	}
+	GST_OBJECT_UNLOCK (mixer);
+
+	return gst_pad_stop_task (pad);
+}
+
+/*
+ * Runs in the leg's streaming thread and copies the buffer into the ring's
+ * head slot. Every completed frame is published, unless the leg has run
+ * PHONE_MIXER_MAX_QUEUED_FRAMES ahead of the mixing clock: it would only add
+ * latency, so the frame is dropped and its slot filled again.
+ */
+static GstFlowReturn gst_phone_mixer_chain (GstPad* pad, GstBuffer* buffer){
+	GstPhoneMixerLeg* leg = (GstPhoneMixerLeg*) gst_pad_get_element_private (pad);
+
+	const guint8* data = GST_BUFFER_DATA (buffer);
+	guint size = GST_BUFFER_SIZE (buffer);
+	guint head = (guint) leg->head;
+
+	while (size){
+		guint8* slot = (guint8*) leg->ring[head % PHONE_MIXER_RING_FRAMES];
+		guint chunk = MIN (size, PHONE_MIXER_FRAME_BYTES - leg->filled);
+
+		memcpy (slot + leg->filled, data, chunk);
+		leg->filled += chunk;
+		data += chunk;
+		size -= chunk;
+
+		if (leg->filled < PHONE_MIXER_FRAME_BYTES){
+			break;
+		}
+		leg->filled = 0;
+
+		if (head - (guint) g_atomic_int_get (&leg->tail) < PHONE_MIXER_MAX_QUEUED_FRAMES){
+			g_atomic_int_set (&leg->head, ++head);
+		}
+	}
+
+	gst_buffer_unref (buffer);
+	return GST_FLOW_OK;
+}
+
+/*
+ * A leg's events must not reach the mixed outputs: an EOS or a flush on one
+ * leg says nothing about the others.
+ */
+static gboolean gst_phone_mixer_sink_event (GstPad* pad, GstEvent* event){
+	GstPhoneMixerLeg* leg = (GstPhoneMixerLeg*) gst_pad_get_element_private (pad);
+
+	// The queued frames belong to the mixing task, which is asked to drop
+	// them; only the partly filled frame is the leg's own.
+	if (GST_EVENT_TYPE (event) == GST_EVENT_FLUSH_STOP){
+		leg->filled = 0;
+		g_atomic_int_set (&leg->flushed, TRUE);
+	}
+
+	gst_event_unref (event);
+	return TRUE;
+}
+
+static void gst_phone_mixer_loop (GstPad* srcpad){
+	GstPhoneMixer* mixer = GST_PHONE_MIXER (GST_PAD_PARENT (srcpad));
+
+	if (!gst_phone_mixer_wait (mixer)){
+		return;
+	}
+
+	struct timespec start, end;
+	clock_gettime (CLOCK_THREAD_CPUTIME_ID, &start);
+
+	GST_OBJECT_LOCK (mixer);
+	GSList* outputs = gst_phone_mixer_mix_frame (mixer);
+	clock_gettime (CLOCK_THREAD_CPUTIME_ID, &end);
+	mixer->mixTime += (end.tv_sec - start.tv_sec) * GST_SECOND + (end.tv_nsec - start.tv_nsec);
+	GST_OBJECT_UNLOCK (mixer);
+
+	gst_phone_mixer_deliver (mixer, outputs);
+
+	clock_gettime (CLOCK_THREAD_CPUTIME_ID, &end);
+	gst_phone_mixer_update_load (mixer, (end.tv_sec - start.tv_sec) * GST_SECOND + (end.tv_nsec - start.tv_nsec));
+
+	mixer->nextRunningTime += PHONE_MIXER_FRAME_DURATION;
+	mixer->offset += PHONE_MIXER_FRAME_SAMPLES;
+}
+
+// A moving average, so a single slow frame does not look like overload.
+static void gst_phone_mixer_update_load (GstPhoneMixer* mixer, GstClockTime elapsed){
+	gint sample = (gint) MIN (gst_util_uint64_scale (elapsed, 1000, PHONE_MIXER_FRAME_DURATION), G_MAXINT / 2);
+	gint load = mixer->load;
+	g_atomic_int_set (&mixer->load, load + (sample - load) / PHONE_MIXER_LOAD_SMOOTHING);
+}
+
+/*
+ * Sleeps on the pipeline clock until the current frame has been fully
+ * received. Returns FALSE when there is nothing to mix yet.
+ */
+static gboolean gst_phone_mixer_wait (GstPhoneMixer* mixer){
+	GST_OBJECT_LOCK (mixer);
+
+	GstClock* clock = GST_ELEMENT (mixer)->clock;
+
+	if (mixer->flushing){
+		GST_OBJECT_UNLOCK (mixer);
+		gst_pad_pause_task (mixer->srcpad);
+		return FALSE;
+	}
+
+	if (!mixer->playing || !clock){
+		GST_OBJECT_UNLOCK (mixer);
+		g_usleep (PHONE_MIXER_FRAME_DURATION / GST_USECOND);
+		return FALSE;
+	}
+
+	gst_object_ref (clock);
+	GstClockTime baseTime = GST_ELEMENT (mixer)->base_time;
+	GstClockTime now = gst_clock_get_time (clock) - baseTime;
+
+	// Start on the current time and resync after a stall instead of trying
+	// to catch up with a burst of stale frames.
+	if (!GST_CLOCK_TIME_IS_VALID (mixer->nextRunningTime)
+			|| now > mixer->nextRunningTime + mixer->deadline + PHONE_MIXER_MAX_QUEUED_FRAMES * PHONE_MIXER_FRAME_DURATION){
+		mixer->nextRunningTime = now;
+	}
+
+	mixer->clockId = gst_clock_new_single_shot_id (clock,
+		baseTime + mixer->nextRunningTime + PHONE_MIXER_FRAME_DURATION + mixer->deadline);
+	GST_OBJECT_UNLOCK (mixer);
+
+	GstClockReturn waited = gst_clock_id_wait (mixer->clockId, NULL);
+
+	GST_OBJECT_LOCK (mixer);
+	gst_clock_id_unref (mixer->clockId);
+	mixer->clockId = 0;
+	GST_OBJECT_UNLOCK (mixer);
+
+	gst_object_unref (clock);
+
+	return waited != GST_CLOCK_UNSCHEDULED;
+}
+
+static GstBuffer* gst_phone_mixer_new_buffer (GstPhoneMixer* mixer){
+	GstBuffer* buffer = phone_mixer_pool_acquire (mixer->pool);
+	GST_BUFFER_TIMESTAMP (buffer)  = mixer->nextRunningTime;
+	GST_BUFFER_DURATION (buffer)   = PHONE_MIXER_FRAME_DURATION;
+	GST_BUFFER_OFFSET (buffer)     = mixer->offset;
+	GST_BUFFER_OFFSET_END (buffer) = mixer->offset + PHONE_MIXER_FRAME_SAMPLES;
+	gst_buffer_set_caps (buffer, mixer->caps);
+	return buffer;
+}
+
+static GSList* gst_phone_mixer_add_output (GSList* outputs, GstPad* pad, GstBuffer* buffer, gint activity){
+	GstPhoneMixerOutput* output = g_slice_new (GstPhoneMixerOutput);
+	output->pad      = gst_object_ref (pad);
+	output->buffer   = buffer;
+	output->newSegment = FALSE;
+	output->activity = activity;
+	return g_slist_prepend (outputs, output);
+}
+
+/*
+ * Takes the leg's frame for this mix into leg->frame. Returns FALSE when it
+ * did not arrive in time. Frames queued too far behind are dropped, so a
+ * late leg cannot build up delay for itself.
+ */
+static gboolean gst_phone_mixer_take_frame (GstPhoneMixer* mixer, GstPhoneMixerLeg* leg){
+	guint head = (guint) g_atomic_int_get (&leg->head);
+	guint tail = (guint) leg->tail;
+
+	if (g_atomic_int_get (&leg->flushed)){
+		g_atomic_int_set (&leg->flushed, FALSE);
+		tail = head;
+	}
+
+	if (head == tail){
+		g_atomic_int_set (&leg->tail, tail);
+		if (leg->voiced){
+			mixer->framesMissing++;
+		}
+		return FALSE;
+	}
+
+	guint lag = head - tail - 1;
+	if (lag > PHONE_MIXER_MAX_LAG_FRAMES){
+		tail += lag - PHONE_MIXER_MAX_LAG_FRAMES;
+		mixer->framesLate += lag - PHONE_MIXER_MAX_LAG_FRAMES;
+	}
+
+	memcpy (leg->frame, leg->ring[tail % PHONE_MIXER_RING_FRAMES], PHONE_MIXER_FRAME_BYTES);
+	g_atomic_int_set (&leg->tail, tail + 1);
+	return TRUE;
+}
+
+/*
+ * Called with the object lock held. Without a cap nobody holds a slot, so
+ * when one is set the talking legs take theirs, however many they are.
+ */
+static void gst_phone_mixer_set_max_speakers (GstPhoneMixer* mixer, guint maxSpeakers){
+	GSList* walk;
+
+	if (!mixer->maxSpeakers){
+		for (walk = mixer->legs; walk; walk = walk->next){
+			GstPhoneMixerLeg* leg = (GstPhoneMixerLeg*) walk->data;
+			leg->speaker = leg->talking;
+			leg->speakerFrames = 0;
+		}
+	}
+	mixer->maxSpeakers = maxSpeakers;
+}
+
+/*
+ * Updates which legs hold the "max-speakers" slots, from the levels of the
+ * frame just taken. Each round either fills a free slot or hands a slot over
+ * to a leg which is then held, so it ends after at most max-speakers rounds.
+ */
+static void gst_phone_mixer_select_speakers (GstPhoneMixer* mixer){
+	GSList* walk;
+	guint speakers = 0;
+
+	for (walk = mixer->legs; walk; walk = walk->next){
+		GstPhoneMixerLeg* leg = (GstPhoneMixerLeg*) walk->data;
+
+		if (leg->speaker && leg->quietFrames >= PHONE_MIXER_SPEAKER_HOLD_FRAMES){
+			leg->speaker = FALSE;
+		}
+		speakers += leg->speaker;
+	}
+
+	for (;;){
+		GstPhoneMixerLeg* loudest = 0;
+		GstPhoneMixerLeg* quietest = 0;
+
+		for (walk = mixer->legs; walk; walk = walk->next){
+			GstPhoneMixerLeg* leg = (GstPhoneMixerLeg*) walk->data;
+
+			if (!leg->speaker){
+				if (leg->voiced && (!loudest || leg->level > loudest->level)){
+					loudest = leg;
+				}
+			} else if (leg->speakerFrames >= PHONE_MIXER_SPEAKER_HOLD_FRAMES
+					&& (!quietest || leg->level < quietest->level)){
+				quietest = leg;
+			}
+		}
+
+		if (!loudest){
+			return;
+		}
+
+		if (speakers < mixer->maxSpeakers){
+			speakers++;
+		} else if (quietest && loudest->level > quietest->level * PHONE_MIXER_SPEAKER_MARGIN){
+			quietest->speaker = FALSE;
+		} else {
+			return;
+		}
+
+		loudest->speaker = TRUE;
+		loudest->speakerFrames = 0;
+		mixer->speakerChanges++;
+	}
+}
+
+/*
+ * Called with the object lock held. Returns the buffers to push and the
+ * activity changes to signal.
+ */
+static GSList* gst_phone_mixer_mix_frame (GstPhoneMixer* mixer){
+	GSList* outputs = 0;
+	GSList* walk;
+	guint active = 0;
+
+	guint64 threshold = (guint64) mixer->silenceThreshold * mixer->silenceThreshold * PHONE_MIXER_FRAME_SAMPLES;
+
+	guint legs = g_slist_length (mixer->legs);
+	if (legs > mixer->activeFramesSize){
+		mixer->activeFramesSize = legs * 2;
+		mixer->activeFrames = g_renew (const gint16*, mixer->activeFrames, mixer->activeFramesSize);
+	}
+
+	for (walk = mixer->legs; walk; walk = walk->next){
+		GstPhoneMixerLeg* leg = (GstPhoneMixerLeg*) walk->data;
+
+		gboolean taken = gst_phone_mixer_take_frame (mixer, leg);
+		guint64 energy = taken ? mixKernels.energy (leg->frame, PHONE_MIXER_FRAME_SAMPLES) : 0;
+
+		leg->voiced = taken && energy >= threshold;
+		leg->level  = leg->level - (leg->level >> 2) + (energy >> 2);
+		leg->quietFrames = leg->voiced ? 0 : leg->quietFrames + 1;
+		leg->speakerFrames++;
+	}
+
+	if (mixer->maxSpeakers){
+		gst_phone_mixer_select_speakers (mixer);
+	}
+
+	for (walk = mixer->legs; walk; walk = walk->next){
+		GstPhoneMixerLeg* leg = (GstPhoneMixerLeg*) walk->data;
+
+		gboolean talking = leg->voiced && (leg->speaker || !mixer->maxSpeakers);
+
+		if (talking){
+			mixer->activeFrames[active++] = leg->frame;
+		}
+
+		if (talking != leg->talking){
+			leg->talking = talking;
+			outputs = gst_phone_mixer_add_output (outputs, leg->sinkpad, NULL, talking);
+		}
+	}
+
+	GstBuffer* mix = gst_phone_mixer_new_buffer (mixer);
+	mixKernels.sum (mixer->activeFrames, active, mixer->sum,
+		(gint16*) GST_BUFFER_DATA (mix), PHONE_MIXER_FRAME_SAMPLES);
+	outputs = gst_phone_mixer_add_output (outputs, mixer->srcpad, mix, -1);
+
+	for (walk = mixer->legs; walk; walk = walk->next){
+		GstPhoneMixerLeg* leg = (GstPhoneMixerLeg*) walk->data;
+
+		if (!leg->minuspad || !leg->talking){
+			continue;
+		}
+
+		GstBuffer* minus = gst_phone_mixer_new_buffer (mixer);
+		mixKernels.minus (mixer->sum, leg->frame,
+			(gint16*) GST_BUFFER_DATA (minus), PHONE_MIXER_FRAME_SAMPLES);
+
+		outputs = gst_phone_mixer_add_output (outputs, leg->minuspad, minus, -1);
+		((GstPhoneMixerOutput*) outputs->data)->newSegment = !leg->minusSegmentSent;
+		leg->minusSegmentSent = TRUE;
+	}
+
+	return g_slist_reverse (outputs);
+}
+
+static void gst_phone_mixer_deliver (GstPhoneMixer* mixer, GSList* outputs){
+	GSList* walk;
+
+	if (!mixer->segmentSent){
+		mixer->segmentSent = TRUE;
+		gst_pad_push_event (mixer->srcpad, gst_event_new_new_segment (FALSE, 1.0, GST_FORMAT_TIME, 0, -1, 0));
+	}
+
+	for (walk = outputs; walk; walk = walk->next){
+		GstPhoneMixerOutput* output = (GstPhoneMixerOutput*) walk->data;
+
+		if (output->activity >= 0){
+			g_signal_emit (mixer, gst_phone_mixer_signals[PHONE_MIXER_SIGNAL_LEG_ACTIVITY], 0,
+				output->pad, output->activity);
+		}
+
+		// A leg being released may already be unlinked or flushing; that
+		// must not stop the mix for everybody else.
+		if (output->newSegment){
+			gst_pad_push_event (output->pad, gst_event_new_new_segment (FALSE, 1.0, GST_FORMAT_TIME, 0, -1, 0));
+		}
+		if (output->buffer){
+			gst_pad_push (output->pad, output->buffer);
+		}
+
+		gst_object_unref (output->pad);
+		g_slice_free (GstPhoneMixerOutput, output);
+	}
+
+	g_slist_free (outputs);
+}
+
+void gst_phone_mixer_register (){
+	gst_element_register (NULL, "phonemixer", GST_RANK_NONE, GST_TYPE_PHONE_MIXER);
+}
+
+#endif
@@ -0,0 +1,296 @@
+#ifndef RECORD_TAP_H
+#define RECORD_TAP_H
+
+#include <gst/gst.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+/*
+ * Recording of 16-bit audio streams without putting the disk on the
+ * streaming threads.
+ *
+ * A tap is fed by a buffer probe: the streaming thread copies the buffer
+ * into the tap's ring and goes on, it never waits. A buffer that does not
+ * fit is dropped from the recording and counted. The ring has a single
+ * producer and a single consumer, so its head and tail are plain atomic
+ * counters, as in phoneMixer.h.
+ *
+ * One writer thread serves every tap: every RECORD_WRITER_PERIOD it moves
+ * what the rings hold into the taps' chunks, turning the samples big-endian
+ * on the way, and writes full chunks of RECORD_TAP_CHUNK_BYTES with one
+ * pwrite() each, from page aligned memory to chunk aligned file offsets.
+ * The part of a chunk filled so far is written over again about every
+ * second, so a recording is never more than that behind.
+ *
+ * Files are Sun .au with the data size left unknown, which is how the
+ * format is streamed: every player reads such a file up to its current end,
+ * so a recording can be played while it is still being written. The file is
+ * only created by the writer, so opening it cannot hold up a join either.
+ */
+
+#define RECORD_TAP_RING_BYTES    (1 << 16)
+#define RECORD_TAP_CHUNK_BYTES   (1 << 15)
+#define RECORD_TAP_ALIGN         4096
+#define RECORD_TAP_FLUSH_PERIODS 10
+#define RECORD_WRITER_PERIOD     (100 * 1000)
+
+#define RECORD_TAP_AU_HEADER_SIZE 24
+#define RECORD_TAP_AU_MAGIC       0x2e736e64
+#define RECORD_TAP_AU_UNKNOWN     0xffffffff
+#define RECORD_TAP_AU_LINEAR_16   3
+
+typedef struct {
+	gchar* path;
+	gint rate;
+	gint channels;
+
+	// Head is only moved by the streaming thread, tail by the writer.
+	guint8* ring;
+	volatile gint head;
+	volatile gint tail;
+	volatile gint closing;
+
+	volatile gint framesRecorded;
+	volatile gint framesDropped;
+
+	// Writer thread only.
+	int fd;
+	gboolean failed;
+	guint8* chunk;
+	guint chunkFill;
+	off_t chunkOffset;
+	guint periodsSinceFlush;
+} RecordTap;
+
+typedef struct {
+	GThread* thread;
+	volatile gint running;
+
+	// Guards the list only; the writer works on a copy of it.
+	GMutex* lock;
+	GPtrArray* taps;
+
+	// Of every tap, closed ones included.
+	volatile gint framesRecorded;
+	volatile gint framesDropped;
+} RecordWriter;
+
+RecordWriter recordWriter;
+
+/*
+ * A new tap, empty and registered with the writer. The streaming thread
+ * calling recordTap_push() must be the only one to do so.
+ */
+RecordTap* recordTap_new(const gchar* path, gint rate, gint channels){
+	RecordTap* tap = g_new0 (RecordTap, 1);
+	tap->path     = g_strdup (path);
+	tap->rate     = rate;
+	tap->channels = channels;
+	tap->ring     = g_malloc (RECORD_TAP_RING_BYTES);
+	tap->fd       = -1;
+
+	void* chunk;
+	int result = posix_memalign (&chunk, RECORD_TAP_ALIGN, RECORD_TAP_CHUNK_BYTES);
+	g_assert (result == 0);
+	tap->chunk = (guint8*) chunk;
+
+	g_mutex_lock (recordWriter.lock);
+	g_ptr_array_add (recordWriter.taps, tap);
+	g_mutex_unlock (recordWriter.lock);
+
+	return tap;
+}
+
+void recordTap_push(RecordTap* tap, const guint8* data, guint size){
+	guint head = (guint) tap->head;
+	guint tail = (guint) g_atomic_int_get (&tap->tail);
+
+	if (size > RECORD_TAP_RING_BYTES - (head - tail) || (size & 1)){
+		g_atomic_int_inc (&tap->framesDropped);
+		g_atomic_int_inc (&recordWriter.framesDropped);
+		return;
+	}
+
+	guint offset = head & (RECORD_TAP_RING_BYTES - 1);
+	guint first  = MIN (size, RECORD_TAP_RING_BYTES - offset);
+	memcpy (tap->ring + offset, data, first);
+	memcpy (tap->ring, data + first, size - first);
+
+	g_atomic_int_set (&tap->head, head + size);
+	g_atomic_int_inc (&tap->framesRecorded);
+	g_atomic_int_inc (&recordWriter.framesRecorded);
+}
+
+static gboolean recordTap_probe(GstPad* pad, GstBuffer* buffer, gpointer data){
+	recordTap_push((RecordTap*) data, GST_BUFFER_DATA (buffer), GST_BUFFER_SIZE (buffer));
+	return TRUE;
+}
+
+// Returns the probe's id, for gst_pad_remove_buffer_probe().
+gulong recordTap_attach(RecordTap* tap, GstPad* pad){
+	return gst_pad_add_buffer_probe (pad, G_CALLBACK (recordTap_probe), tap);
+}
+
+/*
+ * Hands the tap over to the writer, which writes out what is left and
+ * frees it. Nothing may push to the tap anymore.
+ */
+void recordTap_close(RecordTap* tap){
+	g_atomic_int_set (&tap->closing, TRUE);
+}
+
+static void recordTap_writeHeader(RecordTap* tap){
+	guint8* header = tap->chunk;
+	GST_WRITE_UINT32_BE (header,      RECORD_TAP_AU_MAGIC);
+	GST_WRITE_UINT32_BE (header + 4,  RECORD_TAP_AU_HEADER_SIZE);
+	GST_WRITE_UINT32_BE (header + 8,  RECORD_TAP_AU_UNKNOWN);
+	GST_WRITE_UINT32_BE (header + 12, RECORD_TAP_AU_LINEAR_16);
+	GST_WRITE_UINT32_BE (header + 16, tap->rate);
+	GST_WRITE_UINT32_BE (header + 20, tap->channels);
+	tap->chunkFill = RECORD_TAP_AU_HEADER_SIZE;
+}
+
+static void recordTap_open(RecordTap* tap){
+	tap->fd = open (tap->path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (tap->fd < 0){
+		g_printerr ("Recording: cannot open %s: %s.\n", tap->path, g_strerror (errno));
+		tap->failed = TRUE;
+		return;
+	}
+	recordTap_writeHeader(tap);
+}
+
+static void recordTap_writeChunk(RecordTap* tap){
+	if (tap->failed || !tap->chunkFill){
+		return;
+	}
+	if (pwrite (tap->fd, tap->chunk, tap->chunkFill, tap->chunkOffset) != (ssize_t) tap->chunkFill){
+		g_printerr ("Recording: cannot write %s: %s.\n", tap->path, g_strerror (errno));
+		tap->failed = TRUE;
+	}
+	tap->periodsSinceFlush = 0;
+}
+
+// Samples are in host order in the ring and big-endian in the file.
+static void recordTap_copySamples(guint8* to, const guint8* from, guint size){
+	const guint16* samples = (const guint16*) from;
+	guint16* out = (guint16*) to;
+	guint i;
+	for (i = 0; i < size / 2; i++){
+		out[i] = GUINT16_TO_BE (samples[i]);
+	}
+}
+
+static void recordTap_drain(RecordTap* tap){
+	if (tap->fd < 0 && !tap->failed){
+		recordTap_open(tap);
+	}
+
+	guint head = (guint) g_atomic_int_get (&tap->head);
+	guint tail = (guint) tap->tail;
+
+	while (tail != head){
+		guint offset = tail & (RECORD_TAP_RING_BYTES - 1);
+		guint size   = MIN (head - tail, RECORD_TAP_RING_BYTES - offset);
+		size = MIN (size, RECORD_TAP_CHUNK_BYTES - tap->chunkFill);
+
+		if (!tap->failed){
+			recordTap_copySamples(tap->chunk + tap->chunkFill, tap->ring + offset, size);
+			tap->chunkFill += size;
+		}
+		tail += size;
+		g_atomic_int_set (&tap->tail, tail);
+
+		if (tap->chunkFill == RECORD_TAP_CHUNK_BYTES){
+			recordTap_writeChunk(tap);
+			tap->chunkOffset += RECORD_TAP_CHUNK_BYTES;
+			tap->chunkFill = 0;
+		}
+	}
+
+	if (++tap->periodsSinceFlush >= RECORD_TAP_FLUSH_PERIODS){
+		recordTap_writeChunk(tap);
+	}
+}
+
+static void recordTap_free(RecordTap* tap){
+	recordTap_writeChunk(tap);
+	if (tap->fd >= 0){
+		close (tap->fd);
+	}
+	free (tap->chunk);
+	g_free (tap->ring);
+	g_free (tap->path);
+	g_free (tap);
+}
+
+/*
+ * A tap's closing flag is read before it is drained, so everything pushed
+ * before recordTap_close() still makes it to the file.
+ */
+static void recordWriter_serve(gboolean last){
+	g_mutex_lock (recordWriter.lock);
+	GPtrArray* taps = g_ptr_array_sized_new (recordWriter.taps->len);
+	guint i;
+	for (i = 0; i < recordWriter.taps->len; i++){
+		g_ptr_array_add (taps, g_ptr_array_index (recordWriter.taps, i));
+	}
+	g_mutex_unlock (recordWriter.lock);
+
+	for (i = 0; i < taps->len; i++){
+		RecordTap* tap = (RecordTap*) g_ptr_array_index (taps, i);
+		gboolean closing = last || g_atomic_int_get (&tap->closing);
+
+		recordTap_drain(tap);
+		if (!closing){
+			continue;
+		}
+
+		g_mutex_lock (recordWriter.lock);
+		g_ptr_array_remove_fast (recordWriter.taps, tap);
+		g_mutex_unlock (recordWriter.lock);
+		recordTap_free(tap);
+	}
+
+	g_ptr_array_free (taps, TRUE);
+}
+
+static gpointer recordWriter_run(gpointer data){
+	while (g_atomic_int_get (&recordWriter.running)){
+		g_usleep (RECORD_WRITER_PERIOD);
+		recordWriter_serve(FALSE);
+	}
+	recordWriter_serve(TRUE);
+	return 0;
+}
+
+void recordWriter_start(){
+	recordWriter.lock = g_mutex_new ();
+	recordWriter.taps = g_ptr_array_new ();
+	g_atomic_int_set (&recordWriter.running, TRUE);
+
+	GError* error = 0;
+	recordWriter.thread = g_thread_create (recordWriter_run, NULL, TRUE, &error);
+	if (!recordWriter.thread){
+		g_printerr ("Recording writer: %s\n", error->message);
+		g_error_free (error);
+	}
+	g_assert (recordWriter.thread);
+}
+
+// Writes out and closes every tap left, once nothing pushes anymore.
+void recordWriter_stop(){
+	g_atomic_int_set (&recordWriter.running, FALSE);
+	g_thread_join (recordWriter.thread);
+
+	g_print ("Recorded %d frames, %d dropped.\n",
+		g_atomic_int_get (&recordWriter.framesRecorded), g_atomic_int_get (&recordWriter.framesDropped));
+
+	g_ptr_array_free (recordWriter.taps, TRUE);
+	g_mutex_free (recordWriter.lock);
+}
+
+#endif
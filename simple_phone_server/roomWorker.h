@@ -0,0 +1,145 @@
+#ifndef ROOM_WORKER_H
+#define ROOM_WORKER_H
+
+#include <gst/gst.h>
+#include <sched.h>
+#include <unistd.h>
+
+/*
+ * A worker is one thread with its own GMainContext, hosting the main loop
+ * work (bus messages, deferred releases) of a group of rooms.
+ *
+ * Every worker is tied to one CPU. Its own thread is pinned when it starts,
+ * and every streaming thread of the worker's pipelines pins itself from the
+ * bus sync handler when it posts its STREAM_STATUS "enter" message, which is
+ * done from the new thread itself. So a room never competes with rooms of
+ * other workers for a core. An element given a CPU of its own with
+ * roomWorker_setElementCpu() has its streaming thread pinned there instead,
+ * so a room can spread work which scales with cores, like receiving.
+ */
+
+typedef struct {
+	int index;
+	int cpu;
+	GThread* thread;
+	GMainContext* context;
+	GMainLoop* loop;
+} RoomWorker;
+
+int roomWorker_cpuCount(){
+	long count = sysconf (_SC_NPROCESSORS_ONLN);
+	return count > 0 ? (int) count : 1;
+}
+
+void roomWorker_init(RoomWorker* worker, int index, int cpu){
+	worker->index   = index;
+	worker->cpu     = cpu;
+	worker->thread  = 0;
+	worker->context = g_main_context_new ();
+	worker->loop    = g_main_loop_new (worker->context, FALSE);
+}
+
+void roomWorker_pinCurrentThreadTo(RoomWorker* worker, int cpu){
+#ifdef CPU_SET
+	cpu_set_t cpus;
+	CPU_ZERO (&cpus);
+	CPU_SET (cpu, &cpus);
+
+	if (sched_setaffinity (0, sizeof (cpus), &cpus) != 0){
+		g_printerr ("Worker %d: failed to pin thread to CPU %d.\n", worker->index, cpu);
+	}
+#endif
+}
+
+void roomWorker_pinCurrentThread(RoomWorker* worker){
+	roomWorker_pinCurrentThreadTo(worker, worker->cpu);
+}
+
+// Stored off by one, so an element without a CPU reads as -1.
+void roomWorker_setElementCpu(GstElement* element, int cpu){
+	g_object_set_data (G_OBJECT (element), "room-worker-cpu", GINT_TO_POINTER (cpu + 1));
+}
+
+static int roomWorker_getElementCpu(GstElement* element){
+	return element ? GPOINTER_TO_INT (g_object_get_data (G_OBJECT (element), "room-worker-cpu")) - 1 : -1;
+}
+
+static gpointer roomWorker_run(gpointer data){
+	RoomWorker* worker = (RoomWorker*) data;
+
+	roomWorker_pinCurrentThread(worker);
+	g_print ("Worker %d running on CPU %d.\n", worker->index, worker->cpu);
+
+	g_main_context_push_thread_default (worker->context);
+	g_main_loop_run (worker->loop);
+	g_main_context_pop_thread_default (worker->context);
+
+	return 0;
+}
+
+void roomWorker_start(RoomWorker* worker){
+	GError* error = 0;
+	worker->thread = g_thread_create (roomWorker_run, worker, TRUE, &error);
+	if (!worker->thread){
+		g_printerr ("Worker %d: %s\n", worker->index, error->message);
+		g_error_free (error);
+	}
+	g_assert (worker->thread);
+}
+
+void roomWorker_stop(RoomWorker* worker){
+	if (!worker->thread){
+		return;
+	}
+	g_main_loop_quit (worker->loop);
+	g_thread_join (worker->thread);
+	worker->thread = 0;
+}
+
+// The worker's replacement for g_idle_add().
+guint roomWorker_idleAdd(RoomWorker* worker, GSourceFunc function, gpointer data){
+	GSource* source = g_idle_source_new ();
+	g_source_set_callback (source, function, data, NULL);
+	guint id = g_source_attach (source, worker->context);
+	g_source_unref (source);
+	return id;
+}
+
+// The worker's replacement for g_timeout_add().
+guint roomWorker_timeoutAdd(RoomWorker* worker, guint interval, GSourceFunc function, gpointer data){
+	GSource* source = g_timeout_source_new (interval);
+	g_source_set_callback (source, function, data, NULL);
+	guint id = g_source_attach (source, worker->context);
+	g_source_unref (source);
+	return id;
+}
+
+static GstBusSyncReply roomWorker_busSync(GstBus* bus, GstMessage* msg, gpointer data){
+	if (GST_MESSAGE_TYPE (msg) == GST_MESSAGE_STREAM_STATUS){
+		GstStreamStatusType type;
+		GstElement* owner;
+		gst_message_parse_stream_status (msg, &type, &owner);
+
+		if (type == GST_STREAM_STATUS_TYPE_ENTER){
+			RoomWorker* worker = (RoomWorker*) data;
+			int cpu = roomWorker_getElementCpu(owner);
+			roomWorker_pinCurrentThreadTo(worker, cpu >= 0 ? cpu : worker->cpu);
+		}
+	}
+	return GST_BUS_PASS;
+}
+
+/*
+ * The worker's replacement for gst_bus_add_watch(): messages are dispatched
+ * on the worker's context, and streaming threads are pinned as they start.
+ */
+void roomWorker_addBusWatch(RoomWorker* worker, GstBus* bus, GstBusFunc function, gpointer data){
+	gst_bus_set_sync_handler (bus, roomWorker_busSync, worker);
+
+	GSource* source = gst_bus_create_watch (bus);
+	g_source_set_callback (source, (GSourceFunc) function, data, NULL);
+	g_source_attach (source, worker->context);
+	g_source_unref (source);
+}
+
+#endif
@@ -0,0 +1,71 @@
+#include <stdlib.h>
+#include <time.h>
+#include <gst/gst.h>
+
+#include "dynamicConnection.h"
+
+/*
+ * Cost of a join and a leave in the connection registry as it fills up,
+ * from 10 to 10,000 connections. Each round adds one connection, finds it
+ * by pad, SSRC and host, as a join and a leave do, and removes it again,
+ * with the registry holding the given number of others. The cost per
+ * round should stay flat.
+ */
+
+#define BENCH_ROUNDS 200000
+
+#define FAKE_PAD(n) ((GstPad*) GUINT_TO_POINTER (0x1000 + (n) * 16))
+
+static void silence (const gchar* text){
+}
+
+gint64 nowNs(){
+	struct timespec now;
+	clock_gettime (CLOCK_MONOTONIC, &now);
+	return (gint64) now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+DynamicConnection makeConnection(int n){
+	DynamicConnection connection;
+	memset (&connection, 0, sizeof (connection));
+	connection.rptBinPad = FAKE_PAD(n);
+	connection.ssrc      = 0x9e3779b9u * (n + 1);
+	connection.hostKey   = dynamicConnection_hostKey(0x0a000000 + (n >> 16), n & 0xffff);
+	return connection;
+}
+
+gdouble benchRegistry(int size){
+	DynamicConnectionRegistry registry;
+	dynamicConnectionRegistry_init(&registry);
+
+	int i;
+	for (i = 0; i < size; i++){
+		DynamicConnection connection = makeConnection(i);
+		dynamicConnectionRegistry_add(&registry, &connection);
+	}
+
+	gint64 start = nowNs();
+	for (i = 0; i < BENCH_ROUNDS; i++){
+		DynamicConnection connection = makeConnection(size + (i & 1023));
+		DynamicConnectionHandle handle = dynamicConnectionRegistry_add(&registry, &connection);
+
+		g_assert (dynamicConnectionRegistry_findBySsrc(&registry, connection.ssrc) == handle);
+		g_assert (dynamicConnectionRegistry_findByHost(&registry, connection.hostKey >> 16, connection.hostKey & 0xffff) == handle);
+		g_assert (dynamicConnectionRegistry_removeByRtpBinPad(&registry, connection.rptBinPad, NULL));
+	}
+	gint64 elapsed = nowNs() - start;
+
+	dynamicConnectionRegistry_clear(&registry);
+	return (gdouble) elapsed / BENCH_ROUNDS;
+}
+
+int main(int argc, char *argv[]){
+	g_set_print_handler (silence);
+
+	int sizes[] = { 10, 100, 1000, 10000 };
+	guint i;
+	for (i = 0; i < G_N_ELEMENTS (sizes); i++){
+		g_printerr ("%6d connections: %7.1f ns per join and leave.\n", sizes[i], benchRegistry(sizes[i]));
+	}
+	return 0;
+}
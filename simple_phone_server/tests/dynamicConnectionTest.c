@@ -0,0 +1,180 @@
+#include <stdlib.h>
+#include <gst/gst.h>
+
+#include "dynamicConnection.h"
+
+/*
+ * Unit tests of the connection registry. The pads and bins are never
+ * dereferenced by the registry, so made up pointers stand in for them.
+ */
+
+#define FAKE_PAD(n) ((GstPad*) GUINT_TO_POINTER (0x1000 + (n) * 16))
+
+static void silence (const gchar* text){
+}
+
+DynamicConnection makeConnection(int n, guint32 address, guint16 port){
+	DynamicConnection connection;
+	memset (&connection, 0, sizeof (connection));
+	connection.rptBinPad = FAKE_PAD(n);
+	connection.ssrc      = 1000 + n;
+	connection.hostKey   = dynamicConnection_hostKey(address, port);
+	g_snprintf (connection.host, sizeof (connection.host), "10.0.0.%d", n & 0xff);
+	return connection;
+}
+
+int slotIndex(DynamicConnectionHandle handle){
+	return handle & DYNAMIC_CONNECTION_INDEX_MASK;
+}
+
+void testAddFindRemove(){
+	DynamicConnectionRegistry registry;
+	dynamicConnectionRegistry_init(&registry);
+
+	DynamicConnection connection = makeConnection(1, 0x0a000001, 20000);
+	DynamicConnectionHandle handle = dynamicConnectionRegistry_add(&registry, &connection);
+
+	g_assert (handle != DYNAMIC_CONNECTION_NO_HANDLE);
+	g_assert (dynamicConnectionRegistry_findByRtpBinPad(&registry, FAKE_PAD(1)) == handle);
+	g_assert (dynamicConnectionRegistry_findBySsrc(&registry, 1001) == handle);
+	g_assert (dynamicConnectionRegistry_findByHost(&registry, 0x0a000001, 20000) == handle);
+	g_assert (!dynamicConnectionRegistry_isHostNotRegistered(&registry, 0x0a000001, 20000));
+
+	DynamicConnection removed;
+	g_assert (dynamicConnectionRegistry_removeByRtpBinPad(&registry, FAKE_PAD(1), &removed));
+	g_assert (removed.ssrc == 1001);
+	g_assert (dynamicConnectionRegistry_isEmpty(&registry));
+	g_assert (dynamicConnectionRegistry_findBySsrc(&registry, 1001) == DYNAMIC_CONNECTION_NO_HANDLE);
+	g_assert (dynamicConnectionRegistry_isHostNotRegistered(&registry, 0x0a000001, 20000));
+	g_assert (!dynamicConnectionRegistry_get(&registry, handle));
+
+	dynamicConnectionRegistry_clear(&registry);
+}
+
+// A freed slot is the next one taken, under a new generation.
+void testSlotReuse(){
+	DynamicConnectionRegistry registry;
+	dynamicConnectionRegistry_init(&registry);
+
+	DynamicConnection connections[3];
+	DynamicConnectionHandle handles[3];
+	int i;
+	for (i = 0; i < 3; i++){
+		connections[i] = makeConnection(i, 0x0a000001, 20000 + i);
+		handles[i] = dynamicConnectionRegistry_add(&registry, &connections[i]);
+	}
+
+	g_assert (dynamicConnectionRegistry_remove(&registry, handles[1], NULL));
+	g_assert (!dynamicConnectionRegistry_remove(&registry, handles[1], NULL));
+
+	DynamicConnection newcomer = makeConnection(7, 0x0a000002, 30000);
+	DynamicConnectionHandle handle = dynamicConnectionRegistry_add(&registry, &newcomer);
+
+	g_assert (slotIndex(handle) == slotIndex(handles[1]));
+	g_assert (handle != handles[1]);
+	g_assert (!dynamicConnectionRegistry_get(&registry, handles[1]));
+	g_assert (dynamicConnectionRegistry_get(&registry, handle)->ssrc == 1007);
+
+	// The neighbours are untouched.
+	g_assert (dynamicConnectionRegistry_get(&registry, handles[0])->ssrc == 1000);
+	g_assert (dynamicConnectionRegistry_get(&registry, handles[2])->ssrc == 1002);
+	g_assert (dynamicConnectionRegistry_findByHost(&registry, 0x0a000001, 20001) == DYNAMIC_CONNECTION_NO_HANDLE);
+
+	dynamicConnectionRegistry_clear(&registry);
+}
+
+// Slots freed last are reused first, and churn never grows the chunks.
+void testFreeListDoesNotGrow(){
+	DynamicConnectionRegistry registry;
+	dynamicConnectionRegistry_init(&registry);
+
+	int count = DYNAMIC_CONNECTION_CHUNK_SIZE + 1;
+	DynamicConnectionHandle* handles = g_new (DynamicConnectionHandle, count);
+
+	int i;
+	for (i = 0; i < count; i++){
+		DynamicConnection connection = makeConnection(i, 0x0a000001, 20000 + i);
+		handles[i] = dynamicConnectionRegistry_add(&registry, &connection);
+	}
+	g_assert (registry.chunksCount == 2);
+
+	int round;
+	for (round = 0; round < 100; round++){
+		for (i = 0; i < count; i++){
+			g_assert (dynamicConnectionRegistry_remove(&registry, handles[i], NULL));
+		}
+		g_assert (dynamicConnectionRegistry_isEmpty(&registry));
+
+		for (i = count - 1; i >= 0; i--){
+			DynamicConnection connection = makeConnection(i, 0x0a000001, 20000 + i);
+			DynamicConnectionHandle handle = dynamicConnectionRegistry_add(&registry, &connection);
+			g_assert (slotIndex(handle) == slotIndex(handles[i]));
+			handles[i] = handle;
+		}
+	}
+	g_assert (registry.chunksCount == 2);
+	g_assert (registry.size == count);
+
+	g_free (handles);
+	dynamicConnectionRegistry_clear(&registry);
+}
+
+// The generation wraps without ever handing out NO_HANDLE.
+void testGenerationWraps(){
+	DynamicConnectionRegistry registry;
+	dynamicConnectionRegistry_init(&registry);
+
+	DynamicConnection connection = makeConnection(0, 0, 0);
+	guint generations = 1 << (32 - DYNAMIC_CONNECTION_INDEX_BITS);
+
+	guint i;
+	for (i = 0; i < generations + 2; i++){
+		DynamicConnectionHandle handle = dynamicConnectionRegistry_add(&registry, &connection);
+		g_assert (handle != DYNAMIC_CONNECTION_NO_HANDLE);
+		g_assert (slotIndex(handle) == 0);
+		g_assert (dynamicConnectionRegistry_remove(&registry, handle, NULL));
+	}
+
+	dynamicConnectionRegistry_clear(&registry);
+}
+
+// A rejoin from the same host owns the host after the old slot is reused.
+void testRejoinThenRemoveOld(){
+	DynamicConnectionRegistry registry;
+	dynamicConnectionRegistry_init(&registry);
+
+	DynamicConnection old = makeConnection(1, 0x0a000001, 20000);
+	DynamicConnectionHandle oldHandle = dynamicConnectionRegistry_add(&registry, &old);
+
+	DynamicConnection rejoined = makeConnection(2, 0x0a000001, 20000);
+	DynamicConnectionHandle handle = dynamicConnectionRegistry_add(&registry, &rejoined);
+	g_assert (dynamicConnectionRegistry_findByHost(&registry, 0x0a000001, 20000) == handle);
+
+	g_assert (dynamicConnectionRegistry_remove(&registry, oldHandle, NULL));
+	g_assert (dynamicConnectionRegistry_findByHost(&registry, 0x0a000001, 20000) == handle);
+
+	DynamicConnection other = makeConnection(3, 0x0a000002, 30000);
+	DynamicConnectionHandle otherHandle = dynamicConnectionRegistry_add(&registry, &other);
+	g_assert (slotIndex(otherHandle) == slotIndex(oldHandle));
+	g_assert (dynamicConnectionRegistry_findByHost(&registry, 0x0a000001, 20000) == handle);
+	g_assert (dynamicConnectionRegistry_findByHost(&registry, 0x0a000002, 30000) == otherHandle);
+
+	g_assert (dynamicConnectionRegistry_remove(&registry, handle, NULL));
+	g_assert (dynamicConnectionRegistry_isHostNotRegistered(&registry, 0x0a000001, 20000));
+	g_assert (dynamicConnectionRegistry_findByHost(&registry, 0x0a000002, 30000) == otherHandle);
+
+	dynamicConnectionRegistry_clear(&registry);
+}
+
+int main(int argc, char *argv[]){
+	g_set_print_handler (silence);
+
+	testAddFindRemove();
+	testSlotReuse();
+	testFreeListDoesNotGrow();
+	testGenerationWraps();
+	testRejoinThenRemoveOld();
+
+	g_printerr ("dynamicConnectionTest: ok.\n");
+	return 0;
+}
@@ -0,0 +1,223 @@
+#include <stdlib.h>
+#include <string.h>
+#include <glib.h>
+
+#include "mixKernels.h"
+
+/*
+ * Every vector mix kernel the CPU runs against the plain C one: random
+ * samples and full scale ones, so the sums overflow 16 bits and the
+ * outputs saturate, from one input to more than a mixer ever has, over
+ * lengths that leave every possible tail after the vector blocks. The
+ * frames start off the vector alignment, as a mixer's may.
+ */
+
+#define MAX_SAMPLES 1000
+#define MAX_INPUTS  64
+
+static void silence (const gchar* text){
+}
+
+typedef enum {
+	FILL_RANDOM,
+	FILL_MAX,
+	FILL_MIN,
+	FILL_ALTERNATE,
+	FILL_MIXED,
+	FILL_COUNT
+} Fill;
+
+static const guint inputCounts[] = {1, 2, 3, 8, 31, MAX_INPUTS};
+
+GRand* generator;
+gint16* frameData[MAX_INPUTS];
+const gint16* frames[MAX_INPUTS];
+
+MixKernels candidates[3];
+guint candidateCount;
+
+void addCandidates(){
+	candidateCount = 0;
+#ifdef MIX_KERNELS_X86
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("sse2")){
+		MixKernels sse2 = {"sse2", mixKernels_sumSse2, mixKernels_minusSse2, mixKernels_energySse2};
+		candidates[candidateCount++] = sse2;
+	}
+	if (__builtin_cpu_supports("avx2")){
+		MixKernels avx2 = {"avx2", mixKernels_sumAvx2, mixKernels_minusAvx2, mixKernels_energySse2};
+		candidates[candidateCount++] = avx2;
+	}
+#endif
+	g_print ("%u vector kernel sets.\n", candidateCount);
+}
+
+gint16 sample(Fill fill, guint input, guint i){
+	switch (fill){
+	case FILL_MAX:
+		return G_MAXINT16;
+	case FILL_MIN:
+		return G_MININT16;
+	case FILL_ALTERNATE:
+		return (input + i) % 2 ? G_MAXINT16 : G_MININT16;
+	case FILL_MIXED:
+		switch (g_rand_int_range (generator, 0, 4)){
+		case 0:  return G_MAXINT16;
+		case 1:  return G_MININT16;
+		case 2:  return g_rand_int_range (generator, -2, 3);
+		default: break;
+		}
+	default:
+		return g_rand_int_range (generator, G_MININT16, G_MAXINT16 + 1);
+	}
+}
+
+// One extra sample in front, so the frames are not 16-byte aligned.
+void fillFrames(Fill fill, guint count, guint samples){
+	guint k, i;
+	for (k = 0; k < count; k++){
+		for (i = 0; i < samples; i++){
+			frameData[k][1 + i] = sample(fill, k, i);
+		}
+		frames[k] = frameData[k] + 1;
+	}
+}
+
+void checkSum(const MixKernels* kernels, guint count, guint samples){
+	gint32 expectedSum[MAX_SAMPLES], sum[MAX_SAMPLES + 1];
+	gint16 expectedMix[MAX_SAMPLES], mix[MAX_SAMPLES + 1];
+
+	mixKernels_sumScalar(frames, count, expectedSum, expectedMix, samples);
+
+	// A guard sample after the end must survive.
+	sum[samples] = 0x5a5a5a5a;
+	mix[samples] = 0x5a5a;
+	kernels->sum(frames, count, sum, mix, samples);
+
+	g_assert (!memcmp (sum, expectedSum, samples * sizeof (gint32)));
+	g_assert (!memcmp (mix, expectedMix, samples * sizeof (gint16)));
+	g_assert (sum[samples] == 0x5a5a5a5a);
+	g_assert (mix[samples] == 0x5a5a);
+}
+
+// Each leg's mix-minus, and one of a frame absent from the sum.
+void checkMinus(const MixKernels* kernels, guint count, guint samples){
+	gint32 sum[MAX_SAMPLES];
+	gint16 mix[MAX_SAMPLES], expected[MAX_SAMPLES], out[MAX_SAMPLES + 1];
+
+	mixKernels_sumScalar(frames, count, sum, mix, samples);
+
+	guint k;
+	for (k = 0; k < count; k++){
+		mixKernels_minusScalar(sum, frames[k], expected, samples);
+
+		out[samples] = 0x5a5a;
+		kernels->minus(sum, frames[k], out, samples);
+
+		g_assert (!memcmp (out, expected, samples * sizeof (gint16)));
+		g_assert (out[samples] == 0x5a5a);
+	}
+
+	guint i;
+	gint16 other[MAX_SAMPLES];
+	for (i = 0; i < samples; i++){
+		other[i] = -frames[0][i] - 1;
+	}
+	mixKernels_minusScalar(sum, other, expected, samples);
+	kernels->minus(sum, other, out, samples);
+	g_assert (!memcmp (out, expected, samples * sizeof (gint16)));
+}
+
+void checkEnergy(const MixKernels* kernels, guint count, guint samples){
+	guint k;
+	for (k = 0; k < count; k++){
+		g_assert (kernels->energy(frames[k], samples) == mixKernels_energyScalar(frames[k], samples));
+	}
+}
+
+void testKernels(){
+	guint c, fill, n, samples;
+	for (c = 0; c < candidateCount; c++){
+		const MixKernels* kernels = &candidates[c];
+		g_print ("Kernels %s.\n", kernels->name);
+
+		for (fill = 0; fill < FILL_COUNT; fill++){
+			for (n = 0; n < G_N_ELEMENTS (inputCounts); n++){
+				guint count = inputCounts[n];
+
+				// Every tail after one and two blocks of 8 and 16.
+				for (samples = 0; samples <= 48; samples++){
+					fillFrames(fill, count, samples);
+					checkSum(kernels, count, samples);
+					checkMinus(kernels, count, samples);
+					checkEnergy(kernels, count, samples);
+				}
+
+				// Frames of 20 ms at 8 and 48 kHz, and odd ones.
+				static const guint lengths[] = {160, 161, 167, 960, 961, 999};
+				guint l;
+				for (l = 0; l < G_N_ELEMENTS (lengths); l++){
+					samples = lengths[l];
+					fillFrames(fill, count, samples);
+					checkSum(kernels, count, samples);
+					checkMinus(kernels, count, samples);
+					checkEnergy(kernels, count, samples);
+				}
+			}
+		}
+	}
+}
+
+// The largest energy there is: every pair of squares is exactly 2^31.
+void testEnergyFullScale(){
+	guint c, i;
+	gint16 frame[MAX_SAMPLES];
+	for (i = 0; i < MAX_SAMPLES; i++){
+		frame[i] = G_MININT16;
+	}
+	guint64 expected = (guint64) MAX_SAMPLES << 30;
+	g_assert (mixKernels_energyScalar(frame, MAX_SAMPLES) == expected);
+	for (c = 0; c < candidateCount; c++){
+		g_assert (candidates[c].energy(frame, MAX_SAMPLES) == expected);
+	}
+}
+
+// Whatever mixKernels_init() picks is one of the above.
+void testInit(){
+	mixKernels_init();
+	g_print ("Picked %s.\n", mixKernels.name);
+
+	if (!candidateCount){
+		g_assert (mixKernels.sum == mixKernels_sumScalar);
+		return;
+	}
+	const MixKernels* best = &candidates[candidateCount - 1];
+	g_assert (!strcmp (mixKernels.name, best->name));
+	g_assert (mixKernels.sum    == best->sum);
+	g_assert (mixKernels.minus  == best->minus);
+	g_assert (mixKernels.energy == best->energy);
+}
+
+int main(int argc, char *argv[]){
+	g_set_print_handler (silence);
+
+	generator = g_rand_new_with_seed (4711);
+	guint k;
+	for (k = 0; k < MAX_INPUTS; k++){
+		frameData[k] = g_new (gint16, MAX_SAMPLES + 1);
+	}
+
+	addCandidates();
+	testKernels();
+	testEnergyFullScale();
+	testInit();
+
+	for (k = 0; k < MAX_INPUTS; k++){
+		g_free (frameData[k]);
+	}
+	g_rand_free (generator);
+
+	g_printerr ("mixKernelsTest: ok.\n");
+	return 0;
+}
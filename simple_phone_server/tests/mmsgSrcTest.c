@@ -0,0 +1,229 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <arpa/inet.h>
+#include <gst/gst.h>
+
+#include "mmsgSrc.h"
+
+/*
+ * Tests of mmsgsrc's peer table and BYE checks, on the loopback. A caller
+ * and an impostor send from sockets of their own; the source runs in a
+ * pipeline of its own and reports BYEs from its streaming thread.
+ */
+
+#define CALLER_SSRC 0x11111111
+#define OTHER_SSRC  0x22222222
+#define WAIT_STEP   (10 * 1000)
+#define WAIT_STEPS  200
+
+static void silence (const gchar* text){
+}
+
+GstElement* pipeline;
+GstElement* source;
+struct sockaddr_in sourceAddress;
+
+GMutex* byesLock;
+GArray* byes;
+
+static void sourceBye (GstElement* element, guint ssrc, gpointer user_data){
+	g_mutex_lock (byesLock);
+	g_array_append_val (byes, ssrc);
+	g_mutex_unlock (byesLock);
+}
+
+guint byesCount(){
+	g_mutex_lock (byesLock);
+	guint count = byes->len;
+	g_mutex_unlock (byesLock);
+	return count;
+}
+
+// The signal follows the counters, once the source has let go of its lock.
+void waitForByes(guint count){
+	int i;
+	for (i = 0; i < WAIT_STEPS && byesCount() < count; i++){
+		g_usleep (WAIT_STEP);
+	}
+}
+
+guint64 byesDropped(){
+	guint64 dropped;
+	g_object_get (G_OBJECT (source), "byes-dropped", &dropped, NULL);
+	return dropped;
+}
+
+guint64 packetsReceived(){
+	guint64 packets;
+	g_object_get (G_OBJECT (source), "packets-received", &packets, NULL);
+	return packets;
+}
+
+void startSource(){
+	pipeline = gst_pipeline_new (NULL);
+	source   = gst_element_factory_make ("mmsgsrc", NULL);
+	GstElement* sink = gst_element_factory_make ("fakesink", NULL);
+	g_assert (pipeline && source && sink);
+
+	g_object_set (G_OBJECT (source), "port", 0, NULL);
+	g_object_set (G_OBJECT (sink), "sync", FALSE, "async", FALSE, NULL);
+	g_signal_connect (source, "bye-ssrc", G_CALLBACK (sourceBye), NULL);
+
+	gst_bin_add_many (GST_BIN (pipeline), source, sink, NULL);
+	g_assert (gst_element_link (source, sink));
+	gst_element_set_state (pipeline, GST_STATE_PLAYING);
+	gst_element_get_state (pipeline, NULL, NULL, GST_CLOCK_TIME_NONE);
+
+	// Port 0 has the kernel pick one.
+	int sockfd;
+	g_object_get (G_OBJECT (source), "sockfd", &sockfd, NULL);
+	g_assert (sockfd >= 0);
+	socklen_t length = sizeof (sourceAddress);
+	g_assert (getsockname (sockfd, (struct sockaddr*) &sourceAddress, &length) == 0);
+	sourceAddress.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+}
+
+void stopSource(){
+	gst_element_set_state (pipeline, GST_STATE_NULL);
+	gst_object_unref (pipeline);
+}
+
+int openSender(guint16* port){
+	int fd = socket (AF_INET, SOCK_DGRAM, 0);
+	g_assert (fd >= 0);
+
+	struct sockaddr_in address;
+	memset (&address, 0, sizeof (address));
+	address.sin_family      = AF_INET;
+	address.sin_addr.s_addr = htonl (INADDR_LOOPBACK);
+	g_assert (bind (fd, (struct sockaddr*) &address, sizeof (address)) == 0);
+
+	socklen_t length = sizeof (address);
+	g_assert (getsockname (fd, (struct sockaddr*) &address, &length) == 0);
+	*port = ntohs (address.sin_port);
+	return fd;
+}
+
+// Sends and waits until the source has read the datagram.
+void sendAndWait(int fd, const guint8* data, gsize size){
+	guint64 before = packetsReceived();
+	g_assert (sendto (fd, data, size, 0, (struct sockaddr*) &sourceAddress, sizeof (sourceAddress)) == (ssize_t) size);
+
+	int i;
+	for (i = 0; i < WAIT_STEPS && packetsReceived() == before; i++){
+		g_usleep (WAIT_STEP);
+	}
+	g_assert (packetsReceived() > before);
+}
+
+void sendRtp(int fd, guint32 ssrc){
+	guint8 packet[12 + 80];
+	memset (packet, 0, sizeof (packet));
+	packet[0] = 0x80;
+	packet[1] = 96;
+	GST_WRITE_UINT32_BE (packet + 8, ssrc);
+	sendAndWait(fd, packet, sizeof (packet));
+}
+
+// A receiver report with no blocks followed by a BYE, as RFC 3550 has it.
+void sendBye(int fd, guint32 ssrc){
+	guint8 packet[16];
+	packet[0] = 0x80;
+	packet[1] = 201;
+	packet[2] = 0;
+	packet[3] = 1;
+	GST_WRITE_UINT32_BE (packet + 4, ssrc);
+	packet[8]  = 0x81;
+	packet[9]  = MMSG_SRC_RTCP_BYE;
+	packet[10] = 0;
+	packet[11] = 1;
+	GST_WRITE_UINT32_BE (packet + 12, ssrc);
+	sendAndWait(fd, packet, sizeof (packet));
+}
+
+guint16 peerPort(guint32 ssrc){
+	guint32 address;
+	guint16 port;
+	if (!gst_mmsg_src_get_peer (source, ssrc, &address, &port)){
+		return 0;
+	}
+	g_assert (address == INADDR_LOOPBACK);
+	return port;
+}
+
+/*
+ * An impostor sends one RTP packet under a joined caller's SSRC, then a
+ * BYE for it from the same socket. The caller's address stays, the BYE is
+ * dropped, and the caller's own BYE still gets through.
+ */
+void testSpoofedBye(){
+	startSource();
+
+	guint16 callerPort, impostorPort;
+	int caller   = openSender(&callerPort);
+	int impostor = openSender(&impostorPort);
+
+	sendRtp(caller, CALLER_SSRC);
+	g_assert (peerPort(CALLER_SSRC) == callerPort);
+	gst_mmsg_src_keep_peer (source, CALLER_SSRC);
+
+	sendRtp(impostor, CALLER_SSRC);
+	g_assert (peerPort(CALLER_SSRC) == callerPort);
+
+	sendBye(impostor, CALLER_SSRC);
+	g_assert (byesDropped() == 1);
+	g_assert (byesCount() == 0);
+
+	sendBye(caller, CALLER_SSRC);
+	waitForByes(1);
+	g_assert (byesDropped() == 1);
+	g_assert (byesCount() == 1);
+	g_assert (g_array_index (byes, guint32, 0) == CALLER_SSRC);
+
+	close (caller);
+	close (impostor);
+	stopSource();
+	g_array_set_size (byes, 0);
+}
+
+// Before joining, a peer follows its sender; a BYE for an unknown SSRC is dropped.
+void testUnkeptPeerAndUnknownBye(){
+	startSource();
+
+	guint16 firstPort, secondPort;
+	int first  = openSender(&firstPort);
+	int second = openSender(&secondPort);
+
+	sendRtp(first, OTHER_SSRC);
+	g_assert (peerPort(OTHER_SSRC) == firstPort);
+	sendRtp(second, OTHER_SSRC);
+	g_assert (peerPort(OTHER_SSRC) == secondPort);
+
+	sendBye(first, CALLER_SSRC);
+	g_assert (byesDropped() == 1);
+	g_assert (byesCount() == 0);
+
+	close (first);
+	close (second);
+	stopSource();
+	g_array_set_size (byes, 0);
+}
+
+int main(int argc, char *argv[]){
+	gst_init (&argc, &argv);
+	gst_mmsg_src_register();
+	g_set_print_handler (silence);
+
+	byesLock = g_mutex_new ();
+	byes = g_array_new (FALSE, FALSE, sizeof (guint32));
+
+	testSpoofedBye();
+	testUnkeptPeerAndUnknownBye();
+
+	g_array_free (byes, TRUE);
+	g_mutex_free (byesLock);
+
+	g_printerr ("mmsgSrcTest: ok.\n");
+	return 0;
+}
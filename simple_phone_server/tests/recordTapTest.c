@@ -0,0 +1,182 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <gst/gst.h>
+
+#include "recordTap.h"
+
+/*
+ * Unit tests of the recording taps. The writer thread is not started: the
+ * tests drain the taps themselves with recordWriter_serve(), which the
+ * writer would call every RECORD_WRITER_PERIOD.
+ */
+
+#define FRAME_BYTES 320
+
+static void silence (const gchar* text){
+}
+
+gchar* tempDir;
+
+void startWriter(){
+	recordWriter.lock = g_mutex_new ();
+	recordWriter.taps = g_ptr_array_new ();
+	recordWriter.framesRecorded = 0;
+	recordWriter.framesDropped  = 0;
+}
+
+void stopWriter(){
+	recordWriter_serve(TRUE);
+	g_assert (recordWriter.taps->len == 0);
+	g_ptr_array_free (recordWriter.taps, TRUE);
+	g_mutex_free (recordWriter.lock);
+}
+
+gchar* tempPath(const gchar* name){
+	return g_build_filename (tempDir, name, NULL);
+}
+
+// Frame n holds the samples n * FRAME_BYTES / 2 and on, in host order.
+void fillFrame(guint8* frame, guint n){
+	gint16* samples = (gint16*) frame;
+	guint i;
+	for (i = 0; i < FRAME_BYTES / 2; i++){
+		samples[i] = (gint16) (n * FRAME_BYTES / 2 + i);
+	}
+}
+
+guint8* readRecording(const gchar* path, gsize* size){
+	gchar* contents;
+	g_assert (g_file_get_contents (path, &contents, size, NULL));
+	return (guint8*) contents;
+}
+
+// The file holds the header and then the frames in order, big-endian.
+void checkSamples(const guint8* file, gsize size, guint frames){
+	g_assert (size == RECORD_TAP_AU_HEADER_SIZE + frames * FRAME_BYTES);
+
+	const guint8* data = file + RECORD_TAP_AU_HEADER_SIZE;
+	guint i;
+	for (i = 0; i < frames * FRAME_BYTES / 2; i++){
+		g_assert (GST_READ_UINT16_BE (data + 2 * i) == (guint16) i);
+	}
+}
+
+void testAuHeader(){
+	startWriter();
+	gchar* path = tempPath("header.au");
+	RecordTap* tap = recordTap_new(path, 8000, 1);
+
+	recordTap_writeHeader(tap);
+	g_assert (tap->chunkFill == RECORD_TAP_AU_HEADER_SIZE);
+	g_assert (GST_READ_UINT32_BE (tap->chunk)      == RECORD_TAP_AU_MAGIC);
+	g_assert (GST_READ_UINT32_BE (tap->chunk + 4)  == RECORD_TAP_AU_HEADER_SIZE);
+	g_assert (GST_READ_UINT32_BE (tap->chunk + 8)  == RECORD_TAP_AU_UNKNOWN);
+	g_assert (GST_READ_UINT32_BE (tap->chunk + 12) == RECORD_TAP_AU_LINEAR_16);
+	g_assert (GST_READ_UINT32_BE (tap->chunk + 16) == 8000);
+	g_assert (GST_READ_UINT32_BE (tap->chunk + 20) == 1);
+	tap->chunkFill = 0;
+
+	// A recording with nothing in it is just the header.
+	recordTap_close(tap);
+	stopWriter();
+
+	gsize size;
+	guint8* file = readRecording(path, &size);
+	g_assert (size == RECORD_TAP_AU_HEADER_SIZE);
+	g_assert (!memcmp (file, ".snd", 4));
+	g_assert (GST_READ_UINT32_BE (file + 16) == 8000);
+
+	g_free (file);
+	unlink (path);
+	g_free (path);
+}
+
+// Frames straddling the end of the ring come out whole and in order.
+void testRingWraparound(){
+	startWriter();
+	gchar* path = tempPath("wraparound.au");
+	RecordTap* tap = recordTap_new(path, 8000, 1);
+
+	guint frames = 3 * RECORD_TAP_RING_BYTES / FRAME_BYTES;
+	guint8 frame[FRAME_BYTES];
+	guint n;
+	for (n = 0; n < frames; n++){
+		fillFrame(frame, n);
+		recordTap_push(tap, frame, FRAME_BYTES);
+		if (n % 50 == 49){
+			recordWriter_serve(FALSE);
+		}
+	}
+	g_assert ((guint) tap->head > 2 * RECORD_TAP_RING_BYTES);
+	g_assert (tap->framesRecorded == (gint) frames);
+	g_assert (tap->framesDropped == 0);
+
+	recordTap_close(tap);
+	stopWriter();
+
+	gsize size;
+	guint8* file = readRecording(path, &size);
+	checkSamples(file, size, frames);
+
+	g_free (file);
+	unlink (path);
+	g_free (path);
+}
+
+// A full ring drops whole frames, counts them and takes more once drained.
+void testDropWhenFull(){
+	startWriter();
+	gchar* path = tempPath("full.au");
+	RecordTap* tap = recordTap_new(path, 8000, 1);
+
+	guint fitting = RECORD_TAP_RING_BYTES / FRAME_BYTES;
+	guint8 frame[FRAME_BYTES];
+	guint n;
+	for (n = 0; n < fitting; n++){
+		fillFrame(frame, n);
+		recordTap_push(tap, frame, FRAME_BYTES);
+	}
+	g_assert (tap->framesDropped == 0);
+
+	fillFrame(frame, n);
+	recordTap_push(tap, frame, FRAME_BYTES);
+	g_assert (tap->framesRecorded == (gint) fitting);
+	g_assert (tap->framesDropped == 1);
+	g_assert (recordWriter.framesDropped == 1);
+
+	// Half a sample is never taken, even with room to spare.
+	recordWriter_serve(FALSE);
+	recordTap_push(tap, frame, FRAME_BYTES - 1);
+	g_assert (tap->framesDropped == 2);
+
+	recordTap_push(tap, frame, FRAME_BYTES);
+	g_assert (tap->framesRecorded == (gint) fitting + 1);
+
+	recordTap_close(tap);
+	stopWriter();
+
+	gsize size;
+	guint8* file = readRecording(path, &size);
+	checkSamples(file, size, fitting + 1);
+
+	g_free (file);
+	unlink (path);
+	g_free (path);
+}
+
+int main(int argc, char *argv[]){
+	g_set_print_handler (silence);
+
+	tempDir = g_strdup ("/tmp/recordTapTest.XXXXXX");
+	g_assert (mkdtemp (tempDir));
+
+	testAuHeader();
+	testRingWraparound();
+	testDropWhenFull();
+
+	rmdir (tempDir);
+	g_free (tempDir);
+
+	g_printerr ("recordTapTest: ok.\n");
+	return 0;
+}
@@ -0,0 +1,104 @@
+#ifndef TRUNK_H
+#define TRUNK_H
+
+#include <gst/gst.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+/*
+ * Trunks link the same room of several phone_server processes into one
+ * conference. A trunk is an ordinary leg at both ends: each side sends its
+ * peer, with its mix-minus, everything it hears but what the peer sent it,
+ * and mixes what the peer sends like any caller's voice.
+ *
+ * A trunk leg is told from a caller by its address: the peer sends from the
+ * very port it listens on, so a leg coming from a configured HOST:PORT is
+ * the peer's. Both sides must name each other. Until the peer's leg has
+ * joined, nobody would send the first packet, so every side says hello: a
+ * packet of G.726 silence with the room's trunk SSRC, from the room's port,
+ * every TRUNK_HELLO_INTERVAL. The peer joins it as a leg and answers it,
+ * which joins the peer here; the output then goes on with the hellos' SSRC,
+ * sequence and timestamp, so the peer sees one stream all along.
+ *
+ * Mix-minus keeps a trunk's own audio from coming back over it, but a loop
+ * of trunks would still bring it back over the others: trunks must form a
+ * tree, a star or a chain.
+ */
+
+#define TRUNK_HELLO_INTERVAL 1000
+
+// The timestamp keeps up with the clock between hellos, at 8 kHz.
+#define TRUNK_HELLO_TIMESTAMP_STEP (TRUNK_HELLO_INTERVAL * 8)
+
+// 20 ms of G.726 at 32 kbit/s. Code 0 is no change, so all zeros are silence.
+#define TRUNK_HELLO_PAYLOAD_SIZE 80
+#define TRUNK_RTP_HEADER_SIZE    12
+
+typedef struct {
+	// The peer's room, in host order.
+	guint32 address;
+	guint16 port;
+
+	// Of the hellos sent so far, on the room's worker.
+	guint16 sequence;
+	guint32 timestamp;
+} Trunk;
+
+// "HOST:PORT" with an IPv4 HOST, the peer's first room's port.
+gboolean trunk_parse(const gchar* text, Trunk* trunk){
+	const gchar* colon = strrchr (text, ':');
+	if (!colon){
+		return FALSE;
+	}
+
+	gchar* host = g_strndup (text, colon - text);
+	struct in_addr address;
+	gboolean valid = inet_aton (host, &address);
+	g_free (host);
+
+	gchar* end;
+	long port = strtol (colon + 1, &end, 10);
+	if (!valid || *end || port < 1 || port > G_MAXUINT16){
+		return FALSE;
+	}
+
+	memset (trunk, 0, sizeof (Trunk));
+	trunk->address = ntohl (address.s_addr);
+	trunk->port    = (guint16) port;
+	trunk->sequence  = (guint16) g_random_int ();
+	trunk->timestamp = g_random_int ();
+	return TRUE;
+}
+
+gboolean trunk_isPeer(const Trunk* trunk, guint32 address, guint16 port){
+	return trunk->address == address && trunk->port == port;
+}
+
+void trunk_sendHello(Trunk* trunk, int sockfd, guint32 ssrc, guint payload){
+	guint8 packet[TRUNK_RTP_HEADER_SIZE + TRUNK_HELLO_PAYLOAD_SIZE];
+	memset (packet, 0, sizeof (packet));
+
+	packet[0] = 0x80;
+	packet[1] = payload;
+	GST_WRITE_UINT16_BE (packet + 2, trunk->sequence);
+	GST_WRITE_UINT32_BE (packet + 4, trunk->timestamp);
+	GST_WRITE_UINT32_BE (packet + 8, ssrc);
+
+	struct sockaddr_in to;
+	memset (&to, 0, sizeof (to));
+	to.sin_family      = AF_INET;
+	to.sin_addr.s_addr = htonl (trunk->address);
+	to.sin_port        = htons (trunk->port);
+
+	if (sendto (sockfd, packet, sizeof (packet), 0, (struct sockaddr*) &to, sizeof (to)) < 0){
+		return;
+	}
+
+	trunk->sequence++;
+	trunk->timestamp += TRUNK_HELLO_TIMESTAMP_STEP;
+}
+
+#endif
@@ -1,6 +1,9 @@
 #include "common.c"
 
 void createUdpSource();
+static gboolean printFramingStats (gpointer data);
+
+#define FRAMING_STATS_INTERVAL 5
 
 void createElements(){
 	pipeline = gst_pipeline_new ("audio-echo-receive");
@@ -11,4 +14,35 @@ void createElements(){
 void createUdpSource(){
 	source = gst_element_factory_make ("udpsrc", "net-input");
 	g_object_set (G_OBJECT (source), "port", UDP_PORT, NULL);
+
+	if (ptime){
+		GstCaps* caps = gst_caps_from_string (RAW_FRAME_CAPS);
+		g_object_set (G_OBJECT (source), "caps", caps, NULL);
+		gst_caps_unref (caps);
+	}
+}
+
+void createFramer(){
+	framer = gst_element_factory_make ("rawdeframer", "deframer");
+	if (!framer){
+		return;
+	}
+
+	GstCaps* caps = createAudioCaps();
+	g_object_set (G_OBJECT (framer), "caps", caps, "ptime", ptime, "depth", reorderDepth, NULL);
+	gst_caps_unref (caps);
+
+	g_timeout_add_seconds (FRAMING_STATS_INTERVAL, printFramingStats, NULL);
+}
+
+gboolean linkFramed(GstCaps* caps){
+	return gst_element_link (source, framer)
+		&& gst_element_link_filtered (framer, sink, caps);
+}
+
+static gboolean printFramingStats (gpointer data){
+	gint lost, late, reordered;
+	g_object_get (G_OBJECT (framer), "frames-lost", &lost, "frames-late", &late, "frames-reordered", &reordered, NULL);
+	g_print ("Frames lost: %d, late: %d, reordered: %d.\n", lost, late, reordered);
+	return TRUE;
 }
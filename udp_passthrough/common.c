@@ -1,11 +1,20 @@
 #include <stdio.h>
 #include <gst/gst.h>
 
+#include "latencyTracer.h"
+#include "rawFramer.h"
+#include "rawDeframer.h"
+
+void getParameters(int argc, char *argv[]);
+
 void createElementsOrExit();
 void createElements();			// a pseudo-abstract method
+void createFramer();			// a pseudo-abstract method
 void exitOnInvalidElement();
 
+GstCaps* createAudioCaps();
 void linkSourceAndSink();
+gboolean linkFramed(GstCaps* caps);	// a pseudo-abstract method
 
 void registerBusCall();
 static gboolean busCall (GstBus *bus, GstMessage *msg, gpointer data);
@@ -19,8 +28,27 @@ GMainLoop *loop;
 
 GstElement *pipeline, *source, *sink;
 
+// With --ptime the audio goes in fixed frames, see rawFrame.h: the sender
+// frames it, the receiver puts the frames back in order.
+GstElement *framer;
+
+int ptime = 0;
+int reorderDepth = RAW_DEFRAMER_DEFAULT_DEPTH;
+
+static GOptionEntry options[] = {
+	{ "ptime", 'p', 0, G_OPTION_ARG_INT, &ptime,
+		"Send 5, 10 or 20 ms frames with sequence numbers instead of bare audio", "MS" },
+	{ "reorder-depth", 'r', 0, G_OPTION_ARG_INT, &reorderDepth,
+		"Frames the receiver holds back to reorder packets (default: 2)", "N" },
+	{ NULL }
+};
+
 int main(int argc, char *argv[]) {
     gst_init(NULL, NULL);
+	gst_raw_framer_register();
+	gst_raw_deframer_register();
+
+	getParameters(argc, argv);
 	
 	loop = g_main_loop_new (NULL, FALSE);
 
@@ -28,8 +56,12 @@ int main(int argc, char *argv[]) {
 	registerBusCall();
 
 	gst_bin_add_many (GST_BIN (pipeline), source, sink, NULL);
+	if (framer){
+		gst_bin_add (GST_BIN (pipeline), framer);
+	}
 
 	linkSourceAndSink();
+	latencyTracer_attach(pipeline);
 
 	runLoop();
 	cleanUp(); // Under normal conditions this method will never be called
@@ -37,31 +69,63 @@ int main(int argc, char *argv[]) {
     return 0;
 }
 
+void getParameters(int argc, char *argv[]){
+	GError* error = 0;
+	GOptionContext* context = g_option_context_new (NULL);
+	g_option_context_add_main_entries (context, options, NULL);
+
+	if (!g_option_context_parse (context, &argc, &argv, &error)){
+		g_printerr ("%s\n", error->message);
+		exit(-3);
+	}
+	g_option_context_free (context);
+
+	if (ptime != 0 && ptime != 5 && ptime != 10 && ptime != 20){
+		g_printerr ("Invalid ptime: %d ms.\n", ptime);
+		exit(-3);
+	}
+	if (reorderDepth < 0 || reorderDepth > RAW_DEFRAMER_MAX_DEPTH){
+		g_printerr ("Invalid reorder depth: %d.\n", reorderDepth);
+		exit(-3);
+	}
+	if (ptime){
+		g_print ("Framed audio: %d ms per packet.\n", ptime);
+	}
+}
+
 void createElementsOrExit(){
 	g_print ("Creating elements.\n");
 	createElements();
+	if (ptime){
+		createFramer();
+	}
 	g_print ("Checking elements.\n");
 	exitOnInvalidElement();
 }
 
 void exitOnInvalidElement(){
-	if (!pipeline || !source || !sink) {
+	if (!pipeline || !source || !sink || (ptime && !framer)) {
 		g_printerr ("One element could not be created. Exiting.\n");
 		exit(-1);
 	}
 }
 
-void linkSourceAndSink(){
-	GstCaps *caps = gst_caps_new_simple (
+GstCaps* createAudioCaps(){
+	return gst_caps_new_simple (
 		"audio/x-raw-int",	     
 		"rate",       G_TYPE_INT, 22050,
+		"width",      G_TYPE_INT, 16,
 		"depth",      G_TYPE_INT, 16,
 		"endianness", G_TYPE_INT, 4321,
 		"channels",   G_TYPE_INT, 1,
 		"signed",     G_TYPE_BOOLEAN, TRUE,
 		NULL);
+}
+
+void linkSourceAndSink(){
+	GstCaps *caps = createAudioCaps();
 
-	gboolean link_ok = gst_element_link_filtered (source, sink, caps);
+	gboolean link_ok = framer ? linkFramed(caps) : gst_element_link_filtered (source, sink, caps);
 
 	if (!link_ok) {
     	g_printerr ("Failed to link source and sink.");
@@ -120,6 +184,7 @@ void runLoop(){
 void cleanUp(){
 	g_print ("Returned, stopping playback\n");
 	gst_element_set_state (pipeline, GST_STATE_NULL);
+	latencyTracer_dump();
 
 	g_print ("Deleting pipeline\n");
 	gst_object_unref (GST_OBJECT (pipeline));
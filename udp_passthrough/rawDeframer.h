@@ -0,0 +1,474 @@
+#ifndef RAW_DEFRAMER_H
+#define RAW_DEFRAMER_H
+
+#include <string.h>
+#include <gst/gst.h>
+
+#include "rawFrame.h"
+
+/*
+ * "rawdeframer" - turns the packets of rawframer (see rawFrame.h) back into
+ * 16-bit raw audio of the format given in "caps", in order and without gaps.
+ *
+ * Arriving frames are held in a window "depth" frames deep. A frame is
+ * played once a frame "depth" sequence numbers newer has arrived, so a
+ * packet overtaken by up to "depth" later ones is still put back in place
+ * ("frames-reordered"). A frame that has not arrived by then is concealed
+ * ("frames-lost"): the last frame is repeated at half the level each time,
+ * and after RAW_DEFRAMER_MAX_REPEATS repetitions silence is played. A frame
+ * arriving after its turn, or twice, is dropped ("frames-late").
+ *
+ * The window is filled by arrivals rather than by a clock, so the added
+ * latency is a fixed "depth" times ptime, which is answered to latency
+ * queries. Output is stamped with the arrival time of the first packet plus
+ * the sender's timestamp since, so jitter and reordering do not show in the
+ * timestamps. A jump of the sequence number ahead past the window restarts
+ * it. A packet from further back than the window is late as well, unless
+ * RAW_DEFRAMER_MAX_STALE of them arrive in a row, as from a sender restarted
+ * at a lower sequence number: then the window restarts at the last one.
+ *
+ * Output samples must be 16 bit; concealment needs their byte order.
+ */
+
+#define RAW_DEFRAMER_DEFAULT_DEPTH 2
+#define RAW_DEFRAMER_MAX_DEPTH     32
+#define RAW_DEFRAMER_WINDOW        64
+#define RAW_DEFRAMER_MAX_REPEATS   3
+#define RAW_DEFRAMER_MAX_STALE     8
+
+#define GST_TYPE_RAW_DEFRAMER (gst_raw_deframer_get_type())
+#define GST_RAW_DEFRAMER(obj) (G_TYPE_CHECK_INSTANCE_CAST((obj), GST_TYPE_RAW_DEFRAMER, GstRawDeframer))
+
+typedef struct _GstRawDeframer      GstRawDeframer;
+typedef struct _GstRawDeframerClass GstRawDeframerClass;
+
+typedef struct {
+	gboolean present;
+	guint32 timestamp;
+	guint8* data;
+} RawDeframerSlot;
+
+struct _GstRawDeframer {
+	GstElement element;
+
+	GstPad* sinkpad;
+	GstPad* srcpad;
+
+	GstCaps* caps;
+	guint ptime;
+	guint depth;
+
+	// Only touched with the stream lock held.
+	gint rate;
+	gboolean littleEndian;
+	guint frameSamples;
+	guint frameBytes;
+	RawDeframerSlot slots[RAW_DEFRAMER_WINDOW];
+	gboolean started;
+	guint16 next;
+	guint16 newest;
+	guint32 baseTimestamp;
+	GstClockTime baseTime;
+	guint32 lastTimestamp;
+	guint8* lastFrame;
+	guint repeats;
+	guint staleRun;
+
+	volatile gint framesLost;
+	volatile gint framesLate;
+	volatile gint framesReordered;
+};
+
+struct _GstRawDeframerClass {
+	GstElementClass parent_class;
+};
+
+enum {
+	RAW_DEFRAMER_PROP_0,
+	RAW_DEFRAMER_PROP_CAPS,
+	RAW_DEFRAMER_PROP_PTIME,
+	RAW_DEFRAMER_PROP_DEPTH,
+	RAW_DEFRAMER_PROP_FRAMES_LOST,
+	RAW_DEFRAMER_PROP_FRAMES_LATE,
+	RAW_DEFRAMER_PROP_FRAMES_REORDERED
+};
+
+static GstStaticPadTemplate gst_raw_deframer_sink_template = GST_STATIC_PAD_TEMPLATE ("sink",
+	GST_PAD_SINK, GST_PAD_ALWAYS, GST_STATIC_CAPS (RAW_FRAME_CAPS));
+
+static GstStaticPadTemplate gst_raw_deframer_src_template = GST_STATIC_PAD_TEMPLATE ("src",
+	GST_PAD_SRC, GST_PAD_ALWAYS, GST_STATIC_CAPS ("audio/x-raw-int, width = (int) 16, depth = (int) 16"));
+
+// Defined with G_DEFINE_TYPE rather than GST_BOILERPLATE, whose file-wide
+// parent_class would clash with the other elements built into a program.
+G_DEFINE_TYPE (GstRawDeframer, gst_raw_deframer, GST_TYPE_ELEMENT);
+
+static void gst_raw_deframer_set_property (GObject* object, guint id, const GValue* value, GParamSpec* pspec);
+static void gst_raw_deframer_get_property (GObject* object, guint id, GValue* value, GParamSpec* pspec);
+static void gst_raw_deframer_finalize (GObject* object);
+static GstFlowReturn gst_raw_deframer_chain (GstPad* pad, GstBuffer* buffer);
+static gboolean gst_raw_deframer_sink_event (GstPad* pad, GstEvent* event);
+static gboolean gst_raw_deframer_src_query (GstPad* pad, GstQuery* query);
+static GstStateChangeReturn gst_raw_deframer_change_state (GstElement* element, GstStateChange transition);
+
+static void gst_raw_deframer_class_init (GstRawDeframerClass* klass){
+	GObjectClass*    gobject_class = G_OBJECT_CLASS (klass);
+	GstElementClass* element_class = GST_ELEMENT_CLASS (klass);
+
+	gst_element_class_add_pad_template (element_class, gst_static_pad_template_get (&gst_raw_deframer_sink_template));
+	gst_element_class_add_pad_template (element_class, gst_static_pad_template_get (&gst_raw_deframer_src_template));
+
+	gst_element_class_set_details_simple (element_class,
+		"Raw audio deframer", "Codec/Depayloader/Network",
+		"Reorders fixed-ptime raw audio frames and conceals lost ones",
+		"GStreamer Audio Echo");
+
+	gobject_class->set_property = gst_raw_deframer_set_property;
+	gobject_class->get_property = gst_raw_deframer_get_property;
+	gobject_class->finalize     = gst_raw_deframer_finalize;
+
+	g_object_class_install_property (gobject_class, RAW_DEFRAMER_PROP_CAPS,
+		g_param_spec_boxed ("caps", "Caps",
+			"Format of the framed audio", GST_TYPE_CAPS, G_PARAM_READWRITE));
+
+	g_object_class_install_property (gobject_class, RAW_DEFRAMER_PROP_PTIME,
+		g_param_spec_uint ("ptime", "Packet time",
+			"Audio carried by one packet (ms); packets of another are dropped", 1, 255,
+			10, G_PARAM_READWRITE));
+
+	g_object_class_install_property (gobject_class, RAW_DEFRAMER_PROP_DEPTH,
+		g_param_spec_uint ("depth", "Depth",
+			"Frames held back to put reordered packets in place", 0, RAW_DEFRAMER_MAX_DEPTH,
+			RAW_DEFRAMER_DEFAULT_DEPTH, G_PARAM_READWRITE));
+
+	g_object_class_install_property (gobject_class, RAW_DEFRAMER_PROP_FRAMES_LOST,
+		g_param_spec_int ("frames-lost", "Frames lost",
+			"Frames which did not arrive in time and were concealed", 0, G_MAXINT, 0, G_PARAM_READABLE));
+
+	g_object_class_install_property (gobject_class, RAW_DEFRAMER_PROP_FRAMES_LATE,
+		g_param_spec_int ("frames-late", "Frames late",
+			"Frames dropped as they arrived after their turn or twice", 0, G_MAXINT, 0, G_PARAM_READABLE));
+
+	g_object_class_install_property (gobject_class, RAW_DEFRAMER_PROP_FRAMES_REORDERED,
+		g_param_spec_int ("frames-reordered", "Frames reordered",
+			"Frames which arrived after a newer one and were put back in place", 0, G_MAXINT, 0, G_PARAM_READABLE));
+
+	element_class->change_state = GST_DEBUG_FUNCPTR (gst_raw_deframer_change_state);
+}
+
+static void gst_raw_deframer_free_frames (GstRawDeframer* deframer){
+	guint i;
+	for (i = 0; i < RAW_DEFRAMER_WINDOW; i++){
+		g_free (deframer->slots[i].data);
+		deframer->slots[i].data    = 0;
+		deframer->slots[i].present = FALSE;
+	}
+	g_free (deframer->lastFrame);
+	deframer->lastFrame  = 0;
+	deframer->frameBytes = 0;
+}
+
+static void gst_raw_deframer_reset (GstRawDeframer* deframer){
+	guint i;
+	for (i = 0; i < RAW_DEFRAMER_WINDOW; i++){
+		deframer->slots[i].present = FALSE;
+	}
+	deframer->started  = FALSE;
+	deframer->repeats  = RAW_DEFRAMER_MAX_REPEATS;
+	deframer->staleRun = 0;
+}
+
+static void gst_raw_deframer_init (GstRawDeframer* deframer){
+	deframer->sinkpad = gst_pad_new_from_static_template (&gst_raw_deframer_sink_template, "sink");
+	gst_pad_set_chain_function (deframer->sinkpad, GST_DEBUG_FUNCPTR (gst_raw_deframer_chain));
+	gst_pad_set_event_function (deframer->sinkpad, GST_DEBUG_FUNCPTR (gst_raw_deframer_sink_event));
+	gst_element_add_pad (GST_ELEMENT (deframer), deframer->sinkpad);
+
+	deframer->srcpad = gst_pad_new_from_static_template (&gst_raw_deframer_src_template, "src");
+	gst_pad_use_fixed_caps (deframer->srcpad);
+	gst_pad_set_query_function (deframer->srcpad, GST_DEBUG_FUNCPTR (gst_raw_deframer_src_query));
+	gst_element_add_pad (GST_ELEMENT (deframer), deframer->srcpad);
+
+	deframer->caps  = 0;
+	deframer->ptime = 10;
+	deframer->depth = RAW_DEFRAMER_DEFAULT_DEPTH;
+
+	memset (deframer->slots, 0, sizeof (deframer->slots));
+	deframer->lastFrame  = 0;
+	deframer->frameBytes = 0;
+	deframer->baseTime   = GST_CLOCK_TIME_NONE;
+	gst_raw_deframer_reset (deframer);
+
+	deframer->framesLost      = 0;
+	deframer->framesLate      = 0;
+	deframer->framesReordered = 0;
+}
+
+static void gst_raw_deframer_set_property (GObject* object, guint id, const GValue* value, GParamSpec* pspec){
+	GstRawDeframer* deframer = GST_RAW_DEFRAMER (object);
+
+	switch (id) {
+		case RAW_DEFRAMER_PROP_CAPS: {
+			const GstCaps* caps = gst_value_get_caps (value);
+			if (deframer->caps){
+				gst_caps_unref (deframer->caps);
+			}
+			deframer->caps = caps ? gst_caps_copy (caps) : 0;
+			break;
+		}
+		case RAW_DEFRAMER_PROP_PTIME:
+			deframer->ptime = g_value_get_uint (value);
+			break;
+		case RAW_DEFRAMER_PROP_DEPTH:
+			deframer->depth = g_value_get_uint (value);
+			break;
+		default:
+			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, id, pspec);
+			break;
+	}
+}
+
+static void gst_raw_deframer_get_property (GObject* object, guint id, GValue* value, GParamSpec* pspec){
+	GstRawDeframer* deframer = GST_RAW_DEFRAMER (object);
+
+	switch (id) {
+		case RAW_DEFRAMER_PROP_CAPS:
+			gst_value_set_caps (value, deframer->caps);
+			break;
+		case RAW_DEFRAMER_PROP_PTIME:
+			g_value_set_uint (value, deframer->ptime);
+			break;
+		case RAW_DEFRAMER_PROP_DEPTH:
+			g_value_set_uint (value, deframer->depth);
+			break;
+		case RAW_DEFRAMER_PROP_FRAMES_LOST:
+			g_value_set_int (value, g_atomic_int_get (&deframer->framesLost));
+			break;
+		case RAW_DEFRAMER_PROP_FRAMES_LATE:
+			g_value_set_int (value, g_atomic_int_get (&deframer->framesLate));
+			break;
+		case RAW_DEFRAMER_PROP_FRAMES_REORDERED:
+			g_value_set_int (value, g_atomic_int_get (&deframer->framesReordered));
+			break;
+		default:
+			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, id, pspec);
+			break;
+	}
+}
+
+static void gst_raw_deframer_finalize (GObject* object){
+	GstRawDeframer* deframer = GST_RAW_DEFRAMER (object);
+
+	gst_raw_deframer_free_frames (deframer);
+	if (deframer->caps){
+		gst_caps_unref (deframer->caps);
+	}
+	G_OBJECT_CLASS (gst_raw_deframer_parent_class)->finalize (object);
+}
+
+/*
+ * Takes the frame size from "caps" and "ptime" and sets the output caps.
+ * The window's frames are allocated once here.
+ */
+static gboolean gst_raw_deframer_negotiate (GstRawDeframer* deframer){
+	if (!deframer->caps || !gst_caps_is_fixed (deframer->caps)){
+		g_printerr ("Raw deframer: fixed caps are needed.\n");
+		return FALSE;
+	}
+
+	GstStructure* structure = gst_caps_get_structure (deframer->caps, 0);
+	gint rate, channels, endianness;
+	if (!gst_structure_get_int (structure, "rate", &rate)
+			|| !gst_structure_get_int (structure, "channels", &channels)
+			|| !gst_structure_get_int (structure, "endianness", &endianness)){
+		return FALSE;
+	}
+	if (!gst_pad_set_caps (deframer->srcpad, deframer->caps)){
+		return FALSE;
+	}
+
+	deframer->rate         = rate;
+	deframer->littleEndian = endianness == G_LITTLE_ENDIAN;
+	deframer->frameSamples = rawFrame_samples(rate, deframer->ptime);
+	deframer->frameBytes   = deframer->frameSamples * channels * 2;
+
+	guint i;
+	for (i = 0; i < RAW_DEFRAMER_WINDOW; i++){
+		deframer->slots[i].data = g_malloc (deframer->frameBytes);
+	}
+	deframer->lastFrame = g_malloc0 (deframer->frameBytes);
+	return TRUE;
+}
+
+// The last frame played, at half its level, in the sample byte order.
+static void gst_raw_deframer_fade (GstRawDeframer* deframer){
+	guint8* data = deframer->lastFrame;
+	guint i;
+	for (i = 0; i < deframer->frameBytes; i += 2){
+		if (deframer->littleEndian){
+			GST_WRITE_UINT16_LE (data + i, (guint16) ((gint16) GST_READ_UINT16_LE (data + i) / 2));
+		} else {
+			GST_WRITE_UINT16_BE (data + i, (guint16) ((gint16) GST_READ_UINT16_BE (data + i) / 2));
+		}
+	}
+}
+
+/*
+ * Plays the frame whose turn it is, or conceals it. Concealment keeps
+ * fading the last frame played, which is silent after a few repeats.
+ */
+static GstFlowReturn gst_raw_deframer_play_next (GstRawDeframer* deframer){
+	RawDeframerSlot* slot = &deframer->slots[deframer->next % RAW_DEFRAMER_WINDOW];
+	guint32 timestamp;
+
+	if (slot->present){
+		slot->present = FALSE;
+		timestamp = slot->timestamp;
+		memcpy (deframer->lastFrame, slot->data, deframer->frameBytes);
+		deframer->repeats = 0;
+	} else {
+		timestamp = deframer->lastTimestamp + deframer->frameSamples;
+		if (deframer->repeats < RAW_DEFRAMER_MAX_REPEATS){
+			deframer->repeats++;
+			gst_raw_deframer_fade (deframer);
+		} else {
+			memset (deframer->lastFrame, 0, deframer->frameBytes);
+		}
+		g_atomic_int_inc (&deframer->framesLost);
+	}
+
+	deframer->lastTimestamp = timestamp;
+	deframer->next++;
+
+	GstBuffer* buffer = gst_buffer_new_and_alloc (deframer->frameBytes);
+	memcpy (GST_BUFFER_DATA (buffer), deframer->lastFrame, deframer->frameBytes);
+	GST_BUFFER_TIMESTAMP (buffer) = deframer->baseTime
+		+ gst_util_uint64_scale ((guint32) (timestamp - deframer->baseTimestamp), GST_SECOND, deframer->rate);
+	GST_BUFFER_DURATION (buffer) = gst_util_uint64_scale (deframer->frameSamples, GST_SECOND, deframer->rate);
+	gst_buffer_set_caps (buffer, deframer->caps);
+
+	return gst_pad_push (deframer->srcpad, buffer);
+}
+
+/*
+ * Starts the window at a packet: the first one, or one far ahead of the
+ * window or ending a run of stale ones, as from a restarted sender.
+ * Timestamps start again from its arrival.
+ */
+static void gst_raw_deframer_start (GstRawDeframer* deframer, const RawFrameHeader* header, GstClockTime arrival){
+	gst_raw_deframer_reset (deframer);
+	deframer->started = TRUE;
+	deframer->next    = header->sequence;
+	deframer->newest  = header->sequence;
+
+	if (GST_CLOCK_TIME_IS_VALID (arrival) || !GST_CLOCK_TIME_IS_VALID (deframer->baseTime)){
+		deframer->baseTime = GST_CLOCK_TIME_IS_VALID (arrival) ? arrival : 0;
+	}
+	deframer->baseTimestamp = header->timestamp;
+	deframer->lastTimestamp = header->timestamp - deframer->frameSamples;
+}
+
+static GstFlowReturn gst_raw_deframer_chain (GstPad* pad, GstBuffer* buffer){
+	GstRawDeframer* deframer = GST_RAW_DEFRAMER (GST_PAD_PARENT (pad));
+
+	if (!deframer->frameBytes && !gst_raw_deframer_negotiate (deframer)){
+		gst_buffer_unref (buffer);
+		return GST_FLOW_NOT_NEGOTIATED;
+	}
+
+	RawFrameHeader header;
+	if (!rawFrame_readHeader(GST_BUFFER_DATA (buffer), GST_BUFFER_SIZE (buffer), &header)
+			|| header.ptime != deframer->ptime
+			|| GST_BUFFER_SIZE (buffer) != RAW_FRAME_HEADER_SIZE + deframer->frameBytes){
+		gst_buffer_unref (buffer);
+		return GST_FLOW_OK;
+	}
+
+	gint ahead = (gint16) (header.sequence - deframer->next);
+	gboolean stale = deframer->started && ahead < -RAW_DEFRAMER_WINDOW;
+	deframer->staleRun = stale ? deframer->staleRun + 1 : 0;
+
+	if (!deframer->started || ahead >= RAW_DEFRAMER_WINDOW || deframer->staleRun >= RAW_DEFRAMER_MAX_STALE){
+		gst_raw_deframer_start (deframer, &header, GST_BUFFER_TIMESTAMP (buffer));
+		ahead = 0;
+	}
+
+	RawDeframerSlot* slot = &deframer->slots[header.sequence % RAW_DEFRAMER_WINDOW];
+	if (ahead < 0 || slot->present){
+		g_atomic_int_inc (&deframer->framesLate);
+		gst_buffer_unref (buffer);
+		return GST_FLOW_OK;
+	}
+
+	slot->present   = TRUE;
+	slot->timestamp = header.timestamp;
+	memcpy (slot->data, GST_BUFFER_DATA (buffer) + RAW_FRAME_HEADER_SIZE, deframer->frameBytes);
+	gst_buffer_unref (buffer);
+
+	if ((gint16) (header.sequence - deframer->newest) > 0){
+		deframer->newest = header.sequence;
+	} else if (header.sequence != deframer->newest){
+		g_atomic_int_inc (&deframer->framesReordered);
+	}
+
+	GstFlowReturn result = GST_FLOW_OK;
+	while (result == GST_FLOW_OK && (gint16) (deframer->newest - deframer->next) >= (gint) deframer->depth){
+		result = gst_raw_deframer_play_next (deframer);
+	}
+	return result;
+}
+
+static gboolean gst_raw_deframer_sink_event (GstPad* pad, GstEvent* event){
+	GstRawDeframer* deframer = GST_RAW_DEFRAMER (GST_PAD_PARENT (pad));
+
+	if (GST_EVENT_TYPE (event) == GST_EVENT_FLUSH_STOP){
+		gst_raw_deframer_reset (deframer);
+	}
+	return gst_pad_push_event (deframer->srcpad, event);
+}
+
+// The window adds its depth to the latency upstream reports.
+static gboolean gst_raw_deframer_src_query (GstPad* pad, GstQuery* query){
+	GstRawDeframer* deframer = GST_RAW_DEFRAMER (GST_PAD_PARENT (pad));
+
+	if (GST_QUERY_TYPE (query) != GST_QUERY_LATENCY){
+		return gst_pad_query_default (pad, query);
+	}
+	if (!gst_pad_peer_query (deframer->sinkpad, query)){
+		return FALSE;
+	}
+
+	gboolean live;
+	GstClockTime min, max;
+	gst_query_parse_latency (query, &live, &min, &max);
+
+	GstClockTime window = deframer->depth * deframer->ptime * GST_MSECOND;
+	min += window;
+	if (GST_CLOCK_TIME_IS_VALID (max)){
+		max += window;
+	}
+	gst_query_set_latency (query, live, min, max);
+	return TRUE;
+}
+
+static GstStateChangeReturn gst_raw_deframer_change_state (GstElement* element, GstStateChange transition){
+	GstRawDeframer* deframer = GST_RAW_DEFRAMER (element);
+
+	if (transition == GST_STATE_CHANGE_READY_TO_PAUSED){
+		gst_raw_deframer_reset (deframer);
+		deframer->baseTime = GST_CLOCK_TIME_NONE;
+	}
+
+	GstStateChangeReturn result = GST_ELEMENT_CLASS (gst_raw_deframer_parent_class)->change_state (element, transition);
+
+	if (transition == GST_STATE_CHANGE_PAUSED_TO_READY){
+		gst_raw_deframer_free_frames (deframer);
+	}
+	return result;
+}
+
+void gst_raw_deframer_register (){
+	gst_element_register (NULL, "rawdeframer", GST_RANK_NONE, GST_TYPE_RAW_DEFRAMER);
+}
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef RAW_FRAME_H
+#define RAW_FRAME_H
+
+#include <gst/gst.h>
+
+/*
+ * The framed raw format: every UDP packet carries exactly one ptime of raw
+ * audio behind an 8 byte header, all fields big-endian:
+ *
+ *   0      1      2             4                           8
+ *   +------+------+-------------+---------------------------+-------
+ *   | ver  | ptime| sequence    | timestamp                 | audio
+ *   +------+------+-------------+---------------------------+-------
+ *
+ * - ver is RAW_FRAME_VERSION;
+ * - ptime is the frame duration in milliseconds;
+ * - sequence counts packets and wraps at 16 bits;
+ * - timestamp counts samples (per channel) and wraps at 32 bits.
+ *
+ * A frame holds the ptime rounded to whole samples, 221 samples for 10 ms at
+ * 22050 Hz, so packets are all the same size and come at a fixed rate. The
+ * audio format itself is agreed on out of band.
+ */
+
+#define RAW_FRAME_VERSION     1
+#define RAW_FRAME_HEADER_SIZE 8
+
+// An Ethernet MTU less the IPv4 and UDP headers: a frame must not fragment.
+#define RAW_FRAME_MAX_PACKET  1472
+
+#define RAW_FRAME_CAPS "application/x-framed-audio"
+
+typedef struct {
+	guint ptime;
+	guint16 sequence;
+	guint32 timestamp;
+} RawFrameHeader;
+
+guint rawFrame_samples(gint rate, guint ptime){
+	return (rate * ptime + 500) / 1000;
+}
+
+void rawFrame_writeHeader(guint8* data, const RawFrameHeader* header){
+	data[0] = RAW_FRAME_VERSION;
+	data[1] = header->ptime;
+	GST_WRITE_UINT16_BE (data + 2, header->sequence);
+	GST_WRITE_UINT32_BE (data + 4, header->timestamp);
+}
+
+// Returns FALSE for anything that is not a framed raw packet.
+gboolean rawFrame_readHeader(const guint8* data, guint size, RawFrameHeader* header){
+	if (size < RAW_FRAME_HEADER_SIZE || data[0] != RAW_FRAME_VERSION){
+		return FALSE;
+	}
+	header->ptime     = data[1];
+	header->sequence  = GST_READ_UINT16_BE (data + 2);
+	header->timestamp = GST_READ_UINT32_BE (data + 4);
+	return TRUE;
+}
+
+#endif
@@ -0,0 +1,257 @@
+#ifndef RAW_FRAMER_H
+#define RAW_FRAMER_H
+
+#include <gst/gst.h>
+#include <gst/base/gstadapter.h>
+
+#include "rawFrame.h"
+
+/*
+ * "rawframer" - cuts 16-bit raw audio into frames of "ptime" milliseconds
+ * and puts the header of rawFrame.h in front of each, one packet per frame.
+ *
+ * Whatever buffer sizes the source produces, the packets all carry one
+ * frame, so the packet rate is fixed and no packet exceeds
+ * RAW_FRAME_MAX_PACKET: caps whose frame would not fit are refused. Packets
+ * are stamped with the capture time of their first sample.
+ */
+
+#define RAW_FRAMER_DEFAULT_PTIME 10
+
+#define RAW_FRAMER_SINK_CAPS \
+	"audio/x-raw-int, "          \
+	"width = (int) 16, "          \
+	"depth = (int) 16, "          \
+	"signed = (boolean) true, "   \
+	"rate = (int) [ 1, MAX ], "   \
+	"channels = (int) [ 1, MAX ]"
+
+#define GST_TYPE_RAW_FRAMER (gst_raw_framer_get_type())
+#define GST_RAW_FRAMER(obj) (G_TYPE_CHECK_INSTANCE_CAST((obj), GST_TYPE_RAW_FRAMER, GstRawFramer))
+
+typedef struct _GstRawFramer      GstRawFramer;
+typedef struct _GstRawFramerClass GstRawFramerClass;
+
+struct _GstRawFramer {
+	GstElement element;
+
+	GstPad* sinkpad;
+	GstPad* srcpad;
+
+	guint ptime;
+
+	// Only touched with the stream lock held.
+	GstAdapter* adapter;
+	gint rate;
+	guint frameSamples;
+	guint frameBytes;
+	guint16 sequence;
+	guint32 timestamp;
+	GstClockTime adapterTime;
+	guint64 adapterSamples;
+};
+
+struct _GstRawFramerClass {
+	GstElementClass parent_class;
+};
+
+enum {
+	RAW_FRAMER_PROP_0,
+	RAW_FRAMER_PROP_PTIME
+};
+
+static GstStaticPadTemplate gst_raw_framer_sink_template = GST_STATIC_PAD_TEMPLATE ("sink",
+	GST_PAD_SINK, GST_PAD_ALWAYS, GST_STATIC_CAPS (RAW_FRAMER_SINK_CAPS));
+
+static GstStaticPadTemplate gst_raw_framer_src_template = GST_STATIC_PAD_TEMPLATE ("src",
+	GST_PAD_SRC, GST_PAD_ALWAYS, GST_STATIC_CAPS (RAW_FRAME_CAPS));
+
+// Defined with G_DEFINE_TYPE rather than GST_BOILERPLATE, whose file-wide
+// parent_class would clash with the other elements built into a program.
+G_DEFINE_TYPE (GstRawFramer, gst_raw_framer, GST_TYPE_ELEMENT);
+
+static void gst_raw_framer_set_property (GObject* object, guint id, const GValue* value, GParamSpec* pspec);
+static void gst_raw_framer_get_property (GObject* object, guint id, GValue* value, GParamSpec* pspec);
+static void gst_raw_framer_finalize (GObject* object);
+static gboolean gst_raw_framer_set_caps (GstPad* pad, GstCaps* caps);
+static GstFlowReturn gst_raw_framer_chain (GstPad* pad, GstBuffer* buffer);
+static gboolean gst_raw_framer_sink_event (GstPad* pad, GstEvent* event);
+static GstStateChangeReturn gst_raw_framer_change_state (GstElement* element, GstStateChange transition);
+
+static void gst_raw_framer_class_init (GstRawFramerClass* klass){
+	GObjectClass*    gobject_class = G_OBJECT_CLASS (klass);
+	GstElementClass* element_class = GST_ELEMENT_CLASS (klass);
+
+	gst_element_class_add_pad_template (element_class, gst_static_pad_template_get (&gst_raw_framer_sink_template));
+	gst_element_class_add_pad_template (element_class, gst_static_pad_template_get (&gst_raw_framer_src_template));
+
+	gst_element_class_set_details_simple (element_class,
+		"Raw audio framer", "Codec/Payloader/Network",
+		"Packs raw audio into fixed-ptime frames with sequence numbers",
+		"GStreamer Audio Echo");
+
+	gobject_class->set_property = gst_raw_framer_set_property;
+	gobject_class->get_property = gst_raw_framer_get_property;
+	gobject_class->finalize     = gst_raw_framer_finalize;
+
+	g_object_class_install_property (gobject_class, RAW_FRAMER_PROP_PTIME,
+		g_param_spec_uint ("ptime", "Packet time",
+			"Audio carried by one packet (ms)", 1, 255,
+			RAW_FRAMER_DEFAULT_PTIME, G_PARAM_READWRITE));
+
+	element_class->change_state = GST_DEBUG_FUNCPTR (gst_raw_framer_change_state);
+}
+
+static void gst_raw_framer_reset (GstRawFramer* framer){
+	gst_adapter_clear (framer->adapter);
+	framer->sequence       = 0;
+	framer->timestamp      = 0;
+	framer->adapterTime    = GST_CLOCK_TIME_NONE;
+	framer->adapterSamples = 0;
+}
+
+static void gst_raw_framer_init (GstRawFramer* framer){
+	framer->sinkpad = gst_pad_new_from_static_template (&gst_raw_framer_sink_template, "sink");
+	gst_pad_set_setcaps_function (framer->sinkpad, GST_DEBUG_FUNCPTR (gst_raw_framer_set_caps));
+	gst_pad_set_chain_function (framer->sinkpad, GST_DEBUG_FUNCPTR (gst_raw_framer_chain));
+	gst_pad_set_event_function (framer->sinkpad, GST_DEBUG_FUNCPTR (gst_raw_framer_sink_event));
+	gst_element_add_pad (GST_ELEMENT (framer), framer->sinkpad);
+
+	framer->srcpad = gst_pad_new_from_static_template (&gst_raw_framer_src_template, "src");
+	gst_pad_use_fixed_caps (framer->srcpad);
+	gst_element_add_pad (GST_ELEMENT (framer), framer->srcpad);
+
+	framer->ptime        = RAW_FRAMER_DEFAULT_PTIME;
+	framer->adapter      = gst_adapter_new ();
+	framer->rate         = 0;
+	framer->frameSamples = 0;
+	framer->frameBytes   = 0;
+	gst_raw_framer_reset (framer);
+}
+
+static void gst_raw_framer_set_property (GObject* object, guint id, const GValue* value, GParamSpec* pspec){
+	GstRawFramer* framer = GST_RAW_FRAMER (object);
+
+	switch (id) {
+		case RAW_FRAMER_PROP_PTIME:
+			framer->ptime = g_value_get_uint (value);
+			break;
+		default:
+			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, id, pspec);
+			break;
+	}
+}
+
+static void gst_raw_framer_get_property (GObject* object, guint id, GValue* value, GParamSpec* pspec){
+	GstRawFramer* framer = GST_RAW_FRAMER (object);
+
+	switch (id) {
+		case RAW_FRAMER_PROP_PTIME:
+			g_value_set_uint (value, framer->ptime);
+			break;
+		default:
+			G_OBJECT_WARN_INVALID_PROPERTY_ID (object, id, pspec);
+			break;
+	}
+}
+
+static void gst_raw_framer_finalize (GObject* object){
+	g_object_unref (GST_RAW_FRAMER (object)->adapter);
+	G_OBJECT_CLASS (gst_raw_framer_parent_class)->finalize (object);
+}
+
+static gboolean gst_raw_framer_set_caps (GstPad* pad, GstCaps* caps){
+	GstRawFramer* framer = GST_RAW_FRAMER (GST_PAD_PARENT (pad));
+	GstStructure* structure = gst_caps_get_structure (caps, 0);
+
+	gint rate, channels;
+	if (!gst_structure_get_int (structure, "rate", &rate) || !gst_structure_get_int (structure, "channels", &channels)){
+		return FALSE;
+	}
+
+	guint frameSamples = rawFrame_samples(rate, framer->ptime);
+	guint frameBytes   = frameSamples * channels * 2;
+	if (RAW_FRAME_HEADER_SIZE + frameBytes > RAW_FRAME_MAX_PACKET){
+		g_printerr ("Raw framer: %u ms of %d Hz audio take %u bytes, more than a packet holds.\n",
+			framer->ptime, rate, frameBytes);
+		return FALSE;
+	}
+
+	framer->rate         = rate;
+	framer->frameSamples = frameSamples;
+	framer->frameBytes   = frameBytes;
+
+	GstCaps* srcCaps = gst_caps_new_simple (RAW_FRAME_CAPS, "ptime", G_TYPE_INT, (gint) framer->ptime, NULL);
+	gboolean result = gst_pad_set_caps (framer->srcpad, srcCaps);
+	gst_caps_unref (srcCaps);
+	return result;
+}
+
+/*
+ * The adapter remembers the timestamp of the audio it starts with, so the
+ * timestamp of a frame is that plus the samples taken out since.
+ */
+static GstFlowReturn gst_raw_framer_chain (GstPad* pad, GstBuffer* buffer){
+	GstRawFramer* framer = GST_RAW_FRAMER (GST_PAD_PARENT (pad));
+
+	if (!framer->frameBytes){
+		gst_buffer_unref (buffer);
+		return GST_FLOW_NOT_NEGOTIATED;
+	}
+
+	if (!gst_adapter_available (framer->adapter) || GST_BUFFER_IS_DISCONT (buffer)){
+		gst_adapter_clear (framer->adapter);
+		framer->adapterTime    = GST_BUFFER_TIMESTAMP (buffer);
+		framer->adapterSamples = 0;
+	}
+	gst_adapter_push (framer->adapter, buffer);
+
+	GstFlowReturn result = GST_FLOW_OK;
+	while (result == GST_FLOW_OK && gst_adapter_available (framer->adapter) >= framer->frameBytes){
+		GstBuffer* packet = gst_buffer_new_and_alloc (RAW_FRAME_HEADER_SIZE + framer->frameBytes);
+
+		RawFrameHeader header = { framer->ptime, framer->sequence++, framer->timestamp };
+		rawFrame_writeHeader(GST_BUFFER_DATA (packet), &header);
+		gst_adapter_copy (framer->adapter, GST_BUFFER_DATA (packet) + RAW_FRAME_HEADER_SIZE, 0, framer->frameBytes);
+		gst_adapter_flush (framer->adapter, framer->frameBytes);
+
+		if (GST_CLOCK_TIME_IS_VALID (framer->adapterTime)){
+			GST_BUFFER_TIMESTAMP (packet) = framer->adapterTime
+				+ gst_util_uint64_scale (framer->adapterSamples, GST_SECOND, framer->rate);
+		}
+		GST_BUFFER_DURATION (packet) = gst_util_uint64_scale (framer->frameSamples, GST_SECOND, framer->rate);
+		gst_buffer_set_caps (packet, GST_PAD_CAPS (framer->srcpad));
+
+		framer->timestamp      += framer->frameSamples;
+		framer->adapterSamples += framer->frameSamples;
+
+		result = gst_pad_push (framer->srcpad, packet);
+	}
+
+	return result;
+}
+
+// A part frame left over by a flush would end up glued to later audio.
+static gboolean gst_raw_framer_sink_event (GstPad* pad, GstEvent* event){
+	GstRawFramer* framer = GST_RAW_FRAMER (GST_PAD_PARENT (pad));
+
+	if (GST_EVENT_TYPE (event) == GST_EVENT_FLUSH_STOP){
+		gst_adapter_clear (framer->adapter);
+	}
+	return gst_pad_push_event (framer->srcpad, event);
+}
+
+static GstStateChangeReturn gst_raw_framer_change_state (GstElement* element, GstStateChange transition){
+	GstStateChangeReturn result = GST_ELEMENT_CLASS (gst_raw_framer_parent_class)->change_state (element, transition);
+
+	if (transition == GST_STATE_CHANGE_PAUSED_TO_READY){
+		gst_raw_framer_reset (GST_RAW_FRAMER (element));
+	}
+	return result;
+}
+
+void gst_raw_framer_register (){
+	gst_element_register (NULL, "rawframer", GST_RANK_NONE, GST_TYPE_RAW_FRAMER);
+}
+
+#endif
@@ -13,3 +13,16 @@ void createUdpSink(){
 	g_object_set (G_OBJECT (sink), "port", UDP_PORT, NULL);
 	g_object_set (G_OBJECT (sink), "host", "127.0.0.1", NULL);
 }
+
+// 10 ms of the 22050 Hz audio is 221 samples, 442 bytes with the header.
+void createFramer(){
+	framer = gst_element_factory_make ("rawframer", "framer");
+	if (framer){
+		g_object_set (G_OBJECT (framer), "ptime", ptime, NULL);
+	}
+}
+
+gboolean linkFramed(GstCaps* caps){
+	return gst_element_link_filtered (source, framer, caps)
+		&& gst_element_link (framer, sink);
+}
@@ -0,0 +1,213 @@
+#include <stdlib.h>
+#include <gst/gst.h>
+
+#include "rawDeframer.h"
+#include "testPads.h"
+
+/*
+ * What rawdeframer plays for a stream of frames in order, reordered, lost,
+ * duplicated, wrapping its sequence numbers and timestamps, with a stray
+ * packet from long ago and with a sender that starts over.
+ *
+ * Every frame's samples tell its sequence number, FRAME_MARK and up, so a
+ * concealed frame (at most half of one) is told apart from a played one.
+ */
+
+#define RATE          8000
+#define PTIME         10
+#define FRAME_SAMPLES (RATE * PTIME / 1000)
+#define DEPTH         2
+#define FRAME_MARK    16384
+#define MARKS         16000
+
+static void silence (const gchar* text){
+}
+
+void startDeframer(TestPads* pads){
+	testPads_start(pads, "rawdeframer");
+
+	GstCaps* caps = gst_caps_new_simple ("audio/x-raw-int",
+		"rate",       G_TYPE_INT,     RATE,
+		"channels",   G_TYPE_INT,     1,
+		"endianness", G_TYPE_INT,     G_LITTLE_ENDIAN,
+		"width",      G_TYPE_INT,     16,
+		"depth",      G_TYPE_INT,     16,
+		"signed",     G_TYPE_BOOLEAN, TRUE,
+		NULL);
+	g_object_set (G_OBJECT (pads->element), "caps", caps, "ptime", PTIME, "depth", DEPTH, NULL);
+	gst_caps_unref (caps);
+}
+
+void push(TestPads* pads, guint16 sequence, guint32 timestamp){
+	GstBuffer* buffer = gst_buffer_new_and_alloc (RAW_FRAME_HEADER_SIZE + FRAME_SAMPLES * 2);
+	RawFrameHeader header = { PTIME, sequence, timestamp };
+	rawFrame_writeHeader(GST_BUFFER_DATA (buffer), &header);
+
+	guint i;
+	for (i = 0; i < FRAME_SAMPLES; i++){
+		GST_WRITE_UINT16_LE (GST_BUFFER_DATA (buffer) + RAW_FRAME_HEADER_SIZE + i * 2, FRAME_MARK + sequence % MARKS);
+	}
+	g_assert (gst_pad_push (pads->src, buffer) == GST_FLOW_OK);
+}
+
+// Frame n of a sender counting from sequence number first.
+void pushFrame(TestPads* pads, guint16 first, guint32 firstTimestamp, guint n){
+	push(pads, first + n, firstTimestamp + n * FRAME_SAMPLES);
+}
+
+// The sequence number a played frame tells, -1 for a concealed one.
+gint playedSequence(GstBuffer* buffer){
+	g_assert (GST_BUFFER_SIZE (buffer) == FRAME_SAMPLES * 2);
+	gint16 sample = GST_READ_UINT16_LE (GST_BUFFER_DATA (buffer));
+	return sample >= FRAME_MARK ? sample - FRAME_MARK : -1;
+}
+
+// Checks the frames played, -1 for concealed ones, in order.
+void assertPlayed(TestPads* pads, const gint* expected, guint count){
+	g_assert (g_list_length (pads->buffers) == count);
+	GList* item = pads->buffers;
+	guint i;
+	for (i = 0; i < count; i++, item = item->next){
+		g_assert (playedSequence((GstBuffer*) item->data) == expected[i]);
+	}
+}
+
+void assertCounts(TestPads* pads, gint lost, gint late, gint reordered){
+	gint framesLost, framesLate, framesReordered;
+	g_object_get (G_OBJECT (pads->element), "frames-lost", &framesLost, "frames-late", &framesLate,
+		"frames-reordered", &framesReordered, NULL);
+	g_print ("Lost %d, late %d, reordered %d.\n", framesLost, framesLate, framesReordered);
+	g_assert (framesLost == lost && framesLate == late && framesReordered == reordered);
+}
+
+// Sequence numbers and timestamps wrap without a gap or a restart.
+void testWrap(){
+	TestPads pads;
+	startDeframer(&pads);
+
+	guint n;
+	for (n = 0; n < 20; n++){
+		pushFrame(&pads, 65530, 0xFFFFFF00, n);
+	}
+
+	g_assert (g_list_length (pads.buffers) == 20 - DEPTH);
+	GList* item;
+	for (n = 0, item = pads.buffers; item; n++, item = item->next){
+		GstBuffer* buffer = (GstBuffer*) item->data;
+		g_assert (playedSequence(buffer) == (guint16) (65530 + n) % MARKS);
+		g_assert (GST_BUFFER_TIMESTAMP (buffer) == n * PTIME * GST_MSECOND);
+	}
+	assertCounts(&pads, 0, 0, 0);
+
+	testPads_stop(&pads);
+}
+
+// Swapped, lost, duplicated and too late frames.
+void testReorderLossDuplicate(){
+	TestPads pads;
+	startDeframer(&pads);
+
+	static const guint arrivals[] = {0, 1, 3, 2, 4, 4, 6, 7, 5, 8, 9, 10};
+	guint i;
+	for (i = 0; i < G_N_ELEMENTS (arrivals); i++){
+		pushFrame(&pads, 100, 5000, arrivals[i]);
+	}
+
+	// 5 is concealed once 7 arrives; when it comes after that it is late.
+	static const gint played[] = {100, 101, 102, 103, 104, -1, 106, 107, 108};
+	assertPlayed(&pads, played, G_N_ELEMENTS (played));
+	assertCounts(&pads, 1, 2, 1);
+
+	testPads_stop(&pads);
+}
+
+// A stray packet from long ago is late: the window goes on undisturbed.
+void testStalePacket(){
+	TestPads pads;
+	startDeframer(&pads);
+
+	guint n;
+	for (n = 0; n < 100; n++){
+		pushFrame(&pads, 0, 0, n);
+	}
+	push(&pads, 0, 0);
+	push(&pads, 65000, 0);
+	for (n = 100; n < 110; n++){
+		pushFrame(&pads, 0, 0, n);
+	}
+
+	gint played[110 - DEPTH];
+	for (n = 0; n < G_N_ELEMENTS (played); n++){
+		played[n] = n;
+	}
+	assertPlayed(&pads, played, G_N_ELEMENTS (played));
+	assertCounts(&pads, 0, 2, 0);
+
+	testPads_stop(&pads);
+}
+
+// A sender that starts over: its first packets are late, then it plays.
+void testRestartedSender(){
+	TestPads pads;
+	startDeframer(&pads);
+
+	guint n;
+	for (n = 0; n < 20; n++){
+		pushFrame(&pads, 3000, 0, n);
+	}
+	testPads_clear(&pads);
+
+	for (n = 0; n < 20; n++){
+		pushFrame(&pads, 10, 0, n);
+	}
+
+	// The window restarts at frame RAW_DEFRAMER_MAX_STALE - 1.
+	gint played[20 - (RAW_DEFRAMER_MAX_STALE - 1) - DEPTH];
+	for (n = 0; n < G_N_ELEMENTS (played); n++){
+		played[n] = 10 + RAW_DEFRAMER_MAX_STALE - 1 + n;
+	}
+	assertPlayed(&pads, played, G_N_ELEMENTS (played));
+	assertCounts(&pads, 0, RAW_DEFRAMER_MAX_STALE - 1, 0);
+
+	testPads_stop(&pads);
+}
+
+// A jump ahead past the window restarts it at once.
+void testForwardJump(){
+	TestPads pads;
+	startDeframer(&pads);
+
+	guint n;
+	for (n = 0; n < 20; n++){
+		pushFrame(&pads, 0, 0, n);
+	}
+	testPads_clear(&pads);
+
+	for (n = 0; n < 10; n++){
+		pushFrame(&pads, 500, 0, n);
+	}
+
+	gint played[10 - DEPTH];
+	for (n = 0; n < G_N_ELEMENTS (played); n++){
+		played[n] = 500 + n;
+	}
+	assertPlayed(&pads, played, G_N_ELEMENTS (played));
+	assertCounts(&pads, 0, 0, 0);
+
+	testPads_stop(&pads);
+}
+
+int main(int argc, char *argv[]){
+	gst_init (&argc, &argv);
+	gst_raw_deframer_register();
+	g_set_print_handler (silence);
+
+	testWrap();
+	testReorderLossDuplicate();
+	testStalePacket();
+	testRestartedSender();
+	testForwardJump();
+
+	g_printerr ("rawDeframerTest: ok.\n");
+	return 0;
+}